@@ -0,0 +1,29 @@
+#
+# Copyright 2021 Xilinx Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Exercise --rtcp-rate-control with a loopback client over a simulated lossy
+# link. smartcam must already serve the stream on the loopback interface, the
+# bitrate decisions show up in its output.
+#
+url=${1:-"rtsp://127.0.0.1:554/test"}
+loss=${2:-"5"}
+delay=${3:-"20"}
+duration=${4:-"60"}
+
+tc qdisc add dev lo root netem loss ${loss}% delay ${delay}ms 10ms || exit 1
+trap "tc qdisc del dev lo root" EXIT INT TERM
+
+echo "Receiving ${url} for ${duration}s with ${loss}% loss, ${delay}ms delay"
+timeout ${duration} gst-launch-1.0 -q rtspsrc location=${url} protocols=udp latency=200 ! decodebin ! fakesink
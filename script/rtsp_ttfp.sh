@@ -0,0 +1,28 @@
+#
+# Copyright 2021 Xilinx Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Measure the time to first picture of a RTSP stream with a loopback client:
+# connect, decode, and stop at the first decoded frame.
+#
+url=${1:-"rtsp://127.0.0.1:554/test"}
+runs=${2:-"5"}
+
+for i in $(seq 1 ${runs}); do
+    start=$(date +%s%N)
+    gst-launch-1.0 -q rtspsrc location=${url} latency=0 ! decodebin ! fakesink num-buffers=1 > /dev/null 2>&1
+    end=$(date +%s%N)
+    echo "run ${i}: time to first picture $(( (end - start) / 1000000 )) ms"
+    sleep 1
+done
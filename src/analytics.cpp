@@ -0,0 +1,485 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gst/video/video.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+#include "analytics.hpp"
+#include "metrics.hpp"
+
+#define HEAT_CELL 16
+/* Count added per frame covering a cell, in 1/256 */
+#define HEAT_HIT 256
+#define HEAT_MAX 0x7fffffffu
+/* v -= v >> DECAY_SHIFT halves v in 44 steps, rounded up it also takes the
+ * counts below 1 << DECAY_SHIFT down to 0 */
+#define DECAY_SHIFT 6
+#define DECAY_STEPS_PER_HALF_LIFE 44
+/* Opacity of the hottest cells in the display, of 256 */
+#define OVERLAY_MAX_ALPHA 160
+/* Chroma of the tint, a red */
+#define TINT_U 90
+#define TINT_V 240
+
+bool Analytics::ParseShape(const char *spec, guint minPoints,
+        std::pair<std::string, std::vector<Point>> &out)
+{
+    std::string s(spec);
+    std::size_t colon = s.find(':');
+    if (colon == std::string::npos || colon == 0)
+    {
+        return false;
+    }
+    out.first = s.substr(0, colon);
+    out.second.clear();
+
+    std::istringstream in(s.substr(colon + 1));
+    std::string item;
+    std::vector<double> values;
+    while (std::getline(in, item, ','))
+    {
+        char *end;
+        double v = strtod(item.c_str(), &end);
+        if (item.empty() || *end != '\0')
+        {
+            return false;
+        }
+        values.push_back(v);
+    }
+    if (values.size() % 2 || values.size() / 2 < minPoints)
+    {
+        return false;
+    }
+    for (std::size_t i = 0; i < values.size(); i += 2)
+    {
+        out.second.push_back({ values[i], values[i + 1] });
+    }
+    return true;
+}
+
+Analytics::Analytics(const Params &params, SharedTracker *tracker)
+    : params(params), tracker(tracker), frames(0),
+      cols((params.width + HEAT_CELL - 1) / HEAT_CELL), rows((params.height + HEAT_CELL - 1) / HEAT_CELL),
+      nextDecay(GST_CLOCK_TIME_NONE), decayInterval(params.halfLife / DECAY_STEPS_PER_HALF_LIFE),
+      overlayCaps(NULL)
+{
+    if (params.heatmap)
+    {
+        heat.assign((gsize) cols * rows, 0);
+    }
+    for (const auto &l : params.lines)
+    {
+        Line line;
+        line.name = l.first;
+        line.a = l.second[0];
+        line.b = l.second[1];
+        lines.push_back(line);
+        guint i = lines.size() - 1;
+        metricsIds.push_back(Metrics::Get().Register("line " + l.first, [this, i] { return ReportLine(i); }));
+    }
+    for (const auto &z : params.zones)
+    {
+        Zone zone;
+        zone.name = z.first;
+        zone.poly = z.second;
+        zones.push_back(zone);
+        guint i = zones.size() - 1;
+        metricsIds.push_back(Metrics::Get().Register("zone " + z.first, [this, i] { return ReportZone(i); }));
+    }
+    if (params.heatmap)
+    {
+        metricsIds.push_back(Metrics::Get().Register("heatmap", [this] { return ReportHeatmap(); }));
+    }
+}
+
+Analytics::~Analytics()
+{
+    if (overlayCaps)
+    {
+        gst_caps_unref(overlayCaps);
+    }
+    for (auto id : metricsIds)
+    {
+        Metrics::Get().Unregister(id);
+    }
+}
+
+static GstPadProbeReturn
+analytics_probe_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+    Analytics *analytics = (Analytics *) user_data;
+    analytics->OnFrame(GST_PAD_PROBE_INFO_BUFFER(info));
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+analytics_overlay_probe_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+    Analytics *analytics = (Analytics *) user_data;
+    info->data = analytics->Overlay(pad, GST_PAD_PROBE_INFO_BUFFER(info));
+    return GST_PAD_PROBE_OK;
+}
+
+static bool
+add_sink_probe (GstElement *bin, const char *name, GstPadProbeCallback cb, gpointer user_data)
+{
+    GstElement *elem = gst_bin_get_by_name(GST_BIN(bin), name);
+    if (!elem)
+    {
+        g_printerr("ERROR: Element %s not found for the analytics.\n", name);
+        return false;
+    }
+    GstPad *pad = gst_element_get_static_pad(elem, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, cb, user_data, NULL);
+    gst_object_unref(pad);
+    gst_object_unref(elem);
+    return true;
+}
+
+bool Analytics::Attach(GstElement *bin, const char *probeName)
+{
+    return add_sink_probe(bin, probeName, analytics_probe_cb, this);
+}
+
+bool Analytics::AttachOverlay(GstElement *bin, const char *overlayName)
+{
+    return add_sink_probe(bin, overlayName, analytics_overlay_probe_cb, this);
+}
+
+bool Analytics::InPolygon(const std::vector<Point> &poly, const Point &p)
+{
+    bool in = false;
+    for (std::size_t i = 0, j = poly.size() - 1; i < poly.size(); j = i++)
+    {
+        if ((poly[i].y > p.y) != (poly[j].y > p.y)
+                && p.x < (poly[j].x - poly[i].x) * (p.y - poly[i].y) / (poly[j].y - poly[i].y) + poly[i].x)
+        {
+            in = !in;
+        }
+    }
+    return in;
+}
+
+/* Side of @p relative to the line from @a to @b, positive on the left */
+static double
+side (const Analytics::Point &a, const Analytics::Point &b, const Analytics::Point &p)
+{
+    return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+}
+
+void Analytics::OnFrame(GstBuffer *buf)
+{
+    std::vector<Detection> dets;
+    if (!ExtractDetections(buf, dets))
+    {
+        return;
+    }
+    tracker->Track(GST_BUFFER_PTS(buf), dets);
+
+    std::lock_guard<std::mutex> guard(lock);
+    frames++;
+    for (const auto &d : dets)
+    {
+        Point pos = { d.x + d.width / 2.0, d.y + d.height / 2.0 };
+        auto it = tracks.find(d.trackId);
+        bool known = it != tracks.end();
+        TrackState &t = tracks[d.trackId];
+        if (!known)
+        {
+            t.inZone.assign(zones.size(), false);
+        }
+
+        for (auto &l : lines)
+        {
+            /* The move crosses the line, and the line the move */
+            double s0 = known ? side(l.a, l.b, t.pos) : 0, s1 = side(l.a, l.b, pos);
+            if (!known || (s0 < 0) == (s1 < 0) || (side(t.pos, pos, l.a) < 0) == (side(t.pos, pos, l.b) < 0))
+                continue;
+            Counts &c = l.counts[d.label];
+            if (s1 > 0)
+                c.in++;
+            else
+                c.out++;
+        }
+
+        for (std::size_t i = 0; i < zones.size(); i++)
+        {
+            bool in = InPolygon(zones[i].poly, pos);
+            if (in && !t.inZone[i])
+                zones[i].entered[d.label]++;
+            t.inZone[i] = in;
+        }
+        t.pos = pos;
+        t.frame = frames;
+    }
+
+    /* Current occupancy of the zones */
+    for (auto &z : zones)
+    {
+        z.inside.clear();
+    }
+    for (const auto &d : dets)
+    {
+        const TrackState &t = tracks[d.trackId];
+        for (std::size_t i = 0; i < zones.size(); i++)
+        {
+            if (t.inZone[i])
+                zones[i].inside[d.label]++;
+        }
+    }
+
+    /* The tracker closed the tracks which are not updated any more */
+    for (auto it = tracks.begin(); it != tracks.end();)
+    {
+        if (frames - it->second.frame > tracker->MaxMissed())
+            it = tracks.erase(it);
+        else
+            ++it;
+    }
+
+    if (params.heatmap)
+    {
+        Accumulate(dets, GST_BUFFER_PTS(buf));
+    }
+}
+
+void Analytics::Accumulate(const std::vector<Detection> &dets, GstClockTime pts)
+{
+    for (const auto &d : dets)
+    {
+        gint c0 = std::max(d.x, 0) / HEAT_CELL, c1 = std::min((d.x + d.width - 1) / HEAT_CELL, cols - 1);
+        gint r0 = std::max(d.y, 0) / HEAT_CELL, r1 = std::min((d.y + d.height - 1) / HEAT_CELL, rows - 1);
+        for (gint r = r0; r <= r1; r++)
+        {
+            guint32 *__restrict row = heat.data() + (gsize) r * cols;
+            for (gint c = c0; c <= c1; c++)
+            {
+                row[c] = std::min(row[c] + HEAT_HIT, HEAT_MAX);
+            }
+        }
+    }
+
+    if (!GST_CLOCK_TIME_IS_VALID(pts) || decayInterval == 0)
+    {
+        return;
+    }
+    if (!GST_CLOCK_TIME_IS_VALID(nextDecay) || pts + decayInterval < nextDecay)
+    {
+        nextDecay = pts + decayInterval;
+    }
+    if (pts >= nextDecay)
+    {
+        /* All the steps due, several with a short half life or after a gap,
+         * in one pass: v * (1 - 2^-DECAY_SHIFT)^steps in 16.16 fixed point,
+         * rounded down, which is the step above for one */
+        guint64 steps = (pts - nextDecay) / decayInterval + 1;
+        guint32 keep = (guint32) (std::pow(1.0 - 1.0 / (1 << DECAY_SHIFT), (double) steps) * 65536);
+        guint32 *__restrict v = heat.data();
+        gsize n = heat.size();
+        for (gsize i = 0; i < n; i++)
+        {
+            v[i] = (guint32) (((guint64) v[i] * keep) >> 16);
+        }
+        nextDecay += steps * decayInterval;
+    }
+}
+
+GstBuffer *Analytics::Overlay(GstPad *pad, GstBuffer *buf)
+{
+    std::vector<guint8> alpha;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        guint32 peak = 0;
+        for (auto v : heat)
+            peak = std::max(peak, v);
+        if (peak < HEAT_HIT)
+        {
+            return buf;
+        }
+        alpha.resize(heat.size());
+        for (gsize i = 0; i < heat.size(); i++)
+        {
+            alpha[i] = (guint8) ((guint64) heat[i] * OVERLAY_MAX_ALPHA / peak);
+        }
+    }
+
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    if (!caps)
+    {
+        return buf;
+    }
+    if (!overlayCaps || !gst_caps_is_equal(caps, overlayCaps))
+    {
+        gst_caps_replace(&overlayCaps, caps);
+        if (!gst_video_info_from_caps(&overlayInfo, caps))
+        {
+            gst_video_info_init(&overlayInfo);
+        }
+    }
+    gst_caps_unref(caps);
+    if (GST_VIDEO_INFO_FORMAT(&overlayInfo) != GST_VIDEO_FORMAT_NV12)
+    {
+        return buf;
+    }
+
+    /* A frame shared with the encoder branch is only read, its tinted chroma
+     * goes into a new buffer which refers to its luma */
+    bool shared = !gst_buffer_is_writable(buf);
+    GstVideoFrame in;
+    if (!gst_video_frame_map(&in, &overlayInfo, buf, shared ? GST_MAP_READ : GST_MAP_READWRITE))
+    {
+        return buf;
+    }
+    gint frameWidth = GST_VIDEO_FRAME_WIDTH(&in);
+    gint uvRows = GST_VIDEO_FRAME_HEIGHT(&in) / 2;
+    const guint8 *srcPlane = (const guint8 *) GST_VIDEO_FRAME_PLANE_DATA(&in, 1);
+    gint uvStride = GST_VIDEO_FRAME_PLANE_STRIDE(&in, 1);
+    gsize uvOffset = GST_VIDEO_FRAME_PLANE_OFFSET(&in, 1);
+
+    GstBuffer *out = buf;
+    GstMemory *uvMem = NULL;
+    GstMapInfo uvMap;
+    guint8 *uvPlane = (guint8 *) srcPlane;
+    if (shared)
+    {
+        out = gst_buffer_copy_region(buf, GST_BUFFER_COPY_ALL, 0, uvOffset);
+        uvMem = gst_allocator_alloc(NULL, (gsize) uvStride * uvRows, NULL);
+        gsize offsets[GST_VIDEO_MAX_PLANES] = { GST_VIDEO_FRAME_PLANE_OFFSET(&in, 0), uvOffset };
+        gint strides[GST_VIDEO_MAX_PLANES] = { GST_VIDEO_FRAME_PLANE_STRIDE(&in, 0), uvStride };
+        gst_buffer_add_video_meta_full(out, GST_VIDEO_FRAME_FLAG_NONE, GST_VIDEO_FORMAT_NV12,
+                frameWidth, GST_VIDEO_FRAME_HEIGHT(&in), 2, offsets, strides);
+        gst_memory_map(uvMem, &uvMap, GST_MAP_WRITE);
+        uvPlane = uvMap.data;
+    }
+
+    gint width = std::min(frameWidth / 2, cols * HEAT_CELL / 2);
+    gint height = std::min(uvRows, rows * HEAT_CELL / 2);
+
+    /* Alpha per chroma byte of a row of cells */
+    std::vector<guint16> rowAlpha(width * 2);
+    for (gint y = 0; y < uvRows; y++)
+    {
+        const guint8 *src = srcPlane + (gsize) y * uvStride;
+        guint8 *uv = uvPlane + (gsize) y * uvStride;
+        if (y >= height)
+        {
+            if (shared)
+                memcpy(uv, src, frameWidth);
+            continue;
+        }
+        if (y % (HEAT_CELL / 2) == 0)
+        {
+            const guint8 *cells = alpha.data() + (gsize) (y / (HEAT_CELL / 2)) * cols;
+            for (gint x = 0; x < width; x++)
+            {
+                rowAlpha[2 * x] = rowAlpha[2 * x + 1] = cells[x / (HEAT_CELL / 2)];
+            }
+        }
+
+        const guint16 *__restrict a = rowAlpha.data();
+        for (gint k = 0; k < width * 2; k++)
+        {
+            guint16 tint = (k & 1) ? TINT_V : TINT_U;
+            uv[k] = (src[k] * (256 - a[k]) + tint * a[k]) >> 8;
+        }
+        if (shared && width * 2 < frameWidth)
+        {
+            memcpy(uv + width * 2, src + width * 2, frameWidth - width * 2);
+        }
+    }
+    gst_video_frame_unmap(&in);
+
+    if (uvMem)
+    {
+        gst_memory_unmap(uvMem, &uvMap);
+        gst_buffer_append_memory(out, uvMem);
+        gst_buffer_unref(buf);
+    }
+    return out;
+}
+
+static std::string
+format_counts (const std::map<std::string, guint64> &counts)
+{
+    std::ostringstream out;
+    for (const auto &c : counts)
+    {
+        out << " " << (c.first.empty() ? "object" : c.first) << "=" << c.second;
+    }
+    return out.str();
+}
+
+std::string Analytics::ReportLine(guint i)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    std::map<std::string, guint64> in, out;
+    guint64 totalIn = 0, totalOut = 0;
+    for (const auto &c : lines[i].counts)
+    {
+        in[c.first] = c.second.in;
+        out[c.first] = c.second.out;
+        totalIn += c.second.in;
+        totalOut += c.second.out;
+    }
+    std::ostringstream line;
+    line << "in " << totalIn << format_counts(in) << ", out " << totalOut << format_counts(out);
+    return line.str();
+}
+
+std::string Analytics::ReportZone(guint i)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    std::map<std::string, guint64> inside(zones[i].inside.begin(), zones[i].inside.end());
+    guint64 now = 0, entered = 0;
+    for (const auto &c : zones[i].inside)
+        now += c.second;
+    for (const auto &c : zones[i].entered)
+        entered += c.second;
+    std::ostringstream line;
+    line << now << " inside" << format_counts(inside) << ", entered " << entered << format_counts(zones[i].entered);
+    return line.str();
+}
+
+std::string Analytics::ReportHeatmap()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    guint32 peak = 0;
+    gsize peakIdx = 0, active = 0;
+    for (gsize i = 0; i < heat.size(); i++)
+    {
+        if (heat[i] >= HEAT_HIT)
+            active++;
+        if (heat[i] > peak)
+        {
+            peak = heat[i];
+            peakIdx = i;
+        }
+    }
+    char line[160];
+    if (!peak)
+    {
+        return std::string("empty");
+    }
+    snprintf(line, sizeof(line), "%" G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT " cells active, peak %.0f frames at %d,%d",
+            active, heat.size(), peak / (double) HEAT_HIT,
+            (gint) (peakIdx % cols) * HEAT_CELL + HEAT_CELL / 2, (gint) (peakIdx / cols) * HEAT_CELL + HEAT_CELL / 2);
+    return std::string(line);
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_ANALYTICS_H__
+#define __SMARTCAM_ANALYTICS_H__
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "tracker.hpp"
+
+/*
+ * Live scene analytics on the detections of every frame.
+ *
+ * The objects are tracked by the SharedTracker of the stream, and the center
+ * of each one is followed across counting lines, per direction and class, and
+ * into counting zones, which report the objects in them and the objects which
+ * entered, per class.
+ *
+ * The occupancy heatmap is a grid of 16x16 pixel cells holding fixed point
+ * counts of the frames an object covered them. It decays with a half life, by
+ * v -= v >> 6, rounded up so the small counts reach 0 too, on all cells at
+ * the matching interval, so the cost per frame doesn't depend on how long it
+ * ran. The steps due since the last frame are applied together, as one
+ * factor. It can be tinted into the display; when the frame is shared with the
+ * encoder, only its chroma plane is copied for that.
+ *
+ * The counters and a heatmap summary are reported as metrics.
+ */
+class Analytics
+{
+public:
+    struct Point
+    {
+        double x;
+        double y;
+    };
+
+    struct Params
+    {
+        /* Parsed from "name:x0,y0,x1,y1" and "name:x,y,x,y,x,y[,...]" */
+        std::vector<std::pair<std::string, std::vector<Point>>> lines;
+        std::vector<std::pair<std::string, std::vector<Point>>> zones;
+        /* Size of the frames the detections refer to */
+        gint width;
+        gint height;
+        bool heatmap;
+        GstClockTime halfLife;
+    };
+
+    /* Parse "<name>:<x>,<y>,..." with at least @minPoints points */
+    static bool ParseShape(const char *spec, guint minPoints,
+            std::pair<std::string, std::vector<Point>> &out);
+    /* Even-odd test of @p against the closed polygon @poly */
+    static bool InPolygon(const std::vector<Point> &poly, const Point &p);
+
+    Analytics(const Params &params, SharedTracker *tracker);
+    ~Analytics();
+
+    bool Attach(GstElement *bin, const char *probeName);
+    /* Tint the heatmap into the frames through the element @overlayName */
+    bool AttachOverlay(GstElement *bin, const char *overlayName);
+
+    void OnFrame(GstBuffer *buf);
+    GstBuffer *Overlay(GstPad *pad, GstBuffer *buf);
+
+private:
+    struct Counts
+    {
+        guint64 in;
+        guint64 out;
+    };
+
+    struct Line
+    {
+        std::string name;
+        Point a;
+        Point b;
+        std::map<std::string, Counts> counts;
+    };
+
+    struct Zone
+    {
+        std::string name;
+        std::vector<Point> poly;
+        /* Objects inside now and entered, per class */
+        std::map<std::string, guint> inside;
+        std::map<std::string, guint64> entered;
+    };
+
+    struct TrackState
+    {
+        Point pos;
+        std::vector<bool> inZone;
+        guint64 frame;
+    };
+
+    void Accumulate(const std::vector<Detection> &dets, GstClockTime pts);
+    std::string ReportLine(guint i);
+    std::string ReportZone(guint i);
+    std::string ReportHeatmap();
+
+    Params params;
+    SharedTracker *tracker;
+
+    std::mutex lock;
+    std::vector<Line> lines;
+    std::vector<Zone> zones;
+    std::map<guint64, TrackState> tracks;
+    guint64 frames;
+
+    std::vector<guint32> heat;
+    gint cols;
+    gint rows;
+    GstClockTime nextDecay;
+    GstClockTime decayInterval;
+    /* Owned by the display streaming thread */
+    GstCaps *overlayCaps;
+    GstVideoInfo overlayInfo;
+
+    std::vector<guint> metricsIds;
+};
+
+#endif /* __SMARTCAM_ANALYTICS_H__ */
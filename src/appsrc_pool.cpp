@@ -0,0 +1,88 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gst/video/video.h>
+#include <gst/video/gstvideopool.h>
+
+#include "appsrc_pool.hpp"
+
+GstBufferPool *NegotiateAppSrcPool(GstElement *appsrc, GstCaps *caps, guint size, guint minBuffers)
+{
+    GstBufferPool *p = NULL;
+    GstAllocator *allocator = NULL;
+    GstAllocationParams allocParams;
+    guint min = 0, max = 0;
+    gst_allocation_params_init(&allocParams);
+
+    GstPad *srcPad = gst_element_get_static_pad(appsrc, "src");
+    GstQuery *query = gst_query_new_allocation(caps, TRUE);
+    if (gst_pad_peer_query(srcPad, query))
+    {
+        if (gst_query_get_n_allocation_pools(query) > 0)
+        {
+            guint poolSize;
+            gst_query_parse_nth_allocation_pool(query, 0, &p, &poolSize, &min, &max);
+            size = MAX(size, poolSize);
+        }
+        if (gst_query_get_n_allocation_params(query) > 0)
+        {
+            gst_query_parse_nth_allocation_param(query, 0, &allocator, &allocParams);
+        }
+    }
+    gst_query_unref(query);
+    gst_object_unref(srcPad);
+
+    /* Otherwise a video pool on the proposed allocator, system memory if
+     * none */
+    if (!p)
+    {
+        p = gst_video_buffer_pool_new();
+    }
+    min = MAX(min, minBuffers);
+    if (max && max < min)
+    {
+        max = min;
+    }
+
+    GstStructure *config = gst_buffer_pool_get_config(p);
+    gst_buffer_pool_config_set_params(config, caps, size, min, max);
+    if (allocator)
+    {
+        gst_buffer_pool_config_set_allocator(config, allocator, &allocParams);
+        gst_object_unref(allocator);
+    }
+    if (gst_buffer_pool_has_option(p, GST_BUFFER_POOL_OPTION_VIDEO_META))
+    {
+        gst_buffer_pool_config_add_option(config, GST_BUFFER_POOL_OPTION_VIDEO_META);
+    }
+    if (!gst_buffer_pool_set_config(p, config))
+    {
+        /* The pool adjusted the config, take it if it still fits */
+        config = gst_buffer_pool_get_config(p);
+        if (!gst_buffer_pool_config_validate_params(config, caps, size, min, max)
+                || !gst_buffer_pool_set_config(p, config))
+        {
+            gst_object_unref(p);
+            return NULL;
+        }
+    }
+    if (!gst_buffer_pool_set_active(p, TRUE))
+    {
+        gst_object_unref(p);
+        return NULL;
+    }
+    return p;
+}
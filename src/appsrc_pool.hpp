@@ -0,0 +1,31 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_APPSRC_POOL_H__
+#define __SMARTCAM_APPSRC_POOL_H__
+
+#include <gst/gst.h>
+
+/*
+ * Active pool for the @size byte frames of @caps the app pushes into
+ * @appsrc, with at least @minBuffers. It is the pool downstream proposes,
+ * e.g. the DMA buffers of the encoder, so the app writes where the encoder
+ * reads, else a video pool on the proposed allocator, system memory if none.
+ * NULL if no pool takes the config.
+ */
+GstBufferPool *NegotiateAppSrcPool(GstElement *appsrc, GstCaps *caps, guint size, guint minBuffers);
+
+#endif /* __SMARTCAM_APPSRC_POOL_H__ */
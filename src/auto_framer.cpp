@@ -0,0 +1,303 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/video/video.h>
+#include <algorithm>
+#include <cmath>
+
+#include "appsrc_pool.hpp"
+#include "auto_framer.hpp"
+#include "metrics.hpp"
+
+/* Margin around the objects, fraction of their size on each side */
+#define FRAME_MARGIN 0.3
+/* Zoom in at most this much on the input */
+#define MAX_ZOOM 4.0
+/* Moves of the goal smaller than this fraction of the window are ignored */
+#define DEAD_BAND 0.1
+/* Zoom out to the whole frame after this long without objects */
+#define LOST_TIMEOUT (2 * GST_SECOND)
+/* Threads scaling the output, a band of rows each, as one core doesn't keep
+ * up with 4K to 1080p; the "auto framing" metric shows the time per frame */
+#define SCALE_THREADS 3
+/* Output buffers in the pool, besides what downstream asks for */
+#define MIN_OUT_BUFFERS 2
+
+AutoFramer::AutoFramer(const Params &params)
+    : params(params), scaler(SCALE_THREADS), appsrc(NULL), inCaps(NULL), pool(NULL), frameWidth(0), frameHeight(0),
+      lastPts(GST_CLOCK_TIME_NONE), lastSeen(GST_CLOCK_TIME_NONE), frames(0), scaleTime(0), maxScaleTime(0)
+{
+    window = { 0, 0, 0, 0 };
+    goal = window;
+    metricsId = Metrics::Get().Register("auto framing", [this] { return Report(); });
+}
+
+AutoFramer::~AutoFramer()
+{
+    Metrics::Get().Unregister(metricsId);
+    if (pool)
+    {
+        gst_buffer_pool_set_active(pool, FALSE);
+        gst_object_unref(pool);
+    }
+    if (appsrc)
+    {
+        gst_object_unref(appsrc);
+    }
+    if (inCaps)
+    {
+        gst_caps_unref(inCaps);
+    }
+}
+
+bool AutoFramer::Attach(GstElement *bin, const char *sinkName, const char *srcName)
+{
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(bin), sinkName);
+    GstElement *src = gst_bin_get_by_name(GST_BIN(bin), srcName);
+    if (!sink || !src)
+    {
+        g_printerr("ERROR: Elements %s/%s not found for auto framing.\n", sinkName, srcName);
+        if (sink)
+            gst_object_unref(sink);
+        if (src)
+            gst_object_unref(src);
+        return false;
+    }
+
+    g_object_set(src, "is-live", TRUE, "format", GST_FORMAT_TIME, NULL);
+    if (appsrc)
+        gst_object_unref(appsrc);
+    appsrc = src;
+
+    g_object_set(sink, "emit-signals", TRUE, "sync", FALSE, NULL);
+    g_signal_connect(sink, "new-sample", G_CALLBACK(NewFrameCb), this);
+    gst_object_unref(sink);
+    return true;
+}
+
+GstFlowReturn AutoFramer::NewFrameCb(GstElement *sink, gpointer user_data)
+{
+    AutoFramer *framer = (AutoFramer *) user_data;
+    GstSample *sample = gst_app_sink_pull_sample(GST_APP_SINK(sink));
+    if (!sample)
+    {
+        return GST_FLOW_EOS;
+    }
+    framer->OnFrame(sample);
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+bool AutoFramer::SetupOutput(GstCaps *caps)
+{
+    GstVideoInfo info;
+    if (!gst_video_info_from_caps(&info, caps) || GST_VIDEO_INFO_FORMAT(&info) != GST_VIDEO_FORMAT_NV12)
+    {
+        g_printerr("ERROR: Auto framing needs NV12 frames.\n");
+        return false;
+    }
+    frameWidth = GST_VIDEO_INFO_WIDTH(&info);
+    frameHeight = GST_VIDEO_INFO_HEIGHT(&info);
+    window = { 0, 0, (double) frameWidth, (double) frameHeight };
+    goal = window;
+    gst_caps_replace(&inCaps, caps);
+
+    GstCaps *outCaps = gst_caps_copy(caps);
+    gst_caps_set_simple(outCaps, "width", G_TYPE_INT, params.outWidth,
+            "height", G_TYPE_INT, params.outHeight, NULL);
+    GstVideoInfo outInfo;
+    gst_video_info_from_caps(&outInfo, outCaps);
+
+    gst_app_src_set_caps(GST_APP_SRC(appsrc), outCaps);
+    if (pool)
+    {
+        gst_buffer_pool_set_active(pool, FALSE);
+        gst_object_unref(pool);
+    }
+    pool = NegotiateAppSrcPool(appsrc, outCaps, GST_VIDEO_INFO_SIZE(&outInfo), MIN_OUT_BUFFERS);
+    if (!pool)
+    {
+        g_printerr("ERROR: No buffer pool for the auto framing output.\n");
+        gst_caps_unref(outCaps);
+        return false;
+    }
+
+    gst_caps_unref(outCaps);
+    return true;
+}
+
+void AutoFramer::UpdateWindow(const std::vector<Detection> &dets, GstClockTime pts)
+{
+    double x0 = frameWidth, y0 = frameHeight, x1 = 0, y1 = 0;
+    for (const auto &d : dets)
+    {
+        if (params.classes.empty() || params.classes.count(d.label))
+        {
+            x0 = std::min(x0, (double) d.x);
+            y0 = std::min(y0, (double) d.y);
+            x1 = std::max(x1, (double) (d.x + d.width));
+            y1 = std::max(y1, (double) (d.y + d.height));
+        }
+    }
+
+    Window target = { 0, 0, (double) frameWidth, (double) frameHeight };
+    if (x1 > x0 && y1 > y0)
+    {
+        lastSeen = pts;
+        double mx = (x1 - x0) * FRAME_MARGIN, my = (y1 - y0) * FRAME_MARGIN;
+        x0 -= mx;
+        x1 += mx;
+        y0 -= my;
+        y1 += my;
+
+        /* Widen to the output aspect ratio, within the zoom and frame limits */
+        double aspect = (double) params.outWidth / params.outHeight;
+        double tw = std::max(x1 - x0, (y1 - y0) * aspect);
+        tw = std::max(tw, frameWidth / MAX_ZOOM);
+        tw = std::min(std::min(tw, (double) frameWidth), frameHeight * aspect);
+        double th = tw / aspect;
+        target.width = tw;
+        target.height = th;
+        target.x = std::min(std::max((x0 + x1 - tw) / 2, 0.0), frameWidth - tw);
+        target.y = std::min(std::max((y0 + y1 - th) / 2, 0.0), frameHeight - th);
+    }
+    else if (GST_CLOCK_TIME_IS_VALID(lastSeen) && GST_CLOCK_TIME_IS_VALID(pts)
+            && pts >= lastSeen && pts - lastSeen < LOST_TIMEOUT)
+    {
+        /* Objects missed for a few frames, stay */
+        target = goal;
+    }
+
+    /* Dead band against the jitter of the boxes */
+    double band = goal.width * DEAD_BAND;
+    if (std::fabs(target.x + target.width / 2 - (goal.x + goal.width / 2)) > band
+            || std::fabs(target.y + target.height / 2 - (goal.y + goal.height / 2)) > band
+            || std::fabs(target.width - goal.width) > band)
+    {
+        goal = target;
+    }
+
+    /* First order approach of the goal, independent of the frame rate */
+    double alpha = 1.0;
+    if (GST_CLOCK_TIME_IS_VALID(lastPts) && GST_CLOCK_TIME_IS_VALID(pts) && pts > lastPts
+            && params.smoothing > 0)
+    {
+        alpha = 1.0 - std::exp(-(double) (pts - lastPts) / params.smoothing);
+    }
+    lastPts = pts;
+    window.x += (goal.x - window.x) * alpha;
+    window.y += (goal.y - window.y) * alpha;
+    window.width += (goal.width - window.width) * alpha;
+    window.height += (goal.height - window.height) * alpha;
+}
+
+void AutoFramer::OnFrame(GstSample *sample)
+{
+    GstCaps *caps = gst_sample_get_caps(sample);
+    GstBuffer *frame = gst_sample_get_buffer(sample);
+    if (!caps || !frame)
+    {
+        return;
+    }
+    if ((!inCaps || !gst_caps_is_equal(inCaps, caps)) && !SetupOutput(caps))
+    {
+        return;
+    }
+
+    std::vector<Detection> dets;
+    ExtractDetections(frame, dets);
+    UpdateWindow(dets, GST_BUFFER_PTS(frame));
+
+    /* Even crop, as the chroma is subsampled */
+    gint cw = std::max((gint) window.width & ~1, 2);
+    gint ch = std::max((gint) window.height & ~1, 2);
+    gint cx = std::min((gint) window.x & ~1, frameWidth - cw);
+    gint cy = std::min((gint) window.y & ~1, frameHeight - ch);
+
+    GstBuffer *out = NULL;
+    if (gst_buffer_pool_acquire_buffer(pool, &out, NULL) != GST_FLOW_OK)
+    {
+        return;
+    }
+
+    GstVideoInfo inInfo, outInfo;
+    GstVideoFrame in, dst;
+    gst_video_info_from_caps(&inInfo, caps);
+    gst_video_info_set_format(&outInfo, GST_VIDEO_FORMAT_NV12, params.outWidth, params.outHeight);
+    /* The input stays in its DMA buffer, mapping it doesn't copy */
+    if (!gst_video_frame_map(&in, &inInfo, frame, GST_MAP_READ))
+    {
+        gst_buffer_unref(out);
+        return;
+    }
+    if (!gst_video_frame_map(&dst, &outInfo, out, GST_MAP_WRITE))
+    {
+        gst_video_frame_unmap(&in);
+        gst_buffer_unref(out);
+        return;
+    }
+
+    Nv12Scaler::Plane s = { (guint8 *) GST_VIDEO_FRAME_PLANE_DATA(&in, 0), (guint8 *) GST_VIDEO_FRAME_PLANE_DATA(&in, 1),
+            GST_VIDEO_FRAME_PLANE_STRIDE(&in, 0), GST_VIDEO_FRAME_PLANE_STRIDE(&in, 1) };
+    Nv12Scaler::Plane d = { (guint8 *) GST_VIDEO_FRAME_PLANE_DATA(&dst, 0), (guint8 *) GST_VIDEO_FRAME_PLANE_DATA(&dst, 1),
+            GST_VIDEO_FRAME_PLANE_STRIDE(&dst, 0), GST_VIDEO_FRAME_PLANE_STRIDE(&dst, 1) };
+    gint64 start = g_get_monotonic_time();
+    scaler.Scale(s, cx, cy, cw, ch, d, params.outWidth, params.outHeight);
+    guint64 took = g_get_monotonic_time() - start;
+    frames++;
+    scaleTime += took;
+    guint64 peak = maxScaleTime;
+    while (took > peak && !maxScaleTime.compare_exchange_weak(peak, took))
+    {
+    }
+    gst_video_frame_unmap(&dst);
+    gst_video_frame_unmap(&in);
+
+    gst_buffer_copy_into(out, frame, GST_BUFFER_COPY_TIMESTAMPS, 0, -1);
+
+    /* The detections in the output, for the ROI encoding */
+    double sx = (double) params.outWidth / cw, sy = (double) params.outHeight / ch;
+    std::vector<Detection> mapped;
+    for (auto d : dets)
+    {
+        gint x0 = std::max(d.x, cx), y0 = std::max(d.y, cy);
+        gint x1 = std::min(d.x + d.width, cx + cw), y1 = std::min(d.y + d.height, cy + ch);
+        if (x1 <= x0 || y1 <= y0)
+        {
+            continue;
+        }
+        d.x = (gint) ((x0 - cx) * sx);
+        d.y = (gint) ((y0 - cy) * sy);
+        d.width = (gint) ((x1 - x0) * sx);
+        d.height = (gint) ((y1 - y0) * sy);
+        mapped.push_back(d);
+    }
+    AttachDetections(out, params.outWidth, params.outHeight, mapped);
+    gst_app_src_push_buffer(GST_APP_SRC(appsrc), out);
+}
+
+std::string AutoFramer::Report()
+{
+    guint64 n = frames.exchange(0);
+    guint64 t = scaleTime.exchange(0);
+    guint64 peak = maxScaleTime.exchange(0);
+    char line[160];
+    snprintf(line, sizeof(line), "%" G_GUINT64_FORMAT " frames, scaling %.1f ms/frame avg, %.1f ms max on %d threads",
+            n, n ? t / 1000.0 / n : 0, peak / 1000.0, SCALE_THREADS);
+    return std::string(line);
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_AUTO_FRAMER_H__
+#define __SMARTCAM_AUTO_FRAMER_H__
+
+#include <gst/gst.h>
+#include <atomic>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "detections.hpp"
+#include "nv12_scaler.hpp"
+
+/*
+ * Auto framing, a digital pan, tilt and zoom following the detected objects.
+ *
+ * The frames come in through an appsink. The crop window is the box around
+ * the objects of the selected classes with a margin, widened to the aspect
+ * ratio of the output. It only takes a new goal when the objects moved or
+ * grew out of a dead band around the current one, and eases towards it with a
+ * time constant, so the view doesn't jitter with the boxes; without objects
+ * it goes back to the whole frame after a while.
+ *
+ * The window is cut from the mapped frame and scaled into the output size by
+ * an Nv12Scaler, into a buffer from the pool downstream proposes, and pushed
+ * to the appsrc. The detections are mapped into the output along, for the ROI
+ * encoding. The scaling time per frame is reported with the metrics.
+ */
+class AutoFramer
+{
+public:
+    struct Params
+    {
+        /* Labels to follow, empty for all */
+        std::set<std::string> classes;
+        gint outWidth;
+        gint outHeight;
+        /* Time constant of the window movement */
+        GstClockTime smoothing;
+    };
+
+    AutoFramer(const Params &params);
+    ~AutoFramer();
+
+    bool Attach(GstElement *bin, const char *sinkName, const char *srcName);
+
+private:
+    struct Window
+    {
+        double x;
+        double y;
+        double width;
+        double height;
+    };
+
+    static GstFlowReturn NewFrameCb(GstElement *sink, gpointer user_data);
+    void OnFrame(GstSample *sample);
+    void UpdateWindow(const std::vector<Detection> &dets, GstClockTime pts);
+    bool SetupOutput(GstCaps *caps);
+    std::string Report();
+
+    Params params;
+    Nv12Scaler scaler;
+    GstElement *appsrc;
+    GstCaps *inCaps;
+    GstBufferPool *pool;
+    gint frameWidth;
+    gint frameHeight;
+
+    Window window;
+    Window goal;
+    GstClockTime lastPts;
+    GstClockTime lastSeen;
+
+    guint metricsId;
+    std::atomic<guint64> frames;
+    /* Microseconds */
+    std::atomic<guint64> scaleTime;
+    std::atomic<guint64> maxScaleTime;
+};
+
+#endif /* __SMARTCAM_AUTO_FRAMER_H__ */
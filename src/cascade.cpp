@@ -0,0 +1,278 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/ivas/gstinferencemeta.h>
+#include <gst/video/video.h>
+#include <algorithm>
+
+#include "cascade.hpp"
+#include "xpp_roi.h"
+
+/* Frames in the classification branch at a time */
+#define CASCADE_MAX_FRAMES 2
+/* Forget the result of tracks gone for this long */
+#define TRACK_FORGET (60 * GST_SECOND)
+
+Cascade::Cascade(const Params &params, SharedTracker *tracker)
+    : params(params), infer("cascade", CASCADE_MAX_FRAMES), tracker(tracker),
+      outSrc(NULL), outCaps(NULL)
+{
+}
+
+Cascade::~Cascade()
+{
+    if (outSrc)
+    {
+        gst_object_unref(outSrc);
+    }
+    if (outCaps)
+    {
+        gst_caps_unref(outCaps);
+    }
+}
+
+bool Cascade::Attach(GstElement *bin, const char *frameSink, const char *roiSrc,
+        const char *resultSink, const char *outSrcName)
+{
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(bin), frameSink);
+    GstElement *out = gst_bin_get_by_name(GST_BIN(bin), outSrcName);
+    if (!sink || !out || !infer.Attach(bin, roiSrc, resultSink))
+    {
+        g_printerr("ERROR: Elements %s/%s not found for the cascade.\n", frameSink, outSrcName);
+        if (sink)
+            gst_object_unref(sink);
+        if (out)
+            gst_object_unref(out);
+        return false;
+    }
+
+    g_object_set(out, "is-live", TRUE, "format", GST_FORMAT_TIME, "max-bytes", (guint64) 0, NULL);
+    if (outSrc)
+        gst_object_unref(outSrc);
+    outSrc = out;
+
+    g_object_set(sink, "emit-signals", TRUE, "sync", FALSE, NULL);
+    g_signal_connect(sink, "new-sample", G_CALLBACK(NewFrameCb), this);
+    gst_object_unref(sink);
+    return true;
+}
+
+GstFlowReturn Cascade::NewFrameCb(GstElement *sink, gpointer user_data)
+{
+    Cascade *cascade = (Cascade *) user_data;
+    GstSample *sample = gst_app_sink_pull_sample(GST_APP_SINK(sink));
+    if (!sample)
+    {
+        return GST_FLOW_EOS;
+    }
+    cascade->OnFrame(sample);
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+void Cascade::OnFrame(GstSample *sample)
+{
+    GstCaps *caps = gst_sample_get_caps(sample);
+    GstBuffer *frame = gst_sample_get_buffer(sample);
+    GstVideoInfo info;
+    if (!caps || !frame || !gst_video_info_from_caps(&info, caps))
+    {
+        return;
+    }
+    if (!outCaps || !gst_caps_is_equal(outCaps, caps))
+    {
+        gst_caps_replace(&outCaps, caps);
+        gst_app_src_set_caps(GST_APP_SRC(outSrc), caps);
+    }
+
+    GstClockTime pts = GST_BUFFER_PTS(frame);
+    gint fw = GST_VIDEO_INFO_WIDTH(&info);
+    gint fh = GST_VIDEO_INFO_HEIGHT(&info);
+    std::vector<Detection> dets;
+    ExtractDetections(frame, dets);
+    tracker->Track(pts, dets);
+
+    /* Biggest objects first, they classify best */
+    std::vector<std::size_t> order;
+    for (std::size_t i = 0; i < dets.size(); i++)
+    {
+        if ((params.classes.empty() || params.classes.count(dets[i].label))
+                && dets[i].width >= params.minSize && dets[i].height >= params.minSize)
+        {
+            order.push_back(i);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&dets](std::size_t a, std::size_t b) {
+            return dets[a].width * dets[a].height > dets[b].width * dets[b].height; });
+
+    std::vector<RoiInfer::Roi> rois;
+    std::vector<guint64> roiTracks;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto it = cache.begin(); it != cache.end();)
+        {
+            if (GST_CLOCK_TIME_IS_VALID(pts) && pts > it->second.requested
+                    && pts - it->second.requested > TRACK_FORGET)
+                it = cache.erase(it);
+            else
+                ++it;
+        }
+
+        for (auto i : order)
+        {
+            const Detection &d = dets[i];
+            auto it = cache.find(d.trackId);
+            if (it != cache.end() && GST_CLOCK_TIME_IS_VALID(pts)
+                    && pts >= it->second.requested && pts - it->second.requested < params.interval)
+            {
+                continue;
+            }
+            if (rois.size() >= params.maxPerFrame)
+            {
+                break;
+            }
+
+            gint x0 = std::max(d.x, 0) / XPP_ROI_ALIGN * XPP_ROI_ALIGN;
+            gint y0 = std::max(d.y, 0) & ~1;
+            gint x1 = std::min(d.x + d.width, fw);
+            gint y1 = std::min(d.y + d.height, fh);
+            if (x1 - x0 < params.minSize || y1 - y0 < params.minSize)
+            {
+                continue;
+            }
+
+            RoiInfer::Roi r;
+            r.x = x0;
+            r.y = y0;
+            r.width = (x1 - x0) & ~1;
+            r.height = (y1 - y0) & ~1;
+            rois.push_back(r);
+            roiTracks.push_back(d.trackId);
+
+            TrackResult &tr = cache[d.trackId];
+            if (it == cache.end())
+            {
+                tr.valid = false;
+                tr.classified = GST_CLOCK_TIME_NONE;
+            }
+            tr.requested = pts;
+        }
+    }
+
+    /* The classifier doesn't hold up the frames: its results only show up on
+     * the frames after the crops were classified */
+    if (!rois.empty() && !infer.Submit(frame, caps, rois,
+                [this, pts, roiTracks](GstBuffer *, const std::vector<RoiInfer::Roi> &,
+                    const std::vector<std::vector<Detection>> &results) {
+                    Store(pts, roiTracks, results); }))
+    {
+        /* Asked again on the next frame */
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto track : roiTracks)
+        {
+            auto it = cache.find(track);
+            if (it == cache.end())
+                continue;
+            if (it->second.valid)
+                it->second.requested = it->second.classified;
+            else
+                cache.erase(it);
+        }
+    }
+
+    Label(frame, dets);
+}
+
+void Cascade::Store(GstClockTime pts, const std::vector<guint64> &roiTracks,
+        const std::vector<std::vector<Detection>> &results)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    for (std::size_t i = 0; i < roiTracks.size() && i < results.size(); i++)
+    {
+        /* The top class of the crop */
+        const Detection *top = NULL;
+        for (const auto &c : results[i])
+        {
+            if (!top || c.prob > top->prob)
+                top = &c;
+        }
+        TrackResult &tr = cache[roiTracks[i]];
+        tr.valid = top != NULL;
+        if (top)
+            tr.top = *top;
+        tr.classified = pts;
+        tr.requested = pts;
+    }
+}
+
+struct FindById
+{
+    guint64 id;
+    GstInferencePrediction *found;
+};
+
+static gboolean
+find_by_id_foreach (GNode * node, gpointer data)
+{
+    FindById *find = (FindById *) data;
+    GstInferencePrediction *prediction = (GstInferencePrediction *) node->data;
+    if (prediction && node->parent && prediction->prediction_id == find->id)
+    {
+        find->found = prediction;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+void Cascade::Label(GstBuffer *frame, const std::vector<Detection> &dets)
+{
+    std::vector<std::pair<guint64, Detection>> attach;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (const auto &d : dets)
+        {
+            auto it = cache.find(d.trackId);
+            if (it != cache.end() && it->second.valid)
+            {
+                attach.push_back(std::make_pair(d.id, it->second.top));
+            }
+        }
+    }
+
+    GstBuffer *out = gst_buffer_copy(frame);
+    GstInferenceMeta *meta = (GstInferenceMeta *) gst_buffer_get_meta(out, gst_inference_meta_api_get_type());
+    if (meta && meta->prediction)
+    {
+        for (const auto &a : attach)
+        {
+            FindById find = { a.first, NULL };
+            g_node_traverse(meta->prediction->predictions, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
+                    find_by_id_foreach, &find);
+            if (!find.found)
+            {
+                continue;
+            }
+            GstInferencePrediction *child = gst_inference_prediction_new();
+            GstInferenceClassification *c = gst_inference_classification_new_full(a.second.classId,
+                    a.second.prob, a.second.label.c_str(), 0, NULL, NULL);
+            gst_inference_prediction_append_classification(child, c);
+            gst_inference_prediction_append(find.found, child);
+        }
+    }
+    gst_app_src_push_buffer(GST_APP_SRC(outSrc), out);
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_CASCADE_H__
+#define __SMARTCAM_CASCADE_H__
+
+#include <gst/gst.h>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "roi_infer.hpp"
+#include "tracker.hpp"
+
+/*
+ * Second stage classification of the detected objects.
+ *
+ * The frames with the detection meta come in through an appsink. The objects
+ * of the selected classes are tracked, first of the stages sharing the
+ * stream's SharedTracker, and cropped out of the frame for a classification
+ * model by a RoiInfer: libivas_xpp resizes and normalizes the crops with the
+ * mean and scale of the secondary preprocess.json. The result
+ * of an object's track is reused for the interval, so an object is only
+ * classified again once it is older than that.
+ *
+ * The frame continues through an appsrc to the rest of the pipeline right
+ * away, without waiting for the classifier: the last classification of each
+ * object's track is attached as a child prediction without box to its node in
+ * the prediction tree. A new object gets its class a few frames after it
+ * shows up, and a stuck classifier only stops the classes from updating.
+ */
+class Cascade
+{
+public:
+    struct Params
+    {
+        /* Labels of the detections to classify, empty for all */
+        std::set<std::string> classes;
+        GstClockTime interval;
+        guint maxPerFrame;
+        gint minSize;
+    };
+
+    Cascade(const Params &params, SharedTracker *tracker);
+    ~Cascade();
+
+    bool Attach(GstElement *bin, const char *frameSink, const char *roiSrc,
+            const char *resultSink, const char *outSrc);
+
+private:
+    struct TrackResult
+    {
+        Detection top;
+        bool valid;
+        GstClockTime classified;
+        GstClockTime requested;
+    };
+
+    static GstFlowReturn NewFrameCb(GstElement *sink, gpointer user_data);
+    void OnFrame(GstSample *sample);
+    /* Keep the results of the classified tracks */
+    void Store(GstClockTime pts, const std::vector<guint64> &roiTracks,
+            const std::vector<std::vector<Detection>> &results);
+    /* Push the frame on with the classes of its objects */
+    void Label(GstBuffer *frame, const std::vector<Detection> &dets);
+
+    Params params;
+    RoiInfer infer;
+    SharedTracker *tracker;
+
+    std::mutex lock;
+    std::map<guint64, TrackResult> cache;
+
+    GstElement *outSrc;
+    GstCaps *outCaps;
+};
+
+#endif /* __SMARTCAM_CASCADE_H__ */
@@ -0,0 +1,235 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gst/app/gstappsink.h>
+#include <sstream>
+
+#include "clip_recorder.hpp"
+#include "detections.hpp"
+
+/* Memory bound of the pre-roll ring, also cuts GOPs longer than the pre-roll */
+#define RING_MAX_BYTES (32 * 1024 * 1024)
+/* Bound of the data waiting for the disk: a whole pre-roll is queued at once
+ * when a clip starts, with room for the live frames while it drains */
+#define WRITER_MAX_BYTES (RING_MAX_BYTES + 16 * 1024 * 1024)
+
+ClipRecorder::ClipRecorder(const Params &params)
+    : params(params), lastTrigger(GST_CLOCK_TIME_NONE), ringBytes(0), recording(false),
+      waitKey(false), clips(0), dropped(0), writer("clip writer", WRITER_MAX_BYTES)
+{
+}
+
+ClipRecorder::~ClipRecorder()
+{
+    Flush();
+    if (clips)
+    {
+        g_print("INFO: recorded %u clips, %" G_GUINT64_FORMAT " frames dropped\n", clips, dropped);
+    }
+}
+
+void ClipRecorder::Flush()
+{
+    for (auto &gop : ring)
+    {
+        for (auto buf : gop)
+        {
+            gst_buffer_unref(buf);
+        }
+    }
+    ring.clear();
+    ringBytes = 0;
+    if (recording)
+    {
+        writer.Close();
+        recording = false;
+    }
+    lastTrigger = GST_CLOCK_TIME_NONE;
+}
+
+void ClipRecorder::ParseClasses(const char *spec, std::set<std::string> &out)
+{
+    std::istringstream in(spec);
+    std::string item;
+    while (std::getline(in, item, ','))
+    {
+        if (!item.empty())
+        {
+            out.insert(item);
+        }
+    }
+}
+
+static GstPadProbeReturn
+clip_recorder_probe_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+    ClipRecorder *rec = (ClipRecorder *) user_data;
+    rec->OnFrame(GST_PAD_PROBE_INFO_BUFFER(info));
+    return GST_PAD_PROBE_OK;
+}
+
+bool ClipRecorder::Attach(GstElement *bin, const char *probeName, const char *sinkName)
+{
+    GstElement *elem = gst_bin_get_by_name(GST_BIN(bin), probeName);
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(bin), sinkName);
+    if (!elem || !sink)
+    {
+        g_printerr("ERROR: Elements %s/%s not found for recording.\n", probeName, sinkName);
+        if (elem)
+            gst_object_unref(elem);
+        if (sink)
+            gst_object_unref(sink);
+        return false;
+    }
+
+    GstPad *pad = gst_element_get_static_pad(elem, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, clip_recorder_probe_cb, this, NULL);
+    gst_object_unref(pad);
+    gst_object_unref(elem);
+
+    g_object_set(sink, "emit-signals", TRUE, "sync", FALSE, NULL);
+    g_signal_connect(sink, "new-sample", G_CALLBACK(NewSampleCb), this);
+    gst_object_unref(sink);
+    return true;
+}
+
+GstFlowReturn ClipRecorder::NewSampleCb(GstElement *sink, gpointer user_data)
+{
+    ClipRecorder *rec = (ClipRecorder *) user_data;
+    GstSample *sample = gst_app_sink_pull_sample(GST_APP_SINK(sink));
+    if (!sample)
+    {
+        return GST_FLOW_EOS;
+    }
+    rec->OnAccessUnit(gst_sample_get_buffer(sample));
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+void ClipRecorder::OnFrame(GstBuffer *buf)
+{
+    GstClockTime pts = GST_BUFFER_PTS(buf);
+    std::vector<Detection> dets;
+    if (!GST_CLOCK_TIME_IS_VALID(pts) || !ExtractDetections(buf, dets))
+    {
+        return;
+    }
+
+    for (const auto &d : dets)
+    {
+        if (params.classes.empty() || params.classes.count(d.label))
+        {
+            lastTrigger = pts;
+            return;
+        }
+    }
+}
+
+void ClipRecorder::TrimRing(GstClockTime now)
+{
+    /* Keep the newest GOP which starts at least the pre-roll before now */
+    while (ring.size() > 1)
+    {
+        GstClockTime next = GST_BUFFER_PTS(ring[1].front());
+        if (ringBytes <= RING_MAX_BYTES && (now < next || now - next < params.preroll))
+        {
+            break;
+        }
+        for (auto buf : ring.front())
+        {
+            ringBytes -= gst_buffer_get_size(buf);
+            gst_buffer_unref(buf);
+        }
+        ring.pop_front();
+    }
+}
+
+void ClipRecorder::StartClip()
+{
+    GDateTime *dt = g_date_time_new_now_local();
+    gchar *stamp = g_date_time_format(dt, "%Y%m%d-%H%M%S");
+    std::ostringstream path;
+    path << params.dir << "/clip-" << stamp << "-" << clips << "." << params.ext;
+    g_free(stamp);
+    g_date_time_unref(dt);
+
+    writer.Open(path.str());
+    recording = true;
+    waitKey = false;
+    clips++;
+    g_print("INFO: Recording %s\n", path.str().c_str());
+
+    /* The ring always starts with an IDR */
+    for (auto &gop : ring)
+    {
+        for (std::size_t i = 0; i < gop.size(); i++)
+        {
+            Write(gop[i], i == 0);
+        }
+    }
+}
+
+void ClipRecorder::Write(GstBuffer *buf, bool key)
+{
+    if (waitKey && !key)
+    {
+        dropped++;
+        return;
+    }
+    waitKey = !writer.Write(buf);
+    if (waitKey)
+    {
+        dropped++;
+    }
+}
+
+void ClipRecorder::OnAccessUnit(GstBuffer *buf)
+{
+    GstClockTime pts = GST_BUFFER_PTS(buf);
+    bool key = !GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT);
+    if (!GST_CLOCK_TIME_IS_VALID(pts))
+    {
+        return;
+    }
+
+    if (key)
+    {
+        ring.emplace_back();
+    }
+    if (!ring.empty())
+    {
+        ring.back().push_back(gst_buffer_ref(buf));
+        ringBytes += gst_buffer_get_size(buf);
+        TrimRing(pts);
+    }
+
+    GstClockTime trigger = lastTrigger;
+    bool triggered = GST_CLOCK_TIME_IS_VALID(trigger) && pts <= trigger + params.quiet;
+    if (recording && !triggered)
+    {
+        writer.Close();
+        recording = false;
+    }
+    else if (recording)
+    {
+        Write(buf, key);
+    }
+    else if (triggered && !ring.empty())
+    {
+        /* The pre-roll includes this access unit */
+        StartClip();
+    }
+}
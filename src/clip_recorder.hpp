@@ -0,0 +1,93 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_CLIP_RECORDER_H__
+#define __SMARTCAM_CLIP_RECORDER_H__
+
+#include <gst/gst.h>
+#include <atomic>
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "file_writer.hpp"
+
+/*
+ * Record-on-detect for the file target.
+ *
+ * The encoded access units are kept in a ring of whole GOPs which covers at
+ * least the pre-roll time. When an object of one of the configured classes is
+ * detected, a new clip is started with the ring, so it begins at an IDR before
+ * the event, and the live frames are appended until no such object has been
+ * seen for the quiet time.
+ *
+ * The detections are taken from the sink pad of the probe element, the access
+ * units from an appsink after the encoder. The files are written by an
+ * AsyncFileWriter; if it falls behind, frames are dropped up to the next IDR
+ * instead of stalling the encoder.
+ */
+class ClipRecorder
+{
+public:
+    struct Params
+    {
+        GstClockTime preroll;
+        GstClockTime quiet;
+        /* Labels which trigger a clip, empty for any detection */
+        std::set<std::string> classes;
+        std::string dir;
+        std::string ext;
+    };
+
+    ClipRecorder(const Params &params);
+    ~ClipRecorder();
+
+    /* Parse a comma separated list of class labels */
+    static void ParseClasses(const char *spec, std::set<std::string> &out);
+
+    bool Attach(GstElement *bin, const char *probeName, const char *sinkName);
+
+    void OnFrame(GstBuffer *buf);
+    void OnAccessUnit(GstBuffer *buf);
+
+    /* Close the clip in progress and drop the pre-roll and the trigger, for
+     * a stream which stops; the appsink must not be running */
+    void Flush();
+
+private:
+    static GstFlowReturn NewSampleCb(GstElement *sink, gpointer user_data);
+
+    void TrimRing(GstClockTime now);
+    void StartClip();
+    void Write(GstBuffer *buf, bool key);
+
+    Params params;
+    /* PTS of the last frame with a triggering detection */
+    std::atomic<guint64> lastTrigger;
+
+    /* Owned by the appsink streaming thread */
+    std::deque<std::vector<GstBuffer *>> ring;
+    gsize ringBytes;
+    bool recording;
+    bool waitKey;
+    guint clips;
+    guint64 dropped;
+
+    AsyncFileWriter writer;
+};
+
+#endif /* __SMARTCAM_CLIP_RECORDER_H__ */
@@ -0,0 +1,232 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "codec_backend.hpp"
+#include "metrics.hpp"
+
+bool CodecBackend::Select(const char *spec)
+{
+    std::string s(spec);
+    if (s == "vcu")
+    {
+        kind = VCU;
+    }
+    else if (s == "sw")
+    {
+        kind = SW;
+    }
+    else if (s == "auto")
+    {
+        bool vcu = access("/dev/allegroIP", F_OK) == 0 && access("/dev/allegroDecodeIP", F_OK) == 0;
+        kind = vcu ? VCU : SW;
+        if (!vcu)
+        {
+            g_print("INFO: No VCU, using the software codecs\n");
+        }
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+std::string CodecBackend::DecoderFactory(const char *type) const
+{
+    return kind == VCU ? std::string("omx") + type + "dec" : std::string("avdec_") + type;
+}
+
+std::string CodecBackend::EncoderFactory(const char *type) const
+{
+    if (kind == VCU)
+    {
+        return std::string("omx") + type + "enc";
+    }
+    return strcmp(type, "h265") ? "x264enc" : "x265enc";
+}
+
+std::string CodecBackend::DecoderProps() const
+{
+    /* One thread per core */
+    return kind == VCU ? "" : " max-threads=0";
+}
+
+std::string CodecBackend::DecoderConvert() const
+{
+    /* libav decodes to I420 */
+    return kind == VCU ? "" : " ! videoconvert";
+}
+
+std::string CodecBackend::EncoderConvert(const char *type) const
+{
+    /* x265enc doesn't take NV12 */
+    return kind == SW && !strcmp(type, "h265") ? "videoconvert ! " : "";
+}
+
+std::string CodecBackend::EncoderDefaults(const char *type, gint idleGop) const
+{
+    char param[512];
+    if (kind == VCU)
+    {
+        snprintf(param, sizeof(param),
+                "gop-mode=low-delay-p gdr-mode=horizontal cpb-size=200 num-slices=8 periodicity-idr=%d \
+                initial-delay=100  filler-data=false min-qp=15  max-qp=40  b-frames=0  low-bandwidth=false ",
+                idleGop);
+    }
+    else if (strcmp(type, "h265"))
+    {
+        /* Sliced threads for the latency, the buffer and the QP range as on the VCU */
+        snprintf(param, sizeof(param),
+                "speed-preset=ultrafast tune=zerolatency threads=0 bframes=0 vbv-buf-capacity=200 qp-min=15 qp-max=40 \
+                key-int-max=%d ", idleGop);
+    }
+    else
+    {
+        snprintf(param, sizeof(param), "speed-preset=ultrafast tune=zerolatency key-int-max=%d ", idleGop);
+    }
+    return std::string(param);
+}
+
+std::string CodecBackend::EncoderRateProps(const char *type, const char *controlRate, const char *bitrate,
+        const char *gopLength) const
+{
+    std::string props;
+    if (kind == VCU)
+    {
+        if (controlRate)
+        {
+            props = std::string("control-rate=") + controlRate + " ";
+        }
+        if (bitrate)
+        {
+            props += std::string("target-bitrate=") + bitrate + " ";
+        }
+        if (gopLength)
+        {
+            props += std::string("gop-length=") + gopLength + " ";
+        }
+        return props;
+    }
+
+    if (controlRate && strcmp(type, "h265"))
+    {
+        /* Constant QP, constant quality capped at the bitrate, or constant bitrate */
+        std::string mode(controlRate);
+        if (mode == "disable")
+            props = "pass=quant ";
+        else if (mode.find("variable") != std::string::npos)
+            props = "pass=qual ";
+        else
+            props = "pass=cbr ";
+    }
+    /* x265enc only has an average bitrate */
+    if (bitrate)
+    {
+        props += std::string("bitrate=") + bitrate + " ";
+    }
+    if (gopLength)
+    {
+        props += std::string("key-int-max=") + gopLength + " ";
+    }
+    return props;
+}
+
+CodecMeter::CodecMeter(const CodecBackend &backend)
+    : name(backend.Name())
+{
+    for (Counter *c : { &decode, &encode })
+    {
+        c->frames = 0;
+        c->bytes = 0;
+        c->lastFrames = 0;
+        c->lastBytes = 0;
+        c->lastReport = g_get_monotonic_time();
+        c->metricsId = 0;
+    }
+}
+
+CodecMeter::~CodecMeter()
+{
+    for (Counter *c : { &decode, &encode })
+    {
+        if (c->metricsId)
+        {
+            Metrics::Get().Unregister(c->metricsId);
+        }
+    }
+}
+
+GstPadProbeReturn CodecMeter::CountCb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    Counter *c = (Counter *) user_data;
+    c->frames++;
+    c->bytes += gst_buffer_get_size(GST_PAD_PROBE_INFO_BUFFER(info));
+    return GST_PAD_PROBE_OK;
+}
+
+void CodecMeter::AddProbe(GstElement *bin, const char *elemName, Counter &counter, const char *stage)
+{
+    GstElement *elem = gst_bin_get_by_name(GST_BIN(bin), elemName);
+    if (!elem)
+    {
+        return;
+    }
+    GstPad *pad = gst_element_get_static_pad(elem, "src");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, CountCb, &counter, NULL);
+    gst_object_unref(pad);
+    gst_object_unref(elem);
+
+    if (!counter.metricsId)
+    {
+        bool encoded = &counter == &encode;
+        counter.metricsId = Metrics::Get().Register(name + " " + stage,
+                [&counter, encoded] { return Report(counter, encoded); });
+    }
+}
+
+void CodecMeter::Attach(GstElement *bin, const char *decName, const char *encName)
+{
+    AddProbe(bin, decName, decode, "decode");
+    AddProbe(bin, encName, encode, "encode");
+}
+
+std::string CodecMeter::Report(Counter &c, bool encoded)
+{
+    gint64 now = g_get_monotonic_time();
+    guint64 frames = c.frames;
+    guint64 bytes = c.bytes;
+    double secs = (now - c.lastReport) / 1e6;
+    double fps = secs > 0 ? (frames - c.lastFrames) / secs : 0;
+    double kbps = secs > 0 ? (bytes - c.lastBytes) * 8 / secs / 1000 : 0;
+    c.lastFrames = frames;
+    c.lastBytes = bytes;
+    c.lastReport = now;
+
+    char line[96];
+    if (encoded)
+    {
+        snprintf(line, sizeof(line), "%.1f fps, %.0f kbps", fps, kbps);
+    }
+    else
+    {
+        snprintf(line, sizeof(line), "%.1f fps", fps);
+    }
+    return std::string(line);
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_CODEC_BACKEND_H__
+#define __SMARTCAM_CODEC_BACKEND_H__
+
+#include <gst/gst.h>
+#include <atomic>
+#include <string>
+
+/*
+ * The H.264/H.265 decoder and encoder elements: the VCU through OMX, or
+ * multithreaded software codecs from gst-libav and x264/x265 on machines
+ * without it, e.g. a development box or a build server.
+ *
+ * The encoder options of the command line are in terms of the OMX encoder.
+ * For the software encoder they are mapped onto the nearest settings:
+ * target-bitrate to bitrate, gop-length to key-int-max, and control-rate to
+ * the rate control mode of x264. Every key frame of x264/x265 is an IDR, so
+ * the IDR period of the defaults becomes key-int-max too, for a gop-length
+ * to override. The OMX specific defaults, the QP mode and the ROI encoding
+ * are left out.
+ */
+class CodecBackend
+{
+public:
+    enum Kind { VCU, SW };
+
+    CodecBackend() : kind(VCU) {}
+
+    /* Parse auto|vcu|sw, auto picks the VCU if its devices are there */
+    bool Select(const char *spec);
+
+    Kind GetKind() const { return kind; }
+    const char *Name() const { return kind == VCU ? "vcu" : "sw"; }
+
+    /* Factory of the decoder and the encoder of @type, h264 or h265 */
+    std::string DecoderFactory(const char *type) const;
+    std::string EncoderFactory(const char *type) const;
+    /* Properties of the decoder, each with a leading space */
+    std::string DecoderProps() const;
+    /* Elements between the decoder and NV12 caps, " ! <element>" or empty */
+    std::string DecoderConvert() const;
+    /* Elements in front of the encoder of @type which take NV12 to its input */
+    std::string EncoderConvert(const char *type) const;
+    /* The built-in encoder settings, with the GOP length used when idle */
+    std::string EncoderDefaults(const char *type, gint idleGop) const;
+    /* Rate control and GOP properties from the OMX style settings, the NULL
+     * ones are left out */
+    std::string EncoderRateProps(const char *type, const char *controlRate, const char *bitrate,
+            const char *gopLength) const;
+    /* Bitrate property in kbps, can be set while playing */
+    const char *BitrateProperty() const { return kind == VCU ? "target-bitrate" : "bitrate"; }
+
+private:
+    Kind kind;
+};
+
+/*
+ * Frames and bytes out of the decoder and the encoder, reported as metrics
+ * named after the backend, so software numbers aren't taken for VCU ones.
+ */
+class CodecMeter
+{
+public:
+    CodecMeter(const CodecBackend &backend);
+    ~CodecMeter();
+
+    /* Count at the source pads of @decName and @encName, where they exist */
+    void Attach(GstElement *bin, const char *decName, const char *encName);
+
+private:
+    struct Counter
+    {
+        std::atomic<guint64> frames;
+        std::atomic<guint64> bytes;
+        guint64 lastFrames;
+        guint64 lastBytes;
+        gint64 lastReport;
+        guint metricsId;
+    };
+
+    static GstPadProbeReturn CountCb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    void AddProbe(GstElement *bin, const char *elemName, Counter &counter, const char *stage);
+    static std::string Report(Counter &c, bool encoded);
+
+    std::string name;
+    Counter decode;
+    Counter encode;
+};
+
+#endif /* __SMARTCAM_CODEC_BACKEND_H__ */
@@ -0,0 +1,179 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <errno.h>
+#include <glib-unix.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "control_server.hpp"
+#include "unix_socket.hpp"
+
+#define MAX_LINE_BYTES (64 * 1024)
+/* A client which doesn't read its replies can't hold up the main loop for longer */
+#define SEND_TIMEOUT_MS 1000
+
+ControlServer::ControlServer(Handler handler)
+    : handler(handler), fd(-1), source(0)
+{
+}
+
+ControlServer::~ControlServer()
+{
+    for (auto &c : clients)
+    {
+        g_source_remove(c.second->source);
+        close(c.second->fd);
+    }
+    if (source)
+    {
+        g_source_remove(source);
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+        unlink(path.c_str());
+    }
+}
+
+bool ControlServer::Listen(const std::string &socketPath)
+{
+    fd = ListenUnixSocket(socketPath, SOCK_STREAM, "control");
+    if (fd < 0)
+    {
+        return false;
+    }
+    path = socketPath;
+    source = g_unix_fd_add(fd, G_IO_IN, AcceptCb, this);
+    return true;
+}
+
+gboolean ControlServer::AcceptCb(gint fd, GIOCondition condition, gpointer user_data)
+{
+    ControlServer *server = (ControlServer *) user_data;
+    int c = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+    if (c < 0)
+    {
+        return G_SOURCE_CONTINUE;
+    }
+
+    struct timeval tv;
+    tv.tv_sec = SEND_TIMEOUT_MS / 1000;
+    tv.tv_usec = (SEND_TIMEOUT_MS % 1000) * 1000;
+    setsockopt(c, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    std::unique_ptr<Client> client(new Client);
+    client->fd = c;
+    client->source = g_unix_fd_add(c, (GIOCondition) (G_IO_IN | G_IO_HUP | G_IO_ERR), ReadCb, server);
+    server->clients[c] = std::move(client);
+    return G_SOURCE_CONTINUE;
+}
+
+gboolean ControlServer::ReadCb(gint fd, GIOCondition condition, gpointer user_data)
+{
+    ControlServer *server = (ControlServer *) user_data;
+    auto it = server->clients.find(fd);
+    if (it == server->clients.end())
+    {
+        return G_SOURCE_REMOVE;
+    }
+    if (server->Read(it->second.get()))
+    {
+        return G_SOURCE_CONTINUE;
+    }
+    /* Returning G_SOURCE_REMOVE destroys the source */
+    close(fd);
+    server->clients.erase(it);
+    return G_SOURCE_REMOVE;
+}
+
+bool ControlServer::Read(Client *client)
+{
+    char buf[4096];
+    ssize_t n = recv(client->fd, buf, sizeof(buf), 0);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN))
+    {
+        return true;
+    }
+    if (n <= 0)
+    {
+        return false;
+    }
+    client->in.append(buf, n);
+
+    std::size_t pos;
+    while ((pos = client->in.find('\n')) != std::string::npos)
+    {
+        std::string line = client->in.substr(0, pos);
+        client->in.erase(0, pos + 1);
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+        {
+            continue;
+        }
+
+        json_error_t error;
+        json_t *request = json_loads(line.c_str(), 0, &error);
+        json_t *reply;
+        if (!request || !json_is_object(request))
+        {
+            reply = json_pack("{s:b, s:s}", "ok", 0, "error", request ? "the request must be an object" : error.text);
+        }
+        else
+        {
+            reply = handler(request);
+        }
+        if (request)
+        {
+            json_decref(request);
+        }
+        if (!Reply(client, reply))
+        {
+            return false;
+        }
+    }
+    return client->in.size() <= MAX_LINE_BYTES;
+}
+
+bool ControlServer::Reply(Client *client, json_t *reply)
+{
+    char *text = json_dumps(reply, JSON_COMPACT);
+    json_decref(reply);
+    if (!text)
+    {
+        return false;
+    }
+    std::string line = std::string(text) + "\n";
+    free(text);
+
+    std::size_t done = 0;
+    while (done < line.size())
+    {
+        ssize_t n = send(client->fd, line.data() + done, line.size() - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __SMARTCAM_CONTROL_SERVER_H__
+#define __SMARTCAM_CONTROL_SERVER_H__
+
+#include <glib.h>
+#include <jansson.h>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+/*
+ * Local control API on a Unix stream socket.
+ *
+ * A client sends one JSON object per line and gets one JSON object per line
+ * back, in order. The requests are handed to the handler on the main
+ * context, so it can change the pipelines directly. A line which is not a
+ * JSON object gets an error reply, a line longer than 64 KB closes the
+ * connection.
+ */
+class ControlServer
+{
+public:
+    /* Returns a new reference to the reply of @request */
+    typedef std::function<json_t *(json_t *request)> Handler;
+
+    ControlServer(Handler handler);
+    /* Closes the clients and removes the socket file */
+    ~ControlServer();
+
+    /* Listen on @path, false with the error printed if it is in use or
+     * can't be bound */
+    bool Listen(const std::string &path);
+
+private:
+    struct Client
+    {
+        int fd;
+        guint source;
+        std::string in;
+    };
+
+    static gboolean AcceptCb(gint fd, GIOCondition condition, gpointer user_data);
+    static gboolean ReadCb(gint fd, GIOCondition condition, gpointer user_data);
+
+    bool Read(Client *client);
+    bool Reply(Client *client, json_t *reply);
+
+    Handler handler;
+    std::string path;
+    int fd;
+    guint source;
+    std::map<int, std::unique_ptr<Client>> clients;
+};
+
+#endif /* __SMARTCAM_CONTROL_SERVER_H__ */
@@ -0,0 +1,168 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gst/ivas/gstinferencemeta.h>
+#include <sstream>
+#include <iomanip>
+
+#include "detections.hpp"
+
+static gboolean
+collect_node_foreach (GNode * node, gpointer data)
+{
+    std::vector<Detection> *out = (std::vector<Detection> *) data;
+    GstInferencePrediction *prediction = (GstInferencePrediction *) node->data;
+
+    /* The top classification decides the label, same as the render pass */
+    if (!prediction || !prediction->classifications)
+        return FALSE;
+
+    GstInferenceClassification *classification =
+        (GstInferenceClassification *) prediction->classifications->data;
+
+    if (prediction->bbox.width < 1 && prediction->bbox.height < 1 && node->parent && node->parent->parent)
+    {
+        /* Pre-order, the parent is already collected */
+        GstInferencePrediction *parent = (GstInferencePrediction *) node->parent->data;
+        for (auto it = out->rbegin(); it != out->rend(); ++it)
+        {
+            if (it->id == parent->prediction_id)
+            {
+                if (classification->class_label)
+                    it->attributes.push_back(classification->class_label);
+                break;
+            }
+        }
+        return FALSE;
+    }
+
+    Detection det;
+    det.id = prediction->prediction_id;
+    det.trackId = 0;
+    det.x = prediction->bbox.x;
+    det.y = prediction->bbox.y;
+    det.width = prediction->bbox.width;
+    det.height = prediction->bbox.height;
+    det.classId = classification->class_id;
+    det.prob = classification->class_prob;
+    det.label = classification->class_label ? classification->class_label : "";
+    out->push_back(det);
+
+    return FALSE;
+}
+
+bool ExtractDetections(GstBuffer *buf, std::vector<Detection> &out)
+{
+    out.clear();
+
+    GstInferenceMeta *infer_meta = (GstInferenceMeta *) gst_buffer_get_meta (buf,
+            gst_inference_meta_api_get_type ());
+    if (!infer_meta || !infer_meta->prediction)
+    {
+        return false;
+    }
+
+    g_node_traverse (infer_meta->prediction->predictions, G_PRE_ORDER,
+            G_TRAVERSE_ALL, -1, collect_node_foreach, &out);
+    return true;
+}
+
+void AttachDetections(GstBuffer *buf, gint width, gint height, const std::vector<Detection> &dets)
+{
+    GstInferenceMeta *meta = (GstInferenceMeta *) gst_buffer_add_meta (buf,
+            gst_inference_meta_get_info (), NULL);
+    GstInferencePrediction *root = meta->prediction;
+    root->bbox.x = 0;
+    root->bbox.y = 0;
+    root->bbox.width = width;
+    root->bbox.height = height;
+
+    for (const auto &d : dets)
+    {
+        GstInferencePrediction *pred = gst_inference_prediction_new ();
+        pred->bbox.x = d.x;
+        pred->bbox.y = d.y;
+        pred->bbox.width = d.width;
+        pred->bbox.height = d.height;
+
+        GstInferenceClassification *c = gst_inference_classification_new_full (d.classId,
+                d.prob, d.label.c_str (), 0, NULL, NULL);
+        gst_inference_prediction_append_classification (pred, c);
+        gst_inference_prediction_append (root, pred);
+    }
+}
+
+static void JsonEscape(std::ostringstream &oss, const std::string &s)
+{
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+        {
+            oss << '\\' << c;
+        }
+        else if ((unsigned char)c < 0x20)
+        {
+            oss << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c << std::dec;
+        }
+        else
+        {
+            oss << c;
+        }
+    }
+}
+
+std::string DetectionsToJson(GstClockTime pts, guint64 frame, const std::vector<Detection> &dets)
+{
+    std::ostringstream oss;
+    oss << "{\"frame\":" << frame << ",\"pts\":";
+    if (GST_CLOCK_TIME_IS_VALID(pts))
+        oss << pts;
+    else
+        oss << "null";
+
+    oss << ",\"objects\":[";
+    for (size_t i = 0; i < dets.size(); i++)
+    {
+        const Detection &d = dets[i];
+        if (i)
+            oss << ",";
+        oss << "{\"id\":" << d.id;
+        if (d.trackId)
+            oss << ",\"track\":" << d.trackId;
+        oss
+            << ",\"x\":" << d.x << ",\"y\":" << d.y
+            << ",\"w\":" << d.width << ",\"h\":" << d.height
+            << ",\"class_id\":" << d.classId
+            << ",\"prob\":" << std::fixed << std::setprecision(3) << d.prob
+            << ",\"label\":\"";
+        JsonEscape(oss, d.label);
+        oss << "\"";
+        if (!d.attributes.empty())
+        {
+            oss << ",\"attributes\":[";
+            for (size_t j = 0; j < d.attributes.size(); j++)
+            {
+                oss << (j ? ",\"" : "\"");
+                JsonEscape(oss, d.attributes[j]);
+                oss << "\"";
+            }
+            oss << "]";
+        }
+        oss << "}";
+    }
+    oss << "]}";
+    return oss.str();
+}
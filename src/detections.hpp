@@ -0,0 +1,54 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_DETECTIONS_H__
+#define __SMARTCAM_DETECTIONS_H__
+
+#include <gst/gst.h>
+#include <string>
+#include <vector>
+
+/* One detected object, flattened out of the GstInferenceMeta prediction tree.
+ * Coordinates are in pixels of the buffer the meta is attached to. */
+struct Detection
+{
+    guint64 id;
+    /* Stable across frames when set by a tracker, 0 otherwise */
+    guint64 trackId;
+    gint x;
+    gint y;
+    gint width;
+    gint height;
+    gint classId;
+    gdouble prob;
+    std::string label;
+    /* Labels of classifications attached below this object, e.g. by the cascade */
+    std::vector<std::string> attributes;
+};
+
+/* Collect all predictions with a bounding box and at least one classification.
+ * Box-less classifications below such a prediction become its attributes.
+ * Returns false if the buffer carries no inference meta. */
+bool ExtractDetections(GstBuffer *buf, std::vector<Detection> &out);
+
+/* Add a GstInferenceMeta to the writable @buf with @dets as the children of a
+ * root prediction covering the @width x @height frame. */
+void AttachDetections(GstBuffer *buf, gint width, gint height, const std::vector<Detection> &dets);
+
+/* Serialize one frame worth of detections as a single line JSON object. */
+std::string DetectionsToJson(GstClockTime pts, guint64 frame, const std::vector<Detection> &dets);
+
+#endif /* __SMARTCAM_DETECTIONS_H__ */
@@ -0,0 +1,166 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gst/video/video.h>
+#include <vector>
+
+#include "detections.hpp"
+#include "encoder_control.hpp"
+
+EncoderControl::EncoderControl(const Params &params)
+    : params(params), encoder(NULL), active(false), bitrateCap(0), encoderBitrate(0), currentBitrate(0),
+      framesSinceKey(0), lastSeen(GST_CLOCK_TIME_NONE), forcedKeys(0)
+{
+}
+
+EncoderControl::~EncoderControl()
+{
+    if (encoder)
+    {
+        gst_object_unref(encoder);
+    }
+    if (forcedKeys)
+    {
+        g_print("INFO: encoder control forced %" G_GUINT64_FORMAT " key frames\n", forcedKeys);
+    }
+}
+
+static GstPadProbeReturn
+enc_ctrl_probe_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+    EncoderControl *ctrl = (EncoderControl *) user_data;
+    ctrl->OnFrame(pad, GST_PAD_PROBE_INFO_BUFFER(info));
+    return GST_PAD_PROBE_OK;
+}
+
+bool EncoderControl::Attach(GstElement *bin, const char *probeName, const char *encName)
+{
+    GstElement *enc = gst_bin_get_by_name(GST_BIN(bin), encName);
+    GstElement *elem = params.sceneAdaptive ? gst_bin_get_by_name(GST_BIN(bin), probeName) : NULL;
+    if (!enc || (params.sceneAdaptive && !elem))
+    {
+        g_printerr("ERROR: Elements %s/%s not found for encoder control.\n", probeName, encName);
+        if (enc)
+            gst_object_unref(enc);
+        if (elem)
+            gst_object_unref(elem);
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (encoder)
+            gst_object_unref(encoder);
+        encoder = enc;
+        active = !params.sceneAdaptive;
+        g_object_get(encoder, params.bitrateProperty, &encoderBitrate, NULL);
+        currentBitrate = encoderBitrate;
+        ApplyBitrate();
+    }
+
+    if (!elem)
+    {
+        return true;
+    }
+    GstPad *pad = gst_element_get_static_pad(elem, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, enc_ctrl_probe_cb, this, NULL);
+    gst_object_unref(pad);
+    gst_object_unref(elem);
+    return true;
+}
+
+void EncoderControl::ForceKeyFrame(GstPad *pad)
+{
+    /* Serialized with the buffers, so the key frame lands on this very frame */
+    GstEvent *event = gst_video_event_new_downstream_force_key_unit(GST_CLOCK_TIME_NONE,
+            GST_CLOCK_TIME_NONE, GST_CLOCK_TIME_NONE, TRUE, forcedKeys);
+    gst_pad_send_event(pad, event);
+    framesSinceKey = 0;
+    forcedKeys++;
+}
+
+void EncoderControl::SetBitrateCap(guint cap)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    bitrateCap = cap;
+    ApplyBitrate();
+}
+
+/* Called with the lock held */
+void EncoderControl::ApplyBitrate()
+{
+    if (!encoder)
+    {
+        return;
+    }
+    guint bitrate = active ? params.activeBitrate : params.idleBitrate;
+    if (!bitrate)
+    {
+        bitrate = encoderBitrate;
+    }
+    if (bitrateCap && bitrateCap < bitrate)
+    {
+        bitrate = bitrateCap;
+    }
+    if (bitrate != currentBitrate)
+    {
+        g_object_set(encoder, params.bitrateProperty, bitrate, NULL);
+        currentBitrate = bitrate;
+    }
+}
+
+void EncoderControl::OnFrame(GstPad *pad, GstBuffer *buf)
+{
+    GstClockTime now = GST_BUFFER_PTS(buf);
+    if (!GST_CLOCK_TIME_IS_VALID(now))
+    {
+        now = g_get_monotonic_time() * GST_USECOND;
+    }
+
+    std::vector<Detection> dets;
+    ExtractDetections(buf, dets);
+
+    bool newClass = false;
+    for (const auto &d : dets)
+    {
+        auto it = classes.find(d.label);
+        if (it == classes.end() || now - it->second > params.idleDelay)
+        {
+            newClass = true;
+        }
+        classes[d.label] = now;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!dets.empty())
+        {
+            lastSeen = now;
+            active = true;
+        }
+        else if (active && GST_CLOCK_TIME_IS_VALID(lastSeen) && now - lastSeen > params.idleDelay)
+        {
+            active = false;
+        }
+        ApplyBitrate();
+    }
+
+    framesSinceKey++;
+    if (newClass || (active && params.activeGop && framesSinceKey >= params.activeGop))
+    {
+        ForceKeyFrame(pad);
+    }
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_ENCODER_CONTROL_H__
+#define __SMARTCAM_ENCODER_CONTROL_H__
+
+#include <gst/gst.h>
+#include <map>
+#include <mutex>
+#include <string>
+
+/*
+ * Adapts the running encoder to the detection stream.
+ *
+ * Active (objects in the scene): active bitrate, a key frame every active GOP
+ * length frames, and an immediate key frame when a class shows up that wasn't
+ * in the scene before.
+ * Idle (no objects for idleDelay): idle bitrate, and the encoder is left alone
+ * with its own long GOP.
+ *
+ * The encoder is started with the idle GOP length, the active GOP is realized
+ * with force-key-unit events, as the OMX encoder can't change gop-length in
+ * PLAYING.
+ *
+ * Independent of the scene, a bitrate cap can be set from outside, e.g. by the
+ * network feedback loop. The encoder runs at min(scene bitrate, cap).
+ */
+class EncoderControl
+{
+public:
+    struct Params
+    {
+        bool sceneAdaptive;
+        /* 0 for the bitrate the encoder was configured with */
+        guint activeBitrate;
+        guint idleBitrate;
+        guint activeGop;
+        GstClockTime idleDelay;
+        /* Bitrate property of the encoder element, in kbps */
+        const char *bitrateProperty;
+    };
+
+    EncoderControl(const Params &params);
+    ~EncoderControl();
+
+    /* Watch the detections on the sink pad of @probeName and drive @encName */
+    bool Attach(GstElement *bin, const char *probeName, const char *encName);
+
+    void OnFrame(GstPad *pad, GstBuffer *buf);
+
+    /* Thread safe, 0 removes the cap */
+    void SetBitrateCap(guint cap);
+
+private:
+    void ForceKeyFrame(GstPad *pad);
+    void ApplyBitrate();
+
+    Params params;
+    std::mutex lock;
+    GstElement *encoder;
+    bool active;
+    guint bitrateCap;
+    /* Bitrate of the encoder before it was driven */
+    guint encoderBitrate;
+    guint currentBitrate;
+    guint framesSinceKey;
+    GstClockTime lastSeen;
+    /* Class label -> PTS it was last seen at */
+    std::map<std::string, GstClockTime> classes;
+    guint64 forcedKeys;
+};
+
+#endif /* __SMARTCAM_ENCODER_CONTROL_H__ */
@@ -0,0 +1,296 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "file_writer.hpp"
+#include "metrics.hpp"
+
+/* Size and alignment of the writes to the file system, a multiple of the
+ * logical block size for O_DIRECT */
+#define WRITE_CHUNK_SIZE (1024 * 1024)
+#define WRITE_CHUNK_ALIGN 4096
+
+AsyncFileWriter::AsyncFileWriter(const char *name, gsize maxQueuedBytes)
+    : queuedBytes(0), maxQueuedBytes(maxQueuedBytes), stop(false), fd(-1), direct(false), chunk(NULL),
+      chunkFill(0), fileOffset(0), bytesWritten(0), maxLatencyUs(0), lastBytes(0),
+      lastReport(g_get_monotonic_time())
+{
+    if (posix_memalign((void **) &chunk, WRITE_CHUNK_ALIGN, WRITE_CHUNK_SIZE) != 0)
+    {
+        chunk = NULL;
+    }
+    metricsId = Metrics::Get().Register(name, [this] { return Report(); });
+    thread = std::thread(&AsyncFileWriter::Run, this);
+}
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+    }
+    cond.notify_one();
+    thread.join();
+    Metrics::Get().Unregister(metricsId);
+    free(chunk);
+}
+
+void AsyncFileWriter::Push(const Cmd &cmd)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        queue.push_back(cmd);
+    }
+    cond.notify_one();
+}
+
+void AsyncFileWriter::Open(const std::string &path)
+{
+    Cmd cmd;
+    cmd.type = Cmd::OPEN;
+    cmd.path = path;
+    cmd.buf = NULL;
+    Push(cmd);
+}
+
+bool AsyncFileWriter::Write(GstBuffer *buf)
+{
+    gsize size = gst_buffer_get_size(buf);
+    Cmd cmd;
+    cmd.type = Cmd::WRITE;
+    cmd.buf = NULL;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (queuedBytes + size > maxQueuedBytes)
+        {
+            return false;
+        }
+        queuedBytes += size;
+        cmd.buf = gst_buffer_ref(buf);
+        queue.push_back(cmd);
+    }
+    cond.notify_one();
+    return true;
+}
+
+void AsyncFileWriter::Close()
+{
+    Cmd cmd;
+    cmd.type = Cmd::CLOSE;
+    cmd.buf = NULL;
+    Push(cmd);
+}
+
+void AsyncFileWriter::Remove(const std::string &path)
+{
+    Cmd cmd;
+    cmd.type = Cmd::REMOVE;
+    cmd.path = path;
+    cmd.buf = NULL;
+    Push(cmd);
+}
+
+std::string AsyncFileWriter::Report()
+{
+    gint64 now = g_get_monotonic_time();
+    guint64 bytes = bytesWritten;
+    double secs = (now - lastReport) / 1e6;
+    double rate = secs > 0 ? (bytes - lastBytes) / secs / (1024 * 1024) : 0;
+    gsize queued;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        queued = queuedBytes;
+    }
+    lastBytes = bytes;
+    lastReport = now;
+
+    char line[128];
+    snprintf(line, sizeof(line), "%.2f MB/s, max write latency %.1f ms, %" G_GSIZE_FORMAT " KB queued",
+            rate, maxLatencyUs.exchange(0) / 1000.0, queued / 1024);
+    return std::string(line);
+}
+
+void AsyncFileWriter::Run()
+{
+    while (true)
+    {
+        Cmd cmd;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            cond.wait(guard, [this] { return stop || !queue.empty(); });
+            if (queue.empty())
+            {
+                break;
+            }
+            cmd = queue.front();
+            queue.pop_front();
+        }
+
+        switch (cmd.type)
+        {
+            case Cmd::OPEN:
+                DoOpen(cmd.path);
+                break;
+            case Cmd::WRITE:
+                DoWrite(cmd.buf);
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    queuedBytes -= gst_buffer_get_size(cmd.buf);
+                }
+                gst_buffer_unref(cmd.buf);
+                break;
+            case Cmd::CLOSE:
+                DoClose();
+                break;
+            case Cmd::REMOVE:
+                if (unlink(cmd.path.c_str()) != 0 && errno != ENOENT)
+                {
+                    g_printerr("ERROR: Can't remove %s: %s\n", cmd.path.c_str(), strerror(errno));
+                }
+                break;
+        }
+    }
+    DoClose();
+}
+
+void AsyncFileWriter::DoOpen(const std::string &newPath)
+{
+    DoClose();
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    fd = open(newPath.c_str(), flags | O_DIRECT, 0644);
+    direct = fd >= 0;
+    if (fd < 0 && errno == EINVAL)
+    {
+        /* tmpfs and others */
+        fd = open(newPath.c_str(), flags, 0644);
+    }
+    if (fd < 0)
+    {
+        g_printerr("ERROR: Can't open %s: %s\n", newPath.c_str(), strerror(errno));
+        return;
+    }
+    path = newPath;
+    chunkFill = 0;
+    fileOffset = 0;
+}
+
+void AsyncFileWriter::DoWrite(GstBuffer *buf)
+{
+    GstMapInfo map;
+    if (fd < 0 || !chunk || !gst_buffer_map(buf, &map, GST_MAP_READ))
+    {
+        return;
+    }
+
+    gsize done = 0;
+    while (done < map.size && fd >= 0)
+    {
+        gsize len = std::min(map.size - done, (gsize) WRITE_CHUNK_SIZE - chunkFill);
+        memcpy(chunk + chunkFill, map.data + done, len);
+        chunkFill += len;
+        done += len;
+        if (chunkFill == WRITE_CHUNK_SIZE)
+        {
+            FlushChunk();
+        }
+    }
+    gst_buffer_unmap(buf, &map);
+}
+
+/* Back to buffered writes, for the unaligned tail of a file or a file system
+ * which only refuses O_DIRECT on write */
+bool AsyncFileWriter::ClearDirect()
+{
+    if (!direct)
+    {
+        return false;
+    }
+    direct = false;
+    int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags & ~O_DIRECT) == 0;
+}
+
+void AsyncFileWriter::FlushChunk()
+{
+    gint64 start = g_get_monotonic_time();
+    if (direct && chunkFill % WRITE_CHUNK_ALIGN)
+    {
+        ClearDirect();
+    }
+
+    gsize done = 0;
+    while (done < chunkFill)
+    {
+        ssize_t ret = write(fd, chunk + done, chunkFill - done);
+        if (ret < 0)
+        {
+            if (errno == EINTR || (errno == EINVAL && ClearDirect()))
+                continue;
+            g_printerr("ERROR: Write to %s failed: %s\n", path.c_str(), strerror(errno));
+            close(fd);
+            fd = -1;
+            break;
+        }
+        done += ret;
+    }
+
+    if (fd >= 0 && !direct)
+    {
+        /* Start the write back now. The previous chunk was started one chunk
+         * ago: wait for it, as dirty pages can't be dropped, and drop it */
+        sync_file_range(fd, fileOffset, done, SYNC_FILE_RANGE_WRITE);
+        if (fileOffset >= WRITE_CHUNK_SIZE)
+        {
+            off_t prev = fileOffset - WRITE_CHUNK_SIZE;
+            sync_file_range(fd, prev, WRITE_CHUNK_SIZE,
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+            posix_fadvise(fd, prev, WRITE_CHUNK_SIZE, POSIX_FADV_DONTNEED);
+        }
+    }
+    fileOffset += done;
+    chunkFill = 0;
+
+    guint64 latency = g_get_monotonic_time() - start;
+    guint64 prev = maxLatencyUs;
+    while (latency > prev && !maxLatencyUs.compare_exchange_weak(prev, latency))
+    {
+    }
+    bytesWritten += done;
+}
+
+void AsyncFileWriter::DoClose()
+{
+    if (fd >= 0)
+    {
+        if (chunkFill)
+        {
+            FlushChunk();
+        }
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+        fd = -1;
+        g_print("INFO: Closed %s\n", path.c_str());
+    }
+}
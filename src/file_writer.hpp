@@ -0,0 +1,96 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_FILE_WRITER_H__
+#define __SMARTCAM_FILE_WRITER_H__
+
+#include <gst/gst.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/*
+ * Writes buffers to files on a dedicated I/O thread.
+ *
+ * All calls only queue a command and return at once. The queue is bounded in
+ * bytes: Write() refuses a buffer rather than letting a stalled file system
+ * back up into the streaming thread.
+ *
+ * The data is gathered in a page aligned chunk and written out a chunk at a
+ * time with O_DIRECT, so the page cache doesn't pile up dirty data which is
+ * then flushed in one long stall. On file systems without O_DIRECT the write
+ * back of every chunk is started right away, and the pages of the previous
+ * chunk are dropped once they are on the disk.
+ * Throughput and the worst write latency are reported as metrics under @name.
+ */
+class AsyncFileWriter
+{
+public:
+    AsyncFileWriter(const char *name, gsize maxQueuedBytes);
+    /* Writes out what is queued, closes the file and joins the thread */
+    ~AsyncFileWriter();
+
+    void Open(const std::string &path);
+    /* Takes a reference of @buf, returns false if the queue is full */
+    bool Write(GstBuffer *buf);
+    void Close();
+    /* Delete a file, in order with the other commands */
+    void Remove(const std::string &path);
+
+private:
+    struct Cmd
+    {
+        enum Type { OPEN, WRITE, CLOSE, REMOVE } type;
+        std::string path;
+        GstBuffer *buf;
+    };
+
+    void Push(const Cmd &cmd);
+    void Run();
+    void DoOpen(const std::string &path);
+    void DoWrite(GstBuffer *buf);
+    void DoClose();
+    void FlushChunk();
+    bool ClearDirect();
+    std::string Report();
+
+    std::mutex lock;
+    std::condition_variable cond;
+    std::deque<Cmd> queue;
+    gsize queuedBytes;
+    gsize maxQueuedBytes;
+    bool stop;
+    std::thread thread;
+
+    /* Owned by the I/O thread */
+    int fd;
+    bool direct;
+    std::string path;
+    guint8 *chunk;
+    gsize chunkFill;
+    off_t fileOffset;
+
+    guint metricsId;
+    std::atomic<guint64> bytesWritten;
+    std::atomic<guint64> maxLatencyUs;
+    guint64 lastBytes;
+    gint64 lastReport;
+};
+
+#endif /* __SMARTCAM_FILE_WRITER_H__ */
@@ -0,0 +1,498 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib-unix.h>
+#include <gst/allocators/gstdmabuf.h>
+#include <jansson.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sstream>
+
+#include "frame_share.hpp"
+#include "detections.hpp"
+#include "metrics.hpp"
+#include "unix_socket.hpp"
+
+/* Longer packets from a consumer are cut off */
+#define MAX_REQUEST_BYTES 256
+
+/* Linux 5.1, missing from older C library headers */
+#ifndef F_SEAL_FUTURE_WRITE
+#define F_SEAL_FUTURE_WRITE 0x0010
+#endif
+
+FrameShare::FrameShare(guint ringSize)
+    : ringSize(ringSize), fd(-1), source(0), slots(ringSize), frames(0), caps(NULL), pool(NULL),
+      poolSpare(0), shared(0), skipped(0), lagging(0), copied(0)
+{
+    for (auto &s : slots)
+    {
+        s.frame = 0;
+        s.refs = 0;
+        s.buf = NULL;
+        s.memfd = -1;
+        s.map = NULL;
+        s.size = 0;
+    }
+    gst_video_info_init(&info);
+    metricsId = Metrics::Get().Register("frame share", [this] { return Report(); });
+}
+
+FrameShare::~FrameShare()
+{
+    Metrics::Get().Unregister(metricsId);
+    Close();
+    for (auto &s : slots)
+    {
+        FreeSlot(s);
+        if (s.map)
+        {
+            munmap(s.map, s.size);
+        }
+        if (s.memfd >= 0)
+        {
+            close(s.memfd);
+        }
+    }
+    if (caps)
+    {
+        gst_caps_unref(caps);
+    }
+    if (pool)
+    {
+        gst_object_unref(pool);
+    }
+}
+
+bool FrameShare::Listen(const std::string &socketPath)
+{
+    fd = ListenUnixSocket(socketPath, SOCK_SEQPACKET, "frame share");
+    if (fd < 0)
+    {
+        return false;
+    }
+    path = socketPath;
+    source = g_unix_fd_add(fd, G_IO_IN, AcceptCb, this);
+    return true;
+}
+
+void FrameShare::Close()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    for (auto &c : clients)
+    {
+        g_source_remove(c.second->source);
+        close(c.second->fd);
+        for (auto frame : c.second->held)
+        {
+            Release(frame);
+        }
+    }
+    clients.clear();
+    if (source)
+    {
+        g_source_remove(source);
+        source = 0;
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+        fd = -1;
+        unlink(path.c_str());
+    }
+}
+
+gboolean FrameShare::AcceptCb(gint fd, GIOCondition condition, gpointer user_data)
+{
+    FrameShare *share = (FrameShare *) user_data;
+    int c = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+    if (c < 0)
+    {
+        return G_SOURCE_CONTINUE;
+    }
+
+    std::unique_ptr<Client> client(new Client);
+    client->fd = c;
+    client->source = g_unix_fd_add(c, (GIOCondition) (G_IO_IN | G_IO_HUP | G_IO_ERR), ReadCb, share);
+    std::lock_guard<std::mutex> guard(share->lock);
+    share->clients[c] = std::move(client);
+    return G_SOURCE_CONTINUE;
+}
+
+gboolean FrameShare::ReadCb(gint fd, GIOCondition condition, gpointer user_data)
+{
+    FrameShare *share = (FrameShare *) user_data;
+    Client *client;
+    {
+        std::lock_guard<std::mutex> guard(share->lock);
+        auto it = share->clients.find(fd);
+        if (it == share->clients.end())
+        {
+            return G_SOURCE_REMOVE;
+        }
+        client = it->second.get();
+    }
+    if (share->Read(client))
+    {
+        return G_SOURCE_CONTINUE;
+    }
+
+    /* The frames of a consumer which went away are released */
+    std::lock_guard<std::mutex> guard(share->lock);
+    for (auto frame : client->held)
+    {
+        share->Release(frame);
+    }
+    close(fd);
+    share->clients.erase(fd);
+    return G_SOURCE_REMOVE;
+}
+
+bool FrameShare::Read(Client *client)
+{
+    char buf[MAX_REQUEST_BYTES + 1];
+    ssize_t n = recv(client->fd, buf, MAX_REQUEST_BYTES, 0);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN))
+    {
+        return true;
+    }
+    if (n <= 0)
+    {
+        return false;
+    }
+    buf[n] = '\0';
+
+    json_t *request = json_loads(buf, 0, NULL);
+    json_t *release = json_object_get(request, "release");
+    bool ok = json_is_integer(release);
+    if (ok)
+    {
+        guint64 frame = (guint64) json_integer_value(release);
+        std::lock_guard<std::mutex> guard(lock);
+        if (client->held.erase(frame))
+        {
+            Release(frame);
+        }
+    }
+    if (request)
+    {
+        json_decref(request);
+    }
+    /* Anything else is a broken consumer */
+    return ok;
+}
+
+void FrameShare::Release(guint64 frame)
+{
+    for (auto &s : slots)
+    {
+        if (s.refs && s.frame == frame)
+        {
+            if (--s.refs == 0)
+            {
+                FreeSlot(s);
+            }
+            return;
+        }
+    }
+}
+
+void FrameShare::FreeSlot(Slot &slot)
+{
+    /* The memfd stays for the next frame */
+    if (slot.buf)
+    {
+        gst_buffer_unref(slot.buf);
+        slot.buf = NULL;
+    }
+}
+
+bool FrameShare::CopyToMemfd(Slot &slot, GstBuffer *buf)
+{
+    gsize size = gst_buffer_get_size(buf);
+    if (slot.memfd < 0 || slot.size != size)
+    {
+        if (slot.map)
+        {
+            munmap(slot.map, slot.size);
+            slot.map = NULL;
+        }
+        if (slot.memfd >= 0)
+        {
+            close(slot.memfd);
+        }
+        slot.size = 0;
+        slot.memfd = memfd_create("smartcam-frame", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (slot.memfd < 0)
+        {
+            return false;
+        }
+        void *map = MAP_FAILED;
+        if (ftruncate(slot.memfd, size) == 0)
+        {
+            map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, slot.memfd, 0);
+        }
+        /* A consumer can't shrink it under the mapping of the app, nor map
+         * it writable; the mapping of the app, made before, still is */
+        if (map != MAP_FAILED
+                && fcntl(slot.memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_FUTURE_WRITE | F_SEAL_SEAL) != 0)
+        {
+            munmap(map, size);
+            map = MAP_FAILED;
+        }
+        if (map == MAP_FAILED)
+        {
+            close(slot.memfd);
+            slot.memfd = -1;
+            return false;
+        }
+        slot.map = (guint8 *) map;
+        slot.size = size;
+    }
+    return gst_buffer_extract(buf, 0, slot.map, size) == size;
+}
+
+guint FrameShare::PoolSpare(GstBuffer *buf)
+{
+    if (buf->pool == pool)
+    {
+        return poolSpare;
+    }
+    gst_object_replace((GstObject **) &pool, (GstObject *) buf->pool);
+    /* Without a pool or its bound, the buffers are allocated as needed */
+    poolSpare = ringSize;
+    if (pool)
+    {
+        GstStructure *config = gst_buffer_pool_get_config(pool);
+        guint min, max;
+        if (gst_buffer_pool_config_get_params(config, NULL, NULL, &min, &max) && max)
+        {
+            poolSpare = max > min ? max - min : 0;
+        }
+        gst_structure_free(config);
+    }
+    return poolSpare;
+}
+
+guint FrameShare::HeldDmabufs() const
+{
+    guint n = 0;
+    for (const auto &s : slots)
+    {
+        if (s.buf)
+        {
+            n++;
+        }
+    }
+    return n;
+}
+
+static GstPadProbeReturn
+frame_share_probe_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+    FrameShare *share = (FrameShare *) user_data;
+    share->OnFrame(pad, GST_PAD_PROBE_INFO_BUFFER(info));
+    return GST_PAD_PROBE_OK;
+}
+
+bool FrameShare::Attach(GstElement *bin, const char *drawName, const char *probeName)
+{
+    /* The drawing kernel works in place, the consumers would see the boxes
+     * and the privacy masks being drawn into a dmabuf taken before it */
+    GstElement *elem = gst_bin_get_by_name(GST_BIN(bin), drawName);
+    const char *padName = "src";
+    if (!elem)
+    {
+        elem = gst_bin_get_by_name(GST_BIN(bin), probeName);
+        padName = "sink";
+    }
+    if (!elem)
+    {
+        g_printerr("ERROR: Element %s not found for the frame share.\n", probeName);
+        return false;
+    }
+    GstPad *pad = gst_element_get_static_pad(elem, padName);
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, frame_share_probe_cb, this, NULL);
+    gst_object_unref(pad);
+    gst_object_unref(elem);
+    return true;
+}
+
+static bool SendFrame(int sock, const std::string &msg, int frameFd)
+{
+    struct iovec iov;
+    iov.iov_base = (void *) msg.data();
+    iov.iov_len = msg.size();
+
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &frameFd, sizeof(int));
+
+    /* A full socket skips the frame for this consumer */
+    return sendmsg(sock, &hdr, MSG_DONTWAIT | MSG_NOSIGNAL) == (ssize_t) msg.size();
+}
+
+void FrameShare::OnFrame(GstPad *pad, GstBuffer *buf)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (clients.empty())
+        {
+            return;
+        }
+    }
+
+    GstCaps *cur = gst_pad_get_current_caps(pad);
+    if (!cur)
+    {
+        return;
+    }
+    if (!caps || !gst_caps_is_equal(cur, caps))
+    {
+        gst_caps_replace(&caps, cur);
+        if (!gst_video_info_from_caps(&info, caps))
+        {
+            gst_video_info_init(&info);
+        }
+    }
+    gst_caps_unref(cur);
+    if (GST_VIDEO_INFO_FORMAT(&info) != GST_VIDEO_FORMAT_NV12)
+    {
+        return;
+    }
+
+    std::vector<Detection> dets;
+    ExtractDetections(buf, dets);
+
+    std::lock_guard<std::mutex> guard(lock);
+    Slot *slot = NULL;
+    for (auto &s : slots)
+    {
+        if (!s.refs)
+        {
+            slot = &s;
+            break;
+        }
+    }
+    if (!slot)
+    {
+        skipped++;
+        return;
+    }
+
+    gsize offsets[2], strides[2];
+    GstVideoMeta *vmeta = gst_buffer_get_video_meta(buf);
+    for (guint i = 0; i < 2; i++)
+    {
+        offsets[i] = vmeta ? vmeta->offset[i] : GST_VIDEO_INFO_PLANE_OFFSET(&info, i);
+        strides[i] = vmeta ? vmeta->stride[i] : GST_VIDEO_INFO_PLANE_STRIDE(&info, i);
+    }
+
+    /* A frame in a single dmabuf is shared as it is, as long as the held
+     * ones leave the pipeline the buffers its pool was sized for; past the
+     * spare buffers of the pool, it is copied like the others */
+    int frameFd;
+    gsize size;
+    const char *memory;
+    GstMemory *mem = gst_buffer_n_memory(buf) == 1 ? gst_buffer_peek_memory(buf, 0) : NULL;
+    bool dmabuf = mem && gst_is_dmabuf_memory(mem);
+    if (dmabuf && HeldDmabufs() >= PoolSpare(buf))
+    {
+        dmabuf = false;
+        copied++;
+    }
+    if (dmabuf)
+    {
+        frameFd = gst_dmabuf_memory_get_fd(mem);
+        offsets[0] += mem->offset;
+        offsets[1] += mem->offset;
+        size = mem->offset + mem->size;
+        memory = "dmabuf";
+        slot->buf = gst_buffer_ref(buf);
+    }
+    else if (CopyToMemfd(*slot, buf))
+    {
+        frameFd = slot->memfd;
+        size = slot->size;
+        memory = "memfd";
+    }
+    else
+    {
+        skipped++;
+        return;
+    }
+    guint64 frame = ++frames;
+    slot->frame = frame;
+
+    std::ostringstream msg;
+    msg << "{\"memory\":\"" << memory << "\",\"size\":" << size
+        << ",\"width\":" << GST_VIDEO_INFO_WIDTH(&info) << ",\"height\":" << GST_VIDEO_INFO_HEIGHT(&info)
+        << ",\"format\":\"NV12\",\"offsets\":[" << offsets[0] << "," << offsets[1]
+        << "],\"strides\":[" << strides[0] << "," << strides[1] << "],"
+        << DetectionsToJson(GST_BUFFER_PTS(buf), frame, dets).substr(1);
+    std::string text = msg.str();
+
+    for (auto &c : clients)
+    {
+        Client *client = c.second.get();
+        /* One slot stays for the other consumers */
+        if (client->held.size() + 1 >= ringSize || !SendFrame(client->fd, text, frameFd))
+        {
+            lagging++;
+            continue;
+        }
+        client->held.insert(frame);
+        slot->refs++;
+    }
+    if (slot->refs)
+    {
+        shared++;
+    }
+    else
+    {
+        FreeSlot(*slot);
+    }
+}
+
+std::string FrameShare::Report()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    char line[224];
+    snprintf(line, sizeof(line), "%zu consumers, %" G_GUINT64_FORMAT " frames shared, %" G_GUINT64_FORMAT
+            " skipped for a full ring, %" G_GUINT64_FORMAT " skipped for slow consumers, %" G_GUINT64_FORMAT
+            " copied for a busy pool", clients.size(), shared, skipped, lagging, copied);
+    shared = 0;
+    skipped = 0;
+    lagging = 0;
+    copied = 0;
+    return std::string(line);
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_FRAME_SHARE_H__
+#define __SMARTCAM_FRAME_SHARE_H__
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+/*
+ * Shares the frames after the inference and the drawing, with their
+ * detections, with other processes on the board, without encoding or copying
+ * them for each one. Nothing writes into a frame after the drawing kernel, so
+ * its dmabuf can be handed out as it is.
+ *
+ * Local consumers connect to a Unix seqpacket socket. Every frame is sent to
+ * each of them as one packet, a JSON object with the layout of the NV12 frame
+ * and the detections, and the file descriptor of the frame as SCM_RIGHTS:
+ * the dmabuf of the buffer if it is in one, else a memfd the frame was copied
+ * into once, sealed against writes and resizing by the consumers. The
+ * consumer maps the fd read-only and sends {"release":<frame>} when done
+ * with it.
+ *
+ * The frames in flight are held in a bounded ring of slots, each counting the
+ * consumers which hold it; a dmabuf frame keeps its buffer, a copied frame its
+ * memfd, until the last one released it or disconnected. The dmabuf frames
+ * held at once are bounded by the spare buffers of their pool, max - min, so
+ * the consumers can't starve the capture; beyond that frames are copied. The streaming thread
+ * never waits for a consumer: a frame is skipped when no slot is free, and for
+ * a consumer which holds all but one slot or whose socket is full.
+ */
+class FrameShare
+{
+public:
+    FrameShare(guint ringSize);
+    /* Closes the consumers and removes the socket file */
+    ~FrameShare();
+
+    /* Listen on @path, false with the error printed if it is in use or
+     * can't be bound */
+    bool Listen(const std::string &path);
+    /* Disconnect the consumers and stop listening, e.g. while the stream is
+     * parked; Listen() on Path() takes them again */
+    void Close();
+    const std::string &Path() const { return path; }
+
+    /* Share the frames at the source pad of @drawName, or if there is no
+     * such element at the sink pad of @probeName */
+    bool Attach(GstElement *bin, const char *drawName, const char *probeName);
+
+    void OnFrame(GstPad *pad, GstBuffer *buf);
+
+private:
+    struct Slot
+    {
+        guint64 frame;
+        /* Consumers holding the frame */
+        guint refs;
+        /* A dmabuf frame, NULL for a copied one */
+        GstBuffer *buf;
+        int memfd;
+        guint8 *map;
+        gsize size;
+    };
+
+    struct Client
+    {
+        int fd;
+        guint source;
+        /* Frames sent and not released yet */
+        std::set<guint64> held;
+    };
+
+    static gboolean AcceptCb(gint fd, GIOCondition condition, gpointer user_data);
+    static gboolean ReadCb(gint fd, GIOCondition condition, gpointer user_data);
+
+    bool Read(Client *client);
+    /* Called with the lock held */
+    void Release(guint64 frame);
+    void FreeSlot(Slot &slot);
+    bool CopyToMemfd(Slot &slot, GstBuffer *buf);
+    /* Called from the streaming thread */
+    guint PoolSpare(GstBuffer *buf);
+    /* Called with the lock held */
+    guint HeldDmabufs() const;
+    std::string Report();
+
+    guint ringSize;
+    std::string path;
+    int fd;
+    guint source;
+
+    std::mutex lock;
+    std::vector<Slot> slots;
+    std::map<int, std::unique_ptr<Client>> clients;
+    guint64 frames;
+
+    /* Owned by the streaming thread */
+    GstCaps *caps;
+    GstVideoInfo info;
+    /* Pool of the last frame, and how many of its buffers can be held */
+    GstBufferPool *pool;
+    guint poolSpare;
+
+    guint metricsId;
+    guint64 shared;
+    guint64 skipped;
+    guint64 lagging;
+    guint64 copied;
+};
+
+#endif /* __SMARTCAM_FRAME_SHARE_H__ */
@@ -21,11 +21,14 @@
 #include <iostream>
 #include <sstream>
 #include <math.h>
+#include <algorithm>
 #include <ivas/ivas_kernel.h>
 #include <gst/ivas/gstinferencemeta.h>
 #include <chrono>
 
 #include "ivas_airender.hpp"
+#include "ivas_mask.hpp"
+#include "ivas_confwatch.h"
 
 int log_level = LOG_LEVEL_WARNING;
 
@@ -36,6 +39,18 @@ using namespace std;
 #define MAX_LABEL_LEN 1024
 #define MAX_ALLOWED_CLASS 20
 #define MAX_ALLOWED_LABELS 20
+#define DEFAULT_MASK_SIZE 16
+/* Blocks of the pixelation across the smaller side of a box, and the blur
+ * radius as that fraction of it, so big objects are masked as strongly as
+ * small ones */
+#define DEFAULT_MASK_BLOCKS 8
+
+enum mask_mode
+{
+  MASK_NONE,
+  MASK_PIXELATE,
+  MASK_BLUR
+};
 
 struct color
 {
@@ -48,6 +63,7 @@ struct ivass_xclassification
 {
   color class_color;
   char class_name[MAX_CLASS_LEN];
+  mask_mode mask;
 };
 
 struct overlayframe_info
@@ -64,7 +80,8 @@ struct overlayframe_info
 
 using Clock = std::chrono::steady_clock;
 
-struct ivas_xoverlaypriv
+/* Settings from the kernel config, replaced as a whole on a reload */
+struct render_config
 {
   float font_size;
   unsigned int font;
@@ -75,16 +92,25 @@ struct ivas_xoverlaypriv
   unsigned char label_filter_cnt;
   unsigned short classes_count;
   ivass_xclassification class_list[MAX_ALLOWED_CLASS];
+  mask_mode mask;
+  int mask_size;
+  int mask_blocks;
+  int fps_interv;
+  int log_level;
+};
+
+struct ivas_xoverlaypriv
+{
+  /* The config of the current frame */
+  render_config *cfg;
+  IvasConfWatch *watch;
   struct overlayframe_info frameinfo;
   int drawfps;
-  int fps_interv;
   double fps;
   int framecount;
   Clock::time_point startClk;
 };
 
-
-
 /* Check if the given classification is to be filtered */
 int
 ivas_classification_is_allowed (char *cls_name, ivas_xoverlaypriv * kpriv)
@@ -95,8 +121,8 @@ ivas_classification_is_allowed (char *cls_name, ivas_xoverlaypriv * kpriv)
     return -1;
 
   for (idx = 0;
-      idx < sizeof (kpriv->class_list) / sizeof (kpriv->class_list[0]); idx++) {
-    if (!strcmp (cls_name, kpriv->class_list[idx].class_name)) {
+      idx < sizeof (kpriv->cfg->class_list) / sizeof (kpriv->cfg->class_list[0]); idx++) {
+    if (!strcmp (cls_name, kpriv->cfg->class_list[idx].class_name)) {
       return idx;
     }
   }
@@ -124,11 +150,11 @@ get_label_text (GstInferenceClassification * c, ivas_xoverlaypriv * kpriv,
   if (!c->class_label || !strlen ((char *) c->class_label))
     return false;
 
-  for (idx = 0; idx < kpriv->label_filter_cnt; idx++) {
-    if (!strcmp (kpriv->label_filter[idx], "class")) {
+  for (idx = 0; idx < kpriv->cfg->label_filter_cnt; idx++) {
+    if (!strcmp (kpriv->cfg->label_filter[idx], "class")) {
       sprintf (label_string + buffIdx, "%s", (char *) c->class_label);
       buffIdx += strlen (label_string);
-    } else if (!strcmp (kpriv->label_filter[idx], "probability")) {
+    } else if (!strcmp (kpriv->cfg->label_filter[idx], "probability")) {
       sprintf (label_string + buffIdx, " : %.2f ", c->class_prob);
       buffIdx += strlen (label_string);
     }
@@ -136,6 +162,65 @@ get_label_text (GstInferenceClassification * c, ivas_xoverlaypriv * kpriv,
   return true;
 }
 
+/* Parse a "mask" config value, @def if absent */
+static mask_mode
+get_mask_mode (json_t * val, mask_mode def)
+{
+  if (!val || !json_is_string (val))
+    return def;
+  if (!strcmp (json_string_value (val), "pixelate"))
+    return MASK_PIXELATE;
+  if (!strcmp (json_string_value (val), "blur"))
+    return MASK_BLUR;
+  if (strcmp (json_string_value (val), "none"))
+    LOG_MESSAGE (LOG_LEVEL_WARNING, "unknown mask %s, using none",
+        json_string_value (val));
+  return MASK_NONE;
+}
+
+/* Anonymize the box in place, on both planes for NV12 */
+static void
+mask_region (ivas_xoverlaypriv * kpriv, mask_mode mode, int x, int y, int w,
+    int h)
+{
+  struct overlayframe_info *frameinfo = &(kpriv->frameinfo);
+  IVASFrame *frame = frameinfo->inframe;
+  /* Even coordinates, so the chroma covers the same pixels */
+  int xmin = std::max (x, 0) & ~1;
+  int ymin = std::max (y, 0) & ~1;
+  int xmax = std::min (x + w, (int) frame->props.width) & ~1;
+  int ymax = std::min (y + h, (int) frame->props.height) & ~1;
+  if (mode == MASK_NONE || xmax <= xmin || ymax <= ymin)
+    return;
+  /* "mask_size" is the least size, it grows with the box */
+  int size = std::max (kpriv->cfg->mask_size,
+      std::min (xmax - xmin, ymax - ymin) / kpriv->cfg->mask_blocks);
+
+  if (frame->props.fmt == IVAS_VFMT_Y_UV8_420) {
+    uint8_t *luma = (uint8_t *) frame->vaddr[0];
+    uint8_t *chroma = (uint8_t *) frame->vaddr[1];
+    if (mode == MASK_PIXELATE) {
+      ivas_mask_pixelate (luma, frame->props.stride, xmin, ymin,
+          xmax - xmin, ymax - ymin, 1, size);
+      ivas_mask_pixelate (chroma, frame->props.stride, xmin / 2, ymin / 2,
+          (xmax - xmin) / 2, (ymax - ymin) / 2, 2, size / 2);
+    } else {
+      ivas_mask_box_blur (luma, frame->props.stride, xmin, ymin,
+          xmax - xmin, ymax - ymin, 1, size);
+      ivas_mask_box_blur (chroma, frame->props.stride, xmin / 2, ymin / 2,
+          (xmax - xmin) / 2, (ymax - ymin) / 2, 2, size / 2);
+    }
+  } else if (frame->props.fmt == IVAS_VFMT_BGR8) {
+    uint8_t *bgr = (uint8_t *) frame->vaddr[0];
+    if (mode == MASK_PIXELATE)
+      ivas_mask_pixelate (bgr, frame->props.stride, xmin, ymin,
+          xmax - xmin, ymax - ymin, 3, size);
+    else
+      ivas_mask_box_blur (bgr, frame->props.stride, xmin, ymin,
+          xmax - xmin, ymax - ymin, 3, size);
+  }
+}
+
 static gboolean
 overlay_node_foreach (GNode * node, gpointer kpriv_ptr)
 {
@@ -147,6 +232,14 @@ overlay_node_foreach (GNode * node, gpointer kpriv_ptr)
   GstInferenceClassification *classification;
   GstInferencePrediction *prediction = (GstInferencePrediction *) node->data;
 
+  /* A classification of a detected object, e.g. from the cascade, has no box
+   * of its own: its label goes below the box of the parent */
+  auto bbox = prediction->bbox;
+  bool attribute = bbox.width < 1 && bbox.height < 1 && node->parent
+      && node->parent->parent;
+  int attribute_pos = attribute ? g_node_child_position (node->parent, node) : 0;
+  bool masked = false;
+
   /* On each children, iterate through the different associated classes */
   for (classes = prediction->classifications;
       classes; classes = g_list_next (classes)) {
@@ -154,21 +247,28 @@ overlay_node_foreach (GNode * node, gpointer kpriv_ptr)
 
     int idx = ivas_classification_is_allowed ((char *)
         classification->class_label, kpriv);
-    if (kpriv->classes_count && idx == -1)
+    if (kpriv->cfg->classes_count && idx == -1)
       continue;
 
     color clr;
-    if (kpriv->classes_count) {
+    if (kpriv->cfg->classes_count) {
       clr = {
-      kpriv->class_list[idx].class_color.blue,
-            kpriv->class_list[idx].class_color.green,
-            kpriv->class_list[idx].class_color.red};
+      kpriv->cfg->class_list[idx].class_color.blue,
+            kpriv->cfg->class_list[idx].class_color.green,
+            kpriv->cfg->class_list[idx].class_color.red};
     } else {
       /* If there are no classes specified, we will go with default blue */
       clr = {
       255, 0, 0};
     }
 
+    /* Mask before drawing, the box and label stay visible on top */
+    if (!masked && !attribute && bbox.width >= 1 && bbox.height >= 1) {
+      mask_region (kpriv, kpriv->cfg->classes_count ? kpriv->cfg->class_list[idx].mask
+          : kpriv->cfg->mask, bbox.x, bbox.y, bbox.width, bbox.height);
+      masked = true;
+    }
+
     char label_string[MAX_LABEL_LEN];
     bool label_present;
     Size textsize;
@@ -176,25 +276,33 @@ overlay_node_foreach (GNode * node, gpointer kpriv_ptr)
 
     if (label_present) {
       int baseline;
-      textsize = getTextSize (label_string, kpriv->font,
-          kpriv->font_size, 1, &baseline);
+      textsize = getTextSize (label_string, kpriv->cfg->font,
+          kpriv->cfg->font_size, 1, &baseline);
       /* Get y offset to use in case of classification model */
-      if ((prediction->bbox.height < 1) && (prediction->bbox.width < 1)) {
-        if (kpriv->y_offset) {
-          frameinfo->y_offset = kpriv->y_offset;
+      if (!attribute && (bbox.height < 1) && (bbox.width < 1)) {
+        if (kpriv->cfg->y_offset) {
+          frameinfo->y_offset = kpriv->cfg->y_offset;
         } else {
           frameinfo->y_offset = (frameinfo->inframe->props.height * 0.10);
         }
       }
     }
 
+    if (attribute) {
+      GstInferencePrediction *parent =
+          (GstInferencePrediction *) node->parent->data;
+      bbox.x = parent->bbox.x;
+      bbox.y = parent->bbox.y + parent->bbox.height +
+          (label_present ? textsize.height : 0) * (attribute_pos + 1);
+    }
+
     LOG_MESSAGE (LOG_LEVEL_INFO,
         "RESULT: (prediction node %ld) %s(%d) %d %d %d %d (%f)",
         prediction->prediction_id,
         label_present ? classification->class_label : NULL,
-        classification->class_id, prediction->bbox.x, prediction->bbox.y,
-        prediction->bbox.width + prediction->bbox.x,
-        prediction->bbox.height + prediction->bbox.y,
+        classification->class_id, bbox.x, bbox.y,
+        bbox.width + bbox.x,
+        bbox.height + bbox.y,
         classification->class_prob);
 
     /* Check whether the frame is NV12 or BGR and act accordingly */
@@ -204,21 +312,21 @@ overlay_node_foreach (GNode * node, gpointer kpriv_ptr)
       unsigned short uvScalar;
       convert_rgb_to_yuv_clrs (clr, &yScalar, &uvScalar);
       /* Draw rectangle on y an uv plane */
-      int new_xmin = floor (prediction->bbox.x / 2) * 2;
-      int new_ymin = floor (prediction->bbox.y / 2) * 2;
+      int new_xmin = floor (bbox.x / 2) * 2;
+      int new_ymin = floor (bbox.y / 2) * 2;
       int new_xmax =
-          floor ((prediction->bbox.width + prediction->bbox.x) / 2) * 2;
+          floor ((bbox.width + bbox.x) / 2) * 2;
       int new_ymax =
-          floor ((prediction->bbox.height + prediction->bbox.y) / 2) * 2;
+          floor ((bbox.height + bbox.y) / 2) * 2;
       Size test_rect (new_xmax - new_xmin, new_ymax - new_ymin);
 
-      if (!(!prediction->bbox.x && !prediction->bbox.y)) {
+      if (!attribute && !(!bbox.x && !bbox.y)) {
         rectangle (frameinfo->lumaImg, Point (new_xmin,
               new_ymin), Point (new_xmax,
-              new_ymax), Scalar (yScalar), kpriv->line_thickness, 1, 0);
+              new_ymax), Scalar (yScalar), kpriv->cfg->line_thickness, 1, 0);
         rectangle (frameinfo->chromaImg, Point (new_xmin / 2,
               new_ymin / 2), Point (new_xmax / 2,
-              new_ymax / 2), Scalar (uvScalar), kpriv->line_thickness, 1, 0);
+              new_ymax / 2), Scalar (uvScalar), kpriv->cfg->line_thickness, 1, 0);
       }
 
       if (label_present) {
@@ -233,38 +341,38 @@ overlay_node_foreach (GNode * node, gpointer kpriv_ptr)
             Scalar (uvScalar), FILLED, 1, 0);
 
         /* Draw label text on the filled rectanngle */
-        convert_rgb_to_yuv_clrs (kpriv->label_color, &yScalar, &uvScalar);
+        convert_rgb_to_yuv_clrs (kpriv->cfg->label_color, &yScalar, &uvScalar);
         putText (frameinfo->lumaImg, label_string, cv::Point (new_xmin,
-                new_ymin + frameinfo->y_offset), kpriv->font, kpriv->font_size,
+                new_ymin + frameinfo->y_offset), kpriv->cfg->font, kpriv->cfg->font_size,
             Scalar (yScalar), 1, 1);
         putText (frameinfo->chromaImg, label_string, cv::Point (new_xmin / 2,
-                new_ymin / 2 + frameinfo->y_offset / 2), kpriv->font,
-            kpriv->font_size / 2, Scalar (uvScalar), 1, 1);
+                new_ymin / 2 + frameinfo->y_offset / 2), kpriv->cfg->font,
+            kpriv->cfg->font_size / 2, Scalar (uvScalar), 1, 1);
       }
     } else if (frameinfo->inframe->props.fmt == IVAS_VFMT_BGR8) {
       LOG_MESSAGE (LOG_LEVEL_DEBUG, "Drawing rectangle for BGR image");
 
-      if (!(!prediction->bbox.x && !prediction->bbox.y)) {
+      if (!attribute && !(!bbox.x && !bbox.y)) {
         /* Draw rectangle over the dectected object */
-        rectangle (frameinfo->image, Point (prediction->bbox.x,
-              prediction->bbox.y),
-          Point (prediction->bbox.width + prediction->bbox.x,
-              prediction->bbox.height + prediction->bbox.y), Scalar (clr.blue,
-              clr.green, clr.red), kpriv->line_thickness, 1, 0);
+        rectangle (frameinfo->image, Point (bbox.x,
+              bbox.y),
+          Point (bbox.width + bbox.x,
+              bbox.height + bbox.y), Scalar (clr.blue,
+              clr.green, clr.red), kpriv->cfg->line_thickness, 1, 0);
       }
 
       if (label_present) {
         /* Draw filled rectangle for label */
-        rectangle (frameinfo->image, Rect (Point (prediction->bbox.x,
-                    prediction->bbox.y - textsize.height), textsize),
+        rectangle (frameinfo->image, Rect (Point (bbox.x,
+                    bbox.y - textsize.height), textsize),
             Scalar (clr.blue, clr.green, clr.red), FILLED, 1, 0);
 
         /* Draw label text on the filled rectanngle */
         putText (frameinfo->image, label_string,
-            cv::Point (prediction->bbox.x,
-                prediction->bbox.y + frameinfo->y_offset), kpriv->font,
-            kpriv->font_size, Scalar (kpriv->label_color.blue,
-                kpriv->label_color.green, kpriv->label_color.red), 1, 1);
+            cv::Point (bbox.x,
+                bbox.y + frameinfo->y_offset), kpriv->cfg->font,
+            kpriv->cfg->font_size, Scalar (kpriv->cfg->label_color.blue,
+                kpriv->cfg->label_color.green, kpriv->cfg->label_color.red), 1, 1);
       }
     }
   }
@@ -290,7 +398,7 @@ fps_overlay(gpointer kpriv_ptr)
   }
   else 
   {
-      if (kpriv->framecount%kpriv->fps_interv == 0)
+      if (kpriv->framecount%kpriv->cfg->fps_interv == 0)
       {
 
           Clock::time_point nowClk = Clock::now();
@@ -312,21 +420,21 @@ fps_overlay(gpointer kpriv_ptr)
           convert_rgb_to_yuv_clrs (clr, &yScalar, &uvScalar);
           {
               /* Draw label text on the filled rectanngle */
-              convert_rgb_to_yuv_clrs (kpriv->label_color, &yScalar, &uvScalar);
+              convert_rgb_to_yuv_clrs (kpriv->cfg->label_color, &yScalar, &uvScalar);
               putText (frameinfo->lumaImg, oss.str(), cv::Point (new_xmin,
-                          new_ymin), kpriv->font, kpriv->font_size,
+                          new_ymin), kpriv->cfg->font, kpriv->cfg->font_size,
                       Scalar (yScalar), 1, 1);
               putText (frameinfo->chromaImg, oss.str(), cv::Point (new_xmin / 2,
-                          new_ymin / 2), kpriv->font,
-                      kpriv->font_size / 2, Scalar (uvScalar), 1, 1);
+                          new_ymin / 2), kpriv->cfg->font,
+                      kpriv->cfg->font_size / 2, Scalar (uvScalar), 1, 1);
           }
       } else if (frameinfo->inframe->props.fmt == IVAS_VFMT_BGR8) {
           LOG_MESSAGE (LOG_LEVEL_DEBUG, "Drawing rectangle for BGR image");
           {
               /* Draw label text on the filled rectanngle */
               putText (frameinfo->image, oss.str(),
-                      cv::Point (new_xmin, new_ymin), kpriv->font,
-                      kpriv->font_size, Scalar (clr.blue,
+                      cv::Point (new_xmin, new_ymin), kpriv->cfg->font,
+                      kpriv->cfg->font_size, Scalar (clr.blue,
                           clr.green, clr.red), 1, 1);
           }
       }
@@ -336,154 +444,202 @@ fps_overlay(gpointer kpriv_ptr)
   return ;
 }
 
-extern "C"
+/* Parse the kernel config, NULL if it is invalid. Also runs on the reload
+ * thread, so it only builds the new config. */
+static void *
+parse_render_config (json_t * jconfig, void *user_data)
 {
-  int32_t xlnx_kernel_init (IVASKernel * handle)
+  render_config *cfg = (render_config *) calloc (1, sizeof (render_config));
+  json_t *val, *karray = NULL, *classes = NULL;
+
+  if (!cfg)
+    return NULL;
+
+  val = json_object_get (jconfig, "fps_interval");
+  if (!val || !json_is_integer (val) || json_integer_value (val) < 1)
+      cfg->fps_interv = 1;
+  else
+      cfg->fps_interv = json_integer_value (val);
+
+  val = json_object_get (jconfig, "debug_level");
+  if (!val || !json_is_integer (val))
+      cfg->log_level = LOG_LEVEL_WARNING;
+  else
+      cfg->log_level = json_integer_value (val);
+
+  val = json_object_get (jconfig, "font_size");
+  if (!val || !json_is_integer (val))
+      cfg->font_size = 0.5;
+  else
+      cfg->font_size = json_integer_value (val);
+
+  val = json_object_get (jconfig, "font");
+  if (!val || !json_is_integer (val))
+      cfg->font = 0;
+  else
+      cfg->font = json_integer_value (val);
+
+  val = json_object_get (jconfig, "thickness");
+  if (!val || !json_is_integer (val))
+      cfg->line_thickness = 1;
+  else
+      cfg->line_thickness = json_integer_value (val);
+
+  val = json_object_get (jconfig, "y_offset");
+  if (!val || !json_is_integer (val))
+      cfg->y_offset = 0;
+  else
+      cfg->y_offset = json_integer_value (val);
+
+  /* Default privacy mask of all classes: none, pixelate or blur */
+  cfg->mask = get_mask_mode (json_object_get (jconfig, "mask"), MASK_NONE);
+
+  val = json_object_get (jconfig, "mask_size");
+  if (!val || !json_is_integer (val))
+      cfg->mask_size = DEFAULT_MASK_SIZE;
+  else
+      cfg->mask_size = json_integer_value (val);
+
+  val = json_object_get (jconfig, "mask_blocks");
+  if (!val || !json_is_integer (val) || json_integer_value (val) < 1)
+      cfg->mask_blocks = DEFAULT_MASK_BLOCKS;
+  else
+      cfg->mask_blocks = json_integer_value (val);
+
+  /* get label color array */
+  karray = json_object_get (jconfig, "label_color");
+  if (!karray)
   {
-    LOG_MESSAGE (LOG_LEVEL_DEBUG, "enter");
+    LOG_MESSAGE (LOG_LEVEL_ERROR, "failed to find label_color");
+    goto error;
+  } else
+  {
+    cfg->label_color.blue =
+        json_integer_value (json_object_get (karray, "blue"));
+    cfg->label_color.green =
+        json_integer_value (json_object_get (karray, "green"));
+    cfg->label_color.red =
+        json_integer_value (json_object_get (karray, "red"));
+  }
 
-    ivas_xoverlaypriv *kpriv =
-        (ivas_xoverlaypriv *) calloc (1, sizeof (ivas_xoverlaypriv));
+  karray = json_object_get (jconfig, "label_filter");
 
-    json_t *jconfig = handle->kernel_config;
-    json_t *val, *karray = NULL, *classes = NULL;
-
-    /* Initialize config params with default values */
-    log_level = LOG_LEVEL_WARNING;
-    kpriv->font_size = 0.5;
-    kpriv->font = 0;
-    kpriv->line_thickness = 1;
-    kpriv->y_offset = 0;
-    kpriv->label_color = {0, 0, 0};
-    strcpy(kpriv->label_filter[0], "class");
-    strcpy(kpriv->label_filter[1], "probability");
-    kpriv->label_filter_cnt = 2;
-    kpriv->classes_count = 0;
-    kpriv->framecount = 0;
+  if (!json_is_array (karray)) {
+    LOG_MESSAGE (LOG_LEVEL_ERROR, "label_filter not found in the config\n");
+    goto error;
+  }
+  cfg->label_filter_cnt = 0;
+  for (unsigned int index = 0; index < json_array_size (karray)
+      && cfg->label_filter_cnt < MAX_ALLOWED_LABELS; index++) {
+    val = json_array_get (karray, index);
+    if (!json_is_string (val))
+      continue;
+    strncpy (cfg->label_filter[cfg->label_filter_cnt],
+        json_string_value (val), MAX_LABEL_LEN - 1);
+    cfg->label_filter_cnt++;
+  }
 
-    char* env = getenv("SMARTCAM_SCREENFPS");
-    if (env)
-    {
-        kpriv->drawfps = 1;
+  /* get classes array */
+  karray = json_object_get (jconfig, "classes");
+  if (!karray) {
+    LOG_MESSAGE (LOG_LEVEL_ERROR, "failed to find key labels");
+    goto error;
+  }
+
+  if (!json_is_array (karray)) {
+    LOG_MESSAGE (LOG_LEVEL_ERROR, "labels key is not of array type");
+    goto error;
+  }
+  if (json_array_size (karray) > MAX_ALLOWED_CLASS) {
+    LOG_MESSAGE (LOG_LEVEL_ERROR, "more than %d classes", MAX_ALLOWED_CLASS);
+    goto error;
+  }
+  cfg->classes_count = json_array_size (karray);
+  for (unsigned int index = 0; index < cfg->classes_count; index++) {
+    classes = json_array_get (karray, index);
+    if (!classes) {
+      LOG_MESSAGE (LOG_LEVEL_ERROR, "failed to get class object");
+      goto error;
     }
-    else
-    {
-        kpriv->drawfps = 0;
+
+    val = json_object_get (classes, "name");
+    if (!json_is_string (val)) {
+      LOG_MESSAGE (LOG_LEVEL_ERROR, "name is not found for array %d", index);
+      goto error;
+    } else {
+      strncpy (cfg->class_list[index].class_name,
+          (char *) json_string_value (val), MAX_CLASS_LEN - 1);
+      LOG_MESSAGE (LOG_LEVEL_DEBUG, "name %s",
+          cfg->class_list[index].class_name);
     }
 
-    val = json_object_get (jconfig, "fps_interval");
+    val = json_object_get (classes, "green");
     if (!val || !json_is_integer (val))
-        kpriv->fps_interv = 1;
+      cfg->class_list[index].class_color.green = 0;
     else
-        kpriv->fps_interv = json_integer_value (val);
+      cfg->class_list[index].class_color.green = json_integer_value (val);
 
-    val = json_object_get (jconfig, "debug_level");
+    val = json_object_get (classes, "blue");
     if (!val || !json_is_integer (val))
-        log_level = LOG_LEVEL_WARNING;
+      cfg->class_list[index].class_color.blue = 0;
     else
-        log_level = json_integer_value (val);
+      cfg->class_list[index].class_color.blue = json_integer_value (val);
 
-      val = json_object_get (jconfig, "font_size");
+    val = json_object_get (classes, "red");
     if (!val || !json_is_integer (val))
-        kpriv->font_size = 0.5;
+      cfg->class_list[index].class_color.red = 0;
     else
-        kpriv->font_size = json_integer_value (val);
+      cfg->class_list[index].class_color.red = json_integer_value (val);
 
-      val = json_object_get (jconfig, "font");
-    if (!val || !json_is_integer (val))
-        kpriv->font = 0;
-    else
-        kpriv->font = json_integer_value (val);
+    cfg->class_list[index].mask =
+        get_mask_mode (json_object_get (classes, "mask"), cfg->mask);
+  }
+  return cfg;
 
-      val = json_object_get (jconfig, "thickness");
-    if (!val || !json_is_integer (val))
-        kpriv->line_thickness = 1;
-    else
-        kpriv->line_thickness = json_integer_value (val);
+error:
+  free (cfg);
+  return NULL;
+}
 
-      val = json_object_get (jconfig, "y_offset");
-    if (!val || !json_is_integer (val))
-        kpriv->y_offset = 0;
-    else
-        kpriv->y_offset = json_integer_value (val);
+static void
+free_render_config (void *cfg, void *user_data)
+{
+  free (cfg);
+}
 
-    /* get label color array */
-      karray = json_object_get (jconfig, "label_color");
-    if (!karray)
-    {
-      LOG_MESSAGE (LOG_LEVEL_ERROR, "failed to find label_color");
-      return -1;
-    } else
-    {
-      kpriv->label_color.blue =
-          json_integer_value (json_object_get (karray, "blue"));
-      kpriv->label_color.green =
-          json_integer_value (json_object_get (karray, "green"));
-      kpriv->label_color.red =
-          json_integer_value (json_object_get (karray, "red"));
-    }
+extern "C"
+{
+  int32_t xlnx_kernel_init (IVASKernel * handle)
+  {
+    LOG_MESSAGE (LOG_LEVEL_DEBUG, "enter");
 
-    karray = json_object_get (jconfig, "label_filter");
+    ivas_xoverlaypriv *kpriv =
+        (ivas_xoverlaypriv *) calloc (1, sizeof (ivas_xoverlaypriv));
 
-    if (!json_is_array (karray)) {
-      LOG_MESSAGE (LOG_LEVEL_ERROR, "label_filter not found in the config\n");
-      return -1;
+    kpriv->framecount = 0;
+
+    char* env = getenv("SMARTCAM_SCREENFPS");
+    if (env)
+    {
+        kpriv->drawfps = 1;
     }
-    kpriv->label_filter_cnt = 0;
-    for (unsigned int index = 0; index < json_array_size (karray); index++) {
-      strcpy (kpriv->label_filter[index],
-          json_string_value (json_array_get (karray, index)));
-      kpriv->label_filter_cnt++;
+    else
+    {
+        kpriv->drawfps = 0;
     }
 
-    /* get classes array */
-    karray = json_object_get (jconfig, "classes");
-    if (!karray) {
-      LOG_MESSAGE (LOG_LEVEL_ERROR, "failed to find key labels");
+    kpriv->cfg = (render_config *) parse_render_config (handle->kernel_config,
+        NULL);
+    if (!kpriv->cfg) {
+      free (kpriv);
       return -1;
     }
+    log_level = kpriv->cfg->log_level;
 
-    if (!json_is_array (karray)) {
-      LOG_MESSAGE (LOG_LEVEL_ERROR, "labels key is not of array type");
-      return -1;
-    }
-    kpriv->classes_count = json_array_size (karray);
-    for (unsigned int index = 0; index < kpriv->classes_count; index++) {
-      classes = json_array_get (karray, index);
-      if (!classes) {
-        LOG_MESSAGE (LOG_LEVEL_ERROR, "failed to get class object");
-        return -1;
-      }
-
-      val = json_object_get (classes, "name");
-      if (!json_is_string (val)) {
-        LOG_MESSAGE (LOG_LEVEL_ERROR, "name is not found for array %d", index);
-        return -1;
-      } else {
-        strncpy (kpriv->class_list[index].class_name,
-            (char *) json_string_value (val), MAX_CLASS_LEN - 1);
-        LOG_MESSAGE (LOG_LEVEL_DEBUG, "name %s",
-            kpriv->class_list[index].class_name);
-      }
-
-      val = json_object_get (classes, "green");
-      if (!val || !json_is_integer (val))
-        kpriv->class_list[index].class_color.green = 0;
-      else
-        kpriv->class_list[index].class_color.green = json_integer_value (val);
-
-      val = json_object_get (classes, "blue");
-      if (!val || !json_is_integer (val))
-        kpriv->class_list[index].class_color.blue = 0;
-      else
-        kpriv->class_list[index].class_color.blue = json_integer_value (val);
-
-      val = json_object_get (classes, "red");
-      if (!val || !json_is_integer (val))
-        kpriv->class_list[index].class_color.red = 0;
-      else
-        kpriv->class_list[index].class_color.red = json_integer_value (val);
-    }
+    /* Picks up changes of the file named by "config_file" */
+    kpriv->watch = ivas_confwatch_new (handle->kernel_config,
+        "libivas_airender.so", kpriv->cfg, parse_render_config,
+        free_render_config, NULL);
 
     handle->kernel_priv = (void *) kpriv;
     return 0;
@@ -494,8 +650,13 @@ extern "C"
     LOG_MESSAGE (LOG_LEVEL_DEBUG, "enter");
     ivas_xoverlaypriv *kpriv = (ivas_xoverlaypriv *) handle->kernel_priv;
 
-    if (kpriv)
+    if (kpriv) {
+      if (kpriv->watch)
+        ivas_confwatch_free (kpriv->watch);
+      else
+        free (kpriv->cfg);
       free (kpriv);
+    }
 
     return 0;
   }
@@ -509,6 +670,10 @@ extern "C"
     char *pstr;
 
     ivas_xoverlaypriv *kpriv = (ivas_xoverlaypriv *) handle->kernel_priv;
+    if (kpriv->watch) {
+      kpriv->cfg = (render_config *) ivas_confwatch_get (kpriv->watch);
+      log_level = kpriv->cfg->log_level;
+    }
     struct overlayframe_info *frameinfo = &(kpriv->frameinfo);
     frameinfo->y_offset = 0;
     frameinfo->inframe = input[0];
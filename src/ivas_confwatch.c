@@ -0,0 +1,227 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "ivas_confwatch.h"
+
+/* Editors write a file in several steps, reload once it was left alone this long */
+#define SETTLE_MS 200
+/* Poll interval while the streaming thread may still use a replaced state */
+#define RETIRE_POLL_MS 10
+
+struct _IvasConfWatch
+{
+  char *path;
+  char *name;
+  char *library_name;
+  IvasConfParseFunc parse;
+  IvasConfFreeFunc free_state;
+  void *user_data;
+
+  _Atomic (void *) current;
+  /* Bumped on every swap; the streaming thread copies it at each frame */
+  atomic_ulong epoch;
+  atomic_ulong reader_epoch;
+
+  int inotify_fd;
+  int stop_fd[2];
+  int running;
+  pthread_t thread;
+};
+
+void *
+ivas_confwatch_get (IvasConfWatch * watch)
+{
+  /* Done with whatever the previous frame used */
+  atomic_store (&watch->reader_epoch, atomic_load (&watch->epoch));
+  return atomic_load (&watch->current);
+}
+
+static json_t *
+find_kernel_config (json_t * root, const char *library_name)
+{
+  json_t *kernels = json_object_get (root, "kernels");
+  size_t i;
+
+  for (i = 0; i < json_array_size (kernels); i++) {
+    json_t *kernel = json_array_get (kernels, i);
+    json_t *lib = json_object_get (kernel, "library-name");
+    if (json_is_string (lib) && !strcmp (json_string_value (lib), library_name))
+      return json_object_get (kernel, "config");
+  }
+  return NULL;
+}
+
+static void
+confwatch_reload (IvasConfWatch * watch)
+{
+  json_error_t error;
+  json_t *root, *config;
+  void *state, *old;
+  unsigned long epoch;
+
+  root = json_load_file (watch->path, 0, &error);
+  if (!root) {
+    printf ("WARNING: %s: can't load %s: %s, line %d, keeping the current config\n",
+        watch->library_name, watch->path, error.text, error.line);
+    return;
+  }
+  config = find_kernel_config (root, watch->library_name);
+  state = config ? watch->parse (config, watch->user_data) : NULL;
+  json_decref (root);
+  if (!state) {
+    printf ("WARNING: %s: invalid config in %s, keeping the current one\n",
+        watch->library_name, watch->path);
+    return;
+  }
+
+  old = atomic_exchange (&watch->current, state);
+  epoch = atomic_fetch_add (&watch->epoch, 1) + 1;
+  printf ("INFO: %s: reloaded %s\n", watch->library_name, watch->path);
+
+  /* Once the streaming thread came for a state after the swap, it can only
+   * have got the new one. Stopping means it is done anyway. */
+  while (atomic_load (&watch->reader_epoch) < epoch) {
+    struct pollfd stop = { watch->stop_fd[0], POLLIN, 0 };
+    if (poll (&stop, 1, RETIRE_POLL_MS) > 0)
+      break;
+  }
+  watch->free_state (old, watch->user_data);
+}
+
+static void *
+confwatch_thread (void *data)
+{
+  IvasConfWatch *watch = (IvasConfWatch *) data;
+  char events[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  struct pollfd fds[2] = {
+    { watch->stop_fd[0], POLLIN, 0 },
+    { watch->inotify_fd, POLLIN, 0 }
+  };
+  int pending = 0;
+
+  while (1) {
+    int ret = poll (fds, 2, pending ? SETTLE_MS : -1);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret < 0 || fds[0].revents)
+      break;
+    if (ret == 0) {
+      pending = 0;
+      confwatch_reload (watch);
+      continue;
+    }
+
+    ssize_t len = read (watch->inotify_fd, events, sizeof (events));
+    char *p = events;
+    while (len > 0 && p < events + len) {
+      struct inotify_event *ev = (struct inotify_event *) p;
+      if (ev->len && !strcmp (ev->name, watch->name))
+        pending = 1;
+      p += sizeof (struct inotify_event) + ev->len;
+    }
+  }
+  return NULL;
+}
+
+IvasConfWatch *
+ivas_confwatch_new (json_t * kernel_config, const char *library_name,
+    void *state, IvasConfParseFunc parse, IvasConfFreeFunc free_state,
+    void *user_data)
+{
+  IvasConfWatch *watch = (IvasConfWatch *) calloc (1, sizeof (IvasConfWatch));
+  json_t *val = json_object_get (kernel_config, "config_file");
+  char *dir, *slash;
+
+  if (!watch)
+    return NULL;
+  watch->library_name = strdup (library_name);
+  watch->parse = parse;
+  watch->free_state = free_state;
+  watch->user_data = user_data;
+  atomic_init (&watch->current, state);
+  atomic_init (&watch->epoch, 0);
+  atomic_init (&watch->reader_epoch, 0);
+  watch->inotify_fd = -1;
+  watch->stop_fd[0] = watch->stop_fd[1] = -1;
+
+  if (!json_is_string (val))
+    return watch;
+
+  /* Editors replace the file rather than writing it, so the directory is
+   * watched for the name */
+  watch->path = strdup (json_string_value (val));
+  slash = strrchr (watch->path, '/');
+  watch->name = strdup (slash ? slash + 1 : watch->path);
+  if (!slash)
+    dir = strdup (".");
+  else if (slash == watch->path)
+    dir = strdup ("/");
+  else
+    dir = strndup (watch->path, slash - watch->path);
+
+  watch->inotify_fd = inotify_init1 (IN_CLOEXEC);
+  if (watch->inotify_fd < 0
+      || inotify_add_watch (watch->inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0
+      || pipe2 (watch->stop_fd, O_CLOEXEC) != 0
+      || pthread_create (&watch->thread, NULL, confwatch_thread, watch) != 0) {
+    printf ("WARNING: %s: can't watch %s: %s\n", library_name, watch->path,
+        strerror (errno));
+  } else {
+    watch->running = 1;
+    printf ("INFO: %s: watching %s for changes\n", library_name, watch->path);
+  }
+  free (dir);
+  return watch;
+}
+
+void
+ivas_confwatch_free (IvasConfWatch * watch)
+{
+  void *state;
+
+  if (!watch)
+    return;
+  if (watch->running) {
+    if (write (watch->stop_fd[1], "", 1) == 1)
+      pthread_join (watch->thread, NULL);
+  }
+  if (watch->inotify_fd >= 0)
+    close (watch->inotify_fd);
+  if (watch->stop_fd[0] >= 0) {
+    close (watch->stop_fd[0]);
+    close (watch->stop_fd[1]);
+  }
+
+  state = atomic_load (&watch->current);
+  if (state)
+    watch->free_state (state, watch->user_data);
+  free (watch->path);
+  free (watch->name);
+  free (watch->library_name);
+  free (watch);
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __IVAS_CONFWATCH_H__
+#define __IVAS_CONFWATCH_H__
+
+#include <jansson.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Hot reload of the config of an IVAS kernel library.
+ *
+ * If the kernel config names its JSON file with "config_file", a thread
+ * watches the file with inotify. When it was written or replaced, the file is
+ * loaded on that thread, the "config" of the kernel with the given library
+ * name is parsed into a new private state and swapped in as the current one.
+ *
+ * The streaming thread gets the current state once per frame, lock free. The
+ * state it got for the previous frame is only freed after it came for the
+ * next one, like RCU with the start of a frame as the quiescent point, so a
+ * frame is always processed with one complete config. An invalid file leaves
+ * the current state in place.
+ */
+
+typedef struct _IvasConfWatch IvasConfWatch;
+
+/* Returns a new state from a "config" object, NULL if it is invalid */
+typedef void *(*IvasConfParseFunc) (json_t * config, void *user_data);
+typedef void (*IvasConfFreeFunc) (void *state, void *user_data);
+
+/* Takes @state as the current state, from the config the kernel started with */
+IvasConfWatch *ivas_confwatch_new (json_t * kernel_config,
+    const char *library_name, void *state, IvasConfParseFunc parse,
+    IvasConfFreeFunc free_state, void *user_data);
+
+/* The current state, call once at the start of every frame, from the one
+ * streaming thread of the kernel */
+void *ivas_confwatch_get (IvasConfWatch * watch);
+
+/* Stops watching and frees the states */
+void ivas_confwatch_free (IvasConfWatch * watch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __IVAS_CONFWATCH_H__ */
@@ -0,0 +1,172 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "ivas_mask.hpp"
+
+/* The vertical passes run over the bytes of a row with no dependency between
+ * them, written so the compiler vectorizes them with NEON. The horizontal
+ * running sum of the blur carries from pixel to pixel and stays scalar, with
+ * the channels of a pixel summed side by side. */
+
+/* Mask sizes grow with the object, up to these */
+#define MAX_MASK_BLOCK 256
+#define MAX_MASK_RADIUS 128
+
+void
+ivas_mask_pixelate (uint8_t * plane, int stride, int x, int y, int w, int h,
+    int ch, int block)
+{
+  block = std::min (std::max (block, 2), MAX_MASK_BLOCK);
+  if (w <= 0 || h <= 0)
+    return;
+
+  int row_bytes = w * ch;
+  /* A block of up to 256 rows of 255 fits into 16 bits */
+  std::vector < uint16_t > col_sum (row_bytes);
+  uint16_t *__restrict sum = col_sum.data ();
+
+  for (int by = 0; by < h; by += block) {
+    int bh = std::min (block, h - by);
+    uint8_t *band = plane + (size_t) (y + by) * stride + x * ch;
+
+    /* Vertical sums of the band, a row at a time */
+    memset (sum, 0, row_bytes * sizeof (uint16_t));
+    for (int j = 0; j < bh; j++) {
+      const uint8_t *__restrict row = band + (size_t) j * stride;
+      for (int k = 0; k < row_bytes; k++)
+        sum[k] += row[k];
+    }
+
+    for (int bx = 0; bx < w; bx += block) {
+      int bw = std::min (block, w - bx);
+      uint8_t value[4];
+      for (int c = 0; c < ch; c++) {
+        uint32_t total = 0;
+        for (int i = 0; i < bw; i++)
+          total += sum[(bx + i) * ch + c];
+        value[c] = (total + bw * bh / 2) / (bw * bh);
+      }
+
+      for (int j = 0; j < bh; j++) {
+        uint8_t *__restrict dst = band + (size_t) j * stride + bx * ch;
+        if (ch == 1) {
+          memset (dst, value[0], bw);
+        } else {
+          for (int i = 0; i < bw; i++)
+            for (int c = 0; c < ch; c++)
+              dst[i * ch + c] = value[c];
+        }
+      }
+    }
+  }
+}
+
+/* Horizontal running sums over padded rows, with the channel count known
+ * at compile time so the sums stay in registers */
+template < int CH > static void
+blur_rows (const uint8_t * tmp, int tmp_stride, uint8_t * base, int stride,
+    int w, int h, int taps, uint32_t inv)
+{
+  for (int j = 0; j < h; j++) {
+    const uint8_t *__restrict src = tmp + (size_t) j * tmp_stride;
+    uint8_t *__restrict dst = base + (size_t) j * stride;
+    uint32_t acc[CH] = { 0 };
+    for (int i = 0; i < taps; i++)
+      for (int c = 0; c < CH; c++)
+        acc[c] += src[i * CH + c];
+    for (int c = 0; c < CH; c++)
+      dst[c] = (acc[c] * inv + 32768) >> 16;
+    for (int i = 1; i < w; i++) {
+      for (int c = 0; c < CH; c++) {
+        int k = i * CH + c;
+        acc[c] += src[k + (taps - 1) * CH] - src[k - CH];
+        dst[k] = (acc[c] * inv + 32768) >> 16;
+      }
+    }
+  }
+}
+
+void
+ivas_mask_box_blur (uint8_t * plane, int stride, int x, int y, int w, int h,
+    int ch, int radius)
+{
+  radius = std::min (std::max (radius, 1), MAX_MASK_RADIUS);
+  if (w <= 0 || h <= 0 || ch > 4)
+    return;
+
+  int row_bytes = w * ch;
+  int taps = 2 * radius + 1;
+  /* Division by the tap count as a 16 bit fixed point multiplication */
+  uint32_t inv = (65536 + taps / 2) / taps;
+  uint8_t *base = plane + (size_t) y * stride + x * ch;
+
+  /* The rows of tmp have @radius pixels of padding on both sides */
+  int pad_bytes = radius * ch;
+  int tmp_stride = row_bytes + 2 * pad_bytes;
+  static thread_local std::vector < uint8_t > tmp_buf;
+  static thread_local std::vector < uint32_t > sum_buf;
+  tmp_buf.resize ((size_t) tmp_stride * h);
+  sum_buf.resize (row_bytes);
+  uint8_t *__restrict tmp = tmp_buf.data ();
+  uint32_t *__restrict sum = sum_buf.data ();
+
+  /* Vertical pass into tmp, the edge rows are repeated */
+  memset (sum, 0, row_bytes * sizeof (uint32_t));
+  for (int j = -radius; j <= radius; j++) {
+    const uint8_t *__restrict row =
+        base + (size_t) std::min (std::max (j, 0), h - 1) * stride;
+    for (int k = 0; k < row_bytes; k++)
+      sum[k] += row[k];
+  }
+  for (int j = 0; j < h; j++) {
+    uint8_t *__restrict out = tmp + (size_t) j * tmp_stride + pad_bytes;
+    for (int k = 0; k < row_bytes; k++)
+      out[k] = (sum[k] * inv + 32768) >> 16;
+
+    const uint8_t *__restrict add =
+        base + (size_t) std::min (j + radius + 1, h - 1) * stride;
+    const uint8_t *__restrict sub =
+        base + (size_t) std::max (j - radius, 0) * stride;
+    for (int k = 0; k < row_bytes; k++)
+      sum[k] += add[k] - sub[k];
+
+    /* Repeat the edge pixels into the padding */
+    for (int i = 1; i <= radius; i++) {
+      memcpy (out - i * ch, out, ch);
+      memcpy (out + row_bytes - ch + i * ch, out + row_bytes - ch, ch);
+    }
+  }
+
+  /* Horizontal pass back into the plane */
+  switch (ch) {
+    case 1:
+      blur_rows < 1 > (tmp, tmp_stride, base, stride, w, h, taps, inv);
+      break;
+    case 2:
+      blur_rows < 2 > (tmp, tmp_stride, base, stride, w, h, taps, inv);
+      break;
+    case 3:
+      blur_rows < 3 > (tmp, tmp_stride, base, stride, w, h, taps, inv);
+      break;
+    default:
+      blur_rows < 4 > (tmp, tmp_stride, base, stride, w, h, taps, inv);
+      break;
+  }
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __IVAS_MASK_H__
+#define __IVAS_MASK_H__
+
+#include <stdint.h>
+
+/* Privacy masks, applied in place to the region @x, @y, @w x @h of an 8 bit
+ * plane with @ch interleaved channels, e.g. 1 for the Y and 2 for the UV
+ * plane of NV12, 3 for BGR. @x and @w count pixels, @stride bytes. */
+
+/* Replace each @block x @block tile with its average */
+void ivas_mask_pixelate (uint8_t * plane, int stride, int x, int y, int w,
+    int h, int ch, int block);
+
+/* Box blur with a square kernel of 2 * @radius + 1, run as a vertical and a
+ * horizontal pass of running sums, so the cost doesn't depend on @radius */
+void ivas_mask_box_blur (uint8_t * plane, int stride, int x, int y, int w,
+    int h, int ch, int radius);
+
+#endif /* __IVAS_MASK_H__ */
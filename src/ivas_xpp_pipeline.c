@@ -15,10 +15,15 @@
  */
 
 #include <ivas/ivas_kernel.h>
+#include <gst/video/gstvideometa.h>
 #include <stdio.h>
 #include <unistd.h>
 
-typedef struct _kern_priv
+#include "xpp_roi.h"
+#include "ivas_confwatch.h"
+
+/* Normalization from the kernel config, replaced as a whole on a reload */
+typedef struct _xpp_params
 {
     float mean_r;
     float mean_g;
@@ -27,6 +32,13 @@ typedef struct _kern_priv
     float scale_g;
     float scale_b;
     IVASFrame *params;
+} XppParams;
+
+typedef struct _kern_priv
+{
+    /* The params of the current frame */
+    XppParams *cur;
+    IvasConfWatch *watch;
 } ResizeKernelPriv;
 
 int32_t
@@ -35,105 +47,198 @@ int32_t xlnx_kernel_done(IVASKernel *handle);
 int32_t xlnx_kernel_init(IVASKernel *handle);
 uint32_t xlnx_kernel_deinit(IVASKernel *handle);
 
-uint32_t xlnx_kernel_deinit(IVASKernel *handle)
+static void free_params(void *state, void *user_data)
 {
-    ResizeKernelPriv *kernel_priv;
-    kernel_priv = (ResizeKernelPriv *)handle->kernel_priv;
-    ivas_free_buffer (handle, kernel_priv->params);
-    free(kernel_priv);
-    return 0;
+    IVASKernel *handle = (IVASKernel *)user_data;
+    XppParams *xp = (XppParams *)state;
+    ivas_free_buffer (handle, xp->params);
+    free(xp);
 }
 
-int32_t xlnx_kernel_init(IVASKernel *handle)
+/* Also runs on the reload thread, the accelerator keeps reading the buffer of
+ * the current params until the next frame */
+static void *parse_params(json_t *jconfig, void *user_data)
 {
-    json_t *jconfig = handle->kernel_config;
-    json_t *val; /* kernel config from app */
-    ResizeKernelPriv *kernel_priv;
-    float *pPtr; 
+    IVASKernel *handle = (IVASKernel *)user_data;
+    json_t *val;
+    XppParams *xp;
+    float *pPtr;
 
-    kernel_priv = (ResizeKernelPriv *)calloc(1, sizeof(ResizeKernelPriv));
-    if (!kernel_priv) {
+    xp = (XppParams *)calloc(1, sizeof(XppParams));
+    if (!xp) {
         printf("Error: Unable to allocate resize kernel memory\n");
+        return NULL;
     }
 
     /* parse config */
     val = json_object_get(jconfig, "mean_r");
     if (!val || !json_is_number(val))
-        kernel_priv->mean_r = 0;
+        xp->mean_r = 0;
     else {
-        kernel_priv->mean_r = json_number_value(val);
+        xp->mean_r = json_number_value(val);
     }
-    printf("Resize: mean_r=%f\n", kernel_priv->mean_r);
+    printf("Resize: mean_r=%f\n", xp->mean_r);
 
     val = json_object_get(jconfig, "mean_g");
     if (!val || !json_is_number(val))
-        kernel_priv->mean_g = 0;
+        xp->mean_g = 0;
     else {
-        kernel_priv->mean_g = json_number_value(val);
+        xp->mean_g = json_number_value(val);
     }
-    printf("Resize: mean_g=%f\n", kernel_priv->mean_g);
+    printf("Resize: mean_g=%f\n", xp->mean_g);
 
     val = json_object_get(jconfig, "mean_b");
     if (!val || !json_is_number(val))
-        kernel_priv->mean_b = 0;
+        xp->mean_b = 0;
     else {
-        kernel_priv->mean_b = json_number_value(val);
+        xp->mean_b = json_number_value(val);
     }
-    printf("Resize: mean_b=%f\n", kernel_priv->mean_b);
+    printf("Resize: mean_b=%f\n", xp->mean_b);
 
     /* parse config */
     val = json_object_get(jconfig, "scale_r");
     if (!val || !json_is_number(val))
-	kernel_priv->scale_r = 1;
+	xp->scale_r = 1;
     else
-	kernel_priv->scale_r = json_number_value(val);
-    printf("Resize: scale_r=%f\n", kernel_priv->scale_r);
+	xp->scale_r = json_number_value(val);
+    printf("Resize: scale_r=%f\n", xp->scale_r);
 
     val = json_object_get(jconfig, "scale_g");
     if (!val || !json_is_number(val))
-	kernel_priv->scale_g = 1;
+	xp->scale_g = 1;
     else
-	kernel_priv->scale_g = json_number_value(val);
-    printf("Resize: scale_g=%f\n", kernel_priv->scale_g);
+	xp->scale_g = json_number_value(val);
+    printf("Resize: scale_g=%f\n", xp->scale_g);
 
     val = json_object_get(jconfig, "scale_b");
     if (!val || !json_is_number(val))
-	kernel_priv->scale_b = 1;
+	xp->scale_b = 1;
     else
-	kernel_priv->scale_b = json_number_value(val);
-    printf("Resize: scale_b=%f\n", kernel_priv->scale_b);
-
-    kernel_priv->params = ivas_alloc_buffer (handle, 6*(sizeof(float)), IVAS_INTERNAL_MEMORY, NULL);
-    pPtr = kernel_priv->params->vaddr[0];
-    pPtr[0] = (float)kernel_priv->mean_r;  
-    pPtr[1] = (float)kernel_priv->mean_g;  
-    pPtr[2] = (float)kernel_priv->mean_b;  
-    pPtr[3] = (float)kernel_priv->scale_r;  
-    pPtr[4] = (float)kernel_priv->scale_g;  
-    pPtr[5] = (float)kernel_priv->scale_b;  
+	xp->scale_b = json_number_value(val);
+    printf("Resize: scale_b=%f\n", xp->scale_b);
+
+    xp->params = ivas_alloc_buffer (handle, 6*(sizeof(float)), IVAS_INTERNAL_MEMORY, NULL);
+    if (!xp->params) {
+        printf("Error: Unable to allocate the resize params buffer\n");
+        free(xp);
+        return NULL;
+    }
+    pPtr = xp->params->vaddr[0];
+    pPtr[0] = (float)xp->mean_r;  
+    pPtr[1] = (float)xp->mean_g;  
+    pPtr[2] = (float)xp->mean_b;  
+    pPtr[3] = (float)xp->scale_r;  
+    pPtr[4] = (float)xp->scale_g;  
+    pPtr[5] = (float)xp->scale_b;  
+
+    return xp;
+}
+
+uint32_t xlnx_kernel_deinit(IVASKernel *handle)
+{
+    ResizeKernelPriv *kernel_priv;
+    kernel_priv = (ResizeKernelPriv *)handle->kernel_priv;
+    if (kernel_priv->watch)
+        ivas_confwatch_free(kernel_priv->watch);
+    else
+        free_params(kernel_priv->cur, handle);
+    free(kernel_priv);
+    return 0;
+}
+
+int32_t xlnx_kernel_init(IVASKernel *handle)
+{
+    ResizeKernelPriv *kernel_priv;
+
+    kernel_priv = (ResizeKernelPriv *)calloc(1, sizeof(ResizeKernelPriv));
+    if (!kernel_priv) {
+        printf("Error: Unable to allocate resize kernel memory\n");
+        return -1;
+    }
+
+    kernel_priv->cur = parse_params(handle->kernel_config, handle);
+    if (!kernel_priv->cur) {
+        free(kernel_priv);
+        return -1;
+    }
+
+    /* Picks up changes of the file named by "config_file" */
+    kernel_priv->watch = ivas_confwatch_new(handle->kernel_config, "libivas_xpp.so",
+            kernel_priv->cur, parse_params, free_params, handle);
 
     handle->kernel_priv = (void *)kernel_priv;
 
     return 0;
 }
 
+/* Crop of the input requested by the app, see xpp_roi.h. Returns 0 if there is none. */
+static int get_crop(IVASFrame *in, uint32_t *x, uint32_t *y, uint32_t *w, uint32_t *h)
+{
+    GstBuffer *buf = (GstBuffer *) in->app_priv;
+    GstMeta *meta;
+    gpointer state = NULL;
+    GQuark type = g_quark_from_static_string(XPP_ROI_TYPE);
+
+    if (!buf)
+        return 0;
+
+    while ((meta = gst_buffer_iterate_meta_filtered(buf, &state, GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE))) {
+        GstVideoRegionOfInterestMeta *roi = (GstVideoRegionOfInterestMeta *) meta;
+        uint32_t x0, y0, x1, y1;
+        if (roi->roi_type != type)
+            continue;
+
+        x0 = roi->x / XPP_ROI_ALIGN * XPP_ROI_ALIGN;
+        y0 = roi->y & ~1u;
+        x1 = roi->x + roi->w;
+        y1 = roi->y + roi->h;
+        if (x1 > in->props.width)
+            x1 = in->props.width;
+        if (y1 > in->props.height)
+            y1 = in->props.height;
+        if (x1 <= x0 + 1 || y1 <= y0 + 1)
+            return 0;
+
+        *x = x0;
+        *y = y0;
+        *w = (x1 - x0) & ~1u;
+        *h = (y1 - y0) & ~1u;
+        return 1;
+    }
+    return 0;
+}
+
 int32_t xlnx_kernel_start(IVASKernel *handle, int start, IVASFrame *input[MAX_NUM_OBJECT], IVASFrame *output[MAX_NUM_OBJECT])
 {
     ResizeKernelPriv *kernel_priv;
+    uint32_t x, y, width, height;
+    uint64_t y_addr, uv_addr;
     kernel_priv = (ResizeKernelPriv *)handle->kernel_priv;
+    if (kernel_priv->watch)
+        kernel_priv->cur = ivas_confwatch_get(kernel_priv->watch);
+
+    y_addr = input[0]->paddr[0];
+    uv_addr = input[0]->paddr[1];
+    width = input[0]->props.width;
+    height = input[0]->props.height;
+    if (get_crop(input[0], &x, &y, &width, &height)) {
+        /* The accelerator walks the planes by stride, so a crop is an offset and a smaller size */
+        y_addr += (uint64_t) y * input[0]->props.stride + x;
+        uv_addr += (uint64_t) (y / 2) * input[0]->props.stride + x;
+    }
 
-    ivas_register_write(handle, &(input[0]->props.width), sizeof(uint32_t), 0x40);   /* In width */
-    ivas_register_write(handle, &(input[0]->props.height), sizeof(uint32_t), 0x48);  /* In height */
+    ivas_register_write(handle, &width, sizeof(uint32_t), 0x40);   /* In width */
+    ivas_register_write(handle, &height, sizeof(uint32_t), 0x48);  /* In height */
     ivas_register_write(handle, &(input[0]->props.stride), sizeof(uint32_t), 0x50);  /* In stride */
 
     ivas_register_write(handle, &(output[0]->props.width), sizeof(uint32_t), 0x58);  /* Out width */
     ivas_register_write(handle, &(output[0]->props.height), sizeof(uint32_t), 0x60); /* Out height */
     ivas_register_write(handle, &(output[0]->props.width), sizeof(uint32_t), 0x68); /* Out stride */
 
-    ivas_register_write(handle, &(input[0]->paddr[0]), sizeof(uint64_t), 0x10);      /* Y Input */
-    ivas_register_write(handle, &(input[0]->paddr[1]), sizeof(uint64_t), 0x1C);      /* UV Input */
+    ivas_register_write(handle, &y_addr, sizeof(uint64_t), 0x10);      /* Y Input */
+    ivas_register_write(handle, &uv_addr, sizeof(uint64_t), 0x1C);      /* UV Input */
     ivas_register_write(handle, &(output[0]->paddr[0]), sizeof(uint64_t), 0x28);      /* Output */
-    ivas_register_write(handle, &(kernel_priv->params->paddr[0]), sizeof(uint64_t), 0x34);     /* Params */
+    ivas_register_write(handle, &(kernel_priv->cur->params->paddr[0]), sizeof(uint64_t), 0x34);     /* Params */
 
     ivas_register_write(handle, &start, sizeof(uint32_t), 0x0);                      /* start */
     return 0;
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __SMARTCAM_JPEG_ERROR_H__
+#define __SMARTCAM_JPEG_ERROR_H__
+
+#include <stdio.h>
+#include <jpeglib.h>
+#include <setjmp.h>
+
+/*
+ * libjpeg error manager which returns to a setjmp() of the caller, instead of
+ * the default one which calls exit(). The callers run on worker threads, where
+ * a bad frame must only fail that frame.
+ */
+struct JpegError
+{
+    struct jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+static inline void
+jpeg_error_exit_cb (j_common_ptr cinfo)
+{
+    longjmp(((JpegError *) cinfo->err)->jump, 1);
+}
+
+/* Not logged: cameras send the odd corrupt frame, and the callers count the failures */
+static inline void
+jpeg_output_message_cb (j_common_ptr cinfo)
+{
+}
+
+static inline struct jpeg_error_mgr *JpegErrorInit(JpegError *err)
+{
+    jpeg_std_error(&err->pub);
+    err->pub.error_exit = jpeg_error_exit_cb;
+    err->pub.output_message = jpeg_output_message_cb;
+    return &err->pub;
+}
+
+#endif /* __SMARTCAM_JPEG_ERROR_H__ */
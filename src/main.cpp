@@ -14,19 +14,86 @@
  * limitations under the License.
  */
 #include <glob.h>
+#include <stdarg.h>
 #include <stdio.h>
+#include <glib-unix.h>
 #include <gst/gst.h>
 #include <gst/rtsp-server/rtsp-server.h>
 #include <string>
 #include <array>
+#include <algorithm>
 #include <vector>
+#include <list>
+#include <map>
 #include <sstream>
 #include <memory>
 #include <stdexcept>
+#include <mutex>
 #include <unistd.h>
+#include <signal.h>
+#include <string.h>
 #include <sys/types.h>
+#include <jansson.h>
+
+#include "meta_publisher.hpp"
+#include "rtsp_relay.hpp"
+#include "encoder_control.hpp"
+#include "rtcp_rate_control.hpp"
+#include "clip_recorder.hpp"
+#include "segment_writer.hpp"
+#include "metrics.hpp"
+#include "snapshot_exporter.hpp"
+#include "tiled_detector.hpp"
+#include "cascade.hpp"
+#include "multi_model.hpp"
+#include "auto_framer.hpp"
+#include "rendition_scaler.hpp"
+#include "analytics.hpp"
+#include "zone_filter.hpp"
+#include "codec_backend.hpp"
+#include "frame_share.hpp"
+#include "yuyv_to_nv12.hpp"
+#include "mjpeg_decoder.hpp"
+#include "thread_sched.hpp"
+#include "watchdog.hpp"
+#include "pipeline_profile.hpp"
+#include "control_server.hpp"
 
 #define DEFAULT_RTSP_PORT "554"
+#define METAQUEUE_NAME "metaq"
+#define RELAYSINK_NAME "relaysink"
+#define ENCODER_NAME "enc"
+#define RECSINK_NAME "recsink"
+#define TILESINK_NAME "tilesink"
+#define TILESRC_NAME "tilesrc"
+#define TILERES_NAME "tileres"
+#define MERGESRC_NAME "mergesrc"
+#define CASCFRAME_NAME "cascframe"
+#define CASCSRC_NAME "cascsrc"
+#define CASCRES_NAME "cascres"
+#define CASCOUT_NAME "cascout"
+#define MODELFRAME_NAME "modelframe"
+#define MODELSRC_PREFIX "modelsrc"
+#define MODELRES_PREFIX "modelres"
+#define MODELOUT_NAME "modelout"
+#define FRAMESINK_NAME "framesink"
+#define FRAMESRC_NAME "framesrc"
+#define SCALESINK_NAME "scalesink"
+#define SCALESRC_NAME "scalesrc"
+#define HEATOVERLAY_NAME "heatoverlay"
+#define MJPEGSINK_NAME "mjpegsink"
+#define MJPEGSRC_NAME "mjpegsrc"
+/* Named in the launch lines */
+#define VIDEOSRC_NAME "videosrc"
+#define AFFIXER_NAME "ima"
+#define PREPQUEUE_NAME "prepq"
+#define DECODER_NAME "dec"
+#define DRAW_NAME "draw"
+#define RTCP_CONTROL_INTERVAL_MS 1000
+#define METRICS_INTERVAL_MS 5000
+/* Object tracking shared by the cascade, the snapshots and the analytics */
+#define TRACK_MIN_IOU 0.3
+#define TRACK_MAX_MISSED 15
 
 
 static char *port = (char *) DEFAULT_RTSP_PORT;
@@ -38,9 +105,13 @@ static gchar* outMediaType = (gchar*)"h264";
 static gchar* target = (gchar*)"dp";
 static gchar* aitask = (gchar*)"facedetect";
 
-static gchar* controlRate = (gchar*)"low-latency";
-static gchar* targetBitrate = (gchar*)"3000";
-static gchar* gopLength = (gchar*)"60";
+/* Told apart from the values given on the command line by their address */
+static const gchar defaultControlRate[] = "low-latency";
+static const gchar defaultTargetBitrate[] = "3000";
+static const gchar defaultGopLength[] = "60";
+static gchar* controlRate = (gchar*)defaultControlRate;
+static gchar* targetBitrate = (gchar*)defaultTargetBitrate;
+static gchar* gopLength = (gchar*)defaultGopLength;
 
 static gchar* profile = NULL;
 static gchar* level = NULL;
@@ -53,6 +124,9 @@ static gboolean mipi = FALSE;
 static std::string mipidev("");
 static gint usb = -2;
 static std::string usbvideo("");
+static gchar* usbFormat = (gchar*)"raw";
+static bool usbMjpeg = false;
+static gint mjpegThreads = 3;
 static gint w = 1920;
 static gint h = 1080;
 static gboolean nodet = FALSE;
@@ -60,27 +134,112 @@ static gboolean audio = FALSE;
 static gboolean reportFps = FALSE;
 static gboolean screenfps = FALSE;
 static gboolean roiOff = FALSE;
+static gboolean nodraw = FALSE;
+static gchar* metaOut = NULL;
+static gint gopCacheKB = 0;
+static gchar* gopCacheMode = (gchar*)"burst";
+static gboolean adaptiveEnc = FALSE;
+static gint idleBitrate = 500;
+static gint idleGopLength = 600;
+static gint idleDelayMs = 2000;
+static gboolean rtcpRateControl = FALSE;
+static gint minBitrate = 500;
+static gint maxBitrate = 0;
+static gchar* simulcast = NULL;
+static gboolean recordOnDetect = FALSE;
+static gchar* recordClasses = NULL;
+static gint prerollSec = 5;
+static gint recordQuietSec = 10;
+static gchar* recordDir = (gchar*)".";
+static gint segmentSec = 0;
+static gint segmentMB = 0;
+static gint maxSegments = 0;
+static gint maxStorageMB = 0;
+static gchar* snapshot = NULL;
+static gchar* snapshotClasses = NULL;
+static gint snapshotIntervalSec = 10;
+static gint snapshotRate = 2;
+static gint snapshotQuality = 85;
+static gchar* tileGrid = NULL;
+static gint tileOverlap = 20;
+static gchar* cascadeTask = NULL;
+static gchar* cascadeClasses = NULL;
+static gint cascadeIntervalMs = 2000;
+static gint cascadeMax = 8;
+static gchar* autoFrame = NULL;
+static gchar* autoFrameClasses = NULL;
+static gint autoFrameSmoothMs = 500;
+static gchar** countLines = NULL;
+static gchar** countZones = NULL;
+static gchar* zonesFile = NULL;
+static gboolean heatmap = FALSE;
+static gint heatmapHalfLifeSec = 60;
+static gboolean heatmapOverlay = FALSE;
+static gchar** threadSched = NULL;
+static gint watchdogMs = 0;
+static gchar* pipelineProfile = NULL;
+static gchar* codecBackend = (gchar*)"auto";
+static gchar* shareFrames = NULL;
+static gint shareRing = 4;
+static gchar* daemonSocket = NULL;
+static gint daemonWarm = 1;
+
+static bool targetDp = false;
+static bool targetRtsp = false;
+static bool targetFile = false;
+/* Tuning of the stages, empty without --pipeline-profile */
+static PipelineProfile pipeProfile;
+/* Decoder and encoder elements, from --codec-backend */
+static CodecBackend codec;
 static GOptionEntry entries[] =
 {
     { "mipi", 'm', 0, G_OPTION_ARG_NONE, &mipi, "use MIPI camera as input source, auto detect, fail if no mipi connected", ""},
     { "usb", 'u', 0, G_OPTION_ARG_INT, &usb, "usb camera media device id, e.g. 0 for /dev/media0", "media ID"},
+    { "usb-format", 0, 0, G_OPTION_ARG_STRING, &usbFormat, "-u: capture format of the USB camera: [raw | mjpeg], mjpeg for higher resolutions and frame rates over USB 2.0", "raw"},
+    { "mjpeg-threads", 0, 0, G_OPTION_ARG_INT, &mjpegThreads, "--usb-format=mjpeg: threads decoding frames in parallel", "3"},
     { "file", 'f', 0, G_OPTION_ARG_FILENAME, &filename, "location of h26x file as input", "file path"},
     { "infile-type", 'i', 0, G_OPTION_ARG_STRING, &infileType, "input file type: [h264 | h265]", "h264"},
     { "width", 'W', 0, G_OPTION_ARG_INT, &w, "resolution w of the input", "1920"},
     { "height", 'H', 0, G_OPTION_ARG_INT, &h, "resolution h of the input", "1080"},
     { "framerate", 'r', 0, G_OPTION_ARG_INT, &fr, "framerate of the input", "30"},
 
-    { "target", 't', 0, G_OPTION_ARG_STRING, &target, "[dp|rtsp|file]", "dp"},
+    { "target", 't', 0, G_OPTION_ARG_STRING, &target, "[dp|rtsp|file], or a comma separated list of them to output to several targets at once", "dp"},
     { "outmedia-type", 'o', 0, G_OPTION_ARG_STRING, &outMediaType, "output file type: [h264 | h265]", "h264"},
     { "port", 'p', 0, G_OPTION_ARG_STRING, &port,
         "Port to listen on (default: " DEFAULT_RTSP_PORT ")", DEFAULT_RTSP_PORT},
+    { "gop-cache", 0, 0, G_OPTION_ARG_INT, &gopCacheKB, "RTSP: cache the encoded frames since the last IDR, up to the given KB, so new clients start at once, 0 to disable", "0"},
+    { "simulcast", 0, 0, G_OPTION_ARG_STRING, &simulcast, "RTSP: serve several renditions of one inference pass, comma separated list of name:WxH[:bitrate], each at rtsp://ip:port/name", NULL},
+    { "gop-cache-mode", 0, 0, G_OPTION_ARG_STRING, &gopCacheMode, "RTSP: how the GOP cache is sent to a new client: [burst | delay]", "burst"},
 
-    { "aitask", 'a', 0, G_OPTION_ARG_STRING, &aitask, "select AI task to be run: [facedetect|ssd|refinedet]" },
+    { "aitask", 'a', 0, G_OPTION_ARG_STRING, &aitask, "select AI task to be run: [facedetect|ssd|refinedet], or a comma separated list of them to run several models, each as <task>[:<every nth frame>]" },
     { "nodet", 'n', 0, G_OPTION_ARG_NONE, &nodet, "no AI inference", NULL },
+    { "tiles", 0, 0, G_OPTION_ARG_STRING, &tileGrid, "run the inference on a grid of overlapping tiles plus the whole frame, for small objects: <cols>x<rows>", NULL },
+    { "tile-overlap", 0, 0, G_OPTION_ARG_INT, &tileOverlap, "--tiles: overlap of neighbouring tiles in percent of the tile size", "20" },
+    { "cascade", 0, 0, G_OPTION_ARG_STRING, &cascadeTask, "classify the detected objects with a second model: AI task name or absolute path of its config directory", NULL },
+    { "cascade-classes", 0, 0, G_OPTION_ARG_STRING, &cascadeClasses, "--cascade: comma separated list of labels to classify, default is all", NULL },
+    { "cascade-interval", 0, 0, G_OPTION_ARG_INT, &cascadeIntervalMs, "--cascade: ms before a tracked object is classified again", "2000" },
+    { "cascade-max", 0, 0, G_OPTION_ARG_INT, &cascadeMax, "--cascade: at most this many objects classified per frame", "8" },
+    { "autoframe", 0, 0, G_OPTION_ARG_STRING, &autoFrame, "crop and scale the video to the detected objects, following them, into the given output resolution: <width>x<height>", NULL },
+    { "autoframe-classes", 0, 0, G_OPTION_ARG_STRING, &autoFrameClasses, "--autoframe: comma separated list of labels to follow, default is all", NULL },
+    { "autoframe-smooth", 0, 0, G_OPTION_ARG_INT, &autoFrameSmoothMs, "--autoframe: time constant of the view movement in ms", "500" },
+    { "count-line", 0, 0, G_OPTION_ARG_STRING_ARRAY, &countLines, "count the objects crossing a line, per direction and class, can be repeated: <name>:<x0>,<y0>,<x1>,<y1>", NULL },
+    { "count-zone", 0, 0, G_OPTION_ARG_STRING_ARRAY, &countZones, "count the objects in and entering a polygon, per class, can be repeated: <name>:<x>,<y>,<x>,<y>,<x>,<y>[,...]", NULL },
+    { "zones", 0, 0, G_OPTION_ARG_FILENAME, &zonesFile, "restrict the inference to the zones of a JSON file, rectangles and polygons in pixels of the input, default is the \"zones\" of the preprocess config of the AI task", NULL },
+    { "heatmap", 0, 0, G_OPTION_ARG_NONE, &heatmap, "keep a decaying heatmap of where objects were, reported with --report", NULL },
+    { "heatmap-halflife", 0, 0, G_OPTION_ARG_INT, &heatmapHalfLifeSec, "--heatmap: seconds for the heat to fade to half, 0 to keep all", "60" },
+    { "heatmap-overlay", 0, 0, G_OPTION_ARG_NONE, &heatmapOverlay, "--heatmap: tint the heatmap into the dp output", NULL },
     { "audio", 'A', 0, G_OPTION_ARG_NONE, &audio, "RTSP with I2S audio", NULL },
-    { "report", 'R', 0, G_OPTION_ARG_NONE, &reportFps, "report fps", NULL },
+    { "thread-sched", 0, 0, G_OPTION_ARG_STRING_ARRAY, &threadSched, "pin the streaming threads of a stage to cores and set their scheduling policy, can be repeated: <capture|preprocess|inference|draw|encode|rtsp|display|main>=<cpus>[:<other|fifo|rr>[:<priority>]]", NULL },
+    { "pipeline-profile", 0, 0, G_OPTION_ARG_STRING, &pipelineProfile, "queue depths, leaky policies and element properties per stage: profile name or absolute path of a JSON profile", NULL },
+    { "share-frames", 0, 0, G_OPTION_ARG_FILENAME, &shareFrames, "share the frames after the inference and their detections with local processes, as dmabuf or memfd descriptors on the given Unix socket", NULL },
+    { "share-ring", 0, 0, G_OPTION_ARG_INT, &shareRing, "--share-frames: at most this many frames held by the consumers", "4" },
+    { "codec-backend", 0, 0, G_OPTION_ARG_STRING, &codecBackend, "H.264/H.265 decoder and encoder: [auto | vcu | sw], auto uses the software codecs when there is no VCU", "auto" },
+    { "watchdog", 0, 0, G_OPTION_ARG_INT, &watchdogMs, "restart the stalled part of the pipeline when no frame passed the capture, the inference or the output for the given ms, 0 to disable", "0" },
+    { "report", 'R', 0, G_OPTION_ARG_NONE, &reportFps, "report fps and runtime metrics", NULL },
     { "screenfps", 's', 0, G_OPTION_ARG_NONE, &screenfps, "display fps on screen, notice this will cause performance degradation", NULL },
     { "ROI-off", 0, 0, G_OPTION_ARG_NONE, &roiOff, "turn off ROI", NULL },
+    { "nodraw", 0, 0, G_OPTION_ARG_NONE, &nodraw, "don't draw detection results into the video, use with --meta-out", NULL },
+    { "meta-out", 0, 0, G_OPTION_ARG_STRING, &metaOut, "publish per-frame detections as JSON, comma separated list of: [udp://host:port | unix:///path | rtsp]", NULL },
 
     { "control-rate", 0, 0, G_OPTION_ARG_STRING, &controlRate, "Encoder parameter control-rate", "low-latency" },
     { "target-bitrate", 0, 0, G_OPTION_ARG_STRING, &targetBitrate, "Encoder parameter target-bitrate", targetBitrate},
@@ -92,6 +251,38 @@ static GOptionEntry entries[] =
 
     { "encodeEnhancedParam", 0, 0, G_OPTION_ARG_STRING, &encodeEnhancedParam, "String for fully customizing the encoder in the form \"param1=val1, param2=val2,...\", where paramn is the name of the encoder parameter", NULL },
 
+    { "adaptive-enc", 0, 0, G_OPTION_ARG_NONE, &adaptiveEnc, "adapt the encoder to the detections: key frame on new class, target-bitrate/gop-length while objects are present, idle settings otherwise", NULL },
+    { "idle-bitrate", 0, 0, G_OPTION_ARG_INT, &idleBitrate, "--adaptive-enc: target-bitrate when no object is present", "500" },
+    { "idle-gop-length", 0, 0, G_OPTION_ARG_INT, &idleGopLength, "--adaptive-enc: gop-length when no object is present", "600" },
+    { "idle-delay", 0, 0, G_OPTION_ARG_INT, &idleDelayMs, "--adaptive-enc: ms without objects before going idle", "2000" },
+    { "rtcp-rate-control", 0, 0, G_OPTION_ARG_NONE, &rtcpRateControl, "RTSP: adapt the encoder bitrate to the loss and jitter in the RTCP receiver reports", NULL },
+    { "min-bitrate", 0, 0, G_OPTION_ARG_INT, &minBitrate, "--rtcp-rate-control: lower bound of the bitrate", "500" },
+    { "max-bitrate", 0, 0, G_OPTION_ARG_INT, &maxBitrate, "--rtcp-rate-control: upper bound of the bitrate, default is target-bitrate", NULL },
+
+    { "record-on-detect", 0, 0, G_OPTION_ARG_NONE, &recordOnDetect, "file target: only record clips around detections instead of everything", NULL },
+    { "record-classes", 0, 0, G_OPTION_ARG_STRING, &recordClasses, "--record-on-detect: comma separated list of labels which start a clip, default is any detection", NULL },
+    { "preroll", 0, 0, G_OPTION_ARG_INT, &prerollSec, "--record-on-detect: seconds of video before the detection in each clip", "5" },
+    { "record-quiet", 0, 0, G_OPTION_ARG_INT, &recordQuietSec, "--record-on-detect: seconds without detections which end a clip", "10" },
+    { "record-dir", 0, 0, G_OPTION_ARG_FILENAME, &recordDir, "--record-on-detect, --segment-*: directory of the clips and segments", "." },
+    { "segment-sec", 0, 0, G_OPTION_ARG_INT, &segmentSec, "file target: record into segments of the given seconds, starting at IDR frames", "0" },
+    { "segment-mb", 0, 0, G_OPTION_ARG_INT, &segmentMB, "file target: record into segments of the given MB, starting at IDR frames", "0" },
+    { "max-segments", 0, 0, G_OPTION_ARG_INT, &maxSegments, "--segment-*: delete the oldest segments beyond this count, 0 to keep all", "0" },
+    { "max-storage-mb", 0, 0, G_OPTION_ARG_INT, &maxStorageMB, "--segment-*: delete the oldest segments beyond this total MB, 0 to keep all", "0" },
+
+    { "snapshot", 0, 0, G_OPTION_ARG_STRING, &snapshot, "export a JPEG of each detected object with its metadata to: [directory | unix:///path]", NULL },
+    { "snapshot-classes", 0, 0, G_OPTION_ARG_STRING, &snapshotClasses, "--snapshot: comma separated list of labels to export, default is all", NULL },
+    { "snapshot-interval", 0, 0, G_OPTION_ARG_INT, &snapshotIntervalSec, "--snapshot: seconds between snapshots of the same object, 0 for one per object", "10" },
+    { "snapshot-rate", 0, 0, G_OPTION_ARG_INT, &snapshotRate, "--snapshot: at most this many snapshots per second, 0 for no limit", "2" },
+    { "snapshot-quality", 0, 0, G_OPTION_ARG_INT, &snapshotQuality, "--snapshot: JPEG quality", "85" },
+
+    { NULL }
+};
+
+/* Options of the process, not of a stream */
+static GOptionEntry daemonEntries[] =
+{
+    { "daemon", 0, 0, G_OPTION_ARG_FILENAME, &daemonSocket, "run as a daemon which starts, changes and stops streams on JSON commands to the given Unix socket, the other options are the defaults of the streams", "socket path" },
+    { "daemon-warm", 0, 0, G_OPTION_ARG_INT, &daemonWarm, "--daemon: stopped streams kept with their models loaded, to start again quickly", "1" },
     { NULL }
 };
 
@@ -134,6 +325,361 @@ my_bus_callback (GstBus * bus, GstMessage * message, gpointer data)
 
 
 
+/* Application logic hooked onto the elements of a constructed pipeline */
+struct PipelineHooks
+{
+    MetaPublisher *metaPub;
+    EncoderControl *encCtrl;
+    RtcpRateControl *rtcpCtrl;
+    ClipRecorder *recorder;
+    SegmentWriter *segWriter;
+    SnapshotExporter *snapshot;
+    TiledDetector *tiler;
+    Cascade *cascade;
+    MultiModel *multiModel;
+    AutoFramer *framer;
+    RenditionScaler *rendScaler;
+    Analytics *analytics;
+    ZoneFilter *zones;
+    CodecMeter *codecMeter;
+    FrameShare *frameShare;
+    MjpegDecoder *mjpegDec;
+    ThreadSched *sched;
+    Watchdog *watchdog;
+    /* Of the providers the stages register as they attach */
+    guint metricsGroup;
+};
+
+/* False if a stage which feeds a part of the pipeline through the app is
+ * missing its elements, the pipeline would stall without it, or the zone
+ * filter is, the results would go out unfiltered */
+static bool AttachHooks(GstElement *bin, PipelineHooks *hooks)
+{
+    Metrics::Scope scope(hooks->metricsGroup);
+    bool ok = true;
+    if (hooks->sched)
+    {
+        hooks->sched->Attach(bin);
+    }
+    if (hooks->mjpegDec)
+    {
+        ok = hooks->mjpegDec->Attach(bin, MJPEGSINK_NAME, MJPEGSRC_NAME) && ok;
+    }
+    if (hooks->multiModel)
+    {
+        ok = hooks->multiModel->Attach(bin, MODELFRAME_NAME, MODELSRC_PREFIX, MODELRES_PREFIX, MODELOUT_NAME) && ok;
+    }
+    if (hooks->tiler)
+    {
+        ok = hooks->tiler->Attach(bin, TILESINK_NAME, TILESRC_NAME, TILERES_NAME, MERGESRC_NAME) && ok;
+    }
+    if (hooks->zones)
+    {
+        /* On the inference results, before the cascade classifies them */
+        if (hooks->multiModel)
+            ok = hooks->zones->Attach(bin, PREPQUEUE_NAME, MODELOUT_NAME, "src") && ok;
+        else
+            ok = hooks->zones->Attach(bin, PREPQUEUE_NAME, AFFIXER_NAME, "src_slave_0") && ok;
+    }
+    if (hooks->cascade)
+    {
+        ok = hooks->cascade->Attach(bin, CASCFRAME_NAME, CASCSRC_NAME, CASCRES_NAME, CASCOUT_NAME) && ok;
+    }
+    if (hooks->framer)
+    {
+        ok = hooks->framer->Attach(bin, FRAMESINK_NAME, FRAMESRC_NAME) && ok;
+    }
+    if (hooks->rendScaler)
+    {
+        ok = hooks->rendScaler->Attach(bin, SCALESINK_NAME) && ok;
+    }
+    if (hooks->metaPub)
+    {
+        hooks->metaPub->Attach(bin, METAQUEUE_NAME);
+    }
+    if (hooks->encCtrl)
+    {
+        hooks->encCtrl->Attach(bin, METAQUEUE_NAME, ENCODER_NAME);
+    }
+    if (hooks->recorder)
+    {
+        hooks->recorder->Attach(bin, METAQUEUE_NAME, RECSINK_NAME);
+    }
+    if (hooks->segWriter)
+    {
+        hooks->segWriter->Attach(bin, RECSINK_NAME);
+    }
+    if (hooks->snapshot)
+    {
+        hooks->snapshot->Attach(bin, DRAW_NAME, METAQUEUE_NAME);
+    }
+    if (hooks->analytics)
+    {
+        hooks->analytics->Attach(bin, METAQUEUE_NAME);
+        if (heatmapOverlay && targetDp)
+        {
+            hooks->analytics->AttachOverlay(bin, HEATOVERLAY_NAME);
+        }
+    }
+    if (hooks->frameShare)
+    {
+        hooks->frameShare->Attach(bin, DRAW_NAME, METAQUEUE_NAME);
+    }
+    if (hooks->codecMeter)
+    {
+        hooks->codecMeter->Attach(bin, DECODER_NAME, ENCODER_NAME);
+    }
+    if (hooks->watchdog)
+    {
+        hooks->watchdog->Attach(bin, VIDEOSRC_NAME, AFFIXER_NAME, METAQUEUE_NAME);
+    }
+    return ok;
+}
+
+/* A pipeline built from the options and the app stages hooked onto it */
+struct Stream
+{
+    Stream() : pipeline(NULL), busWatchId(0), server(NULL), serverId(0), serial(0), startedUs(0), liveBitrate(false),
+               metricsGroup(0), watchdogMs(0) {}
+    /* Stops the pipeline and the RTSP server */
+    ~Stream();
+
+    MetaPublisher metaPub;
+    /* Used by the stages below, goes last */
+    std::unique_ptr<SharedTracker> tracker;
+    std::unique_ptr<EncoderControl> encCtrl;
+    std::unique_ptr<RtcpRateControl> rtcpCtrl;
+    std::unique_ptr<ClipRecorder> recorder;
+    std::unique_ptr<SegmentWriter> segWriter;
+    std::unique_ptr<SnapshotExporter> snapshotExp;
+    std::unique_ptr<MultiModel> multiModel;
+    std::unique_ptr<TiledDetector> tiler;
+    std::unique_ptr<Cascade> cascade;
+    std::unique_ptr<ThreadSched> sched;
+    std::unique_ptr<Watchdog> watchdog;
+    std::unique_ptr<MjpegDecoder> mjpegDec;
+    std::unique_ptr<AutoFramer> framer;
+    std::unique_ptr<RenditionScaler> rendScaler;
+    std::unique_ptr<Analytics> analytics;
+    std::unique_ptr<ZoneFilter> zones;
+    std::unique_ptr<CodecMeter> codecMeter;
+    std::unique_ptr<FrameShare> frameShare;
+    std::vector<std::unique_ptr<RtspRelay>> relays;
+    PipelineHooks hooks;
+
+    /* NULL when the RTSP server builds the pipeline for its media */
+    GstElement *pipeline;
+    guint busWatchId;
+    GstRTSPServer *server;
+    guint serverId;
+    std::string port;
+    /* Mount path and factory of each RTSP stream */
+    std::vector<std::pair<std::string, GstRTSPMediaFactory *>> mounts;
+    /* Merged drawing config of several models, removed with the stream */
+    std::string drawConfig;
+
+    /* Daemon mode */
+    std::string id;
+    std::vector<std::string> args;
+    guint serial;
+    gint64 startedUs;
+    /* The bitrate of the encoder can be changed while it runs */
+    bool liveBitrate;
+    /* Suspended with the stream while it is parked */
+    guint metricsGroup;
+    /* The watchdog is dropped while the stream is parked */
+    guint watchdogMs;
+    CodecBackend codec;
+};
+
+static GstRTSPFilterResult
+remove_client_cb (GstRTSPServer * server, GstRTSPClient * client, gpointer user_data)
+{
+    return GST_RTSP_FILTER_REMOVE;
+}
+
+/* Serve the mounts of @st on its port */
+static bool ServeRtsp(Stream &st)
+{
+    st.server = gst_rtsp_server_new ();
+    g_object_set (st.server, "service", st.port.c_str(), NULL);
+    GstRTSPMountPoints *mounts = gst_rtsp_server_get_mount_points (st.server);
+    for (auto &m : st.mounts)
+    {
+        gst_rtsp_mount_points_add_factory (mounts, m.first.c_str(), GST_RTSP_MEDIA_FACTORY (g_object_ref (m.second)));
+    }
+    g_object_unref (mounts);
+
+    /* attach the server to the default maincontext */
+    st.serverId = gst_rtsp_server_attach (st.server, NULL);
+    if (!st.serverId)
+    {
+        g_printerr("ERROR: Can't serve RTSP on port %s.\n", st.port.c_str());
+        return false;
+    }
+    return true;
+}
+
+/* Disconnect the clients and close the port */
+static void StopRtsp(Stream &st)
+{
+    if (!st.server)
+    {
+        return;
+    }
+    GstRTSPMountPoints *mounts = gst_rtsp_server_get_mount_points (st.server);
+    for (auto &m : st.mounts)
+    {
+        gst_rtsp_mount_points_remove_factory (mounts, m.first.c_str());
+    }
+    g_object_unref (mounts);
+    gst_rtsp_server_client_filter (st.server, remove_client_cb, NULL);
+    if (st.serverId)
+    {
+        g_source_remove (st.serverId);
+        st.serverId = 0;
+    }
+    g_object_unref (st.server);
+    st.server = NULL;
+}
+
+Stream::~Stream()
+{
+    StopRtsp(*this);
+    for (auto &m : mounts)
+    {
+        g_object_unref (m.second);
+    }
+    if (pipeline)
+    {
+        gst_element_set_state (pipeline, GST_STATE_NULL);
+        gst_object_unref (pipeline);
+    }
+    if (busWatchId)
+    {
+        g_source_remove (busWatchId);
+    }
+    if (!drawConfig.empty())
+    {
+        unlink(drawConfig.c_str());
+    }
+}
+
+static void
+media_configure_cb (GstRTSPMediaFactory * factory, GstRTSPMedia * media, gpointer user_data)
+{
+    PipelineHooks *hooks = (PipelineHooks *) user_data;
+    GstElement *element = gst_rtsp_media_get_element (media);
+    if (!AttachHooks(element, hooks))
+    {
+        /* The client's media doesn't preroll and the client times out */
+        g_printerr("ERROR: Can't hook the app stages onto the media of a client.\n");
+    }
+    gst_object_unref (element);
+}
+
+/* printf onto the end of a launch line */
+static void AppendF(std::string &pip, const char *format, ...) G_GNUC_PRINTF(2, 3);
+static void AppendF(std::string &pip, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    gchar *str = g_strdup_vprintf(format, args);
+    va_end(args);
+    pip += str;
+    g_free(str);
+}
+
+/* Preprocessing and inference of the model in @dir, from the queue in front of the preprocessing;
+ * the queues are the profile stages @branch"preprocess" and @branch"inference" */
+static std::string InferenceDesc(const std::string &dir, const char *branch = "", const std::string &queueDefaults = "")
+{
+    std::ostringstream desc;
+    desc << "! " << pipeProfile.Queue((std::string(branch) + "preprocess").c_str(), queueDefaults)
+         << " ! ivas_xmultisrc kconfig=\"" << dir << "/preprocess.json\"" << pipeProfile.Props("preprocess")
+         << " ! " << pipeProfile.Queue((std::string(branch) + "inference").c_str())
+         << " ! ivas_xfilter kernels-config=\"" << dir << "/aiinference.json\"" << pipeProfile.Props("inference") << " ";
+    return desc.str();
+}
+
+/* ROI generation, encoder and output caps, with the encoder settings from the command line;
+ * @bitrateSet if @bitrate was given rather than the default */
+static std::string EncoderDesc(const char *name, const char *bitrate, bool bitrateSet, const char *defaultParam,
+        bool escapeParentheses)
+{
+    std::string strType = escapeParentheses ? "\\(string\\)" : "(string)";
+    /* The software encoders don't take the ROI meta, nor a level or tier in the caps */
+    bool vcu = codec.GetKind() == CodecBackend::VCU;
+
+    std::string roi = " ! " + pipeProfile.Queue("roi") + " ! ivas_xroigen roi-type=1 roi-qp-delta=-10 roi-max-num=10"
+        + pipeProfile.Props("roi") + " ";
+    /* The profile goes over the defaults, the options given on the command
+     * line over the profile; later properties win in a launch line */
+    std::string qpMode = vcu ? std::string("qp-mode=") + (roiOff ? "auto" : "1") + " " : "";
+    std::string param = std::string(encodeEnhancedParam ? "" : defaultParam) + " " + qpMode
+        + codec.EncoderRateProps(outMediaType, controlRate, bitrate, gopLength)
+        + pipeProfile.Props("encoder") + " "
+        + (roiOff && vcu ? qpMode : "")
+        + codec.EncoderRateProps(outMediaType, controlRate != defaultControlRate ? controlRate : NULL,
+                bitrateSet ? bitrate : NULL, gopLength != defaultGopLength ? gopLength : NULL);
+
+    /* Grows with the profile and the options, no fixed buffer to cut them off */
+    std::string desc;
+    AppendF(desc, " \
+            %s \
+            ! %s ! %s%s name=%s \
+            %s \
+            %s \
+            ! video/x-%s, alignment=au%s\
+            %s%s %s%s %s%s \
+            ",
+            roiOff || !vcu ? "" : roi.c_str(),
+            pipeProfile.Queue("encode").c_str(), codec.EncoderConvert(outMediaType).c_str(),
+            codec.EncoderFactory(outMediaType).c_str(), name,
+            param.c_str(),
+            encodeEnhancedParam ? encodeEnhancedParam : "",
+            outMediaType, vcu ? "" : ", stream-format=byte-stream",
+            profile ? (", profile=" + strType).c_str() : "", profile ? profile : "",
+            level && vcu ? (", level=" + strType).c_str() : "", level && vcu ? level : "",
+            tier && vcu ? (", tier=" + strType).c_str() : "", tier && vcu ? tier: ""
+            );
+    return desc;
+}
+
+static std::string DisplaySinkDesc()
+{
+    std::ostringstream desc;
+    if (heatmapOverlay)
+    {
+        desc << "! identity name=" << HEATOVERLAY_NAME << " ";
+    }
+    desc << "! kmssink driver-name=xlnx plane-id=39 sync=" << (filename ? "true" : "false") << " fullscreen-overlay=true"
+         << pipeProfile.Props("display");
+    return desc.str();
+}
+
+/* Sink of the encoded stream of the file target */
+static std::string FileSinkDesc()
+{
+    std::ostringstream desc;
+    if (recordOnDetect || segmentSec > 0 || segmentMB > 0)
+    {
+        desc << "! appsink name=" << RECSINK_NAME << " async=false";
+    }
+    else
+    {
+        desc << "! filesink location=./out." << outMediaType << " async=false";
+    }
+    return desc.str();
+}
+
+static void
+media_configure_rtcp_cb (GstRTSPMediaFactory * factory, GstRTSPMedia * media, gpointer user_data)
+{
+    RtcpRateControl *ctrl = (RtcpRateControl *) user_data;
+    ctrl->AddMedia(media);
+}
+
 static std::string exec(const char* cmd) {
     std::array<char, 128> buffer;
     std::string result;
@@ -147,6 +693,23 @@ static std::string exec(const char* cmd) {
     return result;
 }
 
+/* Results of the device probing commands, kept by the daemon until a rescan */
+static std::map<std::string, std::string> probeCache;
+static bool cacheProbes = false;
+
+static std::string probe(const char* cmd) {
+    if (!cacheProbes)
+    {
+        return exec(cmd);
+    }
+    auto it = probeCache.find(cmd);
+    if (it == probeCache.end())
+    {
+        it = probeCache.insert(std::make_pair(std::string(cmd), exec(cmd))).first;
+    }
+    return it->second;
+}
+
 static std::vector<std::string> GetIp()
 {
     std::string s = exec("ifconfig | grep 'inet ' | sed 's/.*inet *\\([^ ]*\\).*/\\1/'");
@@ -176,7 +739,7 @@ static std::string FindMIPIDev()
         std::ostringstream cmd;
         cmd << "media-ctl -d " << globbuf.gl_pathv[i] << " -p | grep driver | grep xilinx-video | wc -l";
 
-        std::string a = exec(cmd.str().c_str());
+        std::string a = probe(cmd.str().c_str());
         a=a.substr(0, a.find("\n"));
         if ( a == std::string("1") )
         {
@@ -190,7 +753,7 @@ static std::string FindMIPIDev()
 
 static std::vector<std::string> GetMonitorResolution(std::string& all)
 {
-    all = exec("modetest -M xlnx -c| awk '/name refresh/ {f=1;next}  /props:/{f=0;} f{print $2 \"@\" $3} '");
+    all = probe("modetest -M xlnx -c| awk '/name refresh/ {f=1;next}  /props:/{f=0;} f{print $2 \"@\" $3} '");
 
     std::string s = all;
     std::vector<std::string> rarray;
@@ -225,11 +788,12 @@ static int CheckMIPISrc()
     return 0;
 }
 
-static std::vector<std::string> GetUSBRes(std::string video, std::string& all)
+/* Sizes and their frame rates, of the MJPG format or of the raw formats */
+static std::vector<std::string> GetUSBRes(std::string video, bool mjpeg, std::string& all)
 {
     std::ostringstream cmd;
-    cmd << "v4l2-ctl --list-formats-ext -d " << video << " | awk '/\\s*\\[/ {f=1;}  /MJPG/ {f=0;} /\\s*\\[/ {next} f && /Size/{print s; s=\"\"; print $3;} END{print s} f && /Interval:/{s=s $4 $5}' | awk 'NF'  | sed 's/\\((\\|)(\\|)\\)/ /g' ";
-    all = exec(cmd.str().c_str());
+    cmd << "v4l2-ctl --list-formats-ext -d " << video << " | awk '/\\s*\\[/ {f=" << (mjpeg ? "" : "!") << "/MJPG/; next} f && /Size/{print s; s=\"\"; print $3;} END{print s} f && /Interval:/{s=s $4 $5}' | awk 'NF'  | sed 's/\\((\\|)(\\|)\\)/ /g' ";
+    all = probe(cmd.str().c_str());
     std::string s = all;
     std::vector<std::string> rarray;
     std::size_t pos;
@@ -248,7 +812,7 @@ static std::string GetUSBVideoDevFromMedia(std::string media)
     std::ostringstream cmd;
     cmd << "media-ctl -d " << media << " -p | awk '/^driver\\s*uvcvideo/ {u=1} /device node name *\\/dev\\/video/ {x=$4;f=1;next} u&&f&&/pad0: Sink/ {print x; x=\"\"} f {f=0} '";
 
-    std::string s = exec(cmd.str().c_str());
+    std::string s = probe(cmd.str().c_str());
 
     std::vector<std::string> rarray;
     std::size_t pos;
@@ -327,26 +891,98 @@ static int CheckUSBSrc()
 
     
     std::string allres;
-    std::vector<std::string> resV = GetUSBRes(usbvideo, allres);
+    std::vector<std::string> resV = GetUSBRes(usbvideo, usbMjpeg, allres);
     std::ostringstream inputRes;
     inputRes << w << "x" << h;
+    /* MJPEG is captured at the given frame rate, the raw formats at the camera's default */
+    std::ostringstream inputRate;
+    inputRate << " " << fr << ".";
     bool match = false;
-    for (int i = 0; i < resV.size(); i+=2)
+    for (int i = 0; i + 1 < resV.size(); i+=2)
     {
-        if ( resV[i] == inputRes.str() )
+        if ( resV[i] == inputRes.str() && (!usbMjpeg || (" " + resV[i + 1]).find(inputRate.str()) != std::string::npos) )
         {
             match = true;
         }
     }
     if (!match)
     {
-        g_printerr ("Error: USB camera doesn't support resolution %s\nAll supported resolution:\n%s\n", inputRes.str().c_str(), allres.c_str());
+        if (usbMjpeg)
+            g_printerr ("Error: USB camera doesn't support MJPEG %s@%d\nAll supported MJPEG resolution and fps:\n%s\n", inputRes.str().c_str(), fr, allres.c_str());
+        else
+            g_printerr ("Error: USB camera doesn't support resolution %s\nAll supported resolution:\n%s\n", inputRes.str().c_str(), allres.c_str());
         return 1;
     }
 
     return 0;
 }
 
+static bool ParseTargets(const char *spec)
+{
+    std::istringstream iss(spec);
+    std::string item;
+    while (std::getline(iss, item, ','))
+    {
+        bool *t = NULL;
+        if (item == "dp")
+            t = &targetDp;
+        else if (item == "rtsp")
+            t = &targetRtsp;
+        else if (item == "file")
+            t = &targetFile;
+
+        if (!t || *t)
+        {
+            g_printerr("ERROR: Invalid or duplicated target: %s\n", item.c_str());
+            return false;
+        }
+        *t = true;
+    }
+    return targetDp || targetRtsp || targetFile;
+}
+
+struct Rendition
+{
+    std::string name;
+    gint width;
+    gint height;
+    std::string bitrate;
+    /* Given in the rendition or with --target-bitrate */
+    bool bitrateSet;
+};
+
+/* Parse "high:1920x1080:4000,low:640x360:800", the bitrate defaults to --target-bitrate */
+static bool ParseSimulcast(const char *spec, std::vector<Rendition> &out)
+{
+    std::istringstream iss(spec);
+    std::string item;
+    while (std::getline(iss, item, ','))
+    {
+        Rendition r;
+        char name[64], bitrate[16];
+        bitrate[0] = '\0';
+        int n = sscanf(item.c_str(), "%63[a-zA-Z0-9_-]:%dx%d:%15[0-9]", name, &r.width, &r.height, bitrate);
+        if (n < 3 || r.width <= 0 || r.height <= 0 || r.width % 2 || r.height % 2)
+        {
+            g_printerr("ERROR: Invalid simulcast rendition \"%s\", expected name:WxH[:bitrate]\n", item.c_str());
+            return false;
+        }
+        for (const auto &o : out)
+        {
+            if (o.name == name)
+            {
+                g_printerr("ERROR: Duplicated simulcast rendition name %s\n", name);
+                return false;
+            }
+        }
+        r.name = name;
+        r.bitrate = n == 4 ? bitrate : targetBitrate;
+        r.bitrateSet = n == 4 || targetBitrate != defaultTargetBitrate;
+        out.push_back(r);
+    }
+    return !out.empty();
+}
+
 static int CheckCoexistSrc()
 {
     std::string given("");
@@ -398,42 +1034,20 @@ static int CheckCoexistSrc()
     return 0;
 }
 
-int
-main (int argc, char *argv[])
+/*
+ * Build the pipeline of the options into @st and start it, 1 with the error
+ * printed if the options don't fit together or the devices are not ready.
+ * The bus messages of the pipeline go to @busFunc.
+ */
+static int StartStream(Stream &st, GstBusFunc busFunc, gpointer busData)
 {
-    char* pathVar = std::getenv("PATH");
-    std::string setPath = std::string("PATH=") + std::string(pathVar) + ":/usr/sbin:/sbin";
-    putenv((char*)setPath.c_str());
-
-    GMainLoop *loop;
-    GstRTSPServer *server;
-    GstRTSPMountPoints *mounts;
-    GstRTSPMediaFactory *factory;
-    GstRTSPSessionPool *session;
-    GOptionContext *optctx;
-    GError *error = NULL;
-    guint busWatchId;
-
-    session = gst_rtsp_session_pool_new();
-    gst_rtsp_session_pool_set_max_sessions  (session, 255);
-
-
-    optctx = g_option_context_new ("- Application for facedetion detction on SoM board of Xilinx.");
-    g_option_context_add_main_entries (optctx, entries, NULL);
-    g_option_context_add_group (optctx, gst_init_get_option_group ());
-    if (!g_option_context_parse (optctx, &argc, &argv, &error)) {
-        g_printerr ("Error parsing options: %s\n", error->message);
-        g_option_context_free (optctx);
-        g_clear_error (&error);
-        return -1;
-    }
-    g_option_context_free (optctx);
-
-    if (getuid() != 0) 
+    if (!ParseTargets(target))
     {
-      g_printerr ("Please run with sudo.\n");
-      return 1;
+        return 1;
     }
+    bool multiTarget = (targetDp + targetRtsp + targetFile) > 1;
+    /* RTSP of the input file as is, no decoding at all */
+    bool passthrough = filename && nodet && targetRtsp && !multiTarget && std::string(infileType) == std::string(outMediaType);
 
     if (!filename && !mipi && usb <= -2)
     {
@@ -447,147 +1061,730 @@ main (int argc, char *argv[])
       return 1;
     }
 
-    if (!(filename && nodet && std::string(target) =="rtsp" && std::string(infileType) == std::string(outMediaType)) && access("/dev/allegroDecodeIP", F_OK) != 0)
+    if (!codec.Select(codecBackend))
+    {
+        g_printerr("ERROR: Invalid --codec-backend %s, expected auto, vcu or sw.\n", codecBackend);
+        return 1;
+    }
+    st.codec = codec;
+    if (!passthrough && codec.GetKind() == CodecBackend::VCU && access("/dev/allegroDecodeIP", F_OK) != 0)
     {
         g_printerr("ERROR: VCU decoder is not ready.\n%s", msgFirmware);
         return 1;
     }
 
+    if (std::string(usbFormat) == "mjpeg")
+    {
+        usbMjpeg = true;
+    }
+    else if (std::string(usbFormat) != "raw")
+    {
+        g_printerr("ERROR: Invalid --usb-format %s, expected raw or mjpeg.\n", usbFormat);
+        return 1;
+    }
+
     if ( CheckCoexistSrc() != 0 )
     {
         return 1;
     }
 
-    if (std::string(target) == "dp")
+    MetaPublisher &metaPub = st.metaPub;
+    if (metaOut)
     {
-        if (access( "/dev/dri/by-path/platform-fd4a0000.display-card", F_OK ) != 0 )
+        if (nodet)
         {
-          g_printerr ("Error: zynqmp-display device is not ready.\n%s", filename, msgFirmware);
-          return 1;
+            g_print("WARNING: --meta-out is ignored with --nodet.\n");
         }
-
-        std::string allres;
-        std::vector<std::string> resV = GetMonitorResolution(allres);
-        std::ostringstream inputRes;
-        inputRes << w << "x" << h;
-        bool match = false;
-        for (const auto &res : resV)
+        else if (!metaPub.AddSinks(metaOut))
         {
-            std::size_t pos = res.find("@");
-            std::string wh = res.substr(0, pos);
-            if ( wh == inputRes.str() )
-            {
-                match = true;
-            }
+            return 1;
         }
-        if (!match)
+        else if (metaPub.WantsRtsp() && !targetRtsp)
         {
-            g_printerr ("Error: Monitor doesn't support resolution %s\nAll supported resolution:\n%s\n", inputRes.str().c_str(), allres.c_str());
+            g_printerr("ERROR: --meta-out rtsp requires --target rtsp.\n");
             return 1;
         }
     }
-    else if (std::string(target) == "rtsp")
+    bool publishMeta = metaOut && !nodet;
+
+    std::vector<Rendition> renditions;
+    if (simulcast)
     {
-        if ( !(filename && nodet && std::string(infileType) == std::string(outMediaType)) && access( "/dev/allegroIP", F_OK ) != 0 )
+        if (!targetRtsp || targetFile || audio || passthrough)
+        {
+            g_printerr("ERROR: --simulcast requires the RTSP target with encoding, no audio and no file target.\n");
+            return 1;
+        }
+        if (adaptiveEnc || rtcpRateControl)
+        {
+            g_printerr("ERROR: --simulcast doesn't support --adaptive-enc and --rtcp-rate-control.\n");
+            return 1;
+        }
+        if (!ParseSimulcast(simulcast, renditions))
         {
-            g_printerr("ERROR: VCU encoder is not ready.\n");
             return 1;
         }
     }
 
-
-    loop = g_main_loop_new (NULL, FALSE);
-
-    std::string confdir("/opt/xilinx/share/ivas/smartcam/");
-    confdir += (aitask);
-    char pip[2500];
-    pip[0] = '\0';
-
-    char *perf = (char*)"";
-    if (reportFps)
+    /* The daemon owns the pipelines, so it can stop and restart them */
+    bool relay = targetRtsp && (gopCacheKB > 0 || !renditions.empty() || multiTarget || daemonSocket);
+    RtspRelay::CacheMode cacheMode;
+    if (!RtspRelay::ParseMode(gopCacheMode, cacheMode))
     {
-        perf = (char*)"! perf ";
+        g_printerr("ERROR: Invalid --gop-cache-mode: %s\n", gopCacheMode);
+        return 1;
     }
-    if (screenfps)
+    if (relay && audio)
     {
-        setenv("SMARTCAM_SCREENFPS", "1", 1);
+        g_printerr("ERROR: --gop-cache, --simulcast, several targets and the daemon don't support RTSP with audio.\n");
+        return 1;
+    }
+    if (relay && publishMeta && metaPub.WantsRtsp())
+    {
+        g_printerr("ERROR: --gop-cache, --simulcast, several targets and the daemon don't support --meta-out rtsp.\n");
+        return 1;
     }
 
-    if (std::string(target) == "rtsp")
+    if (adaptiveEnc && (nodet || !(targetRtsp || targetFile)))
     {
-        sprintf(pip + strlen(pip), "( ");
+        g_printerr("ERROR: --adaptive-enc requires AI inference and an encoded target.\n");
+        return 1;
     }
+    if (rtcpRateControl && (!targetRtsp || passthrough))
     {
-        if (filename) {
-            sprintf(pip + strlen(pip), 
-                    "%s location=%s ! %sparse ! queue ! omx%sdec ! video/x-raw, width=%d, height=%d, format=NV12, framerate=%d/1 ", 
-                    (std::string(target) == "file") ? "filesrc" : "multifilesrc",
-                    filename, infileType, infileType, w, h, fr);
-        } else if (mipidev != "") {
-            sprintf(pip + strlen(pip), 
-                    "mediasrcbin name=videosrc media-device=%s %s !  video/x-raw, width=%d, height=%d, format=NV12, framerate=%d/1 ", mipidev.c_str(), (w==1920 && h==1080 && std::string(target) == "dp" ? " v4l2src0::io-mode=dmabuf v4l2src0::stride-align=256" : ""), w, h, fr);
-        } else if (usbvideo != "") {
-            sprintf(pip + strlen(pip), 
-                    "v4l2src name=videosrc device=%s io-mode=mmap %s !  video/x-raw, width=%d, height=%d ! videoconvert \
-                    ! video/x-raw, format=NV12",
-                    usbvideo.c_str(), (w==1920 && h==1080 && std::string(target) == "dp" ? "stride-align=256" : ""), w, h );
-        }
+        g_printerr("ERROR: --rtcp-rate-control requires the RTSP target with encoding.\n");
+        return 1;
+    }
 
-        if (!nodet) {
-            sprintf(pip + strlen(pip), " ! tee name=t \
-                    ! queue ! ivas_xmultisrc kconfig=\"%s/preprocess.json\" \
-                    ! queue ! ivas_xfilter kernels-config=\"%s/aiinference.json\" \
-                    ! ima.sink_master \
-                    ivas_xmetaaffixer name=ima ima.src_master ! fakesink \
-                    t. \
-                    ! queue max-size-buffers=1 leaky=%d ! ima.sink_slave_0 ima.src_slave_0 ! queue ! ivas_xfilter kernels-config=\"%s/drawresult.json\" ",
-                    confdir.c_str(),
-                    confdir.c_str(),
-                    filename? 0 : 2, confdir.c_str());
+    std::unique_ptr<EncoderControl> &encCtrl = st.encCtrl;
+    if (adaptiveEnc || rtcpRateControl)
+    {
+        EncoderControl::Params params;
+        params.sceneAdaptive = adaptiveEnc;
+        params.activeBitrate = targetBitrate ? atoi(targetBitrate) : 0;
+        params.idleBitrate = adaptiveEnc ? idleBitrate : params.activeBitrate;
+        params.activeGop = atoi(gopLength);
+        params.idleDelay = (GstClockTime) idleDelayMs * GST_MSECOND;
+        params.bitrateProperty = codec.BitrateProperty();
+        encCtrl.reset(new EncoderControl(params));
+        if (adaptiveEnc)
+        {
+            /* The encoder runs the long idle GOP, the active one is done with forced key frames */
+            gopLength = g_strdup_printf("%d", idleGopLength);
         }
     }
 
-    if (std::string(target) == "rtsp")
+    std::unique_ptr<RtcpRateControl> &rtcpCtrl = st.rtcpCtrl;
+    if (rtcpRateControl)
     {
-        /* create a server instance */
-        server = gst_rtsp_server_new ();
-        g_object_set (server, "service", port, NULL);
-        mounts = gst_rtsp_server_get_mount_points (server);
-        factory = gst_rtsp_media_factory_new ();
-
-
-        if (filename && std::string(infileType) == std::string(outMediaType) && nodet)
+        RtcpRateControl::Params params;
+        params.minBitrate = minBitrate;
+        params.maxBitrate = maxBitrate > 0 ? maxBitrate : targetBitrate ? atoi(targetBitrate) : 0;
+        params.intervalMs = RTCP_CONTROL_INTERVAL_MS;
+        if (!params.maxBitrate)
         {
-            sprintf(pip, "( multifilesrc location=%s ! %sparse ",
-                    filename, infileType, outMediaType
-                    );
+            g_printerr("ERROR: --rtcp-rate-control requires --max-bitrate or --target-bitrate.\n");
+            return 1;
         }
-        else
+        if (params.minBitrate > params.maxBitrate)
         {
-        sprintf(pip + strlen(pip), " \
-                %s \
-                ! queue ! omx%senc \
-                qp-mode=%s  \
-                control-rate=%s  %s%s gop-length=%s \
-                %s \
-                ! video/x-%s, alignment=au\
-                %s%s %s%s %s%s \
-                ",
-                roiOff ? "" : " ! queue ! ivas_xroigen roi-type=1 roi-qp-delta=-10 roi-max-num=10 ",
-                outMediaType,
-                roiOff ? "auto" : "1",
-                controlRate, targetBitrate?"target-bitrate=":"", targetBitrate?targetBitrate:"", gopLength,
-                encodeEnhancedParam ? encodeEnhancedParam : "gop-mode=low-delay-p gdr-mode=horizontal cpb-size=200 num-slices=8 periodicity-idr=270 \
-                    initial-delay=100  filler-data=false min-qp=15  max-qp=40  b-frames=0  low-bandwidth=false ",
-                outMediaType, 
-                profile ? ", profile=\\(string\\)" : "", profile ? profile : "", level ? ", level=\\(string\\)":"", level ? level : "", tier?", tier=\\(string\\)" : "", tier ? tier: ""
-                );
+            g_printerr("ERROR: --min-bitrate is above --max-bitrate.\n");
+            return 1;
         }
+        rtcpCtrl.reset(new RtcpRateControl(params, encCtrl.get()));
+    }
 
-        std::string audioId = "";
-        if (audio)
+    std::unique_ptr<ClipRecorder> &recorder = st.recorder;
+    if (recordOnDetect)
+    {
+        if (nodet || !targetFile)
         {
-            audioId = exec("arecord -l|grep xlnx-i2s-snd-card | awk '{print $2}' | sed 's/://'");
+            g_printerr("ERROR: --record-on-detect requires AI inference and the file target.\n");
+            return 1;
+        }
+        if (prerollSec < 0 || recordQuietSec <= 0)
+        {
+            g_printerr("ERROR: Invalid --preroll or --record-quiet.\n");
+            return 1;
+        }
+        if (access(recordDir, W_OK) != 0)
+        {
+            g_printerr("ERROR: Can't write to --record-dir %s\n", recordDir);
+            return 1;
+        }
+        ClipRecorder::Params params;
+        params.preroll = (GstClockTime) prerollSec * GST_SECOND;
+        params.quiet = (GstClockTime) recordQuietSec * GST_SECOND;
+        if (recordClasses)
+        {
+            ClipRecorder::ParseClasses(recordClasses, params.classes);
+        }
+        params.dir = recordDir;
+        params.ext = outMediaType;
+        recorder.reset(new ClipRecorder(params));
+    }
+
+    std::unique_ptr<SegmentWriter> &segWriter = st.segWriter;
+    if (segmentSec > 0 || segmentMB > 0)
+    {
+        if (!targetFile || recordOnDetect)
+        {
+            g_printerr("ERROR: --segment-sec and --segment-mb require the file target without --record-on-detect.\n");
+            return 1;
+        }
+        if (access(recordDir, W_OK) != 0)
+        {
+            g_printerr("ERROR: Can't write to --record-dir %s\n", recordDir);
+            return 1;
+        }
+        SegmentWriter::Params params;
+        params.duration = (GstClockTime) std::max(segmentSec, 0) * GST_SECOND;
+        params.maxBytes = (guint64) std::max(segmentMB, 0) * 1024 * 1024;
+        params.maxSegments = std::max(maxSegments, 0);
+        params.maxTotalBytes = (guint64) std::max(maxStorageMB, 0) * 1024 * 1024;
+        params.dir = recordDir;
+        params.ext = outMediaType;
+        segWriter.reset(new SegmentWriter(params));
+    }
+
+    st.tracker.reset(new SharedTracker(TRACK_MIN_IOU, TRACK_MAX_MISSED));
+
+    std::unique_ptr<SnapshotExporter> &snapshotExp = st.snapshotExp;
+    if (snapshot)
+    {
+        if (nodet)
+        {
+            g_printerr("ERROR: --snapshot requires AI inference.\n");
+            return 1;
+        }
+        SnapshotExporter::Params params;
+        params.out = snapshot;
+        if (snapshotClasses)
+        {
+            ClipRecorder::ParseClasses(snapshotClasses, params.classes);
+        }
+        params.interval = (GstClockTime) std::max(snapshotIntervalSec, 0) * GST_SECOND;
+        params.maxPerSec = std::max(snapshotRate, 0);
+        params.quality = std::min(std::max(snapshotQuality, 1), 100);
+        params.threads = 1;
+        snapshotExp.reset(new SnapshotExporter(params, st.tracker.get()));
+        if (!snapshotExp->Open())
+        {
+            return 1;
+        }
+    }
+
+    std::vector<MultiModel::Model> models;
+    if (!nodet && !MultiModel::ParseModels(aitask, models))
+    {
+        g_printerr("ERROR: Invalid --aitask %s.\n", aitask);
+        return 1;
+    }
+    std::unique_ptr<MultiModel> &multiModel = st.multiModel;
+    if (models.size() > 1)
+    {
+        if (tileGrid)
+        {
+            g_printerr("ERROR: --tiles works with a single AI task only.\n");
+            return 1;
+        }
+        multiModel.reset(new MultiModel(models));
+    }
+
+    std::unique_ptr<TiledDetector> &tiler = st.tiler;
+    if (tileGrid)
+    {
+        TiledDetector::Params params;
+        if (nodet || !TiledDetector::ParseGrid(tileGrid, params.cols, params.rows))
+        {
+            g_printerr("ERROR: --tiles requires AI inference and a valid grid.\n");
+            return 1;
+        }
+        if (tileOverlap < 0 || tileOverlap > 50)
+        {
+            g_printerr("ERROR: --tile-overlap must be within 0 to 50.\n");
+            return 1;
+        }
+        params.overlap = tileOverlap / 100.0;
+        params.nmsIou = 0.5;
+        tiler.reset(new TiledDetector(params));
+    }
+
+    std::unique_ptr<Cascade> &cascade = st.cascade;
+    std::string cascadeDir;
+    if (cascadeTask)
+    {
+        if (nodet)
+        {
+            g_printerr("ERROR: --cascade requires AI inference.\n");
+            return 1;
+        }
+        cascadeDir = cascadeTask[0] == '/' ? cascadeTask : std::string("/opt/xilinx/share/ivas/smartcam/") + cascadeTask;
+        if (access((cascadeDir + "/preprocess.json").c_str(), R_OK) != 0
+                || access((cascadeDir + "/aiinference.json").c_str(), R_OK) != 0)
+        {
+            g_printerr("ERROR: %s needs a preprocess.json and an aiinference.json for --cascade.\n", cascadeDir.c_str());
+            return 1;
+        }
+        Cascade::Params params;
+        if (cascadeClasses)
+        {
+            ClipRecorder::ParseClasses(cascadeClasses, params.classes);
+        }
+        params.interval = (GstClockTime) std::max(cascadeIntervalMs, 0) * GST_MSECOND;
+        params.maxPerFrame = std::max(cascadeMax, 1);
+        params.minSize = 32;
+        cascade.reset(new Cascade(params, st.tracker.get()));
+    }
+
+    /* Resolution of the video after the auto framing */
+    gint outW = w, outH = h;
+    std::unique_ptr<ThreadSched> &sched = st.sched;
+    if (threadSched)
+    {
+        std::vector<ThreadSched::Policy> policies;
+        for (gchar **t = threadSched; *t; t++)
+        {
+            ThreadSched::Policy policy;
+            if (!ThreadSched::ParsePolicy(*t, policy))
+            {
+                g_printerr("ERROR: Invalid --thread-sched %s, expected <stage>=<cpus>[:<other|fifo|rr>[:<priority>]].\n", *t);
+                return 1;
+            }
+            policies.push_back(policy);
+        }
+        sched.reset(new ThreadSched(policies));
+    }
+
+    std::unique_ptr<Watchdog> &watchdog = st.watchdog;
+    if (watchdogMs > 0)
+    {
+        watchdog.reset(new Watchdog((guint) watchdogMs));
+        st.watchdogMs = (guint) watchdogMs;
+    }
+
+    std::unique_ptr<MjpegDecoder> &mjpegDec = st.mjpegDec;
+    if (usbvideo != "" && usbMjpeg)
+    {
+        mjpegDec.reset(new MjpegDecoder((guint) std::max(mjpegThreads, 1)));
+    }
+
+    std::unique_ptr<AutoFramer> &framer = st.framer;
+    if (autoFrame)
+    {
+        AutoFramer::Params params;
+        if (nodet || sscanf(autoFrame, "%dx%d", &params.outWidth, &params.outHeight) != 2
+                || params.outWidth <= 0 || params.outHeight <= 0 || params.outWidth % 2 || params.outHeight % 2)
+        {
+            g_printerr("ERROR: --autoframe requires AI inference and an even <width>x<height>.\n");
+            return 1;
+        }
+        if (autoFrameClasses)
+        {
+            ClipRecorder::ParseClasses(autoFrameClasses, params.classes);
+        }
+        params.smoothing = (GstClockTime) std::max(autoFrameSmoothMs, 0) * GST_MSECOND;
+        outW = params.outWidth;
+        outH = params.outHeight;
+        framer.reset(new AutoFramer(params));
+    }
+
+    /* The renditions of another size are scaled in the app, all from one
+     * mapping of the frame */
+    std::vector<RenditionScaler::Output> scaled;
+    for (const auto &r : renditions)
+    {
+        if (targetRtsp && !passthrough && (r.width != outW || r.height != outH))
+        {
+            scaled.push_back({ std::string(SCALESRC_NAME "_") + r.name, r.width, r.height });
+        }
+    }
+    if (!scaled.empty())
+    {
+        st.rendScaler.reset(new RenditionScaler(scaled));
+    }
+
+    std::unique_ptr<Analytics> &analytics = st.analytics;
+    if (countLines || countZones || heatmap || heatmapOverlay)
+    {
+        Analytics::Params params;
+        for (gchar **l = countLines; l && *l; l++)
+        {
+            std::pair<std::string, std::vector<Analytics::Point>> line;
+            if (!Analytics::ParseShape(*l, 2, line) || line.second.size() != 2)
+            {
+                g_printerr("ERROR: Invalid --count-line %s, expected <name>:<x0>,<y0>,<x1>,<y1>.\n", *l);
+                return 1;
+            }
+            params.lines.push_back(line);
+        }
+        for (gchar **z = countZones; z && *z; z++)
+        {
+            std::pair<std::string, std::vector<Analytics::Point>> zone;
+            if (!Analytics::ParseShape(*z, 3, zone))
+            {
+                g_printerr("ERROR: Invalid --count-zone %s, expected <name>: and at least 3 points.\n", *z);
+                return 1;
+            }
+            params.zones.push_back(zone);
+        }
+        if (nodet)
+        {
+            g_printerr("ERROR: --count-line, --count-zone and --heatmap require AI inference.\n");
+            return 1;
+        }
+        if (heatmapOverlay && (!heatmap || !targetDp || framer))
+        {
+            g_printerr("ERROR: --heatmap-overlay requires --heatmap and the dp target, without --autoframe.\n");
+            return 1;
+        }
+        params.width = w;
+        params.height = h;
+        params.heatmap = heatmap;
+        params.halfLife = (GstClockTime) std::max(heatmapHalfLifeSec, 0) * GST_SECOND;
+        analytics.reset(new Analytics(params, st.tracker.get()));
+    }
+
+    std::unique_ptr<ZoneFilter> &zones = st.zones;
+    {
+        std::vector<ZoneFilter::Zone> list;
+        std::string taskConfig = nodet ? "" : "/opt/xilinx/share/ivas/smartcam/" + models[0].task + "/preprocess.json";
+        if (zonesFile)
+        {
+            if (nodet || !ZoneFilter::Load(zonesFile, list) || list.empty())
+            {
+                g_printerr("ERROR: --zones requires AI inference and a file with at least one zone.\n");
+                return 1;
+            }
+        }
+        else if (!nodet && access(taskConfig.c_str(), R_OK) == 0 && !ZoneFilter::Load(taskConfig, list))
+        {
+            return 1;
+        }
+        if (!list.empty())
+        {
+            zones.reset(new ZoneFilter(list, w, h));
+        }
+    }
+
+    if (reportFps && !passthrough && (filename || targetRtsp || targetFile))
+    {
+        st.codecMeter.reset(new CodecMeter(codec));
+    }
+
+    if (shareFrames)
+    {
+        if (nodet || shareRing < 2)
+        {
+            g_printerr("ERROR: --share-frames requires AI inference and a --share-ring of at least 2.\n");
+            return 1;
+        }
+        st.frameShare.reset(new FrameShare((guint) shareRing));
+        if (!st.frameShare->Listen(shareFrames))
+        {
+            return 1;
+        }
+    }
+
+    PipelineHooks &hooks = st.hooks;
+    st.liveBitrate = (targetRtsp || targetFile) && !passthrough && renditions.empty() && !encCtrl;
+    hooks.metaPub = publishMeta ? &metaPub : NULL;
+    hooks.encCtrl = encCtrl.get();
+    hooks.rtcpCtrl = rtcpCtrl.get();
+    hooks.recorder = recorder.get();
+    hooks.segWriter = segWriter.get();
+    hooks.snapshot = snapshotExp.get();
+    hooks.tiler = tiler.get();
+    hooks.cascade = cascade.get();
+    hooks.multiModel = multiModel.get();
+    hooks.framer = framer.get();
+    hooks.rendScaler = st.rendScaler.get();
+    hooks.analytics = analytics.get();
+    hooks.zones = zones.get();
+    hooks.codecMeter = st.codecMeter.get();
+    hooks.frameShare = st.frameShare.get();
+    hooks.mjpegDec = mjpegDec.get();
+    hooks.sched = sched.get();
+    hooks.watchdog = watchdog.get();
+    hooks.metricsGroup = Metrics::CurrentGroup();
+
+    std::string encodeDefaults = codec.EncoderDefaults(outMediaType, adaptiveEnc ? idleGopLength : 270);
+    const char *defaultEncodeParam = encodeDefaults.c_str();
+
+    if (targetDp)
+    {
+        if (access( "/dev/dri/by-path/platform-fd4a0000.display-card", F_OK ) != 0 )
+        {
+          g_printerr ("Error: zynqmp-display device is not ready.\n%s", filename, msgFirmware);
+          return 1;
+        }
+
+        std::string allres;
+        std::vector<std::string> resV = GetMonitorResolution(allres);
+        std::ostringstream inputRes;
+        inputRes << outW << "x" << outH;
+        bool match = false;
+        for (const auto &res : resV)
+        {
+            std::size_t pos = res.find("@");
+            std::string wh = res.substr(0, pos);
+            if ( wh == inputRes.str() )
+            {
+                match = true;
+            }
+        }
+        if (!match)
+        {
+            g_printerr ("Error: Monitor doesn't support resolution %s\nAll supported resolution:\n%s\n", inputRes.str().c_str(), allres.c_str());
+            return 1;
+        }
+    }
+    if (targetRtsp || targetFile)
+    {
+        if ( !passthrough && codec.GetKind() == CodecBackend::VCU && access( "/dev/allegroIP", F_OK ) != 0 )
+        {
+            g_printerr("ERROR: VCU encoder is not ready.\n");
+            return 1;
+        }
+    }
+
+
+    if (pipelineProfile)
+    {
+        std::string path = pipelineProfile[0] == '/' ? pipelineProfile
+            : std::string("/opt/xilinx/share/ivas/smartcam/profiles/") + pipelineProfile + ".json";
+        /* The factories of the element stages in this pipeline */
+        std::map<std::string, std::string> factories;
+        if (filename)
+        {
+            factories["capture"] = (targetFile && !targetRtsp) ? "filesrc" : "multifilesrc";
+            factories["decoder"] = codec.DecoderFactory(infileType);
+        }
+        else
+        {
+            factories["capture"] = mipidev != "" ? "mediasrcbin" : "v4l2src";
+        }
+        if (!nodet)
+        {
+            factories["preprocess"] = "ivas_xmultisrc";
+            factories["inference"] = "ivas_xfilter";
+            if (!nodraw)
+            {
+                factories["draw"] = "ivas_xfilter";
+            }
+        }
+        if ((targetRtsp || targetFile) && !passthrough)
+        {
+            factories["encoder"] = codec.EncoderFactory(outMediaType);
+            if (!roiOff && codec.GetKind() == CodecBackend::VCU)
+            {
+                factories["roi"] = "ivas_xroigen";
+            }
+        }
+        if (targetDp)
+        {
+            factories["display"] = "kmssink";
+        }
+        if (!pipeProfile.Load(path, codec.Name()) || !pipeProfile.Validate(factories))
+        {
+            return 1;
+        }
+        g_print("INFO: Pipeline profile %s%s%s\n", path.c_str(),
+                pipeProfile.Description().empty() ? "" : ": ", pipeProfile.Description().c_str());
+    }
+
+    std::string confdir("/opt/xilinx/share/ivas/smartcam/");
+    /* Drawing and the single model pipelines use the first task */
+    confdir += nodet ? aitask : models[0].task.c_str();
+    std::string drawConfig = confdir + "/drawresult.json";
+    if (multiModel && !nodraw)
+    {
+        /* One draw pass for the objects of all models */
+        gchar *name = g_strdup_printf("smartcam-%d-%p-drawresult.json", (int) getpid(), (void *) &st);
+        gchar *path = g_build_filename(g_get_tmp_dir(), name, NULL);
+        drawConfig = path;
+        st.drawConfig = path;
+        g_free(path);
+        g_free(name);
+        if (!MultiModel::WriteDrawConfig(models, "/opt/xilinx/share/ivas/smartcam/", drawConfig))
+        {
+            return 1;
+        }
+    }
+    std::string pip;
+
+    char *perf = (char*)"";
+    if (reportFps)
+    {
+        perf = (char*)"! perf ";
+        Metrics::Get().Start(METRICS_INTERVAL_MS);
+    }
+    if (screenfps)
+    {
+        setenv("SMARTCAM_SCREENFPS", "1", 1);
+    }
+
+    if (targetRtsp && !relay)
+    {
+        pip += "( ";
+    }
+    {
+        if (filename) {
+            AppendF(pip,
+                    "%s location=%s%s ! %sparse ! %s ! %s name=%s%s%s%s ! video/x-raw, width=%d, height=%d, format=NV12, framerate=%d/1 ", 
+                    (targetFile && !targetRtsp) ? "filesrc" : "multifilesrc",
+                    filename, pipeProfile.Props("capture").c_str(), infileType, pipeProfile.Queue("decoder").c_str(),
+                    codec.DecoderFactory(infileType).c_str(), DECODER_NAME, codec.DecoderProps().c_str(),
+                    pipeProfile.Props("decoder").c_str(), codec.DecoderConvert().c_str(), w, h, fr);
+        } else if (mipidev != "") {
+            AppendF(pip,
+                    "mediasrcbin name=videosrc media-device=%s %s%s !  video/x-raw, width=%d, height=%d, format=NV12, framerate=%d/1 ", mipidev.c_str(), (w==1920 && h==1080 && targetDp ? " v4l2src0::io-mode=dmabuf v4l2src0::stride-align=256" : ""), pipeProfile.Props("capture").c_str(), w, h, fr);
+        } else if (usbvideo != "" && usbMjpeg) {
+            AppendF(pip,
+                    "v4l2src name=videosrc device=%s io-mode=mmap%s ! image/jpeg, width=%d, height=%d, framerate=%d/1 \
+                    ! appsink name=%s async=false appsrc name=%s ! video/x-raw, format=NV12",
+                    usbvideo.c_str(), pipeProfile.Props("capture").c_str(), w, h, fr, MJPEGSINK_NAME, MJPEGSRC_NAME );
+        } else if (usbvideo != "") {
+            AppendF(pip,
+                    "v4l2src name=videosrc device=%s io-mode=mmap %s%s !  video/x-raw, format=(string){YUY2, UYVY}, width=%d, height=%d ! yuyvtonv12 \
+                    ! video/x-raw, format=NV12",
+                    usbvideo.c_str(), (w==1920 && h==1080 && targetDp ? "stride-align=256" : ""), pipeProfile.Props("capture").c_str(), w, h );
+        }
+
+        /* Frames of a file are not dropped */
+        std::string slaveQueue = pipeProfile.Queue("slave", filename ? "max-size-buffers=1 leaky=0" : "max-size-buffers=1 leaky=2");
+
+        /* With the cascade, the frames with the detections go through the app,
+         * which crops the objects into the classification branch */
+        std::string cascadeBranch;
+        std::string slaveOut = "! " + pipeProfile.Queue("draw", "name=" METAQUEUE_NAME);
+        if (cascade) {
+            std::ostringstream branch;
+            branch << "appsrc name=" << CASCSRC_NAME << " " << InferenceDesc(cascadeDir, "cascade-")
+                   << "! appsink name=" << CASCRES_NAME << " async=false ";
+            cascadeBranch = branch.str();
+            slaveOut = "! " + pipeProfile.Queue("cascade") + " ! appsink name=" CASCFRAME_NAME " async=false appsrc name="
+                CASCOUT_NAME " ! " + pipeProfile.Queue("draw", "name=" METAQUEUE_NAME);
+        }
+
+        if (!nodet && multiModel) {
+            /* The app hands the frames to the branch of each model and feeds
+             * the merged result on */
+            AppendF(pip, " ! %s ! appsink name=%s async=false ",
+                    pipeProfile.Queue("models", filename ? "max-size-buffers=2 leaky=0" : "max-size-buffers=2 leaky=2").c_str(),
+                    MODELFRAME_NAME);
+            for (std::size_t i = 0; i < models.size(); i++) {
+                std::string dir = std::string("/opt/xilinx/share/ivas/smartcam/") + models[i].task;
+                AppendF(pip, "appsrc name=%s%zu %s! appsink name=%s%zu async=false ",
+                        MODELSRC_PREFIX, i, InferenceDesc(dir, "model-").c_str(), MODELRES_PREFIX, i);
+            }
+            AppendF(pip, "%s appsrc name=%s %s ",
+                    cascadeBranch.c_str(), MODELOUT_NAME, slaveOut.c_str());
+        } else if (!nodet && tiler) {
+            /* The app splits the frames into tiles, runs them through the inference
+             * branch and feeds the merged result to the master pad */
+            AppendF(pip, " ! tee name=t \
+                    ! %s ! appsink name=%s async=false \
+                    appsrc name=%s %s\
+                    ! appsink name=%s async=false \
+                    appsrc name=%s ! ima.sink_master \
+                    ivas_xmetaaffixer name=ima ima.src_master ! fakesink \
+                    %s t. \
+                    ! %s ! ima.sink_slave_0 ima.src_slave_0 %s ",
+                    pipeProfile.Queue("tiles").c_str(), TILESINK_NAME, TILESRC_NAME,
+                    InferenceDesc(confdir, "tile-").c_str(),
+                    TILERES_NAME, MERGESRC_NAME,
+                    cascadeBranch.c_str(), slaveQueue.c_str(), slaveOut.c_str());
+        } else if (!nodet) {
+            /* With the watchdog, a stuck inference branch must not hold up the tee */
+            AppendF(pip, " ! tee name=t \
+                    %s\
+                    ! ima.sink_master \
+                    ivas_xmetaaffixer name=ima ima.src_master ! fakesink \
+                    %s t. \
+                    ! %s ! ima.sink_slave_0 ima.src_slave_0 %s ",
+                    InferenceDesc(confdir, "", watchdog && !filename ? "name=" PREPQUEUE_NAME " max-size-buffers=2 leaky=2"
+                        : "name=" PREPQUEUE_NAME).c_str(),
+                    cascadeBranch.c_str(), slaveQueue.c_str(), slaveOut.c_str());
+        }
+        if (!nodet) {
+            if (!nodraw) {
+                AppendF(pip, "! ivas_xfilter name=%s kernels-config=\"%s\"%s ",
+                        DRAW_NAME, drawConfig.c_str(), pipeProfile.Props("draw").c_str());
+            }
+        }
+        if (framer) {
+            AppendF(pip, "! %s ! appsink name=%s async=false appsrc name=%s ",
+                    pipeProfile.Queue("autoframe").c_str(), FRAMESINK_NAME, FRAMESRC_NAME);
+        }
+    }
+
+    if (multiTarget && targetDp)
+    {
+        /* Local display taps the drawn frames, the encoded targets share the rest */
+        AppendF(pip, " ! tee name=out \
+                out. ! %s %s out. ! %s ",
+                pipeProfile.Queue("display", "max-size-buffers=1 leaky=2").c_str(), DisplaySinkDesc().c_str(),
+                pipeProfile.Queue("encode-branch").c_str());
+    }
+
+    if (targetRtsp)
+    {
+        GstRTSPMediaFactory *factory;
+        st.port = port;
+
+        if (passthrough)
+        {
+            pip.clear();
+            AppendF(pip, "%smultifilesrc location=%s ! %sparse ",
+                    relay ? "" : "( ", filename, infileType
+                    );
+        }
+        else if (!renditions.empty())
+        {
+            /* One capture, inference and draw chain, encoded per rendition;
+             * the other sizes are scaled by the app, from its own branch */
+            AppendF(pip, " ! tee name=sc ");
+            if (st.rendScaler)
+            {
+                AppendF(pip, " sc. ! %s ! appsink name=%s ", pipeProfile.Queue("scale").c_str(), SCALESINK_NAME);
+            }
+            for (std::size_t i = 0; i < renditions.size(); i++)
+            {
+                const Rendition &r = renditions[i];
+                std::string encName = i == 0 ? std::string(ENCODER_NAME) : std::string(ENCODER_NAME "_") + r.name;
+                if (r.width != outW || r.height != outH)
+                {
+                    AppendF(pip, " appsrc name=%s_%s ", SCALESRC_NAME, r.name.c_str());
+                }
+                else
+                {
+                    AppendF(pip, " sc. ! %s ", pipeProfile.Queue("scale").c_str());
+                }
+                AppendF(pip, "%s ! %s %s ! appsink name=%s_%s ",
+                        EncoderDesc(encName.c_str(), r.bitrate.c_str(), r.bitrateSet, defaultEncodeParam, false).c_str(),
+                        pipeProfile.Queue("output").c_str(), perf, RELAYSINK_NAME, r.name.c_str());
+            }
+        }
+        else
+        {
+        /* Parentheses are bin delimiters in the launch line of the factory */
+        AppendF(pip, "%s",
+                EncoderDesc(ENCODER_NAME, targetBitrate, targetBitrate != defaultTargetBitrate, defaultEncodeParam, !relay).c_str());
+            if (targetFile)
+            {
+                /* The same encoded stream is streamed and recorded */
+                AppendF(pip, " ! tee name=et \
+                        et. ! %s %s \
+                        et. ",
+                        pipeProfile.Queue("file").c_str(), FileSinkDesc().c_str());
+            }
+        }
+
+        std::string audioId = "";
+        if (audio)
+        {
+            audioId = exec("arecord -l|grep xlnx-i2s-snd-card | awk '{print $2}' | sed 's/://'");
             std::size_t pos = audioId.find("\n");
             if (pos != std::string::npos) {
                 audioId = audioId.substr(0,pos);
@@ -596,87 +1793,845 @@ main (int argc, char *argv[])
             }
         }
 
-        if (audio && audioId != "")
+        if (audio && audioId != "")
+        {
+        AppendF(pip, " \
+                ! queue ! mux. \
+                alsasrc device=hw:%s,1 ! queue ! audio/x-raw,format=S24_32LE,rate=48000,channnels=2  \
+                ! audioconvert ! faac ! mux. \
+                mpegtsmux name=mux \
+                ! rtpmp2tpay name=pay0 pt=33 ", audioId.c_str()
+               );
+        }
+        else if (relay)
+        {
+            if (renditions.empty())
+            {
+            AppendF(pip, " \
+                    ! %s %s ! appsink name=%s ",
+                    pipeProfile.Queue("output").c_str(), perf, RELAYSINK_NAME);
+            }
+        }
+        else
+        {
+        AppendF(pip, " \
+                ! %s %s ! rtp%spay name=pay0 pt=96 ",
+                pipeProfile.Queue("output").c_str(), perf, outMediaType);
+        }
+
+        std::vector<std::unique_ptr<RtspRelay>> &relays = st.relays;
+        std::vector<std::string> mountPaths;
+        GstElement *&pipeline = st.pipeline;
+        if (relay)
+        {
+            /* The encoders run all the time and every client is fed through a relay */
+            pipeline = gst_parse_launch(pip.c_str(), NULL);
+            if (!pipeline)
+            {
+                g_printerr("ERROR: Can't build the pipeline.\n");
+                return 1;
+            }
+
+            std::vector<std::string> sinkNames;
+            if (renditions.empty())
+            {
+                mountPaths.push_back("/test");
+                sinkNames.push_back(RELAYSINK_NAME);
+            }
+            for (const auto &r : renditions)
+            {
+                mountPaths.push_back("/" + r.name);
+                sinkNames.push_back(std::string(RELAYSINK_NAME "_") + r.name);
+            }
+
+            for (std::size_t i = 0; i < mountPaths.size(); i++)
+            {
+                relays.emplace_back(new RtspRelay((gsize)gopCacheKB * 1024, cacheMode));
+                relays.back()->AttachSink(pipeline, sinkNames[i].c_str());
+                factory = relays.back()->CreateFactory(outMediaType);
+                if (rtcpCtrl)
+                {
+                    g_signal_connect (factory, "media-configure", (GCallback) media_configure_rtcp_cb, rtcpCtrl.get());
+                }
+                if (sched)
+                {
+                    /* The payloaders run in the pipeline of each client */
+                    g_signal_connect (factory, "media-configure", (GCallback) ThreadSched::MediaConfigureCb, sched.get());
+                }
+                st.mounts.push_back(std::make_pair(mountPaths[i], factory));
+            }
+
+            if (!AttachHooks(pipeline, &hooks))
+            {
+                return 1;
+            }
+            GstBus *bus = gst_element_get_bus (pipeline);
+            st.busWatchId = gst_bus_add_watch (bus, busFunc, busData);
+            gst_object_unref (bus);
+            gst_element_set_state (pipeline, GST_STATE_PLAYING);
+        }
+        else
+        {
+            if (publishMeta && metaPub.WantsRtsp())
+            {
+                AppendF(pip, " \
+                        appsrc name=metasrc is-live=true format=time do-timestamp=false max-bytes=65536 \
+                        caps=application/x-smartcam-meta,encoding=json \
+                        ! queue ! rtpgstpay name=pay1 pt=98 ");
+            }
+            AppendF(pip, ")");
+
+            factory = gst_rtsp_media_factory_new ();
+            gst_rtsp_media_factory_set_launch (factory, pip.c_str());
+            gst_rtsp_media_factory_set_shared (factory, TRUE);
+            g_signal_connect (factory, "media-configure", (GCallback) media_configure_cb, &hooks);
+            if (rtcpCtrl)
+            {
+                g_signal_connect (factory, "media-configure", (GCallback) media_configure_rtcp_cb, rtcpCtrl.get());
+            }
+            mountPaths.push_back("/test");
+            st.mounts.push_back(std::make_pair(std::string("/test"), factory));
+        }
+        if (rtcpCtrl)
+        {
+            rtcpCtrl->Start();
+        }
+
+        if (!ServeRtsp(st))
+        {
+            return 1;
+        }
+
+        /* start serving */
+        std::vector<std::string> ips = GetIp();
+        std::ostringstream addr("");
+        for (auto&ip : ips)
+        {
+            for (auto&mount : mountPaths)
+            {
+                addr << "rtsp://" << ip << ":" << port << mount << "\n";
+            }
+        }
+        g_print ("stream ready at:\n %s", addr.str().c_str());
+    }
+    else
+    {
+        if (targetFile)
+        {
+            AppendF(pip, "%s \
+                %s \
+                %s",
+                EncoderDesc(ENCODER_NAME, targetBitrate, targetBitrate != defaultTargetBitrate, defaultEncodeParam, false).c_str(),
+                perf,
+                FileSinkDesc().c_str());
+        }
+        else if (targetDp)
+        {
+            AppendF(pip, "\
+                    ! %s %s %s", pipeProfile.Queue("display").c_str(), perf, DisplaySinkDesc().c_str());
+        }
+
+        st.pipeline = gst_parse_launch(pip.c_str(), NULL);
+        if (!st.pipeline)
+        {
+            g_printerr("ERROR: Can't build the pipeline.\n");
+            return 1;
+        }
+        if (!AttachHooks(st.pipeline, &hooks))
+        {
+            return 1;
+        }
+        gst_element_set_state (st.pipeline, GST_STATE_PLAYING);
+        GstBus *bus = gst_element_get_bus (st.pipeline);
+        st.busWatchId = gst_bus_add_watch (bus, busFunc, busData);
+        gst_object_unref (bus);
+    }
+    if (sched)
+    {
+        sched->ApplyMain();
+    }
+    return 0;
+}
+
+/* Daemon mode: streams by name, started, changed and stopped on the control socket */
+static std::map<std::string, std::unique_ptr<Stream>> daemonStreams;
+/* Stopped streams with their models still loaded, the least recently stopped first */
+static std::list<std::unique_ptr<Stream>> warmStreams;
+static guint streamSerial = 0;
+
+/* The values of the options on the daemon's command line */
+struct OptionDefault
+{
+    const GOptionEntry *entry;
+    gboolean b;
+    gint i;
+    gchar *s;
+    gchar **v;
+};
+static std::vector<OptionDefault> optionDefaults;
+
+static void SaveOptions()
+{
+    for (const GOptionEntry *e = entries; e->long_name; e++)
+    {
+        OptionDefault d = { e, FALSE, 0, NULL, NULL };
+        switch (e->arg)
+        {
+            case G_OPTION_ARG_NONE:
+                d.b = *(gboolean *) e->arg_data;
+                break;
+            case G_OPTION_ARG_INT:
+                d.i = *(gint *) e->arg_data;
+                break;
+            case G_OPTION_ARG_STRING:
+            case G_OPTION_ARG_FILENAME:
+                d.s = *(gchar **) e->arg_data;
+                break;
+            case G_OPTION_ARG_STRING_ARRAY:
+                d.v = *(gchar ***) e->arg_data;
+                break;
+            default:
+                break;
+        }
+        optionDefaults.push_back(d);
+    }
+}
+
+/* Back to the daemon's options, the values parsed for the last stream are freed */
+static void RestoreOptions()
+{
+    for (const auto &d : optionDefaults)
+    {
+        gpointer data = d.entry->arg_data;
+        switch (d.entry->arg)
+        {
+            case G_OPTION_ARG_NONE:
+                *(gboolean *) data = d.b;
+                break;
+            case G_OPTION_ARG_INT:
+                *(gint *) data = d.i;
+                break;
+            case G_OPTION_ARG_STRING:
+            case G_OPTION_ARG_FILENAME:
+                if (*(gchar **) data != d.s)
+                {
+                    g_free(*(gchar **) data);
+                    *(gchar **) data = d.s;
+                }
+                break;
+            case G_OPTION_ARG_STRING_ARRAY:
+                if (*(gchar ***) data != d.v)
+                {
+                    g_strfreev(*(gchar ***) data);
+                    *(gchar ***) data = d.v;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    /* Derived from the options */
+    mipidev = "";
+    usbvideo = "";
+    usbMjpeg = false;
+    targetDp = targetRtsp = targetFile = false;
+    pipeProfile = PipelineProfile();
+    /* Read by the drawing kernel when it starts */
+    unsetenv("SMARTCAM_SCREENFPS");
+}
+
+/* Set the option globals from the daemon's options and @args */
+static bool ParseStreamArgs(const std::vector<std::string> &args)
+{
+    RestoreOptions();
+
+    gchar **argv = g_new0(gchar *, args.size() + 2);
+    argv[0] = g_strdup("smartcam");
+    for (std::size_t i = 0; i < args.size(); i++)
+    {
+        argv[i + 1] = g_strdup(args[i].c_str());
+    }
+    GOptionContext *ctx = g_option_context_new(NULL);
+    g_option_context_add_main_entries(ctx, entries, NULL);
+    g_option_context_set_help_enabled(ctx, FALSE);
+    GError *error = NULL;
+    bool ok = g_option_context_parse_strv(ctx, &argv, &error);
+    if (!ok)
+    {
+        g_printerr("ERROR: %s\n", error->message);
+        g_clear_error(&error);
+    }
+    else if (argv[1])
+    {
+        g_printerr("ERROR: Unexpected argument %s\n", argv[1]);
+        ok = false;
+    }
+    g_option_context_free(ctx);
+    g_strfreev(argv);
+    return ok;
+}
+
+/* The entry of a "--name[=value]" or "-c" argument */
+static const GOptionEntry *FindEntry(const std::string &arg)
+{
+    for (const GOptionEntry *e = entries; e->long_name; e++)
+    {
+        if (arg.compare(0, 2, "--") == 0 && arg.substr(2, arg.find('=') - 2) == e->long_name)
+        {
+            return e;
+        }
+        if (e->short_name && arg.size() == 2 && arg[0] == '-' && arg[1] == e->short_name)
+        {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/* Replace option @name in @args with @value: a boolean for a flag, a string
+ * or a number, an array of them for the options which can be repeated, null
+ * to remove it */
+static bool SetArg(std::vector<std::string> &args, const char *name, json_t *value)
+{
+    const GOptionEntry *entry = FindEntry(std::string("--") + name);
+    if (!entry)
+    {
+        g_printerr("ERROR: Unknown option %s\n", name);
+        return false;
+    }
+
+    std::vector<std::string> out;
+    for (std::size_t i = 0; i < args.size(); i++)
+    {
+        if (FindEntry(args[i]) != entry)
         {
-        sprintf(pip + strlen(pip), " \
-                ! queue ! mux. \
-                alsasrc device=hw:%s,1 ! queue ! audio/x-raw,format=S24_32LE,rate=48000,channnels=2  \
-                ! audioconvert ! faac ! mux. \
-                mpegtsmux name=mux \
-                ! rtpmp2tpay name=pay0 pt=33 )", audioId.c_str()
-               );
+            out.push_back(args[i]);
+        }
+        else if (entry->arg != G_OPTION_ARG_NONE && args[i].find('=') == std::string::npos)
+        {
+            /* and its value */
+            i++;
+        }
+    }
+
+    std::string option = std::string("--") + name;
+    std::vector<json_t *> values;
+    if (json_is_array(value) && entry->arg == G_OPTION_ARG_STRING_ARRAY)
+    {
+        for (std::size_t i = 0; i < json_array_size(value); i++)
+        {
+            values.push_back(json_array_get(value, i));
+        }
+    }
+    else if (!json_is_null(value))
+    {
+        values.push_back(value);
+    }
+    for (json_t *v : values)
+    {
+        if (entry->arg == G_OPTION_ARG_NONE && json_is_boolean(v))
+        {
+            if (json_is_true(v))
+            {
+                out.push_back(option);
+            }
+        }
+        else if (entry->arg != G_OPTION_ARG_NONE && json_is_string(v))
+        {
+            out.push_back(option + "=" + json_string_value(v));
+        }
+        else if (entry->arg != G_OPTION_ARG_NONE && json_is_integer(v))
+        {
+            out.push_back(option + "=" + std::to_string(json_integer_value(v)));
         }
         else
         {
-        sprintf(pip + strlen(pip), " \
-                ! queue %s ! rtp%spay name=pay0 pt=96 )",
-                perf, outMediaType);
+            g_printerr("ERROR: Invalid value of %s\n", name);
+            return false;
+        }
+    }
+    args = out;
+    return true;
+}
+
+/* Stop @st but keep its inference elements, and with them the kernels and the
+ * models, loaded in PAUSED. All other elements release their devices in NULL,
+ * locked there while the stream is parked. Of the app stages, the metrics are
+ * suspended, the watchdog and the RTCP loop stop, the recordings are closed
+ * and the frame share socket is released; the others only run on frames. */
+static bool ParkStream(Stream &st)
+{
+    StopRtsp(st);
+    Metrics::Get().Suspend(st.metricsGroup);
+    if (st.frameShare)
+    {
+        /* A new stream may share its frames on the same socket */
+        st.frameShare->Close();
+    }
+    if (st.rtcpCtrl)
+    {
+        st.rtcpCtrl->Stop();
+    }
+    /* Removes its probes and its timer */
+    st.watchdog.reset();
+    st.hooks.watchdog = NULL;
+    GstIterator *it = gst_bin_iterate_elements(GST_BIN(st.pipeline));
+    GValue item = G_VALUE_INIT;
+    while (gst_iterator_next(it, &item) == GST_ITERATOR_OK)
+    {
+        GstElement *elem = GST_ELEMENT(g_value_get_object(&item));
+        GstElementFactory *factory = gst_element_get_factory(elem);
+        const gchar *name = factory ? GST_OBJECT_NAME(factory) : "";
+        if (strcmp(name, "ivas_xfilter") && strcmp(name, "ivas_xmultisrc"))
+        {
+            gst_element_set_locked_state(elem, TRUE);
+            gst_element_set_state(elem, GST_STATE_NULL);
+        }
+        g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(it);
+    /* The appsinks are stopped now */
+    if (st.recorder)
+    {
+        st.recorder->Flush();
+    }
+    if (st.segWriter)
+    {
+        st.segWriter->Flush();
+    }
+    return gst_element_set_state(st.pipeline, GST_STATE_PAUSED) != GST_STATE_CHANGE_FAILURE;
+}
+
+static bool ResumeStream(Stream &st)
+{
+    if (st.frameShare && !st.frameShare->Listen(st.frameShare->Path()))
+    {
+        return false;
+    }
+    GstIterator *it = gst_bin_iterate_elements(GST_BIN(st.pipeline));
+    GValue item = G_VALUE_INIT;
+    while (gst_iterator_next(it, &item) == GST_ITERATOR_OK)
+    {
+        gst_element_set_locked_state(GST_ELEMENT(g_value_get_object(&item)), FALSE);
+        g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(it);
+    /* The elements in NULL go all the way up with the pipeline */
+    if (gst_element_set_state(st.pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+    {
+        g_printerr("ERROR: Can't restart the stream.\n");
+        return false;
+    }
+    Metrics::Get().Resume(st.metricsGroup);
+    if (st.watchdogMs)
+    {
+        Metrics::Scope scope(st.metricsGroup);
+        st.watchdog.reset(new Watchdog(st.watchdogMs));
+        st.watchdog->Attach(st.pipeline, VIDEOSRC_NAME, AFFIXER_NAME, METAQUEUE_NAME);
+        st.hooks.watchdog = st.watchdog.get();
+    }
+    if (st.rtcpCtrl)
+    {
+        st.rtcpCtrl->Start();
+    }
+    return st.mounts.empty() || ServeRtsp(st);
+}
+
+static gboolean
+drop_stream_cb (gpointer user_data)
+{
+    guint serial = GPOINTER_TO_UINT(user_data);
+    for (auto it = daemonStreams.begin(); it != daemonStreams.end(); ++it)
+    {
+        if (it->second->serial == serial)
+        {
+            daemonStreams.erase(it);
+            return G_SOURCE_REMOVE;
         }
+    }
+    warmStreams.remove_if([serial](const std::unique_ptr<Stream> &st) { return st->serial == serial; });
+    return G_SOURCE_REMOVE;
+}
 
-        gst_rtsp_media_factory_set_launch (factory, pip);
-        gst_rtsp_media_factory_set_shared (factory, TRUE);
-        gst_rtsp_mount_points_add_factory (mounts, "/test", factory);
+/* A stream which ended or failed is dropped, the daemon goes on */
+static gboolean
+daemon_bus_callback (GstBus * bus, GstMessage * message, gpointer data)
+{
+    Stream *st = (Stream *) data;
+    switch (GST_MESSAGE_TYPE (message)) {
+      case GST_MESSAGE_EOS:
+        g_print ("INFO: Stream %s: end of stream\n", st->id.c_str());
+        g_idle_add (drop_stream_cb, GUINT_TO_POINTER (st->serial));
+        break;
+      case GST_MESSAGE_ERROR:{
+        GError *err;
+        gchar *debug;
+        gst_message_parse_error (message, &err, &debug);
+        g_printerr ("ERROR: Stream %s: %s\n", st->id.c_str(), err->message);
+        g_free(debug);
+        g_error_free(err);
+        g_idle_add (drop_stream_cb, GUINT_TO_POINTER (st->serial));
+        break;
+      }
+      default:
+        break;
+    }
+    return TRUE;
+}
 
-        g_object_unref (mounts);
+static bool StartDaemonStream(const std::string &id, const std::vector<std::string> &args)
+{
+    std::unique_ptr<Stream> st;
+    for (auto it = warmStreams.begin(); it != warmStreams.end(); ++it)
+    {
+        if ((*it)->args == args)
+        {
+            st = std::move(*it);
+            warmStreams.erase(it);
+            break;
+        }
+    }
 
-        /* attach the server to the default maincontext */
-        gst_rtsp_server_attach (server, NULL);
+    if (st)
+    {
+        if (!ResumeStream(*st))
+        {
+            return false;
+        }
+        g_print("INFO: Stream %s resumed with its models loaded\n", id.c_str());
+    }
+    else
+    {
+        st.reset(new Stream);
+        st->metricsGroup = Metrics::Get().NewGroup();
+        Metrics::Scope scope(st->metricsGroup);
+        if (!ParseStreamArgs(args) || StartStream(*st, daemon_bus_callback, st.get()) != 0)
+        {
+            return false;
+        }
+        g_print("INFO: Stream %s started\n", id.c_str());
+    }
+    st->id = id;
+    st->args = args;
+    st->serial = ++streamSerial;
+    st->startedUs = g_get_monotonic_time();
+    daemonStreams[id] = std::move(st);
+    return true;
+}
 
-        /* start serving */
-        std::vector<std::string> ips = GetIp();
-        std::ostringstream addr("");
-        for (auto&ip : ips)
+static void StopDaemonStream(const std::string &id)
+{
+    auto it = daemonStreams.find(id);
+    std::unique_ptr<Stream> st = std::move(it->second);
+    daemonStreams.erase(it);
+    if (daemonWarm > 0 && st->pipeline && ParkStream(*st))
+    {
+        warmStreams.push_back(std::move(st));
+        while (warmStreams.size() > (std::size_t) daemonWarm)
         {
-            addr << "rtsp://" << ip << ":" << port << "/test\n";
+            warmStreams.pop_front();
         }
-        g_print ("stream ready at:\n %s", addr.str().c_str());
-        g_main_loop_run (loop);
     }
+    g_print("INFO: Stream %s stopped\n", id.c_str());
+}
+
+/* The errors printed while a command runs, for its reply */
+static std::mutex commandErrorsLock;
+static std::string commandErrors;
+static GPrintFunc prevPrintErr;
+
+static void CapturePrintErr(const gchar *msg)
+{
+    {
+        std::lock_guard<std::mutex> guard(commandErrorsLock);
+        commandErrors += msg;
+    }
+    if (prevPrintErr)
+        prevPrintErr(msg);
     else
+        fputs(msg, stderr);
+}
+
+static json_t *StatusReply()
+{
+    json_t *streams = json_array();
+    gint64 now = g_get_monotonic_time();
+    for (const auto &s : daemonStreams)
     {
-        if (std::string(target) == "file")
+        json_t *args = json_array();
+        for (const auto &a : s.second->args)
         {
-            sprintf(pip + strlen(pip), "\
-                %s \
-                ! queue ! omx%senc \
-                qp-mode=%s  \
-                control-rate=%s  %s%s gop-length=%s \
-                %s \
-                ! video/x-%s, alignment=au\
-                %s%s %s%s %s%s \
-                %s \
-                ! filesink location=./out.%s async=false",
-                roiOff ? "" : " ! queue ! ivas_xroigen roi-type=1 roi-qp-delta=-10 roi-max-num=10 ",
-                outMediaType,
-                roiOff ? "auto" : "1",
-                controlRate, targetBitrate?"target-bitrate=":"", targetBitrate?targetBitrate:"", gopLength,
-                encodeEnhancedParam ? encodeEnhancedParam : "gop-mode=low-delay-p gdr-mode=horizontal cpb-size=200 num-slices=8 periodicity-idr=270 \
-                    initial-delay=100  filler-data=false min-qp=15  max-qp=40  b-frames=0  low-bandwidth=false ",
-                outMediaType, 
-                profile ? ", profile=(string)" : "", profile ? profile : "", level ? ", level=(string)":"", level ? level : "", tier?"tier=(string)" : "", tier ? tier: "",
-                perf,
-                outMediaType);
+            json_array_append_new(args, json_string(a.c_str()));
+        }
+        GstState state = GST_STATE_PLAYING;
+        if (s.second->pipeline)
+        {
+            gst_element_get_state(s.second->pipeline, &state, NULL, 0);
+        }
+        json_array_append_new(streams, json_pack("{s:s, s:o, s:s, s:f}", "stream", s.first.c_str(), "args", args,
+                    "state", gst_element_state_get_name(state), "uptime", (now - s.second->startedUs) / 1e6));
+    }
+
+    json_t *warm = json_array();
+    for (const auto &st : warmStreams)
+    {
+        json_t *args = json_array();
+        for (const auto &a : st->args)
+        {
+            json_array_append_new(args, json_string(a.c_str()));
+        }
+        json_array_append_new(warm, args);
+    }
+
+    json_t *metrics = json_array();
+    for (const auto &m : Metrics::Get().LastReport())
+    {
+        json_array_append_new(metrics, json_pack("{s:s, s:s}", "name", m.first.c_str(), "value", m.second.c_str()));
+    }
+    return json_pack("{s:b, s:o, s:o, s:o}", "ok", 1, "streams", streams, "warm", warm, "metrics", metrics);
+}
+
+/*
+ * Commands, one JSON object per line:
+ *   {"cmd":"start", "stream":"cam", "args":["--mipi", "--target=rtsp"]}
+ *   {"cmd":"set", "stream":"cam", "options":{"aitask":"ssd", "target-bitrate":2000}}
+ *   {"cmd":"stop", "stream":"cam"}
+ *   {"cmd":"status"}
+ *   {"cmd":"rescan"}
+ * The stream defaults to "default". A change of the target bitrate is
+ * applied to the running encoder, any other change restarts the stream.
+ */
+static json_t *HandleCommand(json_t *request)
+{
+    const char *cmd = json_string_value(json_object_get(request, "cmd"));
+    const char *name = json_string_value(json_object_get(request, "stream"));
+    std::string id = name ? name : "default";
+    bool running = daemonStreams.count(id) > 0;
+    json_t *reply = NULL;
+    bool ok = false;
+
+    {
+        std::lock_guard<std::mutex> guard(commandErrorsLock);
+        commandErrors.clear();
+    }
+    prevPrintErr = g_set_printerr_handler(CapturePrintErr);
+
+    if (!cmd)
+    {
+        g_printerr("ERROR: No \"cmd\" in the request\n");
+    }
+    else if (!strcmp(cmd, "start"))
+    {
+        json_t *jargs = json_object_get(request, "args");
+        std::vector<std::string> args;
+        ok = !running && (!jargs || json_is_array(jargs));
+        for (std::size_t i = 0; ok && i < json_array_size(jargs); i++)
+        {
+            const char *a = json_string_value(json_array_get(jargs, i));
+            ok = a != NULL;
+            args.push_back(a ? a : "");
+        }
+        if (!ok)
+        {
+            g_printerr("ERROR: %s\n", running ? "The stream is running" : "\"args\" must be an array of strings");
+        }
+        ok = ok && StartDaemonStream(id, args);
+    }
+    else if (!strcmp(cmd, "stop"))
+    {
+        if (running)
+        {
+            StopDaemonStream(id);
+            ok = true;
+        }
+        else
+        {
+            g_printerr("ERROR: No stream %s\n", id.c_str());
+        }
+    }
+    else if (!strcmp(cmd, "set"))
+    {
+        json_t *options = json_object_get(request, "options");
+        if (!running || !json_is_object(options))
+        {
+            g_printerr("ERROR: %s\n", running ? "\"options\" must be an object" : "The stream is not running");
+        }
+        else
+        {
+            Stream *st = daemonStreams[id].get();
+            std::vector<std::string> args = st->args;
+            const char *key;
+            json_t *value;
+            ok = true;
+            json_object_foreach(options, key, value)
+            {
+                ok = ok && SetArg(args, key, value);
+            }
+
+            GstElement *enc = st->liveBitrate && st->pipeline ? gst_bin_get_by_name(GST_BIN(st->pipeline), ENCODER_NAME) : NULL;
+            json_t *bitrate = json_object_get(options, "target-bitrate");
+            if (ok && enc && json_object_size(options) == 1 && bitrate)
+            {
+                /* The encoders take a new bitrate while playing */
+                gint kbps = json_is_integer(bitrate) ? (gint) json_integer_value(bitrate)
+                    : json_is_string(bitrate) ? atoi(json_string_value(bitrate)) : 0;
+                ok = kbps > 0;
+                if (ok)
+                {
+                    g_object_set(enc, st->codec.BitrateProperty(), (guint) kbps, NULL);
+                    st->args = args;
+                }
+                else
+                {
+                    g_printerr("ERROR: Invalid target-bitrate\n");
+                }
+            }
+            else if (ok)
+            {
+                std::vector<std::string> prev = st->args;
+                StopDaemonStream(id);
+                ok = StartDaemonStream(id, args);
+                if (!ok && !StartDaemonStream(id, prev))
+                {
+                    g_printerr("ERROR: The stream %s can't be started again either\n", id.c_str());
+                }
+            }
+            if (enc)
+            {
+                gst_object_unref(enc);
+            }
         }
-        else if (std::string(target) == "dp")
+    }
+    else if (!strcmp(cmd, "status"))
+    {
+        reply = StatusReply();
+    }
+    else if (!strcmp(cmd, "rescan"))
+    {
+        /* Cameras or a monitor were plugged */
+        probeCache.clear();
+        ok = true;
+    }
+    else
+    {
+        g_printerr("ERROR: Unknown command %s\n", cmd);
+    }
+
+    g_set_printerr_handler(prevPrintErr);
+    if (!reply && ok)
+    {
+        reply = json_pack("{s:b}", "ok", 1);
+    }
+    else if (!reply)
+    {
+        std::lock_guard<std::mutex> guard(commandErrorsLock);
+        std::string error = commandErrors.empty() ? std::string("failed") : commandErrors;
+        /* The first error is the reason, strip its prefix */
+        error = error.substr(0, error.find('\n'));
+        if (error.compare(0, 7, "ERROR: ") == 0)
         {
-            sprintf(pip + strlen(pip), "\
-                    ! queue %s ! kmssink driver-name=xlnx plane-id=39 sync=%s fullscreen-overlay=true", perf, filename? "true" : "false");
+            error.erase(0, 7);
         }
+        reply = json_pack("{s:b, s:s}", "ok", 0, "error", error.c_str());
+    }
+    return reply;
+}
+
+static gboolean
+quit_cb (gpointer user_data)
+{
+    g_main_loop_quit ((GMainLoop *) user_data);
+    return G_SOURCE_REMOVE;
+}
+
+static int RunDaemon(GMainLoop *loop)
+{
+    /* The options given to the daemon are the defaults of every stream */
+    SaveOptions();
+    cacheProbes = true;
+
+    ControlServer server(HandleCommand);
+    if (!server.Listen(daemonSocket))
+    {
+        return 1;
+    }
+    g_unix_signal_add (SIGINT, quit_cb, loop);
+    g_unix_signal_add (SIGTERM, quit_cb, loop);
+    g_print("INFO: Waiting for commands on %s\n", daemonSocket);
+    g_main_loop_run (loop);
+
+    daemonStreams.clear();
+    warmStreams.clear();
+    return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+    char* pathVar = std::getenv("PATH");
+    std::string setPath = std::string("PATH=") + std::string(pathVar) + ":/usr/sbin:/sbin";
+    putenv((char*)setPath.c_str());
+
+    GMainLoop *loop;
+    GstRTSPSessionPool *session;
+    GOptionContext *optctx;
+    GError *error = NULL;
+
+    session = gst_rtsp_session_pool_new();
+    gst_rtsp_session_pool_set_max_sessions  (session, 255);
+
+
+    optctx = g_option_context_new ("- Application for facedetion detction on SoM board of Xilinx.");
+    g_option_context_add_main_entries (optctx, entries, NULL);
+    g_option_context_add_main_entries (optctx, daemonEntries, NULL);
+    g_option_context_add_group (optctx, gst_init_get_option_group ());
+    if (!g_option_context_parse (optctx, &argc, &argv, &error)) {
+        g_printerr ("Error parsing options: %s\n", error->message);
+        g_option_context_free (optctx);
+        g_clear_error (&error);
+        return -1;
+    }
+    g_option_context_free (optctx);
+    yuyv_to_nv12_register ();
+
+    if (getuid() != 0) 
+    {
+      g_printerr ("Please run with sudo.\n");
+      return 1;
+    }
+
+    loop = g_main_loop_new (NULL, FALSE);
+    if (daemonSocket)
+    {
+        int ret = RunDaemon(loop);
+        g_main_loop_unref (loop);
+        return ret;
+    }
 
-        GstElement *pipeline = gst_parse_launch(pip, NULL);
-        gst_element_set_state (pipeline, GST_STATE_PLAYING);
-        /* Wait until error or EOS */
-        GstBus *bus = gst_element_get_bus (pipeline);
-        busWatchId = gst_bus_add_watch (bus, my_bus_callback, loop);
-        g_main_loop_run (loop);
+    std::unique_ptr<Stream> stream(new Stream);
+    if (StartStream(*stream, my_bus_callback, loop) != 0)
+    {
+        return 1;
+    }
+    /* Wait until error or EOS */
+    g_main_loop_run (loop);
 
+    if (!targetRtsp)
+    {
+        if (recordOnDetect || stream->segWriter)
+        {
+            g_print("Output %s are in %s, please play with your favorite media player, such as VLC, ffplay, etc. to see the video with %s AI results.\n",
+                    recordOnDetect ? "clips" : "segments", recordDir, nodet ? "no" : aitask);
+        }
+        else
+        {
         g_print("Output file is out.%s, please play with your favorite media player, such as VLC, ffplay, etc. to see the video with %s AI results.\n", 
                 outMediaType, nodet ? "no" : aitask);
-        gst_object_unref (bus);
-        gst_element_set_state (pipeline, GST_STATE_NULL);
-        gst_object_unref (pipeline);
-        g_source_remove (busWatchId);
-        g_main_loop_unref (loop);
+        }
     }
+    stream.reset();
+    g_main_loop_unref (loop);
     return 0;
 }
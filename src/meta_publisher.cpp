@@ -0,0 +1,210 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gst/app/gstappsrc.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/un.h>
+#include <sstream>
+
+#include "detections.hpp"
+#include "meta_publisher.hpp"
+
+MetaPublisher::MetaPublisher()
+    : rtsp(false), appsrc(NULL), frames(0), dropped(0)
+{
+}
+
+MetaPublisher::~MetaPublisher()
+{
+    for (auto &s : sinks)
+    {
+        close(s.fd);
+    }
+    if (appsrc)
+    {
+        gst_object_unref(appsrc);
+    }
+    if (dropped)
+    {
+        g_print("INFO: metadata publisher dropped %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " messages\n",
+                dropped, frames);
+    }
+}
+
+bool MetaPublisher::AddSinks(const std::string &uris)
+{
+    std::istringstream iss(uris);
+    std::string uri;
+    while (std::getline(iss, uri, ','))
+    {
+        if (uri.empty())
+            continue;
+        if (!AddSink(uri))
+        {
+            g_printerr("ERROR: Invalid metadata sink: %s\n", uri.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MetaPublisher::AddSink(const std::string &uri)
+{
+    Sink s;
+    memset(&s, 0, sizeof(s));
+
+    if (uri == "rtsp")
+    {
+        rtsp = true;
+        return true;
+    }
+    else if (uri.compare(0, 6, "udp://") == 0)
+    {
+        std::string hostport = uri.substr(6);
+        std::size_t pos = hostport.rfind(":");
+        if (pos == std::string::npos)
+            return false;
+        std::string host = hostport.substr(0, pos);
+        std::string service = hostport.substr(pos + 1);
+
+        struct addrinfo hints, *res = NULL;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        if (getaddrinfo(host.c_str(), service.c_str(), &hints, &res) != 0 || !res)
+            return false;
+
+        s.fd = socket(res->ai_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        memcpy(&s.addr, res->ai_addr, res->ai_addrlen);
+        s.addrLen = res->ai_addrlen;
+        freeaddrinfo(res);
+        if (s.fd < 0)
+            return false;
+        s.connected = true;
+    }
+    else if (uri.compare(0, 7, "unix://") == 0)
+    {
+        std::string path = uri.substr(7);
+        struct sockaddr_un *un = (struct sockaddr_un *) &s.addr;
+        if (path.empty() || path.size() >= sizeof(un->sun_path))
+            return false;
+
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, path.c_str());
+        s.addrLen = sizeof(struct sockaddr_un);
+        s.fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (s.fd < 0)
+            return false;
+        /* The consumer may come and go, connect lazily on send */
+        s.connected = false;
+    }
+    else
+    {
+        return false;
+    }
+
+    sinks.push_back(s);
+    return true;
+}
+
+static GstPadProbeReturn
+meta_probe_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+    MetaPublisher *pub = (MetaPublisher *) user_data;
+    pub->Publish(GST_PAD_PROBE_INFO_BUFFER(info));
+    return GST_PAD_PROBE_OK;
+}
+
+bool MetaPublisher::Attach(GstElement *bin, const char *probeName)
+{
+    GstElement *elem = gst_bin_get_by_name(GST_BIN(bin), probeName);
+    if (!elem)
+    {
+        g_printerr("ERROR: Element %s not found for metadata publishing.\n", probeName);
+        return false;
+    }
+    GstPad *pad = gst_element_get_static_pad(elem, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, meta_probe_cb, this, NULL);
+    gst_object_unref(pad);
+    gst_object_unref(elem);
+
+    if (rtsp)
+    {
+        if (appsrc)
+            gst_object_unref(appsrc);
+        appsrc = gst_bin_get_by_name(GST_BIN(bin), "metasrc");
+    }
+    return true;
+}
+
+void MetaPublisher::SendAll(const std::string &msg)
+{
+    for (auto &s : sinks)
+    {
+        if (!s.connected)
+        {
+            /* Cheap retry, a failed connect on a unix datagram socket is a single syscall */
+            if (connect(s.fd, (struct sockaddr *) &s.addr, s.addrLen) != 0)
+            {
+                dropped++;
+                continue;
+            }
+            s.connected = true;
+        }
+
+        ssize_t ret;
+        if (s.addr.ss_family == AF_UNIX)
+            ret = send(s.fd, msg.data(), msg.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        else
+            ret = sendto(s.fd, msg.data(), msg.size(), MSG_DONTWAIT | MSG_NOSIGNAL,
+                    (struct sockaddr *) &s.addr, s.addrLen);
+
+        if (ret < 0)
+        {
+            dropped++;
+            if (s.addr.ss_family == AF_UNIX && (errno == ECONNREFUSED || errno == ENOTCONN))
+            {
+                s.connected = false;
+            }
+        }
+    }
+}
+
+void MetaPublisher::Publish(GstBuffer *buf)
+{
+    std::vector<Detection> dets;
+    ExtractDetections(buf, dets);
+
+    std::string msg = DetectionsToJson(GST_BUFFER_PTS(buf), frames++, dets);
+
+    SendAll(msg);
+
+    if (appsrc)
+    {
+        GstBuffer *out = gst_buffer_new_allocate(NULL, msg.size(), NULL);
+        gst_buffer_fill(out, 0, msg.data(), msg.size());
+        GST_BUFFER_PTS(out) = GST_BUFFER_PTS(buf);
+        GST_BUFFER_DURATION(out) = GST_BUFFER_DURATION(buf);
+        if (gst_app_src_push_buffer(GST_APP_SRC(appsrc), out) != GST_FLOW_OK)
+        {
+            dropped++;
+        }
+    }
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_META_PUBLISHER_H__
+#define __SMARTCAM_META_PUBLISHER_H__
+
+#include <gst/gst.h>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+
+/*
+ * Publishes the per-frame detections as one JSON datagram per video frame.
+ *
+ * Sinks:
+ *   udp://host:port      UDP datagram
+ *   unix:///path/to/sock Unix datagram socket, the consumer binds the path
+ *   rtsp                 metadata track (pay1) inside the RTSP session
+ *
+ * Sends never block the streaming thread: a datagram that cannot be queued
+ * by the kernel right away is dropped and counted.
+ */
+class MetaPublisher
+{
+public:
+    MetaPublisher();
+    ~MetaPublisher();
+
+    /* Parse a comma separated list of sinks, returns false on a bad entry */
+    bool AddSinks(const std::string &uris);
+    bool WantsRtsp() const { return rtsp; }
+
+    /* Install the probe on element @probeName of @bin and pick up the
+     * "metasrc" appsrc for the RTSP track if present. */
+    bool Attach(GstElement *bin, const char *probeName);
+
+    void Publish(GstBuffer *buf);
+
+private:
+    struct Sink
+    {
+        int fd;
+        struct sockaddr_storage addr;
+        socklen_t addrLen;
+        bool connected;
+    };
+
+    bool AddSink(const std::string &uri);
+    void SendAll(const std::string &msg);
+
+    std::vector<Sink> sinks;
+    bool rtsp;
+    GstElement *appsrc;
+    guint64 frames;
+    guint64 dropped;
+};
+
+#endif /* __SMARTCAM_META_PUBLISHER_H__ */
@@ -0,0 +1,132 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "metrics.hpp"
+
+thread_local guint Metrics::currentGroup = 0;
+
+Metrics::Scope::Scope(guint group)
+    : prev(currentGroup)
+{
+    currentGroup = group;
+}
+
+Metrics::Scope::~Scope()
+{
+    currentGroup = prev;
+}
+
+Metrics::Metrics()
+    : nextId(1), nextGroup(1), timer(0)
+{
+}
+
+Metrics &Metrics::Get()
+{
+    static Metrics metrics;
+    return metrics;
+}
+
+guint Metrics::NewGroup()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return nextGroup++;
+}
+
+guint Metrics::CurrentGroup()
+{
+    return currentGroup;
+}
+
+void Metrics::Suspend(guint group)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    suspended.insert(group);
+}
+
+void Metrics::Resume(guint group)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    suspended.erase(group);
+    /* The rates are over the time since the last call, which would take in
+     * the whole suspension */
+    for (auto &p : providers)
+    {
+        if (p.second.group == group)
+        {
+            p.second.provider();
+        }
+    }
+}
+
+guint Metrics::Register(const std::string &name, Provider provider)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    guint id = nextId++;
+    providers[id] = Entry{name, provider, currentGroup};
+    return id;
+}
+
+void Metrics::Unregister(guint id)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    providers.erase(id);
+}
+
+void Metrics::Start(guint intervalMs)
+{
+    if (!timer)
+    {
+        timer = g_timeout_add(intervalMs, TimeoutCb, this);
+    }
+}
+
+void Metrics::Stop()
+{
+    if (timer)
+    {
+        g_source_remove(timer);
+        timer = 0;
+    }
+}
+
+gboolean Metrics::TimeoutCb(gpointer user_data)
+{
+    Metrics *metrics = (Metrics *) user_data;
+    metrics->Report();
+    return G_SOURCE_CONTINUE;
+}
+
+void Metrics::Report()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    last.clear();
+    for (auto &p : providers)
+    {
+        if (suspended.count(p.second.group))
+        {
+            continue;
+        }
+        last.push_back(std::make_pair(p.second.name, p.second.provider()));
+        g_print("METRICS %s: %s\n", last.back().first.c_str(), last.back().second.c_str());
+    }
+}
+
+std::vector<std::pair<std::string, std::string>> Metrics::LastReport()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return last;
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_METRICS_H__
+#define __SMARTCAM_METRICS_H__
+
+#include <glib.h>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * Registry of the runtime metrics reported with --report.
+ *
+ * Stages register a provider which returns one line of text, e.g. a rate
+ * over the last interval, and is called once per interval on the main
+ * context. Providers must be thread safe against their own stage.
+ *
+ * The providers registered while a Scope is alive on the thread belong to
+ * its group, e.g. the stages of one daemon stream, and are left out of the
+ * reports while the group is suspended.
+ */
+class Metrics
+{
+public:
+    typedef std::function<std::string()> Provider;
+
+    /* Puts the providers registered on this thread into @group until it
+     * goes out of scope */
+    class Scope
+    {
+    public:
+        Scope(guint group);
+        ~Scope();
+
+    private:
+        guint prev;
+    };
+
+    static Metrics &Get();
+
+    /* A new group for Scope, 0 is the one of the providers outside any */
+    guint NewGroup();
+    /* The group of the innermost Scope on this thread */
+    static guint CurrentGroup();
+
+    /* Leave the providers of @group out of the reports, and take them in
+     * again. Resume() calls them once to start their next interval. */
+    void Suspend(guint group);
+    void Resume(guint group);
+
+    /* Returns an id for Unregister() */
+    guint Register(const std::string &name, Provider provider);
+    void Unregister(guint id);
+
+    /* Print all providers every @intervalMs on the default main context */
+    void Start(guint intervalMs);
+    void Stop();
+
+    /* Name and line of each provider in the last report, empty before the
+     * first one */
+    std::vector<std::pair<std::string, std::string>> LastReport();
+
+private:
+    Metrics();
+    static gboolean TimeoutCb(gpointer user_data);
+    void Report();
+
+    struct Entry
+    {
+        std::string name;
+        Provider provider;
+        guint group;
+    };
+
+    static thread_local guint currentGroup;
+
+    std::mutex lock;
+    std::map<guint, Entry> providers;
+    std::set<guint> suspended;
+    guint nextId;
+    guint nextGroup;
+    guint timer;
+    std::vector<std::pair<std::string, std::string>> last;
+};
+
+#endif /* __SMARTCAM_METRICS_H__ */
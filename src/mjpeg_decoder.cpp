@@ -0,0 +1,352 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/video/gstvideopool.h>
+#include <stdio.h>
+#include <algorithm>
+
+#include "jpeg_error.hpp"
+#include "metrics.hpp"
+#include "mjpeg_decoder.hpp"
+#include "nv12_convert.hpp"
+
+/* Strides the IVAS elements and the display take without a copy */
+#define STRIDE_ALIGN 256
+
+struct MjpegDecoder::Job
+{
+    GstBuffer *jpeg;
+    GstBuffer *out;
+    GstVideoInfo info;
+    bool done;
+    bool ok;
+
+    ~Job()
+    {
+        gst_buffer_unref(jpeg);
+        if (out)
+            gst_buffer_unref(out);
+    }
+};
+
+/* Decode a 4:2:2 or 4:2:0 JPEG of the given size into NV12 planes */
+static bool DecodeJpegNv12(const guint8 *data, gsize size, guint8 *dstY, gint yStride,
+        guint8 *dstUV, gint uvStride, gint width, gint height)
+{
+    struct jpeg_decompress_struct cinfo;
+    JpegError jerr;
+    guint8 *volatile scratch = NULL;
+
+    cinfo.err = JpegErrorInit(&jerr);
+    if (setjmp(jerr.jump))
+    {
+        jpeg_destroy_decompress(&cinfo);
+        g_free(scratch);
+        return false;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, (unsigned char *) data, size);
+    jpeg_read_header(&cinfo, TRUE);
+
+    /* Raw data keeps the subsampling of the JPEG, only the usual layouts of
+     * the cameras map onto NV12 */
+    jpeg_component_info *comp = cinfo.comp_info;
+    gint vSamp = comp[0].v_samp_factor;
+    if (cinfo.image_width != (JDIMENSION) width || cinfo.image_height != (JDIMENSION) height
+            || cinfo.num_components != 3 || cinfo.jpeg_color_space != JCS_YCbCr
+            || comp[0].h_samp_factor != 2 || (vSamp != 1 && vSamp != 2)
+            || comp[1].h_samp_factor != 1 || comp[1].v_samp_factor != 1
+            || comp[2].h_samp_factor != 1 || comp[2].v_samp_factor != 1
+            || (gint) (comp[0].width_in_blocks * DCTSIZE) > yStride)
+    {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    cinfo.raw_data_out = TRUE;
+    jpeg_start_decompress(&cinfo);
+
+    /* The decoder writes whole blocks: the luma rows past the frame go to a
+     * scratch row, the chroma of an iMCU row to scratch planes */
+    gint yWidth = comp[0].width_in_blocks * DCTSIZE;
+    gint cWidth = comp[1].width_in_blocks * DCTSIZE;
+    scratch = (guint8 *) g_malloc(yWidth + 2 * DCTSIZE * cWidth);
+    guint8 *pad = scratch;
+    JSAMPROW yRows[2 * DCTSIZE], uRows[DCTSIZE], vRows[DCTSIZE];
+    JSAMPARRAY planes[3] = { yRows, uRows, vRows };
+    for (gint i = 0; i < DCTSIZE; i++)
+    {
+        uRows[i] = scratch + yWidth + i * cWidth;
+        vRows[i] = scratch + yWidth + (DCTSIZE + i) * cWidth;
+    }
+
+    gint lines = vSamp * DCTSIZE;
+    gint chromaW = (width + 1) / 2;
+    gint chromaH = (height + 1) / 2;
+    while (cinfo.output_scanline < cinfo.output_height)
+    {
+        gint row = cinfo.output_scanline;
+        for (gint i = 0; i < lines; i++)
+        {
+            yRows[i] = row + i < height ? dstY + (gsize) (row + i) * yStride : pad;
+        }
+        jpeg_read_raw_data(&cinfo, planes, lines);
+
+        /* 4:2:0 has a chroma row per NV12 row, 4:2:2 two of them */
+        gint step = 3 - vSamp;
+        for (gint i = 0; i < DCTSIZE; i += step)
+        {
+            gint uvRow = (row / vSamp + i) / step;
+            if (uvRow >= chromaH)
+            {
+                break;
+            }
+            PlanarChromaToNv12(uRows[i], uRows[i + step - 1], vRows[i], vRows[i + step - 1],
+                    dstUV + (gsize) uvRow * uvStride, chromaW);
+        }
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    g_free(scratch);
+    return true;
+}
+
+MjpegDecoder::MjpegDecoder(guint threads)
+    : maxInFlight(threads + 1), appsrc(NULL), inCaps(NULL), pool(NULL), frames(0), dropped(0),
+      errors(0), decodeUs(0)
+{
+    gst_video_info_init(&outInfo);
+    metricsId = Metrics::Get().Register("mjpeg decode", [this] { return Report(); });
+    /* The decoding is on the capture path, the threads run at normal priority */
+    workers.reset(new WorkerPool(std::max(threads, 1u), 0, maxInFlight));
+}
+
+MjpegDecoder::~MjpegDecoder()
+{
+    /* Stop the workers before what they use goes away */
+    workers.reset();
+    jobs.clear();
+    Metrics::Get().Unregister(metricsId);
+    if (pool)
+    {
+        gst_buffer_pool_set_active(pool, FALSE);
+        gst_object_unref(pool);
+    }
+    if (appsrc)
+    {
+        gst_object_unref(appsrc);
+    }
+    if (inCaps)
+    {
+        gst_caps_unref(inCaps);
+    }
+}
+
+bool MjpegDecoder::Attach(GstElement *bin, const char *sinkName, const char *srcName)
+{
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(bin), sinkName);
+    GstElement *src = gst_bin_get_by_name(GST_BIN(bin), srcName);
+    if (!sink || !src)
+    {
+        g_printerr("ERROR: Elements %s/%s not found for MJPEG decoding.\n", sinkName, srcName);
+        if (sink)
+            gst_object_unref(sink);
+        if (src)
+            gst_object_unref(src);
+        return false;
+    }
+
+    /* The frames in flight are bounded here instead of by the byte count */
+    g_object_set(src, "is-live", TRUE, "format", GST_FORMAT_TIME, "max-bytes", (guint64) 0, NULL);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (appsrc)
+            gst_object_unref(appsrc);
+        appsrc = src;
+    }
+
+    g_object_set(sink, "emit-signals", TRUE, "sync", FALSE, NULL);
+    g_signal_connect(sink, "new-sample", G_CALLBACK(NewFrameCb), this);
+    gst_object_unref(sink);
+    return true;
+}
+
+GstFlowReturn MjpegDecoder::NewFrameCb(GstElement *sink, gpointer user_data)
+{
+    MjpegDecoder *dec = (MjpegDecoder *) user_data;
+    GstSample *sample = gst_app_sink_pull_sample(GST_APP_SINK(sink));
+    if (!sample)
+    {
+        return GST_FLOW_EOS;
+    }
+    dec->OnFrame(sample);
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+bool MjpegDecoder::SetupOutput(GstCaps *caps)
+{
+    GstStructure *s = gst_caps_get_structure(caps, 0);
+    gint width, height;
+    if (!gst_structure_get_int(s, "width", &width) || !gst_structure_get_int(s, "height", &height))
+    {
+        g_printerr("ERROR: MJPEG caps without a frame size.\n");
+        return false;
+    }
+
+    GstCaps *outCaps = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, "NV12",
+            "width", G_TYPE_INT, width, "height", G_TYPE_INT, height, NULL);
+    const GValue *rate = gst_structure_get_value(s, "framerate");
+    if (rate)
+    {
+        gst_caps_set_value(outCaps, "framerate", rate);
+    }
+    gst_video_info_from_caps(&outInfo, outCaps);
+
+    GstVideoAlignment align;
+    gst_video_alignment_reset(&align);
+    align.stride_align[0] = STRIDE_ALIGN - 1;
+    align.stride_align[1] = STRIDE_ALIGN - 1;
+
+    if (pool)
+    {
+        gst_buffer_pool_set_active(pool, FALSE);
+        gst_object_unref(pool);
+    }
+    pool = gst_video_buffer_pool_new();
+    GstStructure *config = gst_buffer_pool_get_config(pool);
+    gst_buffer_pool_config_set_params(config, outCaps, GST_VIDEO_INFO_SIZE(&outInfo), maxInFlight, 0);
+    gst_buffer_pool_config_add_option(config, GST_BUFFER_POOL_OPTION_VIDEO_META);
+    gst_buffer_pool_config_add_option(config, GST_BUFFER_POOL_OPTION_VIDEO_ALIGNMENT);
+    gst_buffer_pool_config_set_video_alignment(config, &align);
+    gst_buffer_pool_set_config(pool, config);
+    gst_buffer_pool_set_active(pool, TRUE);
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        gst_app_src_set_caps(GST_APP_SRC(appsrc), outCaps);
+    }
+    gst_caps_unref(outCaps);
+    gst_caps_replace(&inCaps, caps);
+    return true;
+}
+
+void MjpegDecoder::OnFrame(GstSample *sample)
+{
+    GstCaps *caps = gst_sample_get_caps(sample);
+    GstBuffer *buf = gst_sample_get_buffer(sample);
+    if (!caps || !buf)
+    {
+        return;
+    }
+    if ((!inCaps || !gst_caps_is_equal(inCaps, caps)) && !SetupOutput(caps))
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (jobs.size() >= maxInFlight)
+        {
+            dropped++;
+            return;
+        }
+    }
+
+    GstBuffer *out = NULL;
+    if (gst_buffer_pool_acquire_buffer(pool, &out, NULL) != GST_FLOW_OK)
+    {
+        return;
+    }
+    gst_buffer_copy_into(out, buf, GST_BUFFER_COPY_TIMESTAMPS, 0, -1);
+
+    std::shared_ptr<Job> job = std::make_shared<Job>();
+    job->jpeg = gst_buffer_ref(buf);
+    job->out = out;
+    job->info = outInfo;
+    job->done = false;
+    job->ok = false;
+
+    std::lock_guard<std::mutex> guard(lock);
+    jobs.push_back(job);
+    if (!workers->TrySubmit([this, job] { Decode(job); }))
+    {
+        jobs.pop_back();
+        dropped++;
+    }
+}
+
+void MjpegDecoder::Decode(std::shared_ptr<Job> job)
+{
+    gint64 start = g_get_monotonic_time();
+    bool ok = false;
+    GstMapInfo map;
+    GstVideoFrame frame;
+    if (gst_buffer_map(job->jpeg, &map, GST_MAP_READ))
+    {
+        if (gst_video_frame_map(&frame, &job->info, job->out, GST_MAP_WRITE))
+        {
+            ok = DecodeJpegNv12(map.data, map.size,
+                    (guint8 *) GST_VIDEO_FRAME_PLANE_DATA(&frame, 0), GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0),
+                    (guint8 *) GST_VIDEO_FRAME_PLANE_DATA(&frame, 1), GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 1),
+                    GST_VIDEO_FRAME_WIDTH(&frame), GST_VIDEO_FRAME_HEIGHT(&frame));
+            gst_video_frame_unmap(&frame);
+        }
+        gst_buffer_unmap(job->jpeg, &map);
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    job->done = true;
+    job->ok = ok;
+    if (ok)
+    {
+        decodeUs += g_get_monotonic_time() - start;
+    }
+    else
+    {
+        errors++;
+    }
+    PushFinished();
+}
+
+void MjpegDecoder::PushFinished()
+{
+    /* Pushing under the lock keeps the capture order */
+    while (!jobs.empty() && jobs.front()->done)
+    {
+        std::shared_ptr<Job> job = jobs.front();
+        jobs.pop_front();
+        if (job->ok && appsrc)
+        {
+            gst_app_src_push_buffer(GST_APP_SRC(appsrc), job->out);
+            job->out = NULL;
+            frames++;
+        }
+    }
+}
+
+std::string MjpegDecoder::Report()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    char line[160];
+    snprintf(line, sizeof(line), "%.1f ms/frame, %" G_GUINT64_FORMAT " frames, %" G_GUINT64_FORMAT " dropped, %" G_GUINT64_FORMAT " corrupt",
+            frames ? decodeUs / 1000.0 / frames : 0, frames, dropped, errors);
+    frames = 0;
+    decodeUs = 0;
+    return std::string(line);
+}
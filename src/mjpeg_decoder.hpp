@@ -0,0 +1,81 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_MJPEG_DECODER_H__
+#define __SMARTCAM_MJPEG_DECODER_H__
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "worker_pool.hpp"
+
+/*
+ * Decodes the MJPEG of USB cameras into NV12, several frames at a time.
+ *
+ * The JPEG frames come in through an appsink. Each is decoded on one of the
+ * threads of a WorkerPool with libjpeg(-turbo) raw data output: the luma goes
+ * straight into the NV12 buffer from a pool, the planar chroma is averaged and
+ * interleaved into it by the kernels of nv12_convert, so there is no color
+ * conversion and no extra copy. The decoded frames are pushed to the appsrc
+ * in capture order.
+ *
+ * At most threads + 1 frames are in flight, a frame arriving when that many
+ * are still decoding is dropped, so the latency stays bounded by the decode
+ * time of a frame when the CPU can't keep up. Frames which fail to decode are
+ * dropped as well. Only 4:2:2 and 4:2:0 JPEGs are taken, which is what UVC
+ * cameras send.
+ */
+class MjpegDecoder
+{
+public:
+    MjpegDecoder(guint threads);
+    ~MjpegDecoder();
+
+    bool Attach(GstElement *bin, const char *sinkName, const char *srcName);
+
+private:
+    struct Job;
+
+    static GstFlowReturn NewFrameCb(GstElement *sink, gpointer user_data);
+    void OnFrame(GstSample *sample);
+    bool SetupOutput(GstCaps *caps);
+    void Decode(std::shared_ptr<Job> job);
+    /* Called with the lock held */
+    void PushFinished();
+    std::string Report();
+
+    guint maxInFlight;
+    std::mutex lock;
+    std::deque<std::shared_ptr<Job>> jobs;
+    GstElement *appsrc;
+    GstCaps *inCaps;
+    GstBufferPool *pool;
+    GstVideoInfo outInfo;
+
+    guint metricsId;
+    guint64 frames;
+    guint64 dropped;
+    guint64 errors;
+    gint64 decodeUs;
+
+    std::unique_ptr<WorkerPool> workers;
+};
+
+#endif /* __SMARTCAM_MJPEG_DECODER_H__ */
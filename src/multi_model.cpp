@@ -0,0 +1,307 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/video/video.h>
+#include <jansson.h>
+#include <stdlib.h>
+#include <set>
+#include <sstream>
+
+#include "multi_model.hpp"
+
+/* Frames in each model branch at a time */
+#define MODEL_MAX_FRAMES 2
+/* MAX_ALLOWED_CLASS of libivas_airender */
+#define DRAW_MAX_CLASSES 20
+
+bool MultiModel::ParseModels(const char *spec, std::vector<Model> &out)
+{
+    std::istringstream in(spec);
+    std::string item;
+    while (std::getline(in, item, ','))
+    {
+        Model m;
+        m.interval = 1;
+        std::size_t colon = item.find(':');
+        m.task = item.substr(0, colon);
+        if (colon != std::string::npos)
+        {
+            char *end;
+            long n = strtol(item.c_str() + colon + 1, &end, 10);
+            if (*end != '\0' || n < 1)
+            {
+                return false;
+            }
+            m.interval = (guint) n;
+        }
+        if (m.task.empty())
+        {
+            return false;
+        }
+        out.push_back(m);
+    }
+    return !out.empty();
+}
+
+/* The "config" of the drawing kernel in a drawresult.json */
+static json_t *DrawConfig(json_t *root)
+{
+    json_t *kernel = json_array_get(json_object_get(root, "kernels"), 0);
+    return json_object_get(kernel, "config");
+}
+
+bool MultiModel::WriteDrawConfig(const std::vector<Model> &models, const std::string &dir,
+        const std::string &path)
+{
+    json_error_t error;
+    std::string first = dir + models[0].task + "/drawresult.json";
+    json_t *root = json_load_file(first.c_str(), 0, &error);
+    json_t *config = DrawConfig(root);
+    if (!json_is_object(config))
+    {
+        g_printerr("ERROR: Can't load the drawing config %s: %s\n", first.c_str(),
+                root ? "no kernel config" : error.text);
+        if (root)
+            json_decref(root);
+        return false;
+    }
+
+    json_t *classes = json_object_get(config, "classes");
+    bool all = !json_is_array(classes) || json_array_size(classes) == 0;
+    std::set<std::string> names;
+    for (std::size_t i = 0; !all && i < json_array_size(classes); i++)
+    {
+        json_t *name = json_object_get(json_array_get(classes, i), "name");
+        if (json_is_string(name))
+            names.insert(json_string_value(name));
+    }
+
+    for (std::size_t m = 1; m < models.size() && !all; m++)
+    {
+        std::string other = dir + models[m].task + "/drawresult.json";
+        json_t *otherRoot = json_load_file(other.c_str(), 0, &error);
+        json_t *otherClasses = json_object_get(DrawConfig(otherRoot), "classes");
+        if (!json_is_array(otherClasses) || json_array_size(otherClasses) == 0)
+        {
+            all = true;
+        }
+        for (std::size_t i = 0; !all && i < json_array_size(otherClasses); i++)
+        {
+            json_t *c = json_array_get(otherClasses, i);
+            json_t *name = json_object_get(c, "name");
+            if (json_is_string(name) && names.insert(json_string_value(name)).second)
+            {
+                json_array_append(classes, c);
+            }
+        }
+        if (otherRoot)
+            json_decref(otherRoot);
+    }
+    if (all)
+    {
+        json_object_del(config, "classes");
+    }
+    else if (json_array_size(classes) > DRAW_MAX_CLASSES)
+    {
+        g_printerr("ERROR: The drawresult.json of the AI tasks list more than %d classes together.\n",
+                DRAW_MAX_CLASSES);
+        json_decref(root);
+        return false;
+    }
+    /* The merged file is not edited, the sources aren't reloaded into it */
+    json_object_del(config, "config_file");
+
+    bool ok = json_dump_file(root, path.c_str(), JSON_INDENT(2)) == 0;
+    if (!ok)
+    {
+        g_printerr("ERROR: Can't write the drawing config %s\n", path.c_str());
+    }
+    json_decref(root);
+    return ok;
+}
+
+MultiModel::MultiModel(const std::vector<Model> &models)
+    : models(models), frameCount(0), last(models.size()), outSrc(NULL), outCaps(NULL)
+{
+    for (const auto &m : models)
+    {
+        infers.emplace_back(new RoiInfer(m.task.c_str(), MODEL_MAX_FRAMES));
+    }
+}
+
+MultiModel::~MultiModel()
+{
+    for (auto &e : entries)
+    {
+        gst_buffer_unref(e->frame);
+    }
+    if (outSrc)
+    {
+        gst_object_unref(outSrc);
+    }
+    if (outCaps)
+    {
+        gst_caps_unref(outCaps);
+    }
+}
+
+bool MultiModel::Attach(GstElement *bin, const char *frameSink, const char *srcPrefix,
+        const char *resultPrefix, const char *outSrcName)
+{
+    for (std::size_t i = 0; i < infers.size(); i++)
+    {
+        std::string src = srcPrefix + std::to_string(i);
+        std::string res = resultPrefix + std::to_string(i);
+        if (!infers[i]->Attach(bin, src.c_str(), res.c_str()))
+        {
+            return false;
+        }
+    }
+
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(bin), frameSink);
+    GstElement *out = gst_bin_get_by_name(GST_BIN(bin), outSrcName);
+    if (!sink || !out)
+    {
+        g_printerr("ERROR: Elements %s/%s not found for the models.\n", frameSink, outSrcName);
+        if (sink)
+            gst_object_unref(sink);
+        if (out)
+            gst_object_unref(out);
+        return false;
+    }
+
+    g_object_set(out, "is-live", TRUE, "format", GST_FORMAT_TIME, "max-bytes", (guint64) 0, NULL);
+    if (outSrc)
+        gst_object_unref(outSrc);
+    outSrc = out;
+
+    g_object_set(sink, "emit-signals", TRUE, "sync", FALSE, NULL);
+    g_signal_connect(sink, "new-sample", G_CALLBACK(NewFrameCb), this);
+    gst_object_unref(sink);
+    return true;
+}
+
+GstFlowReturn MultiModel::NewFrameCb(GstElement *sink, gpointer user_data)
+{
+    MultiModel *mm = (MultiModel *) user_data;
+    GstSample *sample = gst_app_sink_pull_sample(GST_APP_SINK(sink));
+    if (!sample)
+    {
+        return GST_FLOW_EOS;
+    }
+    mm->OnFrame(sample);
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+void MultiModel::OnFrame(GstSample *sample)
+{
+    GstCaps *caps = gst_sample_get_caps(sample);
+    GstBuffer *frame = gst_sample_get_buffer(sample);
+    GstVideoInfo info;
+    if (!caps || !frame || !gst_video_info_from_caps(&info, caps))
+    {
+        return;
+    }
+    if (!outCaps || !gst_caps_is_equal(outCaps, caps))
+    {
+        gst_caps_replace(&outCaps, caps);
+        gst_app_src_set_caps(GST_APP_SRC(outSrc), caps);
+    }
+
+    /* The size goes with the frame, the results come on other threads */
+    std::shared_ptr<Entry> entry(new Entry);
+    entry->frame = gst_buffer_ref(frame);
+    entry->width = GST_VIDEO_INFO_WIDTH(&info);
+    entry->height = GST_VIDEO_INFO_HEIGHT(&info);
+    entry->pending = 1;
+    entry->results.resize(models.size());
+    entry->fresh.assign(models.size(), false);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        entries.push_back(entry);
+    }
+
+    RoiInfer::Roi whole;
+    whole.x = 0;
+    whole.y = 0;
+    whole.width = entry->width & ~1;
+    whole.height = entry->height & ~1;
+
+    for (guint i = 0; i < models.size(); i++)
+    {
+        if (frameCount % models[i].interval)
+        {
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            entry->pending++;
+        }
+        /* A full branch drops the frame, its last result stays */
+        bool ok = infers[i]->Submit(frame, caps, std::vector<RoiInfer::Roi>(1, whole),
+                [this, entry, i](GstBuffer *, const std::vector<RoiInfer::Roi> &,
+                    const std::vector<std::vector<Detection>> &results) {
+                    Complete(entry, i, results.empty() ? NULL : &results[0]); });
+        if (!ok)
+        {
+            Complete(entry, i, NULL);
+        }
+    }
+    frameCount++;
+    /* All due models are in, the frame can go once they reported */
+    Complete(entry, 0, NULL);
+}
+
+void MultiModel::Complete(const std::shared_ptr<Entry> &entry, guint model, const std::vector<Detection> *dets)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (dets)
+    {
+        entry->results[model] = *dets;
+        entry->fresh[model] = true;
+    }
+    entry->pending--;
+
+    /* The output appsrc doesn't block, so the frames are pushed under the
+     * lock to keep their order */
+    while (!entries.empty() && !entries.front()->pending)
+    {
+        std::shared_ptr<Entry> e = entries.front();
+        entries.pop_front();
+
+        std::vector<Detection> merged;
+        for (std::size_t i = 0; i < models.size(); i++)
+        {
+            /* In frame order, so the last result is of the last frame the
+             * model ran on */
+            if (e->fresh[i])
+            {
+                last[i].swap(e->results[i]);
+            }
+            merged.insert(merged.end(), last[i].begin(), last[i].end());
+        }
+
+        /* Shares the memory of the frame, only the meta differs */
+        GstBuffer *out = gst_buffer_copy(e->frame);
+        gst_buffer_unref(e->frame);
+        e->frame = NULL;
+        AttachDetections(out, e->width, e->height, merged);
+        gst_app_src_push_buffer(GST_APP_SRC(outSrc), out);
+    }
+}
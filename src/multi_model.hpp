@@ -0,0 +1,102 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_MULTI_MODEL_H__
+#define __SMARTCAM_MULTI_MODEL_H__
+
+#include <gst/gst.h>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "roi_infer.hpp"
+
+/*
+ * Several detection models on one capture.
+ *
+ * Every frame from the frame appsink is handed to the preprocess and inference
+ * branch of each model by a RoiInfer, as a region covering the whole frame, so
+ * the branches run in parallel on the same decoded buffer. A branch with an
+ * interval of N only gets every Nth frame; for the frames in between, and the
+ * frames it dropped, its last result is reused.
+ *
+ * A frame is pushed to the output appsrc, in order, once every model due on
+ * it reported or dropped it. Its detections are those results, with the last
+ * ones of the models which weren't due, merged into one GstInferenceMeta for
+ * a single draw pass. The boxes of a model thus always belong to the frame
+ * they are drawn on, or to the last frame the model ran on.
+ */
+class MultiModel
+{
+public:
+    struct Model
+    {
+        std::string task;
+        /* Run on every Nth frame */
+        guint interval;
+    };
+
+    /* Parse a comma separated list of <task>[:<interval>] */
+    static bool ParseModels(const char *spec, std::vector<Model> &out);
+
+    /* Write the drawresult.json of the first model in @dir to @path, with the
+     * "classes" of all models, so the single draw pass shows the objects of
+     * each. If a model draws all its classes, so does the merged config. */
+    static bool WriteDrawConfig(const std::vector<Model> &models, const std::string &dir,
+            const std::string &path);
+
+    MultiModel(const std::vector<Model> &models);
+    ~MultiModel();
+
+    /* The branch of model i has the appsrc @srcPrefix<i> and the appsink @resultPrefix<i> */
+    bool Attach(GstElement *bin, const char *frameSink, const char *srcPrefix,
+            const char *resultPrefix, const char *outSrc);
+
+private:
+    struct Entry
+    {
+        GstBuffer *frame;
+        gint width;
+        gint height;
+        /* Models due on the frame which didn't report yet, plus one while
+         * OnFrame submits it */
+        guint pending;
+        /* Of each model, fresh if it ran on this frame */
+        std::vector<std::vector<Detection>> results;
+        std::vector<bool> fresh;
+    };
+
+    static GstFlowReturn NewFrameCb(GstElement *sink, gpointer user_data);
+    void OnFrame(GstSample *sample);
+    /* @model is done with @entry, @dets is NULL if it dropped the frame */
+    void Complete(const std::shared_ptr<Entry> &entry, guint model, const std::vector<Detection> *dets);
+
+    std::vector<Model> models;
+    std::vector<std::unique_ptr<RoiInfer>> infers;
+    guint64 frameCount;
+
+    std::mutex lock;
+    std::deque<std::shared_ptr<Entry>> entries;
+    /* Last result of each model, in frame coordinates */
+    std::vector<std::vector<Detection>> last;
+
+    GstElement *outSrc;
+    GstCaps *outCaps;
+};
+
+#endif /* __SMARTCAM_MULTI_MODEL_H__ */
@@ -0,0 +1,149 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+
+#include "nv12_convert.hpp"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Split 16 packed pixels of @src into 16 luma bytes and 16 chroma bytes,
+ * the chroma already in the U V order of NV12. Returns the pixels done. */
+static inline gint
+split_422_row (const guint8 * src, gboolean uyvy, guint8 * y, guint8 * uv, gint width)
+{
+    gint x = 0;
+#if defined(__ARM_NEON)
+    for (; x + 16 <= width; x += 16)
+    {
+        uint8x16x2_t px = vld2q_u8(src + 2 * x);
+        vst1q_u8(y + x, uyvy ? px.val[1] : px.val[0]);
+        vst1q_u8(uv + x, uyvy ? px.val[0] : px.val[1]);
+    }
+#elif defined(__SSE2__)
+    const __m128i lowMask = _mm_set1_epi16(0x00ff);
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *) (src + 2 * x));
+        __m128i b = _mm_loadu_si128((const __m128i *) (src + 2 * x + 16));
+        __m128i even = _mm_packus_epi16(_mm_and_si128(a, lowMask), _mm_and_si128(b, lowMask));
+        __m128i odd = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+        _mm_storeu_si128((__m128i *) (y + x), uyvy ? odd : even);
+        _mm_storeu_si128((__m128i *) (uv + x), uyvy ? even : odd);
+    }
+#endif
+    return x;
+}
+
+/* Luma of two packed rows, and their averaged chroma */
+static void
+convert_row_pair (const guint8 * s0, const guint8 * s1, gboolean uyvy,
+        guint8 * y0, guint8 * y1, guint8 * uv, gint width)
+{
+    gint x = 0;
+#if defined(__ARM_NEON)
+    for (; x + 16 <= width; x += 16)
+    {
+        uint8x16x2_t a = vld2q_u8(s0 + 2 * x);
+        uint8x16x2_t b = vld2q_u8(s1 + 2 * x);
+        vst1q_u8(y0 + x, uyvy ? a.val[1] : a.val[0]);
+        vst1q_u8(y1 + x, uyvy ? b.val[1] : b.val[0]);
+        vst1q_u8(uv + x, uyvy ? vrhaddq_u8(a.val[0], b.val[0]) : vrhaddq_u8(a.val[1], b.val[1]));
+    }
+#elif defined(__SSE2__)
+    const __m128i lowMask = _mm_set1_epi16(0x00ff);
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i a0 = _mm_loadu_si128((const __m128i *) (s0 + 2 * x));
+        __m128i a1 = _mm_loadu_si128((const __m128i *) (s0 + 2 * x + 16));
+        __m128i b0 = _mm_loadu_si128((const __m128i *) (s1 + 2 * x));
+        __m128i b1 = _mm_loadu_si128((const __m128i *) (s1 + 2 * x + 16));
+        __m128i aEven = _mm_packus_epi16(_mm_and_si128(a0, lowMask), _mm_and_si128(a1, lowMask));
+        __m128i aOdd = _mm_packus_epi16(_mm_srli_epi16(a0, 8), _mm_srli_epi16(a1, 8));
+        __m128i bEven = _mm_packus_epi16(_mm_and_si128(b0, lowMask), _mm_and_si128(b1, lowMask));
+        __m128i bOdd = _mm_packus_epi16(_mm_srli_epi16(b0, 8), _mm_srli_epi16(b1, 8));
+        _mm_storeu_si128((__m128i *) (y0 + x), uyvy ? aOdd : aEven);
+        _mm_storeu_si128((__m128i *) (y1 + x), uyvy ? bOdd : bEven);
+        _mm_storeu_si128((__m128i *) (uv + x), uyvy ? _mm_avg_epu8(aEven, bEven) : _mm_avg_epu8(aOdd, bOdd));
+    }
+#endif
+    gint ly = uyvy ? 1 : 0;
+    for (; x < width; x++)
+    {
+        y0[x] = s0[2 * x + ly];
+        y1[x] = s1[2 * x + ly];
+        uv[x] = (s0[2 * x + 1 - ly] + s1[2 * x + 1 - ly] + 1) >> 1;
+    }
+}
+
+void Yuv422PackedToNv12(const guint8 *src, gint srcStride, gboolean uyvy,
+        guint8 *dstY, gint yStride, guint8 *dstUV, gint uvStride,
+        gint width, gint height, gint rowStart, gint rowEnd)
+{
+    rowEnd = std::min(rowEnd, height);
+    gint j = rowStart;
+    for (; j + 1 < rowEnd; j += 2)
+    {
+        convert_row_pair(src + (gsize) j * srcStride, src + (gsize) (j + 1) * srcStride, uyvy,
+                dstY + (gsize) j * yStride, dstY + (gsize) (j + 1) * yStride,
+                dstUV + (gsize) (j / 2) * uvStride, width);
+    }
+    if (j < rowEnd)
+    {
+        /* Odd height, the last chroma row comes from one row */
+        const guint8 *s = src + (gsize) j * srcStride;
+        guint8 *y = dstY + (gsize) j * yStride;
+        guint8 *uv = dstUV + (gsize) (j / 2) * uvStride;
+        gint ly = uyvy ? 1 : 0;
+        for (gint x = split_422_row(s, uyvy, y, uv, width); x < width; x++)
+        {
+            y[x] = s[2 * x + ly];
+            uv[x] = s[2 * x + 1 - ly];
+        }
+    }
+}
+
+void PlanarChromaToNv12(const guint8 *u0, const guint8 *u1, const guint8 *v0, const guint8 *v1,
+        guint8 *dstUV, gint width)
+{
+    gint x = 0;
+#if defined(__ARM_NEON)
+    for (; x + 16 <= width; x += 16)
+    {
+        uint8x16x2_t uv;
+        uv.val[0] = vrhaddq_u8(vld1q_u8(u0 + x), vld1q_u8(u1 + x));
+        uv.val[1] = vrhaddq_u8(vld1q_u8(v0 + x), vld1q_u8(v1 + x));
+        vst2q_u8(dstUV + 2 * x, uv);
+    }
+#elif defined(__SSE2__)
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i u = _mm_avg_epu8(_mm_loadu_si128((const __m128i *) (u0 + x)), _mm_loadu_si128((const __m128i *) (u1 + x)));
+        __m128i v = _mm_avg_epu8(_mm_loadu_si128((const __m128i *) (v0 + x)), _mm_loadu_si128((const __m128i *) (v1 + x)));
+        _mm_storeu_si128((__m128i *) (dstUV + 2 * x), _mm_unpacklo_epi8(u, v));
+        _mm_storeu_si128((__m128i *) (dstUV + 2 * x + 16), _mm_unpackhi_epi8(u, v));
+    }
+#endif
+    for (; x < width; x++)
+    {
+        dstUV[2 * x] = (u0[x] + u1[x] + 1) >> 1;
+        dstUV[2 * x + 1] = (v0[x] + v1[x] + 1) >> 1;
+    }
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_NV12_CONVERT_H__
+#define __SMARTCAM_NV12_CONVERT_H__
+
+#include <glib.h>
+
+/*
+ * Conversions of camera formats into NV12.
+ *
+ * The chroma of two source rows is averaged into one NV12 chroma row. The
+ * functions take a range of source rows, which must start at an even row, so
+ * a frame can be split across threads. The inner loops use NEON on the target
+ * and SSE2 on x86, with a plain C tail.
+ */
+
+/* Packed 4:2:2, YUY2 or UYVY */
+void Yuv422PackedToNv12(const guint8 *src, gint srcStride, gboolean uyvy,
+        guint8 *dstY, gint yStride, guint8 *dstUV, gint uvStride,
+        gint width, gint height, gint rowStart, gint rowEnd);
+
+/* One NV12 chroma row from planar U and V, e.g. the raw output of a JPEG
+ * decoder. The two rows of each plane are averaged, pass the same row twice
+ * for 4:2:0 sources. @width is in chroma samples. */
+void PlanarChromaToNv12(const guint8 *u0, const guint8 *u1, const guint8 *v0, const guint8 *v1,
+        guint8 *dstUV, gint width);
+
+#endif /* __SMARTCAM_NV12_CONVERT_H__ */
@@ -0,0 +1,172 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+
+#include "nv12_scaler.hpp"
+
+Nv12Scaler::Nv12Scaler(guint threads)
+    : generation(0), running(0), stop(false)
+{
+    for (guint i = 1; i < threads; i++)
+    {
+        helpers.emplace_back(&Nv12Scaler::HelperRun, this, i);
+    }
+}
+
+Nv12Scaler::~Nv12Scaler()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+    }
+    cond.notify_all();
+    for (auto &t : helpers)
+    {
+        t.join();
+    }
+}
+
+void Nv12Scaler::HelperRun(guint band)
+{
+    std::vector<guint8> helperRow;
+    guint64 seen = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            cond.wait(guard, [this, seen] { return stop || generation != seen; });
+            if (stop)
+            {
+                break;
+            }
+            seen = generation;
+        }
+        ScaleBand(band, helpers.size() + 1, helperRow);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            running--;
+        }
+        doneCond.notify_one();
+    }
+}
+
+void Nv12Scaler::MakeTable(Table &t, gint srcStart, gint srcLen, gint dstLen)
+{
+    t.pos.resize(dstLen);
+    t.frac.resize(dstLen);
+    /* Pixel centers in 16.16 fixed point */
+    gint64 step = ((gint64) srcLen << 16) / dstLen;
+    gint64 s = step / 2 - (1 << 15);
+    for (gint i = 0; i < dstLen; i++, s += step)
+    {
+        gint64 c = std::max(s, (gint64) 0);
+        gint p = (gint) (c >> 16);
+        guint8 f = (guint8) ((c >> 8) & 0xff);
+        if (p >= srcLen - 1)
+        {
+            p = srcLen - 2;
+            f = 255;
+        }
+        t.pos[i] = srcStart + std::max(p, 0);
+        t.frac[i] = srcLen > 1 ? f : 0;
+    }
+}
+
+void Nv12Scaler::PrepareJob(Job &job, const guint8 *src, gint srcStride, gint ch, gint cropX, gint cropY,
+        gint cropW, gint cropH, guint8 *dst, gint dstStride, gint dstW, gint dstH)
+{
+    job.src = src;
+    job.srcStride = srcStride;
+    job.ch = ch;
+    job.cropX = cropX;
+    job.cropW = cropW;
+    job.cropH = cropH;
+    job.dst = dst;
+    job.dstStride = dstStride;
+    job.dstW = dstW;
+    job.dstH = dstH;
+    MakeTable(job.xTable, 0, cropW, dstW);
+    MakeTable(job.yTable, cropY, cropH, dstH);
+}
+
+void Nv12Scaler::ScaleRows(const Job &job, gint first, gint last, std::vector<guint8> &row)
+{
+    gint ch = job.ch;
+    gint cropBytes = job.cropW * ch;
+    row.resize(cropBytes + ch);
+
+    for (gint j = first; j < last; j++)
+    {
+        /* Vertical blend of the two source rows over the crop width */
+        const guint8 *__restrict a = job.src + (gsize) job.yTable.pos[j] * job.srcStride + job.cropX * ch;
+        const guint8 *__restrict b = job.cropH > 1 ? a + job.srcStride : a;
+        guint8 *__restrict v = row.data();
+        guint16 wb = job.yTable.frac[j];
+        guint16 wa = 256 - wb;
+        for (gint k = 0; k < cropBytes; k++)
+        {
+            v[k] = (a[k] * wa + b[k] * wb + 128) >> 8;
+        }
+        /* Repeat the last pixel for the right edge */
+        for (gint c = 0; c < ch; c++)
+        {
+            v[cropBytes + c] = v[cropBytes - ch + c];
+        }
+
+        /* Horizontal pass into the output row */
+        guint8 *out = job.dst + (gsize) j * job.dstStride;
+        for (gint i = 0; i < job.dstW; i++)
+        {
+            const guint8 *p = v + job.xTable.pos[i] * ch;
+            guint16 fx = job.xTable.frac[i];
+            for (gint c = 0; c < ch; c++)
+            {
+                out[i * ch + c] = (p[c] * (256 - fx) + p[c + ch] * fx + 128) >> 8;
+            }
+        }
+    }
+}
+
+void Nv12Scaler::ScaleBand(guint band, guint bands, std::vector<guint8> &row)
+{
+    for (const Job &job : planes)
+    {
+        gint first = (gint) ((gint64) job.dstH * band / bands);
+        gint last = (gint) ((gint64) job.dstH * (band + 1) / bands);
+        ScaleRows(job, first, last, row);
+    }
+}
+
+void Nv12Scaler::Scale(const Plane &src, gint cropX, gint cropY, gint cropW, gint cropH,
+        const Plane &dst, gint dstW, gint dstH)
+{
+    PrepareJob(planes[0], src.y, src.yStride, 1, cropX, cropY, cropW, cropH, dst.y, dst.yStride, dstW, dstH);
+    PrepareJob(planes[1], src.uv, src.uvStride, 2, cropX / 2, cropY / 2, cropW / 2, cropH / 2,
+            dst.uv, dst.uvStride, dstW / 2, dstH / 2);
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        running = helpers.size();
+        generation++;
+    }
+    cond.notify_all();
+
+    ScaleBand(0, helpers.size() + 1, row);
+
+    std::unique_lock<std::mutex> guard(lock);
+    doneCond.wait(guard, [this] { return running == 0; });
+}
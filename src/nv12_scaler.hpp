@@ -0,0 +1,101 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_NV12_SCALER_H__
+#define __SMARTCAM_NV12_SCALER_H__
+
+#include <glib.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Bilinear crop and scale of NV12 frames on the CPU.
+ *
+ * Every output row is first blended from two source rows over the crop
+ * width, a plain loop the compiler vectorizes, and then scaled horizontally
+ * with precomputed positions and 8 bit weights, so the gathering part only
+ * runs once per output pixel.
+ *
+ * The output rows are split into bands, one per thread: the calling thread
+ * scales the first one, helper threads kept for the scaler the others.
+ */
+class Nv12Scaler
+{
+public:
+    struct Plane
+    {
+        guint8 *y;
+        guint8 *uv;
+        gint yStride;
+        gint uvStride;
+    };
+
+    /* Scale on @threads threads, the caller's included */
+    Nv12Scaler(guint threads = 1);
+    ~Nv12Scaler();
+
+    /* Scale the even @cropX, @cropY, @cropW x @cropH region of @src into the
+     * whole @dstW x @dstH @dst */
+    void Scale(const Plane &src, gint cropX, gint cropY, gint cropW, gint cropH,
+            const Plane &dst, gint dstW, gint dstH);
+
+private:
+    struct Table
+    {
+        std::vector<gint> pos;
+        std::vector<guint8> frac;
+    };
+
+    /* One plane of a Scale call, the tables are shared by the bands */
+    struct Job
+    {
+        const guint8 *src;
+        gint srcStride;
+        gint ch;
+        gint cropX;
+        gint cropW;
+        gint cropH;
+        guint8 *dst;
+        gint dstStride;
+        gint dstW;
+        gint dstH;
+        Table xTable;
+        Table yTable;
+    };
+
+    static void MakeTable(Table &t, gint srcStart, gint srcLen, gint dstLen);
+    static void ScaleRows(const Job &job, gint first, gint last, std::vector<guint8> &row);
+    void PrepareJob(Job &job, const guint8 *src, gint srcStride, gint ch, gint cropX, gint cropY,
+            gint cropW, gint cropH, guint8 *dst, gint dstStride, gint dstW, gint dstH);
+    /* Band @band of @bands of both planes */
+    void ScaleBand(guint band, guint bands, std::vector<guint8> &row);
+    void HelperRun(guint band);
+
+    Job planes[2];
+    std::vector<guint8> row;
+
+    std::mutex lock;
+    std::condition_variable cond;
+    std::condition_variable doneCond;
+    guint64 generation;
+    guint running;
+    bool stop;
+    std::vector<std::thread> helpers;
+};
+
+#endif /* __SMARTCAM_NV12_SCALER_H__ */
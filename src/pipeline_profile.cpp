@@ -0,0 +1,309 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <jansson.h>
+#include <string.h>
+
+#include "pipeline_profile.hpp"
+
+static const char *queueStages[] = {
+    "decoder", "preprocess", "inference", "slave", "models", "tiles", "cascade", "draw", "autoframe",
+    "display", "encode-branch", "scale", "roi", "encode", "file", "output",
+    "cascade-preprocess", "cascade-inference", "model-preprocess", "model-inference",
+    "tile-preprocess", "tile-inference", NULL
+};
+
+/* Branches the app feeds and matches the results of by their order, a
+ * dropped buffer would shift the results onto the wrong frames */
+static const char *appFedStages[] = {
+    "cascade-preprocess", "cascade-inference", "model-preprocess", "model-inference",
+    "tile-preprocess", "tile-inference", NULL
+};
+
+static const char *elementStages[] = {
+    "capture", "decoder", "preprocess", "inference", "draw", "roi", "encoder", "display", NULL
+};
+
+/* Names of CodecBackend, an element stage can be qualified with */
+static const char *backends[] = { "vcu", "sw", NULL };
+
+static bool IsStage(const char *const *stages, const char *name)
+{
+    for (const char *const *s = stages; *s; s++)
+    {
+        if (!strcmp(*s, name))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool ValueString(json_t *val, std::string &out)
+{
+    char buf[64];
+    if (json_is_integer(val))
+    {
+        snprintf(buf, sizeof(buf), "%" JSON_INTEGER_FORMAT, json_integer_value(val));
+        out = buf;
+    }
+    else if (json_is_real(val))
+    {
+        snprintf(buf, sizeof(buf), "%g", json_real_value(val));
+        out = buf;
+    }
+    else if (json_is_boolean(val))
+    {
+        out = json_is_true(val) ? "true" : "false";
+    }
+    else if (json_is_string(val))
+    {
+        out = json_string_value(val);
+        /* Can't be quoted in a launch line, parentheses not in the one of an RTSP factory */
+        return !out.empty() && out.find_first_of("\"()") == std::string::npos;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+/* With a @backend, the stages may be qualified as "<stage>:<backend>"; those
+ * of @backend come after the plain ones, the others are left out */
+static bool LoadSection(json_t *section, const char *key, const char *const *stages, const char *backend,
+        std::map<std::string, std::vector<std::pair<std::string, std::string>>> &out, const std::string &path)
+{
+    const char *entry, *name;
+    json_t *props, *val;
+    std::map<std::string, std::vector<std::pair<std::string, std::string>>> qualified;
+
+    if (!section)
+    {
+        return true;
+    }
+    if (!json_is_object(section))
+    {
+        g_printerr("ERROR: %s: \"%s\" must be an object.\n", path.c_str(), key);
+        return false;
+    }
+    json_object_foreach(section, entry, props)
+    {
+        std::string stageName(entry), qualifier;
+        std::size_t colon = stageName.find(':');
+        if (backend && colon != std::string::npos)
+        {
+            qualifier = stageName.substr(colon + 1);
+            stageName.erase(colon);
+            if (!IsStage(backends, qualifier.c_str()))
+            {
+                g_printerr("ERROR: %s: unknown codec backend \"%s\" in \"%s\".\n", path.c_str(), qualifier.c_str(), key);
+                return false;
+            }
+        }
+        const char *stage = stageName.c_str();
+        if (!IsStage(stages, stage))
+        {
+            g_printerr("ERROR: %s: unknown stage \"%s\" in \"%s\".\n", path.c_str(), entry, key);
+            return false;
+        }
+        if (!json_is_object(props))
+        {
+            g_printerr("ERROR: %s: \"%s\" in \"%s\" must be an object of properties.\n", path.c_str(), stage, key);
+            return false;
+        }
+        json_object_foreach(props, name, val)
+        {
+            std::string str;
+            if (!strcmp(name, "name"))
+            {
+                /* The app finds the elements by their names */
+                g_printerr("ERROR: %s: the name of %s can't be set.\n", path.c_str(), stage);
+                return false;
+            }
+            if (!ValueString(val, str))
+            {
+                g_printerr("ERROR: %s: invalid value of %s of %s.\n", path.c_str(), name, stage);
+                return false;
+            }
+            if (qualifier.empty())
+            {
+                out[stage].push_back(std::make_pair(std::string(name), str));
+            }
+            else if (qualifier == backend)
+            {
+                qualified[stage].push_back(std::make_pair(std::string(name), str));
+            }
+        }
+    }
+    for (auto &q : qualified)
+    {
+        out[q.first].insert(out[q.first].end(), q.second.begin(), q.second.end());
+    }
+    return true;
+}
+
+bool PipelineProfile::Load(const std::string &path, const char *backend)
+{
+    json_error_t error;
+    json_t *root = json_load_file(path.c_str(), 0, &error);
+    if (!root)
+    {
+        g_printerr("ERROR: Can't load the pipeline profile %s: %s, line %d\n", path.c_str(), error.text, error.line);
+        return false;
+    }
+
+    bool ok = json_is_object(root);
+    if (!ok)
+    {
+        g_printerr("ERROR: %s: the pipeline profile must be an object.\n", path.c_str());
+    }
+    const char *key;
+    json_t *val;
+    json_object_foreach(root, key, val)
+    {
+        if (!strcmp(key, "description") && json_is_string(val))
+        {
+            description = json_string_value(val);
+        }
+        else if (strcmp(key, "queues") && strcmp(key, "elements"))
+        {
+            g_printerr("ERROR: %s: unknown key \"%s\".\n", path.c_str(), key);
+            ok = false;
+        }
+    }
+    ok = ok && LoadSection(json_object_get(root, "queues"), "queues", queueStages, NULL, queues, path)
+        && LoadSection(json_object_get(root, "elements"), "elements", elementStages, backend, elements, path);
+    json_decref(root);
+    return ok;
+}
+
+bool PipelineProfile::CheckProps(const char *factoryName, const std::string &stage, const PropList &props)
+{
+    GstElementFactory *factory = gst_element_factory_find(factoryName);
+    if (!factory)
+    {
+        /* Fails with the missing element when the pipeline is built */
+        return true;
+    }
+    GstPluginFeature *loaded = gst_plugin_feature_load(GST_PLUGIN_FEATURE(factory));
+    gst_object_unref(factory);
+    if (!loaded)
+    {
+        return true;
+    }
+
+    GObjectClass *klass = (GObjectClass *) g_type_class_ref(
+            gst_element_factory_get_element_type(GST_ELEMENT_FACTORY(loaded)));
+    bool ok = true;
+    for (const auto &p : props)
+    {
+        /* Properties of the children of a bin, like v4l2src0::io-mode, are
+         * only known once it is built */
+        if (p.first.find("::") != std::string::npos)
+        {
+            continue;
+        }
+        GParamSpec *spec = g_object_class_find_property(klass, p.first.c_str());
+        if (!spec || !(spec->flags & G_PARAM_WRITABLE))
+        {
+            g_printerr("ERROR: Pipeline profile, %s: %s has no property %s.\n", stage.c_str(), factoryName, p.first.c_str());
+            ok = false;
+            break;
+        }
+        GValue value = G_VALUE_INIT;
+        g_value_init(&value, spec->value_type);
+        if (!gst_value_deserialize(&value, p.second.c_str()))
+        {
+            g_printerr("ERROR: Pipeline profile, %s: invalid value %s of %s.\n", stage.c_str(), p.second.c_str(), p.first.c_str());
+            ok = false;
+        }
+        g_value_unset(&value);
+        if (!ok)
+        {
+            break;
+        }
+    }
+    g_type_class_unref(klass);
+    gst_object_unref(loaded);
+    return ok;
+}
+
+bool PipelineProfile::Validate(const std::map<std::string, std::string> &factories) const
+{
+    for (const auto &q : queues)
+    {
+        if (!CheckProps("queue", q.first, q.second))
+        {
+            return false;
+        }
+        if (!IsStage(appFedStages, q.first.c_str()))
+        {
+            continue;
+        }
+        for (const auto &p : q.second)
+        {
+            if (p.first == "leaky")
+            {
+                g_printerr("ERROR: Pipeline profile, %s: the queue can't be leaky, the app matches the results of the branch by their order.\n",
+                        q.first.c_str());
+                return false;
+            }
+        }
+    }
+    for (const auto &e : elements)
+    {
+        /* Stages not in this pipeline are left out */
+        auto it = factories.find(e.first);
+        if (it != factories.end() && !CheckProps(it->second.c_str(), e.first, e.second))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string PipelineProfile::Join(const PropList &props)
+{
+    std::string out;
+    for (const auto &p : props)
+    {
+        bool quote = p.second.find_first_of(" ,;!=") != std::string::npos;
+        out += " " + p.first + "=" + (quote ? "\"" + p.second + "\"" : p.second);
+    }
+    return out;
+}
+
+std::string PipelineProfile::Queue(const char *stage, const std::string &defaults) const
+{
+    std::string desc = "queue";
+    if (!defaults.empty())
+    {
+        desc += " " + defaults;
+    }
+    auto it = queues.find(stage);
+    if (it != queues.end())
+    {
+        desc += Join(it->second);
+    }
+    return desc;
+}
+
+std::string PipelineProfile::Props(const char *stage) const
+{
+    auto it = elements.find(stage);
+    return it != elements.end() ? Join(it->second) : std::string();
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_PIPELINE_PROFILE_H__
+#define __SMARTCAM_PIPELINE_PROFILE_H__
+
+#include <gst/gst.h>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * Per stage tuning of the pipeline from a JSON profile.
+ *
+ * The topology of the pipeline follows from the command line, and the app
+ * stages are bound to its elements by name. A profile sets the properties of
+ * the queue in front of a stage and of the main element of a stage:
+ *
+ *   {
+ *     "description" : "Lowest latency for the display",
+ *     "queues" : { "display" : { "max-size-buffers" : 1, "leaky" : "downstream" } },
+ *     "elements" : { "encoder" : { "gop-length" : 30 } }
+ *   }
+ *
+ * The properties of a profile come after the built-in ones in the launch
+ * line, so they win, and before the options given on the command line. The
+ * stage and property names and the values are checked against the element
+ * factories at startup.
+ *
+ * The branches the app feeds, of the cascade, the models and the tiles, have
+ * queue stages of their own, e.g. "model-preprocess"; those can't be leaky.
+ *
+ * The elements of a stage differ with the codec backend, so an element stage
+ * can be qualified with one, e.g. "encoder:vcu" for the OMX encoder only. The
+ * properties for the backend in use go after the plain ones of the stage.
+ */
+class PipelineProfile
+{
+public:
+    /* Load @path for the codec @backend, vcu or sw, false with the error
+     * printed if it is invalid */
+    bool Load(const std::string &path, const char *backend);
+
+    /* Check the properties, with the factory of each element stage of this
+     * pipeline; the stages which aren't in it are skipped */
+    bool Validate(const std::map<std::string, std::string> &factories) const;
+
+    /* "queue" with the @defaults and the properties of the profile for @stage */
+    std::string Queue(const char *stage, const std::string &defaults = "") const;
+    /* The properties of the profile for the element of @stage, each with a
+     * leading space */
+    std::string Props(const char *stage) const;
+
+    const std::string &Description() const { return description; }
+
+private:
+    typedef std::vector<std::pair<std::string, std::string>> PropList;
+
+    static bool CheckProps(const char *factoryName, const std::string &stage, const PropList &props);
+    static std::string Join(const PropList &props);
+
+    std::string description;
+    std::map<std::string, PropList> queues;
+    std::map<std::string, PropList> elements;
+};
+
+#endif /* __SMARTCAM_PIPELINE_PROFILE_H__ */
@@ -0,0 +1,231 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <algorithm>
+
+#include "appsrc_pool.hpp"
+#include "metrics.hpp"
+#include "rendition_scaler.hpp"
+
+/* Threads scaling the renditions, a band of rows each, as in the auto framing */
+#define SCALE_THREADS 3
+/* Output buffers in each pool, besides what its encoder asks for */
+#define MIN_OUT_BUFFERS 2
+
+RenditionScaler::RenditionScaler(const std::vector<Output> &outputs)
+    : scaler(SCALE_THREADS), inCaps(NULL), frameWidth(0), frameHeight(0), frames(0), scaleTime(0), maxScaleTime(0)
+{
+    for (const auto &o : outputs)
+    {
+        Target t;
+        t.out = o;
+        t.appsrc = NULL;
+        t.pool = NULL;
+        targets.push_back(t);
+    }
+    metricsId = Metrics::Get().Register("rendition scaling", [this] { return Report(); });
+}
+
+RenditionScaler::~RenditionScaler()
+{
+    Metrics::Get().Unregister(metricsId);
+    for (auto &t : targets)
+    {
+        if (t.pool)
+        {
+            gst_buffer_pool_set_active(t.pool, FALSE);
+            gst_object_unref(t.pool);
+        }
+        if (t.appsrc)
+        {
+            gst_object_unref(t.appsrc);
+        }
+    }
+    if (inCaps)
+    {
+        gst_caps_unref(inCaps);
+    }
+}
+
+bool RenditionScaler::Attach(GstElement *bin, const char *sinkName)
+{
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(bin), sinkName);
+    if (!sink)
+    {
+        g_printerr("ERROR: Element %s not found for the rendition scaling.\n", sinkName);
+        return false;
+    }
+    for (auto &t : targets)
+    {
+        GstElement *src = gst_bin_get_by_name(GST_BIN(bin), t.out.srcName.c_str());
+        if (!src)
+        {
+            g_printerr("ERROR: Element %s not found for the rendition scaling.\n", t.out.srcName.c_str());
+            gst_object_unref(sink);
+            return false;
+        }
+        g_object_set(src, "is-live", TRUE, "format", GST_FORMAT_TIME, NULL);
+        if (t.appsrc)
+            gst_object_unref(t.appsrc);
+        t.appsrc = src;
+    }
+
+    g_object_set(sink, "emit-signals", TRUE, "sync", FALSE, NULL);
+    g_signal_connect(sink, "new-sample", G_CALLBACK(NewFrameCb), this);
+    gst_object_unref(sink);
+    return true;
+}
+
+GstFlowReturn RenditionScaler::NewFrameCb(GstElement *sink, gpointer user_data)
+{
+    RenditionScaler *rs = (RenditionScaler *) user_data;
+    GstSample *sample = gst_app_sink_pull_sample(GST_APP_SINK(sink));
+    if (!sample)
+    {
+        return GST_FLOW_EOS;
+    }
+    rs->OnFrame(sample);
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+bool RenditionScaler::SetupOutputs(GstCaps *caps)
+{
+    GstVideoInfo info;
+    if (!gst_video_info_from_caps(&info, caps) || GST_VIDEO_INFO_FORMAT(&info) != GST_VIDEO_FORMAT_NV12)
+    {
+        g_printerr("ERROR: The rendition scaling needs NV12 frames.\n");
+        return false;
+    }
+    frameWidth = GST_VIDEO_INFO_WIDTH(&info);
+    frameHeight = GST_VIDEO_INFO_HEIGHT(&info);
+    gst_caps_replace(&inCaps, caps);
+
+    for (auto &t : targets)
+    {
+        GstCaps *outCaps = gst_caps_copy(caps);
+        gst_caps_set_simple(outCaps, "width", G_TYPE_INT, t.out.width, "height", G_TYPE_INT, t.out.height, NULL);
+        GstVideoInfo outInfo;
+        gst_video_info_from_caps(&outInfo, outCaps);
+
+        gst_app_src_set_caps(GST_APP_SRC(t.appsrc), outCaps);
+        if (t.pool)
+        {
+            gst_buffer_pool_set_active(t.pool, FALSE);
+            gst_object_unref(t.pool);
+        }
+        t.pool = NegotiateAppSrcPool(t.appsrc, outCaps, GST_VIDEO_INFO_SIZE(&outInfo), MIN_OUT_BUFFERS);
+        gst_caps_unref(outCaps);
+        if (!t.pool)
+        {
+            g_printerr("ERROR: No buffer pool for the rendition %dx%d.\n", t.out.width, t.out.height);
+            return false;
+        }
+    }
+    return true;
+}
+
+void RenditionScaler::Push(Target &t, GstBuffer *frame, const GstVideoFrame &in, const std::vector<Detection> &dets)
+{
+    GstBuffer *out = NULL;
+    if (gst_buffer_pool_acquire_buffer(t.pool, &out, NULL) != GST_FLOW_OK)
+    {
+        return;
+    }
+    GstVideoInfo outInfo;
+    GstVideoFrame dst;
+    gst_video_info_set_format(&outInfo, GST_VIDEO_FORMAT_NV12, t.out.width, t.out.height);
+    if (!gst_video_frame_map(&dst, &outInfo, out, GST_MAP_WRITE))
+    {
+        gst_buffer_unref(out);
+        return;
+    }
+    Nv12Scaler::Plane s = { (guint8 *) GST_VIDEO_FRAME_PLANE_DATA(&in, 0), (guint8 *) GST_VIDEO_FRAME_PLANE_DATA(&in, 1),
+            GST_VIDEO_FRAME_PLANE_STRIDE(&in, 0), GST_VIDEO_FRAME_PLANE_STRIDE(&in, 1) };
+    Nv12Scaler::Plane d = { (guint8 *) GST_VIDEO_FRAME_PLANE_DATA(&dst, 0), (guint8 *) GST_VIDEO_FRAME_PLANE_DATA(&dst, 1),
+            GST_VIDEO_FRAME_PLANE_STRIDE(&dst, 0), GST_VIDEO_FRAME_PLANE_STRIDE(&dst, 1) };
+    scaler.Scale(s, 0, 0, frameWidth & ~1, frameHeight & ~1, d, t.out.width, t.out.height);
+    gst_video_frame_unmap(&dst);
+
+    gst_buffer_copy_into(out, frame, GST_BUFFER_COPY_TIMESTAMPS, 0, -1);
+
+    double sx = (double) t.out.width / frameWidth, sy = (double) t.out.height / frameHeight;
+    std::vector<Detection> mapped;
+    for (auto d : dets)
+    {
+        d.x = (gint) (d.x * sx);
+        d.y = (gint) (d.y * sy);
+        d.width = (gint) (d.width * sx);
+        d.height = (gint) (d.height * sy);
+        mapped.push_back(d);
+    }
+    AttachDetections(out, t.out.width, t.out.height, mapped);
+    gst_app_src_push_buffer(GST_APP_SRC(t.appsrc), out);
+}
+
+void RenditionScaler::OnFrame(GstSample *sample)
+{
+    GstCaps *caps = gst_sample_get_caps(sample);
+    GstBuffer *frame = gst_sample_get_buffer(sample);
+    if (!caps || !frame)
+    {
+        return;
+    }
+    if ((!inCaps || !gst_caps_is_equal(inCaps, caps)) && !SetupOutputs(caps))
+    {
+        return;
+    }
+
+    std::vector<Detection> dets;
+    ExtractDetections(frame, dets);
+
+    GstVideoInfo inInfo;
+    GstVideoFrame in;
+    gst_video_info_from_caps(&inInfo, caps);
+    /* The input stays in its DMA buffer, mapping it doesn't copy, once for
+     * all the renditions */
+    if (!gst_video_frame_map(&in, &inInfo, frame, GST_MAP_READ))
+    {
+        return;
+    }
+    gint64 start = g_get_monotonic_time();
+    for (auto &t : targets)
+    {
+        Push(t, frame, in, dets);
+    }
+    guint64 took = g_get_monotonic_time() - start;
+    gst_video_frame_unmap(&in);
+
+    frames++;
+    scaleTime += took;
+    guint64 peak = maxScaleTime;
+    while (took > peak && !maxScaleTime.compare_exchange_weak(peak, took))
+    {
+    }
+}
+
+std::string RenditionScaler::Report()
+{
+    guint64 n = frames.exchange(0);
+    guint64 t = scaleTime.exchange(0);
+    guint64 peak = maxScaleTime.exchange(0);
+    char line[160];
+    snprintf(line, sizeof(line), "%" G_GUINT64_FORMAT " frames, scaling %zu renditions %.1f ms/frame avg, %.1f ms max on %d threads",
+            n, targets.size(), n ? t / 1000.0 / n : 0, peak / 1000.0, SCALE_THREADS);
+    return std::string(line);
+}
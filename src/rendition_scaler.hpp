@@ -0,0 +1,80 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_RENDITION_SCALER_H__
+#define __SMARTCAM_RENDITION_SCALER_H__
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "detections.hpp"
+#include "nv12_scaler.hpp"
+
+/*
+ * Scaling of the simulcast renditions whose size differs from the stream.
+ *
+ * The frames come in through one appsink, are mapped once and scaled by an
+ * Nv12Scaler into a buffer of each rendition, from the pool its encoder
+ * proposes, which is pushed to the appsrc of the rendition with the
+ * detections mapped along, for the ROI encoding. The scaling time of all
+ * renditions per frame is reported with the metrics.
+ */
+class RenditionScaler
+{
+public:
+    struct Output
+    {
+        std::string srcName;
+        gint width;
+        gint height;
+    };
+
+    RenditionScaler(const std::vector<Output> &outputs);
+    ~RenditionScaler();
+
+    bool Attach(GstElement *bin, const char *sinkName);
+
+private:
+    struct Target
+    {
+        Output out;
+        GstElement *appsrc;
+        GstBufferPool *pool;
+    };
+
+    static GstFlowReturn NewFrameCb(GstElement *sink, gpointer user_data);
+    void OnFrame(GstSample *sample);
+    bool SetupOutputs(GstCaps *caps);
+    void Push(Target &t, GstBuffer *frame, const GstVideoFrame &in, const std::vector<Detection> &dets);
+    std::string Report();
+
+    Nv12Scaler scaler;
+    std::vector<Target> targets;
+    GstCaps *inCaps;
+    gint frameWidth;
+    gint frameHeight;
+
+    guint metricsId;
+    std::atomic<guint64> frames;
+    /* Microseconds */
+    std::atomic<guint64> scaleTime;
+    std::atomic<guint64> maxScaleTime;
+};
+
+#endif /* __SMARTCAM_RENDITION_SCALER_H__ */
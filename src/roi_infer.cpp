@@ -0,0 +1,202 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/video/video.h>
+#include <stdio.h>
+
+#include "metrics.hpp"
+#include "roi_infer.hpp"
+#include "xpp_roi.h"
+
+RoiInfer::RoiInfer(const char *name, guint maxFrames)
+    : maxFrames(maxFrames), appsrc(NULL), caps(NULL), frames(0), rois(0), busyUs(0), dropped(0)
+{
+    metricsId = Metrics::Get().Register(name, [this] { return Report(); });
+}
+
+RoiInfer::~RoiInfer()
+{
+    Metrics::Get().Unregister(metricsId);
+    for (auto &p : pending)
+    {
+        gst_buffer_unref(p.frame);
+    }
+    if (appsrc)
+    {
+        gst_object_unref(appsrc);
+    }
+    if (caps)
+    {
+        gst_caps_unref(caps);
+    }
+}
+
+bool RoiInfer::Attach(GstElement *bin, const char *srcName, const char *resultName)
+{
+    GstElement *src = gst_bin_get_by_name(GST_BIN(bin), srcName);
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(bin), resultName);
+    if (!src || !sink)
+    {
+        g_printerr("ERROR: Elements %s/%s not found for region inference.\n", srcName, resultName);
+        if (src)
+            gst_object_unref(src);
+        if (sink)
+            gst_object_unref(sink);
+        return false;
+    }
+
+    /* Every region is a full frame to the appsrc byte count, the frames in flight are bounded here instead */
+    g_object_set(src, "is-live", TRUE, "format", GST_FORMAT_TIME, "max-bytes", (guint64) 0, NULL);
+    g_object_set(sink, "emit-signals", TRUE, "sync", FALSE, NULL);
+    g_signal_connect(sink, "new-sample", G_CALLBACK(ResultCb), this);
+    gst_object_unref(sink);
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (appsrc)
+        gst_object_unref(appsrc);
+    appsrc = src;
+    return true;
+}
+
+bool RoiInfer::Submit(GstBuffer *frame, GstCaps *frameCaps, const std::vector<Roi> &regions, DoneFunc done)
+{
+    /* Runs on the streaming thread of the caller, which must not wait for
+     * the branch: a full branch drops the frame */
+    std::unique_lock<std::mutex> guard(lock);
+    if (!appsrc || pending.size() >= maxFrames)
+    {
+        dropped++;
+        return false;
+    }
+
+    if (regions.empty() && pending.empty())
+    {
+        guard.unlock();
+        done(frame, regions, std::vector<std::vector<Detection>>());
+        return true;
+    }
+
+    if (!caps || !gst_caps_is_equal(caps, frameCaps))
+    {
+        gst_caps_replace(&caps, frameCaps);
+        gst_app_src_set_caps(GST_APP_SRC(appsrc), caps);
+    }
+
+    Pending p;
+    p.frame = gst_buffer_ref(frame);
+    p.rois = regions;
+    p.done = done;
+    p.start = g_get_monotonic_time();
+    pending.push_back(p);
+
+    GstElement *src = (GstElement *) gst_object_ref(appsrc);
+    guard.unlock();
+
+    for (const auto &r : regions)
+    {
+        /* Shares the memory of the frame, only the meta differs */
+        GstBuffer *buf = gst_buffer_copy(frame);
+        gst_buffer_add_video_region_of_interest_meta(buf, XPP_ROI_TYPE, r.x, r.y, r.width, r.height);
+        gst_app_src_push_buffer(GST_APP_SRC(src), buf);
+    }
+    gst_object_unref(src);
+    return true;
+}
+
+GstFlowReturn RoiInfer::ResultCb(GstElement *sink, gpointer user_data)
+{
+    RoiInfer *infer = (RoiInfer *) user_data;
+    GstSample *sample = gst_app_sink_pull_sample(GST_APP_SINK(sink));
+    if (!sample)
+    {
+        return GST_FLOW_EOS;
+    }
+    infer->OnResult(sample);
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+void RoiInfer::PopFinished(std::vector<Pending> &finished)
+{
+    while (!pending.empty() && pending.front().results.size() == pending.front().rois.size())
+    {
+        Pending &p = pending.front();
+        frames++;
+        rois += p.rois.size();
+        busyUs += g_get_monotonic_time() - p.start;
+        finished.push_back(p);
+        pending.pop_front();
+    }
+}
+
+void RoiInfer::OnResult(GstSample *sample)
+{
+    GstVideoInfo info;
+    GstCaps *sampleCaps = gst_sample_get_caps(sample);
+    if (!sampleCaps || !gst_video_info_from_caps(&info, sampleCaps))
+    {
+        return;
+    }
+    gint modelW = GST_VIDEO_INFO_WIDTH(&info);
+    gint modelH = GST_VIDEO_INFO_HEIGHT(&info);
+
+    std::vector<Detection> dets;
+    ExtractDetections(gst_sample_get_buffer(sample), dets);
+
+    std::vector<Pending> finished;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (pending.empty())
+        {
+            return;
+        }
+
+        Pending &p = pending.front();
+        const Roi &r = p.rois[p.results.size()];
+        for (auto &d : dets)
+        {
+            if (d.width > 0 && d.height > 0)
+            {
+                d.x = r.x + d.x * r.width / modelW;
+                d.y = r.y + d.y * r.height / modelH;
+                d.width = d.width * r.width / modelW;
+                d.height = d.height * r.height / modelH;
+            }
+        }
+        p.results.push_back(dets);
+        PopFinished(finished);
+    }
+
+    for (auto &p : finished)
+    {
+        p.done(p.frame, p.rois, p.results);
+        gst_buffer_unref(p.frame);
+    }
+}
+
+std::string RoiInfer::Report()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    char line[160];
+    snprintf(line, sizeof(line), "%.1f regions/frame, %.1f ms/frame, %" G_GUINT64_FORMAT " frames, %" G_GINT64_FORMAT " dropped",
+            frames ? (double) rois / frames : 0, frames ? busyUs / 1000.0 / frames : 0, frames, dropped);
+    frames = 0;
+    rois = 0;
+    busyUs = 0;
+    return std::string(line);
+}
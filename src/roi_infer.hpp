@@ -0,0 +1,96 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_ROI_INFER_H__
+#define __SMARTCAM_ROI_INFER_H__
+
+#include <gst/gst.h>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "detections.hpp"
+
+/*
+ * Runs the preprocess and inference branch on regions of a frame.
+ *
+ * For every region, a buffer sharing the frame's memory, with an XPP_ROI_TYPE
+ * region of interest meta, is pushed into the branch's appsrc, so libivas_xpp
+ * scales only that region to the model input. The regions are pushed back to
+ * back, the DPU runs them without waiting for the app in between.
+ *
+ * The branch keeps the order, so the results arriving at the appsink are
+ * paired with the regions first in, first out. Boxes are mapped back from the
+ * model input to frame coordinates; results without a box, i.e. of
+ * classification models, are passed as they are. Once all regions of a frame
+ * are done, its callback runs on the appsink streaming thread.
+ */
+class RoiInfer
+{
+public:
+    struct Roi
+    {
+        gint x;
+        gint y;
+        gint width;
+        gint height;
+    };
+
+    typedef std::function<void(GstBuffer *frame, const std::vector<Roi> &rois,
+            const std::vector<std::vector<Detection>> &results)> DoneFunc;
+
+    /* @name labels the metrics, at most @maxFrames are in the branch at a time */
+    RoiInfer(const char *name, guint maxFrames);
+    ~RoiInfer();
+
+    bool Attach(GstElement *bin, const char *srcName, const char *resultName);
+
+    /* Returns false at once if @frame was dropped as the branch is full.
+     * Regions must be aligned to XPP_ROI_ALIGN horizontally and even. */
+    bool Submit(GstBuffer *frame, GstCaps *caps, const std::vector<Roi> &rois, DoneFunc done);
+
+private:
+    struct Pending
+    {
+        GstBuffer *frame;
+        std::vector<Roi> rois;
+        std::vector<std::vector<Detection>> results;
+        DoneFunc done;
+        gint64 start;
+    };
+
+    static GstFlowReturn ResultCb(GstElement *sink, gpointer user_data);
+    void OnResult(GstSample *sample);
+    /* Called with the lock held, returns the finished frames in order */
+    void PopFinished(std::vector<Pending> &finished);
+    std::string Report();
+
+    std::mutex lock;
+    std::deque<Pending> pending;
+    guint maxFrames;
+    GstElement *appsrc;
+    GstCaps *caps;
+
+    guint metricsId;
+    guint64 frames;
+    guint64 rois;
+    gint64 busyUs;
+    gint64 dropped;
+};
+
+#endif /* __SMARTCAM_ROI_INFER_H__ */
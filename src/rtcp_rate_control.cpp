@@ -0,0 +1,200 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gst/rtp/gstrtcpbuffer.h>
+#include <algorithm>
+
+#include "rtcp_rate_control.hpp"
+
+/* Clock rate of the video payloads, used to turn the RTCP jitter into ms */
+#define VIDEO_CLOCK_RATE 90000
+#define LOSS_HIGH 0.10
+#define LOSS_LOW 0.02
+#define INCREASE_FACTOR 1.05
+#define JITTER_BACKOFF_FACTOR 0.85
+/* Jitter growth in ms per interval that counts as queue build up */
+#define JITTER_GROWTH_MS 5.0
+
+RtcpRateControl::RtcpRateControl(const Params &params, EncoderControl *enc)
+    : params(params), enc(enc), rate(params.maxBitrate), prevJitterMs(0), timer(0)
+{
+}
+
+RtcpRateControl::~RtcpRateControl()
+{
+    if (timer)
+    {
+        g_source_remove(timer);
+    }
+}
+
+void RtcpRateControl::Start()
+{
+    enc->SetBitrateCap(rate);
+    timer = g_timeout_add(params.intervalMs, TimeoutCb, this);
+}
+
+void RtcpRateControl::Stop()
+{
+    if (timer)
+    {
+        g_source_remove(timer);
+        timer = 0;
+    }
+    prevJitterMs = 0;
+    std::lock_guard<std::mutex> guard(lock);
+    reports.clear();
+}
+
+void RtcpRateControl::AddMedia(GstRTSPMedia *media)
+{
+    g_signal_connect(media, "prepared", G_CALLBACK(MediaPreparedCb), this);
+}
+
+void RtcpRateControl::MediaPreparedCb(GstRTSPMedia *media, gpointer user_data)
+{
+    RtcpRateControl *ctrl = (RtcpRateControl *) user_data;
+    guint n = gst_rtsp_media_n_streams(media);
+    for (guint i = 0; i < n; i++)
+    {
+        GstRTSPStream *stream = gst_rtsp_media_get_stream(media, i);
+        GObject *session = gst_rtsp_stream_get_rtpsession(stream);
+        if (session)
+        {
+            g_signal_connect(session, "on-receiving-rtcp", G_CALLBACK(ReceivingRtcpCb), ctrl);
+            g_object_unref(session);
+        }
+    }
+}
+
+void RtcpRateControl::ReceivingRtcpCb(GObject *session, GstBuffer *buf, gpointer user_data)
+{
+    RtcpRateControl *ctrl = (RtcpRateControl *) user_data;
+    ctrl->OnRtcp(buf);
+}
+
+void RtcpRateControl::OnRtcp(GstBuffer *buf)
+{
+    GstRTCPBuffer rtcp = GST_RTCP_BUFFER_INIT;
+    GstRTCPPacket packet;
+
+    if (!gst_rtcp_buffer_map(buf, GST_MAP_READ, &rtcp))
+    {
+        return;
+    }
+
+    gint64 now = g_get_monotonic_time();
+    std::lock_guard<std::mutex> guard(lock);
+    gboolean more = gst_rtcp_buffer_get_first_packet(&rtcp, &packet);
+    while (more)
+    {
+        GstRTCPType type = gst_rtcp_packet_get_type(&packet);
+        if (type == GST_RTCP_TYPE_RR || type == GST_RTCP_TYPE_SR)
+        {
+            guint32 reporter;
+            if (type == GST_RTCP_TYPE_RR)
+            {
+                reporter = gst_rtcp_packet_rr_get_ssrc(&packet);
+            }
+            else
+            {
+                gst_rtcp_packet_sr_get_sender_info(&packet, &reporter, NULL, NULL, NULL, NULL);
+            }
+
+            guint count = gst_rtcp_packet_get_rb_count(&packet);
+            for (guint i = 0; i < count; i++)
+            {
+                guint32 ssrc, exthighestseq, jitter, lsr, dlsr;
+                guint8 fractionlost;
+                gint32 packetslost;
+                gst_rtcp_packet_get_rb(&packet, i, &ssrc, &fractionlost, &packetslost,
+                        &exthighestseq, &jitter, &lsr, &dlsr);
+
+                Report r;
+                r.loss = fractionlost / 256.0;
+                r.jitterMs = jitter * 1000.0 / VIDEO_CLOCK_RATE;
+                r.time = now;
+                reports[reporter] = r;
+            }
+        }
+        more = gst_rtcp_packet_move_to_next(&packet);
+    }
+    gst_rtcp_buffer_unmap(&rtcp);
+}
+
+gboolean RtcpRateControl::TimeoutCb(gpointer user_data)
+{
+    RtcpRateControl *ctrl = (RtcpRateControl *) user_data;
+    ctrl->Update();
+    return G_SOURCE_CONTINUE;
+}
+
+guint RtcpRateControl::NextBitrate(double loss, double jitterMs) const
+{
+    double next = rate;
+    if (loss > LOSS_HIGH)
+    {
+        next = rate * (1.0 - loss / 2);
+    }
+    else if (jitterMs - prevJitterMs > JITTER_GROWTH_MS)
+    {
+        next = rate * JITTER_BACKOFF_FACTOR;
+    }
+    else if (loss < LOSS_LOW)
+    {
+        next = rate * INCREASE_FACTOR;
+    }
+    return (guint) std::min(std::max(next, (double) params.minBitrate), (double) params.maxBitrate);
+}
+
+void RtcpRateControl::Update()
+{
+    double loss = 0, jitterMs = 0;
+    bool any = false;
+    gint64 now = g_get_monotonic_time();
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto it = reports.begin(); it != reports.end();)
+        {
+            /* Receivers which stopped reporting are gone */
+            if (now - it->second.time > (gint64) params.intervalMs * 1000 * 5)
+            {
+                it = reports.erase(it);
+                continue;
+            }
+            loss = std::max(loss, it->second.loss);
+            jitterMs = std::max(jitterMs, it->second.jitterMs);
+            any = true;
+            ++it;
+        }
+    }
+
+    if (!any)
+    {
+        return;
+    }
+
+    guint next = NextBitrate(loss, jitterMs);
+    prevJitterMs = jitterMs;
+    if (next != rate)
+    {
+        g_print("INFO: RTCP rate control: loss %.1f%% jitter %.1f ms, bitrate %u -> %u kbps\n",
+                loss * 100, jitterMs, rate, next);
+        rate = next;
+        enc->SetBitrateCap(rate);
+    }
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_RTCP_RATE_CONTROL_H__
+#define __SMARTCAM_RTCP_RATE_CONTROL_H__
+
+#include <gst/gst.h>
+#include <gst/rtsp-server/rtsp-server.h>
+#include <map>
+#include <mutex>
+
+#include "encoder_control.hpp"
+
+/*
+ * Congestion control of the encoder bitrate from RTCP receiver reports.
+ *
+ * The report blocks of all RTSP sessions are collected as they arrive, and
+ * once per interval the worst receiver drives a loss based loop in the style
+ * of GCC (RFC draft-ietf-rmcat-gcc):
+ *   loss > 10%          rate *= 1 - loss / 2
+ *   loss < 2%           rate *= 1.05, unless the jitter is growing
+ *   otherwise           hold
+ * Growing jitter is taken as queue build up and also backs off.
+ * The result, clamped to [min, max], is applied as the encoder bitrate cap.
+ */
+class RtcpRateControl
+{
+public:
+    struct Params
+    {
+        guint minBitrate;
+        guint maxBitrate;
+        guint intervalMs;
+    };
+
+    RtcpRateControl(const Params &params, EncoderControl *enc);
+    ~RtcpRateControl();
+
+    /* Collect the receiver reports of all the streams of @media */
+    void AddMedia(GstRTSPMedia *media);
+
+    /* Start the control loop on the default main context */
+    void Start();
+    /* Stop it and forget the receivers, Start() goes on from the last rate */
+    void Stop();
+
+private:
+    struct Report
+    {
+        double loss;
+        double jitterMs;
+        gint64 time;
+    };
+
+    static void MediaPreparedCb(GstRTSPMedia *media, gpointer user_data);
+    static void ReceivingRtcpCb(GObject *session, GstBuffer *buf, gpointer user_data);
+    static gboolean TimeoutCb(gpointer user_data);
+
+    void OnRtcp(GstBuffer *buf);
+    void Update();
+    guint NextBitrate(double loss, double jitterMs) const;
+
+    Params params;
+    EncoderControl *enc;
+    std::mutex lock;
+    /* Reporter SSRC -> last report block */
+    std::map<guint32, Report> reports;
+    guint rate;
+    double prevJitterMs;
+    guint timer;
+};
+
+#endif /* __SMARTCAM_RTCP_RATE_CONTROL_H__ */
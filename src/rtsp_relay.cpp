@@ -0,0 +1,272 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <algorithm>
+
+#include "rtsp_relay.hpp"
+
+#define RELAY_SRC_NAME "relaysrc"
+/* A client whose send queue grows past this is resynced at the next IDR */
+#define RELAY_CLIENT_MIN_QUEUE (4 * 1024 * 1024)
+
+RtspRelay::RtspRelay(gsize limit, CacheMode mode)
+    : cacheBytes(0), cacheLimit(limit), cacheValid(false), mode(mode), caps(NULL)
+{
+}
+
+RtspRelay::~RtspRelay()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    ClearCache();
+    for (auto &c : clients)
+    {
+        gst_object_unref(c.appsrc);
+    }
+    clients.clear();
+    if (caps)
+    {
+        gst_caps_unref(caps);
+    }
+}
+
+bool RtspRelay::ParseMode(const char *str, CacheMode &mode)
+{
+    std::string s(str);
+    if (s == "burst")
+        mode = CACHE_BURST;
+    else if (s == "delay")
+        mode = CACHE_DELAY;
+    else
+        return false;
+    return true;
+}
+
+bool RtspRelay::AttachSink(GstElement *bin, const char *sinkName)
+{
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(bin), sinkName);
+    if (!sink)
+    {
+        g_printerr("ERROR: Element %s not found for RTSP relay.\n", sinkName);
+        return false;
+    }
+    g_object_set(sink, "emit-signals", TRUE, "sync", FALSE, NULL);
+    g_signal_connect(sink, "new-sample", G_CALLBACK(NewSampleCb), this);
+    gst_object_unref(sink);
+    return true;
+}
+
+GstRTSPMediaFactory *RtspRelay::CreateFactory(const char *mediaType)
+{
+    char launch[512];
+    GstRTSPMediaFactory *factory = gst_rtsp_media_factory_new();
+
+    snprintf(launch, sizeof(launch),
+            "( appsrc name=" RELAY_SRC_NAME " is-live=true format=time do-timestamp=false "
+            "! queue ! rtp%spay name=pay0 pt=96 )", mediaType);
+    gst_rtsp_media_factory_set_launch(factory, launch);
+    /* Every client has its own media, so it can be started from the cached IDR */
+    gst_rtsp_media_factory_set_shared(factory, FALSE);
+    g_signal_connect(factory, "media-configure", G_CALLBACK(MediaConfigureCb), this);
+    return factory;
+}
+
+GstFlowReturn RtspRelay::NewSampleCb(GstElement *sink, gpointer user_data)
+{
+    RtspRelay *relay = (RtspRelay *) user_data;
+    GstSample *sample = gst_app_sink_pull_sample(GST_APP_SINK(sink));
+    if (!sample)
+    {
+        return GST_FLOW_EOS;
+    }
+    relay->OnSample(sample);
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+void RtspRelay::MediaConfigureCb(GstRTSPMediaFactory *factory, GstRTSPMedia *media, gpointer user_data)
+{
+    RtspRelay *relay = (RtspRelay *) user_data;
+    GstElement *element = gst_rtsp_media_get_element(media);
+    GstElement *appsrc = gst_bin_get_by_name(GST_BIN(element), RELAY_SRC_NAME);
+    gst_object_unref(element);
+    if (!appsrc)
+    {
+        return;
+    }
+
+    g_object_set_data_full(G_OBJECT(media), "relay-appsrc", appsrc, gst_object_unref);
+    g_signal_connect(media, "unprepared", G_CALLBACK(MediaUnpreparedCb), relay);
+    relay->AddClient(appsrc);
+}
+
+void RtspRelay::MediaUnpreparedCb(GstRTSPMedia *media, gpointer user_data)
+{
+    RtspRelay *relay = (RtspRelay *) user_data;
+    GstElement *appsrc = (GstElement *) g_object_get_data(G_OBJECT(media), "relay-appsrc");
+    if (appsrc)
+    {
+        relay->RemoveClient(appsrc);
+    }
+}
+
+void RtspRelay::AddClient(GstElement *appsrc)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    Client c;
+    c.appsrc = (GstElement *) gst_object_ref(appsrc);
+    c.needBurst = true;
+    c.waitKey = true;
+    c.offset = GST_CLOCK_TIME_NONE;
+    c.lastPts = GST_CLOCK_TIME_NONE;
+    g_object_set(appsrc, "max-bytes", (guint64) std::max((gsize) RELAY_CLIENT_MIN_QUEUE, 2 * cacheLimit), NULL);
+    if (caps)
+    {
+        gst_app_src_set_caps(GST_APP_SRC(appsrc), caps);
+    }
+    clients.push_back(c);
+}
+
+void RtspRelay::RemoveClient(GstElement *appsrc)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    for (auto it = clients.begin(); it != clients.end(); ++it)
+    {
+        if (it->appsrc == appsrc)
+        {
+            gst_object_unref(it->appsrc);
+            clients.erase(it);
+            break;
+        }
+    }
+}
+
+void RtspRelay::ClearCache()
+{
+    for (auto buf : cache)
+    {
+        gst_buffer_unref(buf);
+    }
+    cache.clear();
+    cacheBytes = 0;
+}
+
+void RtspRelay::PushToClient(Client &c, GstBuffer *buf, bool cached)
+{
+    GstClockTime pts = GST_BUFFER_PTS(buf);
+    GstClockTime outPts;
+
+    if (!cached && gst_app_src_get_current_level_bytes(GST_APP_SRC(c.appsrc)) >
+            std::max((guint64) RELAY_CLIENT_MIN_QUEUE, (guint64) 2 * cacheLimit))
+    {
+        /* Client can't keep up, drop until the next IDR instead of queueing forever */
+        c.waitKey = true;
+        return;
+    }
+
+    if (cached && mode == CACHE_BURST)
+    {
+        /* Squeeze the cached GOP, the decoder runs through it and shows the latest picture at once */
+        outPts = GST_CLOCK_TIME_IS_VALID(c.lastPts) ? c.lastPts + GST_MSECOND : 0;
+    }
+    else
+    {
+        if (!GST_CLOCK_TIME_IS_VALID(c.offset))
+        {
+            GstClockTime start = GST_CLOCK_TIME_IS_VALID(c.lastPts) ? c.lastPts + GST_MSECOND : 0;
+            c.offset = pts > start ? pts - start : 0;
+        }
+        outPts = pts > c.offset ? pts - c.offset : 0;
+    }
+
+    GstBuffer *out = gst_buffer_copy(buf);
+    GST_BUFFER_PTS(out) = outPts;
+    GST_BUFFER_DTS(out) = outPts;
+    if (!GST_CLOCK_TIME_IS_VALID(c.lastPts))
+    {
+        GST_BUFFER_FLAG_SET(out, GST_BUFFER_FLAG_DISCONT);
+    }
+    c.lastPts = outPts;
+    gst_app_src_push_buffer(GST_APP_SRC(c.appsrc), out);
+}
+
+void RtspRelay::OnSample(GstSample *sample)
+{
+    GstBuffer *buf = gst_sample_get_buffer(sample);
+    GstCaps *sampleCaps = gst_sample_get_caps(sample);
+    bool key = !GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT);
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (sampleCaps && (!caps || !gst_caps_is_equal(caps, sampleCaps)))
+    {
+        gst_caps_replace(&caps, sampleCaps);
+        for (auto &c : clients)
+        {
+            gst_app_src_set_caps(GST_APP_SRC(c.appsrc), caps);
+        }
+    }
+
+    for (auto &c : clients)
+    {
+        if (c.needBurst)
+        {
+            c.needBurst = false;
+            if (!key && cacheValid && !cache.empty())
+            {
+                for (auto cached : cache)
+                {
+                    PushToClient(c, cached, true);
+                }
+                c.waitKey = false;
+                g_print("INFO: RTSP client started from GOP cache, %u access units, %u bytes\n",
+                        (unsigned) cache.size(), (unsigned) cacheBytes);
+            }
+        }
+
+        if (c.waitKey)
+        {
+            if (!key)
+                continue;
+            c.waitKey = false;
+        }
+        PushToClient(c, buf, false);
+    }
+
+    if (key)
+    {
+        ClearCache();
+        cacheValid = cacheLimit > 0;
+    }
+    if (cacheValid)
+    {
+        gsize size = gst_buffer_get_size(buf);
+        if (cacheBytes + size > cacheLimit)
+        {
+            /* GOP doesn't fit, new clients wait for the next IDR until then */
+            ClearCache();
+            cacheValid = false;
+        }
+        else
+        {
+            cache.push_back(gst_buffer_ref(buf));
+            cacheBytes += size;
+        }
+    }
+}
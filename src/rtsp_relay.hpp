@@ -0,0 +1,87 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_RTSP_RELAY_H__
+#define __SMARTCAM_RTSP_RELAY_H__
+
+#include <gst/gst.h>
+#include <gst/rtsp-server/rtsp-server.h>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * Fans one encoded elementary stream out to per-client RTSP medias.
+ *
+ * The encoder runs in the main pipeline and ends in an appsink. Every RTSP
+ * client gets its own light media "appsrc ! rtpXpay" which is fed from here.
+ * The access units since the last IDR are kept in a bounded cache, so a newly
+ * joined client starts from that IDR instead of waiting for the next one.
+ */
+class RtspRelay
+{
+public:
+    enum CacheMode
+    {
+        /* Cached frames are sent with compressed timestamps, the client catches up to live at once */
+        CACHE_BURST,
+        /* Cached frames keep their spacing, the client plays with the cache depth as extra latency */
+        CACHE_DELAY,
+    };
+
+    RtspRelay(gsize limit, CacheMode mode);
+    ~RtspRelay();
+
+    /* Take the encoded access units from appsink @sinkName of @bin */
+    bool AttachSink(GstElement *bin, const char *sinkName);
+
+    /* A non shared factory whose medias are fed by this relay */
+    GstRTSPMediaFactory *CreateFactory(const char *mediaType);
+
+    static bool ParseMode(const char *str, CacheMode &mode);
+
+private:
+    struct Client
+    {
+        GstElement *appsrc;
+        bool needBurst;
+        bool waitKey;
+        GstClockTime offset;
+        GstClockTime lastPts;
+    };
+
+    static GstFlowReturn NewSampleCb(GstElement *sink, gpointer user_data);
+    static void MediaConfigureCb(GstRTSPMediaFactory *factory, GstRTSPMedia *media, gpointer user_data);
+    static void MediaUnpreparedCb(GstRTSPMedia *media, gpointer user_data);
+
+    void OnSample(GstSample *sample);
+    void AddClient(GstElement *appsrc);
+    void RemoveClient(GstElement *appsrc);
+    void PushToClient(Client &c, GstBuffer *buf, bool cached);
+    void ClearCache();
+
+    std::mutex lock;
+    std::vector<Client> clients;
+    std::deque<GstBuffer *> cache;
+    gsize cacheBytes;
+    gsize cacheLimit;
+    bool cacheValid;
+    CacheMode mode;
+    GstCaps *caps;
+};
+
+#endif /* __SMARTCAM_RTSP_RELAY_H__ */
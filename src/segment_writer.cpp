@@ -0,0 +1,201 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gst/app/gstappsink.h>
+#include <glob.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <vector>
+
+#include "segment_writer.hpp"
+
+/* Bound of the data waiting for the disk */
+#define WRITER_MAX_BYTES (32 * 1024 * 1024)
+/* Digits of the sequence number which orders the segments across runs */
+#define SEGMENT_SEQ_DIGITS 10
+
+SegmentWriter::SegmentWriter(const Params &params)
+    : params(params), totalBytes(0), open(false), waitKey(false), segStart(GST_CLOCK_TIME_NONE),
+      segBytes(0), index(0), dropped(0), writer("segment writer", WRITER_MAX_BYTES)
+{
+    ScanExisting();
+}
+
+SegmentWriter::~SegmentWriter()
+{
+    Flush();
+    if (dropped)
+    {
+        g_print("INFO: segment writer dropped %" G_GUINT64_FORMAT " frames\n", dropped);
+    }
+}
+
+/* Sequence number of a segment name, 0 for a name without one */
+static guint SegmentSequence(const std::string &path)
+{
+    std::string name = path.substr(path.rfind('/') + 1);
+    const char *seq = name.c_str() + strlen("seg-");
+    if (strspn(seq, "0123456789") != SEGMENT_SEQ_DIGITS)
+    {
+        return 0;
+    }
+    return (guint) strtoul(seq, NULL, 10);
+}
+
+void SegmentWriter::ScanExisting()
+{
+    std::string pattern = params.dir + "/seg-*." + params.ext;
+    glob_t globbuf;
+    if (glob(pattern.c_str(), 0, NULL, &globbuf) != 0)
+    {
+        return;
+    }
+
+    /* The names sort by their sequence number, the time in them may be off on
+     * a board without a battery backed RTC */
+    std::vector<std::pair<guint, std::string>> names;
+    for (std::size_t i = 0; i < globbuf.gl_pathc; i++)
+    {
+        names.push_back(std::make_pair(SegmentSequence(globbuf.gl_pathv[i]), globbuf.gl_pathv[i]));
+    }
+    globfree(&globbuf);
+    std::sort(names.begin(), names.end());
+    for (const auto &name : names)
+    {
+        struct stat st;
+        if (stat(name.second.c_str(), &st) == 0)
+        {
+            segments.push_back(std::make_pair(name.second, (guint64) st.st_size));
+            totalBytes += st.st_size;
+        }
+        index = std::max(index, name.first + 1);
+    }
+}
+
+bool SegmentWriter::Attach(GstElement *bin, const char *sinkName)
+{
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(bin), sinkName);
+    if (!sink)
+    {
+        g_printerr("ERROR: Element %s not found for the segment writer.\n", sinkName);
+        return false;
+    }
+    g_object_set(sink, "emit-signals", TRUE, "sync", FALSE, NULL);
+    g_signal_connect(sink, "new-sample", G_CALLBACK(NewSampleCb), this);
+    gst_object_unref(sink);
+    return true;
+}
+
+GstFlowReturn SegmentWriter::NewSampleCb(GstElement *sink, gpointer user_data)
+{
+    SegmentWriter *seg = (SegmentWriter *) user_data;
+    GstSample *sample = gst_app_sink_pull_sample(GST_APP_SINK(sink));
+    if (!sample)
+    {
+        return GST_FLOW_EOS;
+    }
+    seg->OnAccessUnit(gst_sample_get_buffer(sample));
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+void SegmentWriter::Flush()
+{
+    if (open)
+    {
+        FinishSegment();
+    }
+    segStart = GST_CLOCK_TIME_NONE;
+    waitKey = false;
+}
+
+void SegmentWriter::StartSegment(GstClockTime pts)
+{
+    GDateTime *dt = g_date_time_new_now_local();
+    gchar *stamp = g_date_time_format(dt, "%Y%m%d-%H%M%S");
+    gchar *path = g_strdup_printf("%s/seg-%0*u-%s.%s", params.dir.c_str(), SEGMENT_SEQ_DIGITS, index++, stamp,
+            params.ext.c_str());
+    segPath = path;
+    g_free(path);
+    g_free(stamp);
+    g_date_time_unref(dt);
+
+    writer.Open(segPath);
+    open = true;
+    segStart = pts;
+    segBytes = 0;
+}
+
+void SegmentWriter::FinishSegment()
+{
+    writer.Close();
+    open = false;
+    segments.push_back(std::make_pair(segPath, segBytes));
+    totalBytes += segBytes;
+    ApplyRetention();
+}
+
+void SegmentWriter::ApplyRetention()
+{
+    while (segments.size() > 1 &&
+            ((params.maxSegments && segments.size() > params.maxSegments) ||
+             (params.maxTotalBytes && totalBytes > params.maxTotalBytes)))
+    {
+        writer.Remove(segments.front().first);
+        totalBytes -= segments.front().second;
+        segments.pop_front();
+    }
+}
+
+void SegmentWriter::OnAccessUnit(GstBuffer *buf)
+{
+    GstClockTime pts = GST_BUFFER_PTS(buf);
+    bool key = !GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT);
+
+    if (key)
+    {
+        bool full = (params.duration && GST_CLOCK_TIME_IS_VALID(pts) && GST_CLOCK_TIME_IS_VALID(segStart)
+                    && pts - segStart >= params.duration)
+                || (params.maxBytes && segBytes >= params.maxBytes);
+        if (open && full)
+        {
+            FinishSegment();
+        }
+        if (!open)
+        {
+            StartSegment(pts);
+        }
+        waitKey = false;
+    }
+
+    if (!open || waitKey)
+    {
+        dropped++;
+        return;
+    }
+    if (writer.Write(buf))
+    {
+        segBytes += gst_buffer_get_size(buf);
+    }
+    else
+    {
+        /* The disk doesn't keep up, continue with a decodable frame */
+        waitKey = true;
+        dropped++;
+    }
+}
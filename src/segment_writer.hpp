@@ -0,0 +1,87 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_SEGMENT_WRITER_H__
+#define __SMARTCAM_SEGMENT_WRITER_H__
+
+#include <gst/gst.h>
+#include <deque>
+#include <string>
+#include <utility>
+
+#include "file_writer.hpp"
+
+/*
+ * Continuous recording of the file target into segments.
+ *
+ * The encoded access units are taken from an appsink and written as
+ * elementary stream files. A new segment is started at the first IDR after
+ * the segment duration or size is reached, so every segment plays on its own.
+ *
+ * Retention: once a segment is finished, the oldest segments in the directory,
+ * including the ones of earlier runs, are deleted while there are more than
+ * maxSegments or they take more than maxTotalBytes. 0 disables a limit.
+ */
+class SegmentWriter
+{
+public:
+    struct Params
+    {
+        GstClockTime duration;
+        guint64 maxBytes;
+        guint maxSegments;
+        guint64 maxTotalBytes;
+        std::string dir;
+        std::string ext;
+    };
+
+    SegmentWriter(const Params &params);
+    ~SegmentWriter();
+
+    bool Attach(GstElement *bin, const char *sinkName);
+
+    void OnAccessUnit(GstBuffer *buf);
+
+    /* Finish the segment in progress, for a stream which stops; the appsink
+     * must not be running */
+    void Flush();
+
+private:
+    static GstFlowReturn NewSampleCb(GstElement *sink, gpointer user_data);
+
+    void ScanExisting();
+    void StartSegment(GstClockTime pts);
+    void FinishSegment();
+    void ApplyRetention();
+
+    Params params;
+
+    /* Finished segments, oldest first, with their size */
+    std::deque<std::pair<std::string, guint64>> segments;
+    guint64 totalBytes;
+
+    bool open;
+    bool waitKey;
+    std::string segPath;
+    GstClockTime segStart;
+    guint64 segBytes;
+    guint index;
+    guint64 dropped;
+
+    AsyncFileWriter writer;
+};
+
+#endif /* __SMARTCAM_SEGMENT_WRITER_H__ */
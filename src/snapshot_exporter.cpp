@@ -0,0 +1,427 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <algorithm>
+
+#include "jpeg_error.hpp"
+#include "snapshot_exporter.hpp"
+
+/* Snapshot jobs queued for encoding, each with the crops of one frame */
+#define MAX_PENDING_FRAMES 2
+#define WORKER_NICE 10
+/* Forget the snapshot time of tracks gone for this long */
+#define TRACK_FORGET (600 * GST_SECOND)
+
+/* An object copied out of the frame as 4:2:0 planes, padded to whole MCUs */
+struct SnapshotExporter::Crop
+{
+    Detection det;
+    gint width;
+    gint height;
+    gint padW;
+    gint padH;
+    std::vector<guint8> y;
+    std::vector<guint8> u;
+    std::vector<guint8> v;
+};
+
+struct SnapshotExporter::Job
+{
+    GstClockTime pts;
+    guint64 frame;
+    std::vector<Crop> crops;
+};
+
+SnapshotExporter::SnapshotExporter(const Params &params, SharedTracker *tracker)
+    : params(params), toSocket(false), fd(-1), addrLen(0),
+      tracker(tracker), secondStart(GST_CLOCK_TIME_NONE), inSecond(0),
+      frames(0), caps(NULL), exported(0), dropped(0)
+{
+    gst_video_info_init(&info);
+    pool.reset(new WorkerPool(std::max(params.threads, 1u), WORKER_NICE, MAX_PENDING_FRAMES));
+}
+
+SnapshotExporter::~SnapshotExporter()
+{
+    /* Stop the workers before what they use goes away */
+    pool.reset();
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    if (caps)
+    {
+        gst_caps_unref(caps);
+    }
+    g_print("INFO: exported %" G_GUINT64_FORMAT " snapshots, %" G_GUINT64_FORMAT " dropped\n",
+            (guint64) exported, (guint64) dropped);
+}
+
+bool SnapshotExporter::Open()
+{
+    if (params.out.compare(0, 7, "unix://") == 0)
+    {
+        std::string path = params.out.substr(7);
+        struct sockaddr_un *un = (struct sockaddr_un *) &addr;
+        memset(&addr, 0, sizeof(addr));
+        if (path.empty() || path.size() >= sizeof(un->sun_path))
+        {
+            g_printerr("ERROR: Invalid snapshot socket: %s\n", params.out.c_str());
+            return false;
+        }
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, path.c_str());
+        addrLen = sizeof(struct sockaddr_un);
+        fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        toSocket = true;
+        return fd >= 0;
+    }
+
+    struct stat st;
+    if (stat(params.out.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) || access(params.out.c_str(), W_OK) != 0)
+    {
+        g_printerr("ERROR: Snapshot directory %s is not writable.\n", params.out.c_str());
+        return false;
+    }
+    return true;
+}
+
+static GstPadProbeReturn
+snapshot_probe_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+    SnapshotExporter *snap = (SnapshotExporter *) user_data;
+    snap->OnFrame(pad, GST_PAD_PROBE_INFO_BUFFER(info));
+    return GST_PAD_PROBE_OK;
+}
+
+bool SnapshotExporter::Attach(GstElement *bin, const char *drawName, const char *probeName)
+{
+    /* After the drawing kernel the frames carry the privacy masks, without it
+     * there is nothing to mask */
+    GstElement *elem = gst_bin_get_by_name(GST_BIN(bin), drawName);
+    const char *padName = "src";
+    if (!elem)
+    {
+        elem = gst_bin_get_by_name(GST_BIN(bin), probeName);
+        padName = "sink";
+    }
+    if (!elem)
+    {
+        g_printerr("ERROR: Element %s not found for snapshots.\n", probeName);
+        return false;
+    }
+    GstPad *pad = gst_element_get_static_pad(elem, padName);
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, snapshot_probe_cb, this, NULL);
+    gst_object_unref(pad);
+    gst_object_unref(elem);
+    return true;
+}
+
+bool SnapshotExporter::Wanted(const Detection &det, GstClockTime pts, guint picked) const
+{
+    if (!params.classes.empty() && !params.classes.count(det.label))
+    {
+        return false;
+    }
+
+    auto it = lastShot.find(det.trackId);
+    if (it != lastShot.end() && (!params.interval || pts - it->second < params.interval))
+    {
+        return false;
+    }
+
+    bool newSecond = !GST_CLOCK_TIME_IS_VALID(secondStart) || pts - secondStart >= GST_SECOND;
+    guint used = (newSecond ? 0 : inSecond) + picked;
+    return !params.maxPerSec || used < params.maxPerSec;
+}
+
+/* The snapshots of @trackIds were queued, they count from now on */
+void SnapshotExporter::Taken(const std::vector<guint64> &trackIds, GstClockTime pts)
+{
+    if (!GST_CLOCK_TIME_IS_VALID(secondStart) || pts - secondStart >= GST_SECOND)
+    {
+        secondStart = pts;
+        inSecond = 0;
+    }
+    for (auto id : trackIds)
+    {
+        inSecond++;
+        lastShot[id] = pts;
+    }
+}
+
+void SnapshotExporter::OnFrame(GstPad *pad, GstBuffer *buf)
+{
+    GstClockTime pts = GST_BUFFER_PTS(buf);
+    guint64 frame = frames++;
+    std::vector<Detection> dets;
+    if (!GST_CLOCK_TIME_IS_VALID(pts) || !ExtractDetections(buf, dets))
+    {
+        return;
+    }
+    tracker->Track(pts, dets);
+
+    for (auto it = lastShot.begin(); it != lastShot.end();)
+    {
+        if (pts > it->second && pts - it->second > TRACK_FORGET)
+            it = lastShot.erase(it);
+        else
+            ++it;
+    }
+
+    std::vector<Detection> wanted;
+    for (const auto &d : dets)
+    {
+        /* One per track and frame, as if the shot was recorded */
+        bool dup = std::any_of(wanted.begin(), wanted.end(),
+                [&d](const Detection &w) { return w.trackId == d.trackId; });
+        if (!dup && d.width >= 16 && d.height >= 16 && Wanted(d, pts, wanted.size()))
+        {
+            wanted.push_back(d);
+        }
+    }
+    if (wanted.empty())
+    {
+        return;
+    }
+
+    GstCaps *current = gst_pad_get_current_caps(pad);
+    if (!current)
+    {
+        return;
+    }
+    if (!caps || !gst_caps_is_equal(caps, current))
+    {
+        gst_caps_replace(&caps, current);
+        if (!gst_video_info_from_caps(&info, caps)
+                || GST_VIDEO_INFO_FORMAT(&info) != GST_VIDEO_FORMAT_NV12)
+        {
+            gst_video_info_init(&info);
+        }
+    }
+    gst_caps_unref(current);
+    GstVideoFrame vframe;
+    if (GST_VIDEO_INFO_FORMAT(&info) != GST_VIDEO_FORMAT_NV12
+            || !gst_video_frame_map(&vframe, &info, buf, GST_MAP_READ))
+    {
+        dropped += wanted.size();
+        return;
+    }
+
+    /* Only the crops are copied, the frame goes on downstream right away */
+    std::shared_ptr<Job> job = std::make_shared<Job>();
+    job->pts = pts;
+    job->frame = frame;
+    for (const auto &d : wanted)
+    {
+        Crop crop;
+        crop.det = d;
+        if (CopyCrop(&vframe, crop))
+        {
+            job->crops.push_back(std::move(crop));
+        }
+    }
+    gst_video_frame_unmap(&vframe);
+
+    if (job->crops.empty())
+    {
+        return;
+    }
+    /* Before the job is handed to the pool, which owns it then */
+    std::vector<guint64> trackIds;
+    for (const auto &c : job->crops)
+    {
+        trackIds.push_back(c.det.trackId);
+    }
+    if (pool->TrySubmit([this, job] { Process(*job); }))
+    {
+        Taken(trackIds, pts);
+    }
+    else
+    {
+        dropped += job->crops.size();
+    }
+}
+
+/* Copy the object out of the frame, clamped to it on even coordinates for
+ * the 2x2 chroma, false if too little of it is left */
+bool SnapshotExporter::CopyCrop(GstVideoFrame *frame, Crop &crop)
+{
+    const Detection &d = crop.det;
+    gint fw = GST_VIDEO_FRAME_WIDTH(frame);
+    gint fh = GST_VIDEO_FRAME_HEIGHT(frame);
+    gint x = std::max(d.x, 0) & ~1;
+    gint y = std::max(d.y, 0) & ~1;
+    gint width = (std::min(d.x + d.width, fw) & ~1) - x;
+    gint height = (std::min(d.y + d.height, fh) & ~1) - y;
+    if (width < 16 || height < 16)
+    {
+        return false;
+    }
+
+    const guint8 *yPlane = (const guint8 *) GST_VIDEO_FRAME_PLANE_DATA(frame, 0);
+    const guint8 *uvPlane = (const guint8 *) GST_VIDEO_FRAME_PLANE_DATA(frame, 1);
+    gint yStride = GST_VIDEO_FRAME_PLANE_STRIDE(frame, 0);
+    gint uvStride = GST_VIDEO_FRAME_PLANE_STRIDE(frame, 1);
+
+    /* Raw data input wants whole MCUs, 16x16 luma, padded by repeating the edge */
+    gint padW = (width + 15) & ~15;
+    gint padH = (height + 15) & ~15;
+    crop.width = width;
+    crop.height = height;
+    crop.padW = padW;
+    crop.padH = padH;
+    crop.y.resize(padW * padH);
+    crop.u.resize(padW / 2 * padH / 2);
+    crop.v.resize(padW / 2 * padH / 2);
+
+    for (gint row = 0; row < padH; row++)
+    {
+        const guint8 *src = yPlane + (gsize) (y + std::min(row, height - 1)) * yStride + x;
+        guint8 *dst = &crop.y[row * padW];
+        memcpy(dst, src, width);
+        memset(dst + width, src[width - 1], padW - width);
+    }
+    for (gint row = 0; row < padH / 2; row++)
+    {
+        const guint8 *src = uvPlane + (gsize) (y / 2 + std::min(row, height / 2 - 1)) * uvStride + x;
+        guint8 *u = &crop.u[row * padW / 2];
+        guint8 *v = &crop.v[row * padW / 2];
+        for (gint col = 0; col < padW / 2; col++)
+        {
+            gint c = std::min(col, width / 2 - 1);
+            u[col] = src[2 * c];
+            v[col] = src[2 * c + 1];
+        }
+    }
+    return true;
+}
+
+/* Encode a crop as a 4:2:0 JPEG */
+static bool EncodeJpeg(const SnapshotExporter::Crop &crop, gint quality, std::vector<guint8> &out)
+{
+    struct jpeg_compress_struct cinfo;
+    JpegError jerr;
+    unsigned char *mem = NULL;
+    unsigned long memSize = 0;
+
+    cinfo.err = JpegErrorInit(&jerr);
+    if (setjmp(jerr.jump))
+    {
+        jpeg_destroy_compress(&cinfo);
+        free(mem);
+        return false;
+    }
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &mem, &memSize);
+
+    cinfo.image_width = crop.width;
+    cinfo.image_height = crop.height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_YCbCr;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_colorspace(&cinfo, JCS_YCbCr);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    cinfo.raw_data_in = TRUE;
+    cinfo.dct_method = JDCT_IFAST;
+    cinfo.comp_info[0].h_samp_factor = 2;
+    cinfo.comp_info[0].v_samp_factor = 2;
+    cinfo.comp_info[1].h_samp_factor = 1;
+    cinfo.comp_info[1].v_samp_factor = 1;
+    cinfo.comp_info[2].h_samp_factor = 1;
+    cinfo.comp_info[2].v_samp_factor = 1;
+
+    jpeg_start_compress(&cinfo, TRUE);
+    JSAMPROW yRows[16], uRows[8], vRows[8];
+    JSAMPARRAY planes[3] = { yRows, uRows, vRows };
+    gint padW = crop.padW;
+    while (cinfo.next_scanline < cinfo.image_height)
+    {
+        gint base = cinfo.next_scanline;
+        for (gint i = 0; i < 16; i++)
+        {
+            yRows[i] = (JSAMPROW) &crop.y[(base + i) * padW];
+        }
+        for (gint i = 0; i < 8; i++)
+        {
+            uRows[i] = (JSAMPROW) &crop.u[(base / 2 + i) * padW / 2];
+            vRows[i] = (JSAMPROW) &crop.v[(base / 2 + i) * padW / 2];
+        }
+        jpeg_write_raw_data(&cinfo, planes, 16);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    out.assign(mem, mem + memSize);
+    free(mem);
+    return !out.empty();
+}
+
+void SnapshotExporter::Process(Job &job)
+{
+    for (const auto &crop : job.crops)
+    {
+        std::vector<guint8> jpeg;
+        if (EncodeJpeg(crop, params.quality, jpeg))
+        {
+            Output(job, crop.det, jpeg);
+        }
+        else
+        {
+            dropped++;
+        }
+    }
+}
+
+void SnapshotExporter::Output(const Job &job, const Detection &det, const std::vector<guint8> &jpeg)
+{
+    std::vector<Detection> one(1, det);
+    std::string meta = DetectionsToJson(job.pts, job.frame, one);
+
+    if (toSocket)
+    {
+        /* Blocking is fine here, this is a worker thread */
+        std::string msg = meta + "\n";
+        msg.append((const char *) jpeg.data(), jpeg.size());
+        if (sendto(fd, msg.data(), msg.size(), MSG_NOSIGNAL, (struct sockaddr *) &addr, addrLen) < 0)
+        {
+            dropped++;
+            return;
+        }
+        exported++;
+        return;
+    }
+
+    gchar *base = g_strdup_printf("%s/snap-%08" G_GUINT64_FORMAT "-%" G_GUINT64_FORMAT,
+            params.out.c_str(), job.frame, det.trackId);
+    std::string jpgPath = std::string(base) + ".jpg";
+    std::string jsonPath = std::string(base) + ".json";
+    g_free(base);
+
+    /* The JSON is written last, its presence means the JPEG is complete */
+    if (!g_file_set_contents(jpgPath.c_str(), (const gchar *) jpeg.data(), jpeg.size(), NULL) ||
+            !g_file_set_contents(jsonPath.c_str(), meta.c_str(), meta.size(), NULL))
+    {
+        dropped++;
+        return;
+    }
+    exported++;
+}
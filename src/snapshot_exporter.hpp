@@ -0,0 +1,109 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_SNAPSHOT_EXPORTER_H__
+#define __SMARTCAM_SNAPSHOT_EXPORTER_H__
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "detections.hpp"
+#include "tracker.hpp"
+#include "worker_pool.hpp"
+
+/*
+ * Exports a JPEG thumbnail of detected objects.
+ *
+ * The detections on the sink pad of the probe element get the track ids of
+ * the stream's SharedTracker, and an object gets a snapshot when it shows up,
+ * then at most once per interval, with a global limit of snapshots per second. The streaming thread only copies
+ * the objects out of the NV12 frame, after the drawing kernel so they carry
+ * the privacy masks; the crops are encoded with libjpeg(-turbo) on low
+ * priority worker threads.
+ *
+ * Output, with the object's metadata as JSON:
+ *   directory            snap-<frame>-<track>.jpg and .json per snapshot
+ *   unix:///path         one datagram per snapshot, the JSON line, '\n', the JPEG
+ *
+ */
+class SnapshotExporter
+{
+public:
+    struct Params
+    {
+        std::string out;
+        /* Labels to export, empty for all */
+        std::set<std::string> classes;
+        GstClockTime interval;
+        guint maxPerSec;
+        gint quality;
+        guint threads;
+    };
+
+    SnapshotExporter(const Params &params, SharedTracker *tracker);
+    ~SnapshotExporter();
+
+    /* Check and open the output, returns false if unusable */
+    bool Open();
+
+    /* Take the frames at the source pad of @drawName, or if there is no such
+     * element at the sink pad of @probeName */
+    bool Attach(GstElement *bin, const char *drawName, const char *probeName);
+
+    void OnFrame(GstPad *pad, GstBuffer *buf);
+
+    struct Crop;
+
+private:
+    struct Job;
+
+    bool CopyCrop(GstVideoFrame *frame, Crop &crop);
+    void Process(Job &job);
+    void Output(const Job &job, const Detection &det, const std::vector<guint8> &jpeg);
+    /* Whether @det is due, with @picked objects of the frame taken before;
+     * nothing is recorded until Taken() */
+    bool Wanted(const Detection &det, GstClockTime pts, guint picked) const;
+    void Taken(const std::vector<guint64> &trackIds, GstClockTime pts);
+
+    Params params;
+    bool toSocket;
+    int fd;
+    struct sockaddr_storage addr;
+    socklen_t addrLen;
+
+    /* Streaming thread state */
+    SharedTracker *tracker;
+    /* Track -> PTS of its last snapshot */
+    std::map<guint64, GstClockTime> lastShot;
+    GstClockTime secondStart;
+    guint inSecond;
+    guint64 frames;
+    GstCaps *caps;
+    GstVideoInfo info;
+
+    std::atomic<guint64> exported;
+    std::atomic<guint64> dropped;
+    std::unique_ptr<WorkerPool> pool;
+};
+
+#endif /* __SMARTCAM_SNAPSHOT_EXPORTER_H__ */
@@ -0,0 +1,476 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+
+#include "metrics.hpp"
+#include "thread_sched.hpp"
+
+/* Elements followed from the owner of a thread to find its stage */
+#define MAX_HOPS 16
+#define DEFAULT_RT_PRIORITY 50
+/* Application message SyncCb answers, to find out if it is the handler */
+#define PROBE_MESSAGE "smartcam-sched-probe"
+
+static const char *stageNames[] = {
+    "capture", "preprocess", "inference", "draw", "encode", "rtsp", "display", "main", NULL
+};
+
+static bool ParseCpuList(const std::string &list, cpu_set_t &cpus)
+{
+    long count = sysconf(_SC_NPROCESSORS_CONF);
+    CPU_ZERO(&cpus);
+    std::istringstream in(list);
+    std::string item;
+    while (std::getline(in, item, ','))
+    {
+        char *end;
+        long first = strtol(item.c_str(), &end, 10);
+        long last = first;
+        if (*end == '-')
+        {
+            last = strtol(end + 1, &end, 10);
+        }
+        if (item.empty() || *end != '\0' || first < 0 || last < first || last >= count)
+        {
+            return false;
+        }
+        for (long c = first; c <= last; c++)
+        {
+            CPU_SET(c, &cpus);
+        }
+    }
+    return CPU_COUNT(&cpus) > 0;
+}
+
+bool ThreadSched::ParsePolicy(const char *spec, Policy &out)
+{
+    std::string s(spec);
+    std::size_t eq = s.find('=');
+    if (eq == std::string::npos)
+    {
+        return false;
+    }
+    out.stage = s.substr(0, eq);
+    bool known = false;
+    for (const char **n = stageNames; *n; n++)
+    {
+        known = known || out.stage == *n;
+    }
+    if (!known)
+    {
+        return false;
+    }
+
+    std::vector<std::string> fields;
+    std::istringstream in(s.substr(eq + 1));
+    std::string item;
+    while (std::getline(in, item, ':'))
+    {
+        fields.push_back(item);
+    }
+    if (fields.empty() || fields.size() > 3)
+    {
+        return false;
+    }
+
+    out.cpuList = fields[0];
+    if (!out.cpuList.empty() && !ParseCpuList(out.cpuList, out.cpus))
+    {
+        return false;
+    }
+
+    out.policy = SCHED_OTHER;
+    out.priority = 0;
+    if (fields.size() > 1)
+    {
+        if (fields[1] == "fifo")
+            out.policy = SCHED_FIFO;
+        else if (fields[1] == "rr")
+            out.policy = SCHED_RR;
+        else if (fields[1] != "other")
+            return false;
+    }
+    if (out.policy != SCHED_OTHER)
+    {
+        out.priority = DEFAULT_RT_PRIORITY;
+    }
+    if (fields.size() > 2)
+    {
+        char *end;
+        out.priority = strtol(fields[2].c_str(), &end, 10);
+        if (fields[2].empty() || *end != '\0' || out.priority < sched_get_priority_min(out.policy)
+                || out.priority > sched_get_priority_max(out.policy))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+ThreadSched::ThreadSched(const std::vector<Policy> &list)
+    : metricsGroup(Metrics::CurrentGroup())
+{
+    sched_getaffinity(0, sizeof(defaultCpus), &defaultCpus);
+    for (const auto &p : list)
+    {
+        policies[p.stage] = p;
+        g_print("INFO: Thread policy of %s: %s\n", p.stage.c_str(), Describe(&p).c_str());
+    }
+}
+
+ThreadSched::~ThreadSched()
+{
+    for (auto id : metricsIds)
+    {
+        Metrics::Get().Unregister(id);
+    }
+}
+
+bool ThreadSched::Handles(GstBus *bus)
+{
+    /* The sync handler runs in gst_bus_post(), on this thread */
+    gboolean seen = FALSE;
+    GstStructure *s = gst_structure_new(PROBE_MESSAGE, "sched", G_TYPE_POINTER, this,
+            "seen", G_TYPE_POINTER, &seen, NULL);
+    gst_bus_post(bus, gst_message_new_application(NULL, s));
+    return seen;
+}
+
+bool ThreadSched::Attach(GstElement *elem)
+{
+    /* The messages are posted on the bus of the top level pipeline */
+    GstObject *top = (GstObject *) gst_object_ref(elem);
+    GstObject *parent;
+    while ((parent = gst_object_get_parent(top)))
+    {
+        gst_object_unref(top);
+        top = parent;
+    }
+    GstBus *bus = gst_element_get_bus(GST_ELEMENT(top));
+    bool ok = true;
+    if (bus)
+    {
+        /* There is no API to read or chain a sync handler, and setting one
+         * over another is ignored */
+        if (!Handles(bus))
+        {
+            gst_bus_set_sync_handler(bus, SyncCb, this, NULL);
+            ok = Handles(bus);
+        }
+        gst_object_unref(bus);
+    }
+    if (!ok)
+    {
+        g_printerr("WARNING: The bus of %s has a sync handler already, --thread-sched doesn't apply to its threads.\n",
+                GST_OBJECT_NAME(top));
+    }
+    gst_object_unref(top);
+    return ok;
+}
+
+void ThreadSched::MediaConfigureCb(GstRTSPMediaFactory *factory, GstRTSPMedia *media, gpointer user_data)
+{
+    ThreadSched *sched = (ThreadSched *) user_data;
+    GstElement *element = gst_rtsp_media_get_element(media);
+    sched->Attach(element);
+    gst_object_unref(element);
+}
+
+void ThreadSched::ApplyMain()
+{
+    if (policies.count("main"))
+    {
+        Apply("main", "main loop");
+    }
+}
+
+GstBusSyncReply ThreadSched::SyncCb(GstBus *bus, GstMessage *msg, gpointer user_data)
+{
+    ThreadSched *sched = (ThreadSched *) user_data;
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_APPLICATION
+            && gst_message_has_name(msg, PROBE_MESSAGE))
+    {
+        const GstStructure *s = gst_message_get_structure(msg);
+        gpointer from = NULL, seen = NULL;
+        gst_structure_get(s, "sched", G_TYPE_POINTER, &from, "seen", G_TYPE_POINTER, &seen, NULL);
+        if (from == sched && seen)
+        {
+            *(gboolean *) seen = TRUE;
+        }
+        return GST_BUS_DROP;
+    }
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_STREAM_STATUS)
+    {
+        GstStreamStatusType type;
+        GstElement *owner;
+        gst_message_parse_stream_status(msg, &type, &owner);
+        /* Both are posted from the streaming thread itself */
+        if (type == GST_STREAM_STATUS_TYPE_ENTER)
+        {
+            sched->OnEnter(owner);
+        }
+        else if (type == GST_STREAM_STATUS_TYPE_LEAVE)
+        {
+            sched->OnLeave();
+        }
+    }
+    return GST_BUS_PASS;
+}
+
+/* The stage an element identifies, empty if none; @boundary is set for the
+ * elements where another thread takes over */
+static std::string ElementStage(GstElement *elem, bool &boundary)
+{
+    GstElementFactory *factory = gst_element_get_factory(elem);
+    std::string name = factory ? GST_OBJECT_NAME(factory) : "";
+    boundary = false;
+
+    if (name == "queue" || name == "appsink" || name == "fakesink" || name == "filesink")
+    {
+        boundary = true;
+        return "";
+    }
+    if (name == "ivas_xmultisrc")
+    {
+        return "preprocess";
+    }
+    if (name == "ivas_xfilter")
+    {
+        gchar *config = NULL;
+        g_object_get(elem, "kernels-config", &config, NULL);
+        bool draw = config && strstr(config, "drawresult");
+        g_free(config);
+        return draw ? "draw" : "inference";
+    }
+    if ((g_str_has_prefix(name.c_str(), "omx") && g_str_has_suffix(name.c_str(), "enc"))
+            || name == "x264enc" || name == "x265enc")
+    {
+        return "encode";
+    }
+    if (g_str_has_prefix(name.c_str(), "rtp") && g_str_has_suffix(name.c_str(), "pay"))
+    {
+        return "rtsp";
+    }
+    if (name == "kmssink")
+    {
+        return "display";
+    }
+    return "";
+}
+
+std::string ThreadSched::StageOf(GstElement *owner)
+{
+    GstElementFactory *factory = gst_element_get_factory(owner);
+    const gchar *name = factory ? GST_OBJECT_NAME(factory) : "";
+    /* The input file is decoded on the decoder's own thread */
+    if (!g_strcmp0(name, "v4l2src") || !g_strcmp0(name, "filesrc") || !g_strcmp0(name, "multifilesrc")
+            || (g_str_has_prefix(name, "omx") && g_str_has_suffix(name, "dec")))
+    {
+        return "capture";
+    }
+
+    /* A streaming thread runs the elements downstream of its owner up to the
+     * next queue, the first one on the way which identifies a stage names it */
+    std::string stage;
+    GstElement *elem = (GstElement *) gst_object_ref(owner);
+    for (gint hops = 0; hops < MAX_HOPS && elem && stage.empty(); hops++)
+    {
+        GstPad *src = NULL;
+        GST_OBJECT_LOCK(elem);
+        if (elem->srcpads)
+        {
+            src = (GstPad *) gst_object_ref(elem->srcpads->data);
+        }
+        GST_OBJECT_UNLOCK(elem);
+        gst_object_unref(elem);
+        elem = NULL;
+
+        if (src)
+        {
+            GstPad *peer = gst_pad_get_peer(src);
+            if (peer)
+            {
+                elem = gst_pad_get_parent_element(peer);
+                gst_object_unref(peer);
+            }
+            gst_object_unref(src);
+        }
+        if (elem)
+        {
+            bool boundary;
+            stage = ElementStage(elem, boundary);
+            if (boundary)
+            {
+                break;
+            }
+        }
+    }
+    if (elem)
+    {
+        gst_object_unref(elem);
+    }
+    return stage;
+}
+
+static bool ReadThreadStats(pid_t tid, guint64 &runNs, guint64 &waitNs, guint64 &preempted)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/task/%d/schedstat", (int) tid);
+    std::ifstream sched(path);
+    if (!(sched >> runNs >> waitNs))
+    {
+        return false;
+    }
+
+    snprintf(path, sizeof(path), "/proc/self/task/%d/status", (int) tid);
+    std::ifstream status(path);
+    std::string line;
+    preempted = 0;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 27, "nonvoluntary_ctxt_switches:") == 0)
+        {
+            preempted = strtoull(line.c_str() + 27, NULL, 10);
+        }
+    }
+    return true;
+}
+
+std::string ThreadSched::Describe(const Policy *p) const
+{
+    std::ostringstream out;
+    out << (p && !p->cpuList.empty() ? "cpus " + p->cpuList : std::string("any cpu"));
+    if (!p || p->policy == SCHED_OTHER)
+        out << ", SCHED_OTHER";
+    else
+        out << (p->policy == SCHED_FIFO ? ", SCHED_FIFO " : ", SCHED_RR ") << p->priority;
+    return out.str();
+}
+
+bool ThreadSched::Apply(const std::string &stage, const std::string &what)
+{
+    auto it = policies.find(stage);
+    const Policy *p = it != policies.end() ? &it->second : NULL;
+
+    /* Threads inherit the settings of their creator, those without a policy
+     * of their own are put back to the default */
+    const cpu_set_t *cpus = p && !p->cpuList.empty() ? &p->cpus : &defaultCpus;
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = p ? p->priority : 0;
+
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), cpus);
+    if (!err)
+    {
+        err = pthread_setschedparam(pthread_self(), p ? p->policy : SCHED_OTHER, &param);
+    }
+    if (p)
+    {
+        if (err)
+            g_printerr("WARNING: Can't set %s on the %s thread of %s: %s\n",
+                    Describe(p).c_str(), stage.c_str(), what.c_str(), strerror(err));
+        else
+            g_print("INFO: %s thread of %s (tid %ld): %s\n", stage.c_str(), what.c_str(),
+                    (long) syscall(SYS_gettid), Describe(p).c_str());
+    }
+    return !err;
+}
+
+void ThreadSched::OnEnter(GstElement *owner)
+{
+    std::string stage = StageOf(owner);
+    Apply(stage, GST_ELEMENT_NAME(owner));
+    if (stage.empty())
+    {
+        return;
+    }
+
+    pid_t tid = syscall(SYS_gettid);
+    Thread t;
+    t.stage = stage;
+    if (!ReadThreadStats(tid, t.runNs, t.waitNs, t.preempted))
+    {
+        t.runNs = t.waitNs = t.preempted = 0;
+    }
+
+    bool first;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        threads[tid] = t;
+        first = lastReport.find(stage) == lastReport.end();
+        if (first)
+        {
+            lastReport[stage] = g_get_monotonic_time();
+        }
+    }
+    /* Not under the lock, the metrics call the providers under their own */
+    if (first)
+    {
+        Metrics::Scope scope(metricsGroup);
+        guint id = Metrics::Get().Register("sched " + stage, [this, stage] { return Report(stage); });
+        std::lock_guard<std::mutex> guard(lock);
+        metricsIds.push_back(id);
+    }
+}
+
+void ThreadSched::OnLeave()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    threads.erase(syscall(SYS_gettid));
+}
+
+std::string ThreadSched::Report(const std::string &stage)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    guint count = 0;
+    guint64 runNs = 0, waitNs = 0, preempted = 0;
+    for (auto &t : threads)
+    {
+        guint64 run, wait, pre;
+        if (t.second.stage != stage || !ReadThreadStats(t.first, run, wait, pre))
+        {
+            continue;
+        }
+        count++;
+        runNs += run - t.second.runNs;
+        waitNs += wait - t.second.waitNs;
+        preempted += pre - t.second.preempted;
+        t.second.runNs = run;
+        t.second.waitNs = wait;
+        t.second.preempted = pre;
+    }
+
+    gint64 now = g_get_monotonic_time();
+    double secs = (now - lastReport[stage]) / 1e6;
+    lastReport[stage] = now;
+
+    auto it = policies.find(stage);
+    char line[192];
+    snprintf(line, sizeof(line), "%u threads, %s, %.1f%% cpu, %.2f ms/s run queue wait, %.1f preemptions/s",
+            count, Describe(it != policies.end() ? &it->second : NULL).c_str(),
+            secs > 0 ? runNs / 1e7 / secs : 0, secs > 0 ? waitNs / 1e6 / secs : 0,
+            secs > 0 ? preempted / secs : 0);
+    return std::string(line);
+}
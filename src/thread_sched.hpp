@@ -0,0 +1,108 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_THREAD_SCHED_H__
+#define __SMARTCAM_THREAD_SCHED_H__
+
+#include <gst/gst.h>
+#include <gst/rtsp-server/rtsp-server.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * CPU affinity and scheduling policy of the pipeline stages.
+ *
+ * A sync handler on the bus of each pipeline sees the STREAM_STATUS enter
+ * message of every new streaming thread, in that thread. The stage of the
+ * thread is found from the element owning it, by following the data flow to
+ * the first element which identifies a stage, up to the next queue: a capture
+ * source, the preprocess, inference or drawing IVAS element, an encoder, an
+ * RTP payloader or the display sink. The policy of the stage, or the default
+ * of the process for stages without one, is then set on the thread.
+ *
+ * The "main" stage is the main thread, which runs the GLib main loop and the
+ * RTSP server.
+ *
+ * For every stage seen, the CPU time, the time spent waiting on the run queue
+ * and the involuntary context switches of its threads are reported as
+ * metrics, from /proc.
+ */
+class ThreadSched
+{
+public:
+    struct Policy
+    {
+        std::string stage;
+        /* Empty for no pinning */
+        std::string cpuList;
+        cpu_set_t cpus;
+        int policy;
+        int priority;
+    };
+
+    /* Parse "<stage>=<cpus>[:<other|fifo|rr>[:<priority>]]", cpus like 0,2-3 */
+    static bool ParsePolicy(const char *spec, Policy &out);
+
+    ThreadSched(const std::vector<Policy> &policies);
+    ~ThreadSched();
+
+    /* Watch the new threads of the pipeline @elem is in, false with a
+     * warning if its bus already has a sync handler of someone else, which
+     * can't be replaced nor chained */
+    bool Attach(GstElement *elem);
+    /* Apply the policy of the "main" stage to the calling thread */
+    void ApplyMain();
+
+    /* For "media-configure" of RTSP factories whose pipelines don't go through Attach() */
+    static void MediaConfigureCb(GstRTSPMediaFactory *factory, GstRTSPMedia *media, gpointer user_data);
+
+private:
+    struct Thread
+    {
+        std::string stage;
+        guint64 runNs;
+        guint64 waitNs;
+        guint64 preempted;
+    };
+
+    static GstBusSyncReply SyncCb(GstBus *bus, GstMessage *msg, gpointer user_data);
+    /* Whether SyncCb of this handles the messages posted on @bus */
+    bool Handles(GstBus *bus);
+    static std::string StageOf(GstElement *owner);
+    void OnEnter(GstElement *owner);
+    void OnLeave();
+    bool Apply(const std::string &stage, const std::string &what);
+    std::string Describe(const Policy *p) const;
+    std::string Report(const std::string &stage);
+
+    std::map<std::string, Policy> policies;
+    cpu_set_t defaultCpus;
+
+    std::mutex lock;
+    std::map<pid_t, Thread> threads;
+    /* Time of the last report, per stage seen */
+    std::map<std::string, gint64> lastReport;
+    std::vector<guint> metricsIds;
+    /* Metrics group of the creator, the providers register on the
+     * streaming threads */
+    guint metricsGroup;
+};
+
+#endif /* __SMARTCAM_THREAD_SCHED_H__ */
@@ -0,0 +1,215 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/video/video.h>
+#include <stdio.h>
+#include <algorithm>
+#include <cmath>
+
+#include "tiled_detector.hpp"
+#include "tracker.hpp"
+#include "xpp_roi.h"
+
+/* Frames in the inference branch at a time */
+#define TILED_MAX_FRAMES 2
+/* A box this much inside a better one is a partial detection at a tile edge */
+#define CONTAINED_RATIO 0.8
+
+TiledDetector::TiledDetector(const Params &params)
+    : params(params), infer("tiled inference", TILED_MAX_FRAMES), mergeSrc(NULL), mergeCaps(NULL),
+      frameWidth(0), frameHeight(0)
+{
+}
+
+TiledDetector::~TiledDetector()
+{
+    if (mergeSrc)
+    {
+        gst_object_unref(mergeSrc);
+    }
+    if (mergeCaps)
+    {
+        gst_caps_unref(mergeCaps);
+    }
+}
+
+bool TiledDetector::ParseGrid(const char *spec, guint &cols, guint &rows)
+{
+    if (sscanf(spec, "%ux%u", &cols, &rows) != 2 || cols < 1 || rows < 1 || cols * rows > 16)
+    {
+        g_printerr("ERROR: Invalid tile grid: %s, expected <cols>x<rows>, up to 16 tiles\n", spec);
+        return false;
+    }
+    return true;
+}
+
+bool TiledDetector::Attach(GstElement *bin, const char *frameSink, const char *tileSrc,
+        const char *resultSink, const char *mergeSrcName)
+{
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(bin), frameSink);
+    GstElement *merge = gst_bin_get_by_name(GST_BIN(bin), mergeSrcName);
+    if (!sink || !merge || !infer.Attach(bin, tileSrc, resultSink))
+    {
+        g_printerr("ERROR: Elements %s/%s not found for tiled inference.\n", frameSink, mergeSrcName);
+        if (sink)
+            gst_object_unref(sink);
+        if (merge)
+            gst_object_unref(merge);
+        return false;
+    }
+
+    g_object_set(merge, "is-live", TRUE, "format", GST_FORMAT_TIME, "max-bytes", (guint64) 0, NULL);
+    if (mergeSrc)
+        gst_object_unref(mergeSrc);
+    mergeSrc = merge;
+
+    g_object_set(sink, "emit-signals", TRUE, "sync", FALSE, NULL);
+    g_signal_connect(sink, "new-sample", G_CALLBACK(NewFrameCb), this);
+    gst_object_unref(sink);
+    return true;
+}
+
+GstFlowReturn TiledDetector::NewFrameCb(GstElement *sink, gpointer user_data)
+{
+    TiledDetector *det = (TiledDetector *) user_data;
+    GstSample *sample = gst_app_sink_pull_sample(GST_APP_SINK(sink));
+    if (!sample)
+    {
+        return GST_FLOW_EOS;
+    }
+    det->OnFrame(sample);
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+void TiledDetector::ComputeTiles(gint width, gint height)
+{
+    frameWidth = width;
+    frameHeight = height;
+    tiles.clear();
+
+    /* cols tiles overlapping by overlap cover cols - (cols - 1) * overlap tile widths */
+    gint tw = (gint) std::ceil(width / (params.cols - (params.cols - 1) * params.overlap));
+    gint th = (gint) std::ceil(height / (params.rows - (params.rows - 1) * params.overlap));
+    tw = std::min(tw, width);
+    th = std::min(th, height);
+
+    for (guint r = 0; r < params.rows; r++)
+    {
+        gint y = params.rows > 1 ? (gint) ((height - th) * (double) r / (params.rows - 1)) : 0;
+        y &= ~1;
+        gint y1 = std::min(y + th, height);
+        for (guint c = 0; c < params.cols; c++)
+        {
+            gint x = params.cols > 1 ? (gint) ((width - tw) * (double) c / (params.cols - 1)) : 0;
+            /* Keep the right edge where it was when the start is aligned down */
+            gint x1 = std::min(x + tw, width);
+            x = x / XPP_ROI_ALIGN * XPP_ROI_ALIGN;
+
+            RoiInfer::Roi tile;
+            tile.x = x;
+            tile.y = y;
+            tile.width = (x1 - x) & ~1;
+            tile.height = (y1 - y) & ~1;
+            tiles.push_back(tile);
+        }
+    }
+
+    /* The whole frame last, for the objects larger than a tile */
+    if (params.cols * params.rows > 1)
+    {
+        RoiInfer::Roi full;
+        full.x = 0;
+        full.y = 0;
+        full.width = width & ~1;
+        full.height = height & ~1;
+        tiles.push_back(full);
+    }
+
+    g_print("INFO: Tiled inference with %zu regions of %dx%d\n", tiles.size(), tw, th);
+}
+
+void TiledDetector::OnFrame(GstSample *sample)
+{
+    GstVideoInfo info;
+    GstCaps *caps = gst_sample_get_caps(sample);
+    GstBuffer *frame = gst_sample_get_buffer(sample);
+    if (!caps || !frame || !gst_video_info_from_caps(&info, caps))
+    {
+        return;
+    }
+
+    if (GST_VIDEO_INFO_WIDTH(&info) != frameWidth || GST_VIDEO_INFO_HEIGHT(&info) != frameHeight)
+    {
+        ComputeTiles(GST_VIDEO_INFO_WIDTH(&info), GST_VIDEO_INFO_HEIGHT(&info));
+        gst_caps_replace(&mergeCaps, caps);
+        gst_app_src_set_caps(GST_APP_SRC(mergeSrc), caps);
+    }
+
+    infer.Submit(frame, caps, tiles,
+            [this](GstBuffer *f, const std::vector<RoiInfer::Roi> &rois,
+                const std::vector<std::vector<Detection>> &results) { Merge(f, results); });
+}
+
+static double ContainedRatio(const Detection &inner, const Detection &outer)
+{
+    gint x0 = std::max(inner.x, outer.x);
+    gint y0 = std::max(inner.y, outer.y);
+    gint x1 = std::min(inner.x + inner.width, outer.x + outer.width);
+    gint y1 = std::min(inner.y + inner.height, outer.y + outer.height);
+    double area = (double) inner.width * inner.height;
+    if (x1 <= x0 || y1 <= y0 || area <= 0)
+    {
+        return 0;
+    }
+    return (double) (x1 - x0) * (y1 - y0) / area;
+}
+
+void TiledDetector::Merge(GstBuffer *frame, const std::vector<std::vector<Detection>> &results)
+{
+    std::vector<Detection> all;
+    for (const auto &r : results)
+    {
+        all.insert(all.end(), r.begin(), r.end());
+    }
+    std::sort(all.begin(), all.end(),
+            [](const Detection &a, const Detection &b) { return a.prob > b.prob; });
+
+    std::vector<Detection> kept;
+    for (const auto &d : all)
+    {
+        bool duplicate = false;
+        for (const auto &k : kept)
+        {
+            if (k.label == d.label && (IouTracker::Iou(k, d) > params.nmsIou
+                        || ContainedRatio(d, k) > CONTAINED_RATIO))
+            {
+                duplicate = true;
+                break;
+            }
+        }
+        if (!duplicate)
+        {
+            kept.push_back(d);
+        }
+    }
+
+    GstBuffer *out = gst_buffer_copy(frame);
+    AttachDetections(out, frameWidth, frameHeight, kept);
+    gst_app_src_push_buffer(GST_APP_SRC(mergeSrc), out);
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_TILED_DETECTOR_H__
+#define __SMARTCAM_TILED_DETECTOR_H__
+
+#include <gst/gst.h>
+#include <vector>
+
+#include "roi_infer.hpp"
+
+/*
+ * Tiled inference for small objects in large frames.
+ *
+ * Every frame from the frame appsink is split into a grid of overlapping
+ * tiles, plus the whole frame for the objects too large for a tile, which are
+ * run through the detection model by a RoiInfer. The boxes of all tiles are
+ * merged with a class wise NMS across the tiles, where a box mostly inside a
+ * higher scored one also counts as a duplicate, as objects cut by a tile edge
+ * give such partial boxes.
+ * The frame is then pushed with the merged GstInferenceMeta to the merge
+ * appsrc, which feeds the master pad of the meta affixer.
+ */
+class TiledDetector
+{
+public:
+    struct Params
+    {
+        guint cols;
+        guint rows;
+        /* Overlap of neighbouring tiles, fraction of the tile size */
+        double overlap;
+        double nmsIou;
+    };
+
+    /* Parse "<cols>x<rows>" */
+    static bool ParseGrid(const char *spec, guint &cols, guint &rows);
+
+    TiledDetector(const Params &params);
+    ~TiledDetector();
+
+    bool Attach(GstElement *bin, const char *frameSink, const char *tileSrc,
+            const char *resultSink, const char *mergeSrc);
+
+private:
+    static GstFlowReturn NewFrameCb(GstElement *sink, gpointer user_data);
+    void OnFrame(GstSample *sample);
+    void ComputeTiles(gint width, gint height);
+    void Merge(GstBuffer *frame, const std::vector<std::vector<Detection>> &results);
+
+    Params params;
+    RoiInfer infer;
+    GstElement *mergeSrc;
+    GstCaps *mergeCaps;
+    gint frameWidth;
+    gint frameHeight;
+    std::vector<RoiInfer::Roi> tiles;
+};
+
+#endif /* __SMARTCAM_TILED_DETECTOR_H__ */
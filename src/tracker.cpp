@@ -0,0 +1,150 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <tuple>
+
+#include "tracker.hpp"
+
+/* Frames between the first and the last stage of a stream */
+#define SHARED_TRACK_FRAMES 64
+
+IouTracker::IouTracker(double minIou, guint maxMissed)
+    : minIou(minIou), maxMissed(maxMissed), nextId(1)
+{
+}
+
+double IouTracker::Iou(const Detection &a, const Detection &b)
+{
+    gint x0 = std::max(a.x, b.x);
+    gint y0 = std::max(a.y, b.y);
+    gint x1 = std::min(a.x + a.width, b.x + b.width);
+    gint y1 = std::min(a.y + a.height, b.y + b.height);
+    if (x1 <= x0 || y1 <= y0)
+    {
+        return 0;
+    }
+    double inter = (double) (x1 - x0) * (y1 - y0);
+    double uni = (double) a.width * a.height + (double) b.width * b.height - inter;
+    return uni > 0 ? inter / uni : 0;
+}
+
+void IouTracker::Update(std::vector<Detection> &dets)
+{
+    /* (iou, track, detection) of all candidate pairs */
+    std::vector<std::tuple<double, std::size_t, std::size_t>> pairs;
+    for (std::size_t t = 0; t < tracks.size(); t++)
+    {
+        for (std::size_t d = 0; d < dets.size(); d++)
+        {
+            if (tracks[t].last.label != dets[d].label)
+                continue;
+            double iou = Iou(tracks[t].last, dets[d]);
+            if (iou >= minIou)
+            {
+                pairs.emplace_back(iou, t, d);
+            }
+        }
+    }
+    std::sort(pairs.begin(), pairs.end(),
+            [](const std::tuple<double, std::size_t, std::size_t> &a,
+               const std::tuple<double, std::size_t, std::size_t> &b) { return std::get<0>(a) > std::get<0>(b); });
+
+    std::vector<bool> trackUsed(tracks.size(), false);
+    std::vector<bool> detUsed(dets.size(), false);
+    for (const auto &p : pairs)
+    {
+        std::size_t t = std::get<1>(p), d = std::get<2>(p);
+        if (trackUsed[t] || detUsed[d])
+            continue;
+        trackUsed[t] = detUsed[d] = true;
+        dets[d].trackId = tracks[t].last.trackId;
+        tracks[t].last = dets[d];
+        tracks[t].missed = 0;
+    }
+
+    std::vector<Track> next;
+    next.reserve(tracks.size() + dets.size());
+    for (std::size_t t = 0; t < tracks.size(); t++)
+    {
+        if (!trackUsed[t] && ++tracks[t].missed > maxMissed)
+            continue;
+        next.push_back(tracks[t]);
+    }
+    for (std::size_t d = 0; d < dets.size(); d++)
+    {
+        if (detUsed[d])
+            continue;
+        dets[d].trackId = nextId++;
+        Track track;
+        track.last = dets[d];
+        track.missed = 0;
+        next.push_back(track);
+    }
+    tracks.swap(next);
+}
+
+SharedTracker::SharedTracker(double minIou, guint maxMissed)
+    : tracker(minIou, maxMissed), minIou(minIou), maxMissed(maxMissed)
+{
+}
+
+void SharedTracker::Track(GstClockTime pts, std::vector<Detection> &dets)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    auto frame = recent.end();
+    if (GST_CLOCK_TIME_IS_VALID(pts))
+    {
+        frame = std::find_if(recent.begin(), recent.end(),
+                [pts](const std::pair<GstClockTime, std::vector<Detection>> &f) { return f.first == pts; });
+    }
+    if (frame == recent.end())
+    {
+        tracker.Update(dets);
+        if (GST_CLOCK_TIME_IS_VALID(pts))
+        {
+            recent.emplace_back(pts, dets);
+            if (recent.size() > SHARED_TRACK_FRAMES)
+                recent.pop_front();
+        }
+        return;
+    }
+
+    /* The boxes pass unchanged, the overlap only covers a stage which
+     * adjusted them */
+    const std::vector<Detection> &tracked = frame->second;
+    for (auto &d : dets)
+    {
+        d.trackId = 0;
+        double best = minIou;
+        for (const auto &t : tracked)
+        {
+            if (t.label != d.label)
+                continue;
+            if (t.x == d.x && t.y == d.y && t.width == d.width && t.height == d.height)
+            {
+                d.trackId = t.trackId;
+                break;
+            }
+            double iou = IouTracker::Iou(t, d);
+            if (iou >= best)
+            {
+                best = iou;
+                d.trackId = t.trackId;
+            }
+        }
+    }
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_TRACKER_H__
+#define __SMARTCAM_TRACKER_H__
+
+#include <gst/gst.h>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "detections.hpp"
+
+/*
+ * Minimal IoU tracker.
+ *
+ * Each detection is matched greedily, best overlap first, to the track of the
+ * same class it overlaps most with in the previous frame. Unmatched detections
+ * open new tracks, tracks without a match for maxMissed frames are closed.
+ * Not thread safe, feed it from one streaming thread.
+ */
+class IouTracker
+{
+public:
+    IouTracker(double minIou, guint maxMissed);
+
+    /* Sets trackId of every detection of the next frame */
+    void Update(std::vector<Detection> &dets);
+
+    static double Iou(const Detection &a, const Detection &b);
+
+private:
+    struct Track
+    {
+        Detection last;
+        guint missed;
+    };
+
+    double minIou;
+    guint maxMissed;
+    std::vector<Track> tracks;
+    guint64 nextId;
+};
+
+/*
+ * One IouTracker for all the stages of a stream, so they agree on the track
+ * ids and the tracking runs once per frame.
+ *
+ * The first stage to see a frame tracks it, the stages further down look the
+ * ids of the same frame up by its timestamp and match the detections by box
+ * and label. Thread safe.
+ */
+class SharedTracker
+{
+public:
+    SharedTracker(double minIou, guint maxMissed);
+
+    /* Sets trackId of the detections of the frame at @pts, 0 for those the
+     * first stage didn't see */
+    void Track(GstClockTime pts, std::vector<Detection> &dets);
+
+    /* Frames a track lives on without its object */
+    guint MaxMissed() const { return maxMissed; }
+
+private:
+    std::mutex lock;
+    IouTracker tracker;
+    double minIou;
+    guint maxMissed;
+    /* The last frames tracked, oldest first */
+    std::deque<std::pair<GstClockTime, std::vector<Detection>>> recent;
+};
+
+#endif /* __SMARTCAM_TRACKER_H__ */
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <glib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "unix_socket.hpp"
+
+int ListenUnixSocket(const std::string &path, int type, const char *what)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+    {
+        g_printerr("ERROR: Invalid %s socket path %s\n", what, path.c_str());
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+
+    int s = socket(AF_UNIX, type | SOCK_CLOEXEC, 0);
+    if (s < 0)
+    {
+        g_printerr("ERROR: Can't create the %s socket: %s\n", what, strerror(errno));
+        return -1;
+    }
+    if (connect(s, (struct sockaddr *) &addr, sizeof(addr)) == 0)
+    {
+        g_printerr("ERROR: %s is in use by another process\n", path.c_str());
+        close(s);
+        return -1;
+    }
+    unlink(path.c_str());
+    close(s);
+
+    s = socket(AF_UNIX, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (s < 0 || bind(s, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(s, 4) != 0)
+    {
+        g_printerr("ERROR: Can't listen on %s: %s\n", path.c_str(), strerror(errno));
+        if (s >= 0)
+            close(s);
+        return -1;
+    }
+    chmod(path.c_str(), 0660);
+    return s;
+}
@@ -0,0 +1,30 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_UNIX_SOCKET_H__
+#define __SMARTCAM_UNIX_SOCKET_H__
+
+#include <string>
+
+/*
+ * Listening Unix socket of @type, e.g. SOCK_STREAM, on @path, non blocking
+ * and only for root and its group. A socket file left by a process which
+ * died is replaced, one which is still served is not. Returns the fd, or -1
+ * with the error printed, naming the socket @what.
+ */
+int ListenUnixSocket(const std::string &path, int type, const char *what);
+
+#endif /* __SMARTCAM_UNIX_SOCKET_H__ */
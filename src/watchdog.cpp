@@ -0,0 +1,431 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <condition_variable>
+
+#include "metrics.hpp"
+#include "watchdog.hpp"
+
+/* Elements followed upstream from the affixer to find the tee */
+#define MAX_HOPS 8
+/* A recovery taking longer is stuck in a streaming thread */
+#define RECOVERY_TIMEOUT_MS 10000
+
+struct IdleWait
+{
+    std::mutex lock;
+    std::condition_variable cond;
+    bool idle = false;
+};
+
+static GstPadProbeReturn IdleCb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    std::shared_ptr<IdleWait> &wait = *(std::shared_ptr<IdleWait> *) user_data;
+    {
+        std::lock_guard<std::mutex> guard(wait->lock);
+        wait->idle = true;
+    }
+    wait->cond.notify_one();
+    return GST_PAD_PROBE_REMOVE;
+}
+
+static void IdleFree(gpointer user_data)
+{
+    delete (std::shared_ptr<IdleWait> *) user_data;
+}
+
+Watchdog::Watchdog(guint deadlineMs)
+    : deadlineUs((gint64) deadlineMs * 1000), pipeline(NULL), ownsPipeline(false), branchPad(NULL),
+      playingSinceUs(0), incidentUs(0), level(0), recovering(false), recoveryStartUs(0),
+      recoveryEndUs(0), stalls(0), branchRestarts(0), pipelineRestarts(0), lastRecoveryUs(0),
+      maxRecoveryUs(0)
+{
+    timer = g_timeout_add(std::max(deadlineMs / 4, 1u), TimeoutCb, this);
+    metricsId = Metrics::Get().Register("watchdog", [this] { return Report(); });
+}
+
+Watchdog::~Watchdog()
+{
+    g_source_remove(timer);
+    if (worker.joinable())
+    {
+        worker.join();
+    }
+    Metrics::Get().Unregister(metricsId);
+    std::lock_guard<std::mutex> guard(lock);
+    Detach();
+}
+
+void Watchdog::Detach()
+{
+    for (auto &p : points)
+    {
+        gst_pad_remove_probe(p->pad, p->probeId);
+        gst_object_unref(p->pad);
+    }
+    points.clear();
+    for (auto elem : branch)
+    {
+        gst_object_unref(elem);
+    }
+    branch.clear();
+    if (branchPad)
+    {
+        gst_object_unref(branchPad);
+        branchPad = NULL;
+    }
+    if (pipeline)
+    {
+        gst_object_unref(pipeline);
+        pipeline = NULL;
+    }
+}
+
+GstPadProbeReturn Watchdog::FlowCb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    Point *p = ((std::shared_ptr<Point> *) user_data)->get();
+    gint64 now = g_get_monotonic_time();
+    p->lastUs = now;
+    if (!p->firstUs)
+    {
+        p->firstUs = now;
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn Watchdog::DropCb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    return GST_PAD_PROBE_DROP;
+}
+
+void Watchdog::PointFree(gpointer user_data)
+{
+    delete (std::shared_ptr<Point> *) user_data;
+}
+
+void Watchdog::AddPoint(const char *name, GstPad *pad)
+{
+    std::shared_ptr<Point> p = std::make_shared<Point>();
+    p->name = name;
+    p->pad = pad;
+    p->lastUs = 0;
+    p->firstUs = 0;
+    /* The probe holds its own reference, a callback still running when the
+     * probe is removed keeps the point until it returns */
+    p->probeId = gst_pad_add_probe(pad,
+            (GstPadProbeType) (GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST), FlowCb,
+            new std::shared_ptr<Point>(p), PointFree);
+    points.push_back(p);
+}
+
+void Watchdog::FindBranch(GstPad *masterPad)
+{
+    GstPad *pad = (GstPad *) gst_object_ref(masterPad);
+    for (int hops = 0; pad && hops < MAX_HOPS; hops++)
+    {
+        GstPad *peer = gst_pad_get_peer(pad);
+        gst_object_unref(pad);
+        pad = NULL;
+        if (!peer)
+        {
+            break;
+        }
+        GstElement *elem = gst_pad_get_parent_element(peer);
+        GstElementFactory *factory = elem ? gst_element_get_factory(elem) : NULL;
+        if (factory && !strcmp(GST_OBJECT_NAME(factory), "tee"))
+        {
+            branchPad = peer;
+            gst_object_unref(elem);
+            return;
+        }
+        gst_object_unref(peer);
+        if (!elem)
+        {
+            break;
+        }
+        /* An app source ends the walk, the inference runs in the app then */
+        branch.push_back(elem);
+        pad = gst_element_get_static_pad(elem, "sink");
+    }
+    if (pad)
+    {
+        gst_object_unref(pad);
+    }
+    for (auto elem : branch)
+    {
+        gst_object_unref(elem);
+    }
+    branch.clear();
+}
+
+void Watchdog::Attach(GstElement *bin, const char *sourceName, const char *affixerName, const char *outputName)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    Detach();
+
+    GstObject *top = (GstObject *) gst_object_ref(bin);
+    GstObject *parent;
+    while ((parent = gst_object_get_parent(top)))
+    {
+        gst_object_unref(top);
+        top = parent;
+    }
+    pipeline = GST_ELEMENT(top);
+    /* The pipelines of RTSP media are owned by the server */
+    ownsPipeline = pipeline == bin;
+
+    GstElement *elem = gst_bin_get_by_name(GST_BIN(bin), sourceName);
+    if (elem)
+    {
+        GstPad *pad = gst_element_get_static_pad(elem, "src");
+        if (pad)
+        {
+            AddPoint("capture", pad);
+        }
+        gst_object_unref(elem);
+    }
+    elem = gst_bin_get_by_name(GST_BIN(bin), affixerName);
+    if (elem)
+    {
+        GstPad *pad = gst_element_get_static_pad(elem, "sink_master");
+        if (pad)
+        {
+            FindBranch(pad);
+            AddPoint("inference", pad);
+        }
+        gst_object_unref(elem);
+    }
+    elem = gst_bin_get_by_name(GST_BIN(bin), outputName);
+    if (elem)
+    {
+        GstPad *pad = gst_element_get_static_pad(elem, "sink");
+        if (pad)
+        {
+            AddPoint("output", pad);
+        }
+        gst_object_unref(elem);
+    }
+
+    if (points.empty())
+    {
+        g_printerr("ERROR: Elements %s/%s/%s not found for the watchdog.\n", sourceName, affixerName, outputName);
+        return;
+    }
+    std::string names;
+    for (auto &p : points)
+    {
+        names += (names.empty() ? "" : ", ") + p->name;
+    }
+    g_print("INFO: Watchdog on %s, inference branch restart %s, pipeline restart %s\n", names.c_str(),
+            branchPad ? "on" : "off", ownsPipeline ? "on" : "off");
+    playingSinceUs = 0;
+}
+
+gboolean Watchdog::TimeoutCb(gpointer user_data)
+{
+    Watchdog *wd = (Watchdog *) user_data;
+    wd->Check();
+    return G_SOURCE_CONTINUE;
+}
+
+void Watchdog::Check()
+{
+    gint64 now = g_get_monotonic_time();
+    if (recovering)
+    {
+        if (now - recoveryStartUs > (gint64) RECOVERY_TIMEOUT_MS * 1000)
+        {
+            /* A streaming thread is stuck in the driver, only a new process helps */
+            g_printerr("ERROR: Watchdog: the recovery hangs, exiting\n");
+            _exit(EXIT_FAILURE);
+        }
+        return;
+    }
+    if (worker.joinable())
+    {
+        worker.join();
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (!pipeline || GST_STATE(pipeline) != GST_STATE_PLAYING || points.empty())
+    {
+        playingSinceUs = 0;
+        return;
+    }
+    if (!playingSinceUs)
+    {
+        playingSinceUs = now;
+    }
+    /* Every point gets the whole deadline after a start or a recovery */
+    gint64 since = std::max(playingSinceUs, recoveryEndUs.load());
+
+    Point *stalled = NULL;
+    bool allFlowing = true;
+    gint64 resumedUs = 0;
+    for (auto &p : points)
+    {
+        if (!stalled && now - std::max(p->lastUs.load(), since) > deadlineUs)
+        {
+            stalled = p.get();
+        }
+        allFlowing = allFlowing && p->firstUs;
+        resumedUs = std::max(resumedUs, p->firstUs.load());
+    }
+
+    if (incidentUs && allFlowing)
+    {
+        gint64 took = resumedUs - incidentUs;
+        lastRecoveryUs = took;
+        maxRecoveryUs = std::max(maxRecoveryUs.load(), took);
+        g_print("INFO: Watchdog: frames flow again after %.1f s\n", took / 1e6);
+        incidentUs = 0;
+        level = 0;
+    }
+    if (!stalled)
+    {
+        return;
+    }
+
+    if (!incidentUs)
+    {
+        incidentUs = now;
+        stalls++;
+        /* Only the inference results stopping is local to the branch */
+        level = stalled->name == "inference" && branchPad ? 0 : 1;
+    }
+    g_printerr("WARNING: Watchdog: no frame at %s for %" G_GINT64_FORMAT " ms\n", stalled->name.c_str(),
+            (now - std::max(stalled->lastUs.load(), since)) / 1000);
+
+    Action action = level == 0 ? RESTART_BRANCH : (level == 1 && ownsPipeline ? RESTART_PIPELINE : EXIT);
+    level = action == RESTART_BRANCH ? 1 : 2;
+    if (action == EXIT)
+    {
+        g_printerr("ERROR: Watchdog: the restarts didn't help, exiting\n");
+        _exit(EXIT_FAILURE);
+    }
+
+    for (auto &p : points)
+    {
+        p->firstUs = 0;
+    }
+    recovering = true;
+    recoveryStartUs = now;
+    worker = std::thread(&Watchdog::Recover, this, action);
+}
+
+void Watchdog::Recover(Action action)
+{
+    if (action == RESTART_BRANCH ? RestartBranch() : RestartPipeline())
+    {
+        if (action == RESTART_BRANCH)
+            branchRestarts++;
+        else
+            pipelineRestarts++;
+    }
+    recoveryEndUs = g_get_monotonic_time();
+    recovering = false;
+}
+
+bool Watchdog::RestartBranch()
+{
+    GstPad *teePad;
+    std::vector<GstElement *> elems;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        teePad = (GstPad *) gst_object_ref(branchPad);
+        for (auto elem : branch)
+        {
+            elems.push_back((GstElement *) gst_object_ref(elem));
+        }
+    }
+    g_print("INFO: Watchdog: restarting the inference branch\n");
+
+    /* Cut the branch off, and wait until the tee is out of its queue */
+    gulong dropId = gst_pad_add_probe(teePad,
+            (GstPadProbeType) (GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST), DropCb, NULL, NULL);
+    std::shared_ptr<IdleWait> wait = std::make_shared<IdleWait>();
+    gulong idleId = gst_pad_add_probe(teePad, GST_PAD_PROBE_TYPE_IDLE, IdleCb,
+            new std::shared_ptr<IdleWait>(wait), IdleFree);
+    bool idle;
+    {
+        std::unique_lock<std::mutex> guard(wait->lock);
+        idle = wait->cond.wait_for(guard, std::chrono::microseconds(deadlineUs), [&wait] { return wait->idle; });
+    }
+
+    bool ok = false;
+    if (!idle)
+    {
+        /* The queue of the branch is full, the tee itself is stuck */
+        g_printerr("WARNING: Watchdog: the tee doesn't leave the inference branch\n");
+        gst_pad_remove_probe(teePad, idleId);
+    }
+    else
+    {
+        for (auto elem : elems)
+        {
+            gst_element_set_state(elem, GST_STATE_NULL);
+        }
+        /* Relinking makes the tee send the sticky events again, the branch
+         * lost them when it was stopped */
+        GstPad *sinkPad = gst_pad_get_peer(teePad);
+        if (sinkPad)
+        {
+            gst_pad_unlink(teePad, sinkPad);
+            gst_pad_link(teePad, sinkPad);
+            gst_object_unref(sinkPad);
+        }
+        ok = true;
+        for (auto elem : elems)
+        {
+            ok = gst_element_sync_state_with_parent(elem) && ok;
+        }
+    }
+    gst_pad_remove_probe(teePad, dropId);
+
+    for (auto elem : elems)
+    {
+        gst_object_unref(elem);
+    }
+    gst_object_unref(teePad);
+    return ok;
+}
+
+bool Watchdog::RestartPipeline()
+{
+    GstElement *top;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        top = (GstElement *) gst_object_ref(pipeline);
+    }
+    g_print("INFO: Watchdog: restarting the pipeline\n");
+    gst_element_set_state(top, GST_STATE_NULL);
+    bool ok = gst_element_set_state(top, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE;
+    gst_object_unref(top);
+    return ok;
+}
+
+std::string Watchdog::Report()
+{
+    char line[160];
+    snprintf(line, sizeof(line), "%u stalls, %u branch and %u pipeline restarts, recovery last %.1f s max %.1f s",
+            stalls.load(), branchRestarts.load(), pipelineRestarts.load(), lastRecoveryUs / 1e6,
+            maxRecoveryUs / 1e6);
+    return std::string(line);
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_WATCHDOG_H__
+#define __SMARTCAM_WATCHDOG_H__
+
+#include <gst/gst.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Stall watchdog with in-place recovery.
+ *
+ * Buffer probes note the time of the last frame at the capture source, at the
+ * inference result pad of the metadata affixer and at the input of the output
+ * chain. A timer on the main loop checks them while the pipeline is playing.
+ * When a point saw no frame for the deadline, the watchdog recovers in steps:
+ *
+ * 1. A stall of the inference results restarts only the inference branch
+ *    behind the tee. A probe on the tee pad drops the buffers of the branch,
+ *    so the tee, and with it the display or the stream, keeps going, while
+ *    the elements of the branch are cycled through NULL, which reopens their
+ *    kernels. The branch is then linked in again.
+ * 2. Any other stall, or one which is still there after the branch restart,
+ *    restarts the whole pipeline, if it is not owned by the RTSP server.
+ * 3. If that doesn't bring the frames back either, or a recovery hangs in a
+ *    stuck kernel, the process exits with a failure status, for the service
+ *    manager to start it again.
+ *
+ * The recoveries run on a thread of their own, as the state changes wait for
+ * the streaming threads. The stalls, the restarts and the time until all
+ * points had frames again are reported as metrics.
+ */
+class Watchdog
+{
+public:
+    Watchdog(guint deadlineMs);
+    ~Watchdog();
+
+    /* Watch the pipeline @bin is in, at the source pad of @sourceName, the
+     * master sink pad of @affixerName and the sink pad of @outputName, where
+     * they exist. Replaces the pipeline watched before. */
+    void Attach(GstElement *bin, const char *sourceName, const char *affixerName, const char *outputName);
+
+private:
+    struct Point
+    {
+        std::string name;
+        GstPad *pad;
+        gulong probeId;
+        std::atomic<gint64> lastUs;
+        /* First frame after the last recovery, 0 for none yet */
+        std::atomic<gint64> firstUs;
+    };
+
+    enum Action { RESTART_BRANCH, RESTART_PIPELINE, EXIT };
+
+    static GstPadProbeReturn FlowCb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static void PointFree(gpointer user_data);
+    static GstPadProbeReturn DropCb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static gboolean TimeoutCb(gpointer user_data);
+
+    void Detach();
+    void AddPoint(const char *name, GstPad *pad);
+    void FindBranch(GstPad *masterPad);
+    void Check();
+    void Recover(Action action);
+    bool RestartBranch();
+    bool RestartPipeline();
+    std::string Report();
+
+    gint64 deadlineUs;
+    guint timer;
+    guint metricsId;
+
+    std::mutex lock;
+    /* Top level pipeline, restarted only if it is the one attached */
+    GstElement *pipeline;
+    bool ownsPipeline;
+    std::vector<std::shared_ptr<Point>> points;
+    /* Source pad of the tee feeding the inference branch, and the elements
+     * of the branch, downstream first */
+    GstPad *branchPad;
+    std::vector<GstElement *> branch;
+
+    /* Owned by the main loop */
+    gint64 playingSinceUs;
+    gint64 incidentUs;
+    int level;
+
+    std::thread worker;
+    std::atomic<bool> recovering;
+    std::atomic<gint64> recoveryStartUs;
+    std::atomic<gint64> recoveryEndUs;
+
+    std::atomic<guint> stalls;
+    std::atomic<guint> branchRestarts;
+    std::atomic<guint> pipelineRestarts;
+    std::atomic<gint64> lastRecoveryUs;
+    std::atomic<gint64> maxRecoveryUs;
+};
+
+#endif /* __SMARTCAM_WATCHDOG_H__ */
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "worker_pool.hpp"
+
+WorkerPool::WorkerPool(guint count, gint niceValue, gsize maxQueued)
+    : maxQueued(maxQueued), niceValue(niceValue), stop(false)
+{
+    for (guint i = 0; i < count; i++)
+    {
+        threads.emplace_back(&WorkerPool::Run, this);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    std::deque<Task> pending;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+        pending.swap(queue);
+    }
+    cond.notify_all();
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+}
+
+bool WorkerPool::TrySubmit(Task task)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (stop || queue.size() >= maxQueued)
+        {
+            return false;
+        }
+        queue.push_back(std::move(task));
+    }
+    cond.notify_one();
+    return true;
+}
+
+void WorkerPool::Run()
+{
+    /* On Linux the nice value is per thread */
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), niceValue);
+
+    while (true)
+    {
+        Task task;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            cond.wait(guard, [this] { return stop || !queue.empty(); });
+            if (stop)
+            {
+                break;
+            }
+            task = std::move(queue.front());
+            queue.pop_front();
+        }
+        task();
+    }
+}
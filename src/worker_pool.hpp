@@ -0,0 +1,59 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_WORKER_POOL_H__
+#define __SMARTCAM_WORKER_POOL_H__
+
+#include <glib.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Fixed set of background threads for work which must not delay the
+ * streaming threads, e.g. image encoding.
+ *
+ * The threads run at the given nice value, so they only take the CPU time the
+ * pipeline leaves. The queue is bounded, TrySubmit() never waits: a task which
+ * doesn't fit is refused and the caller drops it.
+ * Tasks still queued on destruction are destroyed without being run.
+ */
+class WorkerPool
+{
+public:
+    typedef std::function<void()> Task;
+
+    WorkerPool(guint threads, gint niceValue, gsize maxQueued);
+    ~WorkerPool();
+
+    bool TrySubmit(Task task);
+
+private:
+    void Run();
+
+    std::mutex lock;
+    std::condition_variable cond;
+    std::deque<Task> queue;
+    gsize maxQueued;
+    gint niceValue;
+    bool stop;
+    std::vector<std::thread> threads;
+};
+
+#endif /* __SMARTCAM_WORKER_POOL_H__ */
@@ -0,0 +1,30 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_XPP_ROI_H__
+#define __SMARTCAM_XPP_ROI_H__
+
+/*
+ * A GstVideoRegionOfInterestMeta of this type on the input buffer of
+ * libivas_xpp restricts the preprocessing to that rectangle: only the crop is
+ * scaled to the model input size.
+ */
+#define XPP_ROI_TYPE "smartcam-xpp-crop"
+
+/* The crop start is aligned down to this many pixels, for the AXI reads of the accelerator */
+#define XPP_ROI_ALIGN 16
+
+#endif /* __SMARTCAM_XPP_ROI_H__ */
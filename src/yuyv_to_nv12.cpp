@@ -0,0 +1,372 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gst/video/video.h>
+#include <gst/video/gstvideofilter.h>
+#include <gst/video/gstvideopool.h>
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "nv12_convert.hpp"
+#include "yuyv_to_nv12.hpp"
+
+#define DEFAULT_THREADS 2
+#define MAX_THREADS 8
+#define STRIDE_ALIGN 256
+
+/* Runs a function on bands of rows on a fixed set of threads, the calling
+ * thread doing the first band */
+class RowWorkers
+{
+public:
+    typedef std::function<void(gint, gint)> Job;
+
+    RowWorkers(guint count) : generation(0), pending(0), rows(0), stop(false)
+    {
+        for (guint i = 1; i < count; i++)
+        {
+            threads.emplace_back(&RowWorkers::Run, this, i);
+        }
+    }
+
+    ~RowWorkers()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stop = true;
+        }
+        start.notify_all();
+        for (auto &t : threads)
+        {
+            t.join();
+        }
+    }
+
+    void Process(gint totalRows, const Job &fn)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            job = fn;
+            rows = totalRows;
+            pending = threads.size();
+            generation++;
+        }
+        start.notify_all();
+        fn(BandStart(0), BandStart(1));
+
+        std::unique_lock<std::mutex> guard(lock);
+        done.wait(guard, [this] { return pending == 0; });
+    }
+
+private:
+    /* Bands start at even rows, for the chroma */
+    gint BandStart(guint i) const
+    {
+        gint bands = threads.size() + 1;
+        gint step = ((rows + bands - 1) / bands + 1) & ~1;
+        return std::min((gint) i * step, rows);
+    }
+
+    void Run(guint index)
+    {
+        guint64 seen = 0;
+        while (true)
+        {
+            Job fn;
+            gint begin, end;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                start.wait(guard, [this, seen] { return stop || generation != seen; });
+                if (stop)
+                {
+                    return;
+                }
+                seen = generation;
+                fn = job;
+                begin = BandStart(index);
+                end = BandStart(index + 1);
+            }
+            if (begin < end)
+            {
+                fn(begin, end);
+            }
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                pending--;
+            }
+            done.notify_one();
+        }
+    }
+
+    std::mutex lock;
+    std::condition_variable start;
+    std::condition_variable done;
+    std::vector<std::thread> threads;
+    Job job;
+    guint64 generation;
+    gsize pending;
+    gint rows;
+    bool stop;
+};
+
+typedef struct _GstYuyvToNv12
+{
+    GstVideoFilter parent;
+    guint threads;
+    RowWorkers *workers;
+} GstYuyvToNv12;
+
+typedef struct _GstYuyvToNv12Class
+{
+    GstVideoFilterClass parent_class;
+} GstYuyvToNv12Class;
+
+enum
+{
+    PROP_0,
+    PROP_THREADS
+};
+
+GType gst_yuyv_to_nv12_get_type (void);
+G_DEFINE_TYPE (GstYuyvToNv12, gst_yuyv_to_nv12, GST_TYPE_VIDEO_FILTER);
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+        GST_PAD_SINK, GST_PAD_ALWAYS,
+        GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE ("{ YUY2, UYVY }")));
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+        GST_PAD_SRC, GST_PAD_ALWAYS,
+        GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE ("NV12")));
+
+static GstCaps *
+gst_yuyv_to_nv12_transform_caps (GstBaseTransform * trans, GstPadDirection direction,
+        GstCaps * caps, GstCaps * filter)
+{
+    GstCaps *result = gst_caps_new_empty ();
+    for (guint i = 0; i < gst_caps_get_size (caps); i++)
+    {
+        GstStructure *s = gst_structure_copy (gst_caps_get_structure (caps, i));
+        gst_structure_remove_fields (s, "format", "colorimetry", "chroma-site", NULL);
+        if (direction == GST_PAD_SINK)
+        {
+            gst_structure_set (s, "format", G_TYPE_STRING, "NV12", NULL);
+        }
+        else
+        {
+            GValue list = G_VALUE_INIT, v = G_VALUE_INIT;
+            gst_value_list_init (&list, 2);
+            g_value_init (&v, G_TYPE_STRING);
+            g_value_set_string (&v, "YUY2");
+            gst_value_list_append_value (&list, &v);
+            g_value_set_string (&v, "UYVY");
+            gst_value_list_append_value (&list, &v);
+            gst_structure_take_value (s, "format", &list);
+            g_value_unset (&v);
+        }
+        result = gst_caps_merge_structure (result, s);
+    }
+
+    if (filter)
+    {
+        GstCaps *tmp = gst_caps_intersect_full (filter, result, GST_CAPS_INTERSECT_FIRST);
+        gst_caps_unref (result);
+        result = tmp;
+    }
+    return result;
+}
+
+static gboolean
+gst_yuyv_to_nv12_decide_allocation (GstBaseTransform * trans, GstQuery * query)
+{
+    GstCaps *caps;
+    GstVideoInfo info;
+    gst_query_parse_allocation (query, &caps, NULL);
+    if (!caps || !gst_video_info_from_caps (&info, caps))
+    {
+        return FALSE;
+    }
+
+    /* The downstream pool if there is one, e.g. the DMA buffers of the IVAS
+     * elements, our own otherwise; both with the strides the IVAS elements
+     * want where the pool can align them */
+    GstBufferPool *pool = NULL;
+    guint size = 0, min = 0, max = 0;
+    gboolean have = gst_query_get_n_allocation_pools (query) > 0;
+    if (have)
+        gst_query_parse_nth_allocation_pool (query, 0, &pool, &size, &min, &max);
+    if (!pool)
+        pool = gst_video_buffer_pool_new ();
+    size = MAX (size, (guint) GST_VIDEO_INFO_SIZE (&info));
+    min = MAX (min, 2);
+    if (max && max < min)
+        max = min;
+
+    GstVideoAlignment align;
+    gst_video_alignment_reset (&align);
+    align.stride_align[0] = STRIDE_ALIGN - 1;
+    align.stride_align[1] = STRIDE_ALIGN - 1;
+
+    GstStructure *config = gst_buffer_pool_get_config (pool);
+    gst_buffer_pool_config_set_params (config, caps, size, min, max);
+    if (gst_buffer_pool_has_option (pool, GST_BUFFER_POOL_OPTION_VIDEO_META))
+        gst_buffer_pool_config_add_option (config, GST_BUFFER_POOL_OPTION_VIDEO_META);
+    if (gst_buffer_pool_has_option (pool, GST_BUFFER_POOL_OPTION_VIDEO_ALIGNMENT))
+    {
+        gst_buffer_pool_config_add_option (config, GST_BUFFER_POOL_OPTION_VIDEO_ALIGNMENT);
+        gst_buffer_pool_config_set_video_alignment (config, &align);
+    }
+    if (!gst_buffer_pool_set_config (pool, config))
+    {
+        /* Take the pool's own adjustments if they still fit */
+        config = gst_buffer_pool_get_config (pool);
+        if (!gst_buffer_pool_config_validate_params (config, caps, size, min, max)
+                || !gst_buffer_pool_set_config (pool, config))
+        {
+            gst_object_unref (pool);
+            return FALSE;
+        }
+    }
+
+    /* The pool pads the size to the alignment */
+    config = gst_buffer_pool_get_config (pool);
+    gst_buffer_pool_config_get_params (config, NULL, &size, &min, &max);
+    gst_structure_free (config);
+
+    if (have)
+        gst_query_set_nth_allocation_pool (query, 0, pool, size, min, max);
+    else
+        gst_query_add_allocation_pool (query, pool, size, min, max);
+    gst_object_unref (pool);
+
+    return GST_BASE_TRANSFORM_CLASS (gst_yuyv_to_nv12_parent_class)->decide_allocation (trans, query);
+}
+
+static GstFlowReturn
+gst_yuyv_to_nv12_transform_frame (GstVideoFilter * filter, GstVideoFrame * in, GstVideoFrame * out)
+{
+    GstYuyvToNv12 *self = (GstYuyvToNv12 *) filter;
+    const guint8 *src = (const guint8 *) GST_VIDEO_FRAME_PLANE_DATA (in, 0);
+    gint srcStride = GST_VIDEO_FRAME_PLANE_STRIDE (in, 0);
+    gboolean uyvy = GST_VIDEO_FRAME_FORMAT (in) == GST_VIDEO_FORMAT_UYVY;
+    guint8 *y = (guint8 *) GST_VIDEO_FRAME_PLANE_DATA (out, 0);
+    guint8 *uv = (guint8 *) GST_VIDEO_FRAME_PLANE_DATA (out, 1);
+    gint yStride = GST_VIDEO_FRAME_PLANE_STRIDE (out, 0);
+    gint uvStride = GST_VIDEO_FRAME_PLANE_STRIDE (out, 1);
+    gint width = GST_VIDEO_FRAME_WIDTH (in);
+    gint height = GST_VIDEO_FRAME_HEIGHT (in);
+
+    if (!self->workers)
+    {
+        self->workers = new RowWorkers (self->threads);
+    }
+    self->workers->Process (height, [=] (gint begin, gint end) {
+            Yuv422PackedToNv12 (src, srcStride, uyvy, y, yStride, uv, uvStride,
+                    width, height, begin, end);
+            });
+    return GST_FLOW_OK;
+}
+
+static gboolean
+gst_yuyv_to_nv12_stop (GstBaseTransform * trans)
+{
+    GstYuyvToNv12 *self = (GstYuyvToNv12 *) trans;
+    delete self->workers;
+    self->workers = NULL;
+    return TRUE;
+}
+
+static void
+gst_yuyv_to_nv12_set_property (GObject * object, guint prop_id, const GValue * value, GParamSpec * pspec)
+{
+    GstYuyvToNv12 *self = (GstYuyvToNv12 *) object;
+    switch (prop_id)
+    {
+        case PROP_THREADS:
+            self->threads = g_value_get_uint (value);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+            break;
+    }
+}
+
+static void
+gst_yuyv_to_nv12_get_property (GObject * object, guint prop_id, GValue * value, GParamSpec * pspec)
+{
+    GstYuyvToNv12 *self = (GstYuyvToNv12 *) object;
+    switch (prop_id)
+    {
+        case PROP_THREADS:
+            g_value_set_uint (value, self->threads);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+            break;
+    }
+}
+
+static void
+gst_yuyv_to_nv12_finalize (GObject * object)
+{
+    GstYuyvToNv12 *self = (GstYuyvToNv12 *) object;
+    delete self->workers;
+    G_OBJECT_CLASS (gst_yuyv_to_nv12_parent_class)->finalize (object);
+}
+
+static void
+gst_yuyv_to_nv12_class_init (GstYuyvToNv12Class * klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+    GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+    GstBaseTransformClass *trans_class = GST_BASE_TRANSFORM_CLASS (klass);
+    GstVideoFilterClass *filter_class = GST_VIDEO_FILTER_CLASS (klass);
+
+    gobject_class->set_property = gst_yuyv_to_nv12_set_property;
+    gobject_class->get_property = gst_yuyv_to_nv12_get_property;
+    gobject_class->finalize = gst_yuyv_to_nv12_finalize;
+
+    g_object_class_install_property (gobject_class, PROP_THREADS,
+            g_param_spec_uint ("threads", "Threads", "Threads converting bands of rows",
+                1, MAX_THREADS, DEFAULT_THREADS, (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+    gst_element_class_add_static_pad_template (element_class, &sink_template);
+    gst_element_class_add_static_pad_template (element_class, &src_template);
+    gst_element_class_set_static_metadata (element_class, "YUY2/UYVY to NV12",
+            "Filter/Converter/Video", "Converts packed 4:2:2 camera frames to NV12", "Xilinx Inc.");
+
+    trans_class->transform_caps = GST_DEBUG_FUNCPTR (gst_yuyv_to_nv12_transform_caps);
+    trans_class->decide_allocation = GST_DEBUG_FUNCPTR (gst_yuyv_to_nv12_decide_allocation);
+    trans_class->stop = GST_DEBUG_FUNCPTR (gst_yuyv_to_nv12_stop);
+    trans_class->passthrough_on_same_caps = FALSE;
+    filter_class->transform_frame = GST_DEBUG_FUNCPTR (gst_yuyv_to_nv12_transform_frame);
+}
+
+static void
+gst_yuyv_to_nv12_init (GstYuyvToNv12 * self)
+{
+    self->threads = DEFAULT_THREADS;
+    self->workers = NULL;
+}
+
+gboolean
+yuyv_to_nv12_register (void)
+{
+    return gst_element_register (NULL, "yuyvtonv12", GST_RANK_NONE, gst_yuyv_to_nv12_get_type ());
+}
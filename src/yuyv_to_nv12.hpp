@@ -0,0 +1,36 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_YUYV_TO_NV12_H__
+#define __SMARTCAM_YUYV_TO_NV12_H__
+
+#include <gst/gst.h>
+
+/*
+ * yuyvtonv12: converts the packed YUY2 and UYVY frames of USB cameras to
+ * NV12 for the IVAS elements, in place of videoconvert.
+ *
+ * The rows of a frame are split across "threads" threads, each running the
+ * SIMD kernels of nv12_convert on its band. The output buffers come from the
+ * pool downstream proposes, or a pool of its own without one, with the
+ * strides aligned to 256 bytes where the pool can, the layout the IVAS
+ * elements and the display take without another copy.
+ */
+
+/* Register the element with the application, before parsing a pipeline */
+gboolean yuyv_to_nv12_register (void);
+
+#endif /* __SMARTCAM_YUYV_TO_NV12_H__ */
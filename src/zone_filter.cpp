@@ -0,0 +1,314 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gst/ivas/gstinferencemeta.h>
+#include <gst/video/video.h>
+#include <jansson.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+
+#include "zone_filter.hpp"
+#include "metrics.hpp"
+#include "xpp_roi.h"
+
+static bool ParsePoint(json_t *val, Analytics::Point &p)
+{
+    if (!json_is_array(val) || json_array_size(val) != 2
+            || !json_is_number(json_array_get(val, 0)) || !json_is_number(json_array_get(val, 1)))
+    {
+        return false;
+    }
+    p.x = json_number_value(json_array_get(val, 0));
+    p.y = json_number_value(json_array_get(val, 1));
+    return true;
+}
+
+static bool ParseZone(json_t *val, ZoneFilter::Zone &zone)
+{
+    json_t *name = json_object_get(val, "name");
+    json_t *rect = json_object_get(val, "rect");
+    json_t *poly = json_object_get(val, "polygon");
+    if (!json_is_object(val) || !json_is_string(name) || !rect == !poly)
+    {
+        return false;
+    }
+    zone.name = json_string_value(name);
+    zone.poly.clear();
+
+    if (rect)
+    {
+        /* [x, y, width, height] */
+        double v[4];
+        if (!json_is_array(rect) || json_array_size(rect) != 4)
+        {
+            return false;
+        }
+        for (int i = 0; i < 4; i++)
+        {
+            json_t *n = json_array_get(rect, i);
+            if (!json_is_number(n))
+            {
+                return false;
+            }
+            v[i] = json_number_value(n);
+        }
+        if (v[2] <= 0 || v[3] <= 0)
+        {
+            return false;
+        }
+        zone.poly.push_back({ v[0], v[1] });
+        zone.poly.push_back({ v[0] + v[2], v[1] });
+        zone.poly.push_back({ v[0] + v[2], v[1] + v[3] });
+        zone.poly.push_back({ v[0], v[1] + v[3] });
+    }
+    else
+    {
+        /* [[x, y], [x, y], [x, y], ...] */
+        if (!json_is_array(poly) || json_array_size(poly) < 3)
+        {
+            return false;
+        }
+        for (std::size_t i = 0; i < json_array_size(poly); i++)
+        {
+            Analytics::Point p;
+            if (!ParsePoint(json_array_get(poly, i), p))
+            {
+                return false;
+            }
+            zone.poly.push_back(p);
+        }
+    }
+
+    zone.x0 = zone.x1 = zone.poly[0].x;
+    zone.y0 = zone.y1 = zone.poly[0].y;
+    for (const auto &p : zone.poly)
+    {
+        zone.x0 = std::min(zone.x0, p.x);
+        zone.y0 = std::min(zone.y0, p.y);
+        zone.x1 = std::max(zone.x1, p.x);
+        zone.y1 = std::max(zone.y1, p.y);
+    }
+    return true;
+}
+
+/* The "zones" of a zone file, or of the libivas_xpp config in a kernel config */
+static json_t *FindZones(json_t *root)
+{
+    json_t *zones = json_object_get(root, "zones");
+    json_t *kernels = json_object_get(root, "kernels");
+    if (zones || !json_is_array(kernels))
+    {
+        return zones;
+    }
+    for (std::size_t i = 0; i < json_array_size(kernels); i++)
+    {
+        json_t *kernel = json_array_get(kernels, i);
+        json_t *lib = json_object_get(kernel, "library-name");
+        if (json_is_string(lib) && !strcmp(json_string_value(lib), "libivas_xpp.so"))
+        {
+            return json_object_get(json_object_get(kernel, "config"), "zones");
+        }
+    }
+    return NULL;
+}
+
+bool ZoneFilter::Load(const std::string &path, std::vector<Zone> &zones)
+{
+    json_error_t error;
+    json_t *root = json_load_file(path.c_str(), 0, &error);
+    if (!root)
+    {
+        g_printerr("ERROR: Can't load the zones %s: %s, line %d\n", path.c_str(), error.text, error.line);
+        return false;
+    }
+
+    bool ok = true;
+    json_t *list = FindZones(root);
+    if (list && !json_is_array(list))
+    {
+        g_printerr("ERROR: %s: \"zones\" must be an array.\n", path.c_str());
+        ok = false;
+    }
+    for (std::size_t i = 0; ok && list && i < json_array_size(list); i++)
+    {
+        Zone zone;
+        if (!ParseZone(json_array_get(list, i), zone))
+        {
+            g_printerr("ERROR: %s: zone %zu needs a \"name\" and either a \"rect\" of [x, y, width, height] "
+                    "or a \"polygon\" of at least 3 [x, y] points.\n", path.c_str(), i);
+            ok = false;
+            break;
+        }
+        zones.push_back(zone);
+    }
+    json_decref(root);
+    return ok;
+}
+
+ZoneFilter::ZoneFilter(const std::vector<Zone> &zones, gint width, gint height)
+    : zones(zones), width(width), height(height), cropping(false), frames(0), kept(0), dropped(0)
+{
+    double x0 = width, y0 = height, x1 = 0, y1 = 0;
+    for (const auto &z : zones)
+    {
+        x0 = std::min(x0, z.x0);
+        y0 = std::min(y0, z.y0);
+        x1 = std::max(x1, z.x1);
+        y1 = std::max(y1, z.y1);
+    }
+
+    /* Same alignment as in libivas_xpp, so the boxes map back exactly */
+    cropX = std::max((gint) std::floor(x0), 0) / XPP_ROI_ALIGN * XPP_ROI_ALIGN;
+    cropY = std::max((gint) std::floor(y0), 0) & ~1;
+    gint right = std::min((gint) std::ceil(x1), width);
+    gint bottom = std::min((gint) std::ceil(y1), height);
+    cropWidth = std::max(right - cropX, 0) & ~1;
+    cropHeight = std::max(bottom - cropY, 0) & ~1;
+
+    g_print("INFO: %zu inference zones, the model sees %dx%d at %d,%d of the frame\n",
+            zones.size(), cropWidth, cropHeight, cropX, cropY);
+    metricsId = Metrics::Get().Register("zones", [this] { return Report(); });
+}
+
+ZoneFilter::~ZoneFilter()
+{
+    Metrics::Get().Unregister(metricsId);
+}
+
+static GstPadProbeReturn
+zone_crop_probe_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+    ZoneFilter *filter = (ZoneFilter *) user_data;
+    info->data = filter->Crop(GST_PAD_PROBE_INFO_BUFFER(info));
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+zone_filter_probe_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+    ZoneFilter *filter = (ZoneFilter *) user_data;
+    info->data = filter->Filter(GST_PAD_PROBE_INFO_BUFFER(info));
+    return GST_PAD_PROBE_OK;
+}
+
+bool ZoneFilter::Attach(GstElement *bin, const char *cropName, const char *resultName, const char *resultPad)
+{
+    GstElement *elem = gst_bin_get_by_name(GST_BIN(bin), resultName);
+    GstPad *pad = elem ? gst_element_get_static_pad(elem, resultPad) : NULL;
+    if (!pad)
+    {
+        g_printerr("ERROR: Pad %s of %s not found for the zones.\n", resultPad, resultName);
+        if (elem)
+            gst_object_unref(elem);
+        return false;
+    }
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, zone_filter_probe_cb, this, NULL);
+    gst_object_unref(pad);
+    gst_object_unref(elem);
+
+    /* Only the single model branch has a queue into the preprocessing, the
+     * tiles and the other models are preprocessed through the app */
+    bool crop = cropWidth < (width & ~1) || cropHeight < (height & ~1);
+    elem = crop && cropWidth > 0 && cropHeight > 0 ? gst_bin_get_by_name(GST_BIN(bin), cropName) : NULL;
+    cropping = elem != NULL;
+    if (elem)
+    {
+        pad = gst_element_get_static_pad(elem, "sink");
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, zone_crop_probe_cb, this, NULL);
+        gst_object_unref(pad);
+        gst_object_unref(elem);
+    }
+    return true;
+}
+
+GstBuffer *ZoneFilter::Crop(GstBuffer *buf)
+{
+    /* Shared with the tee branch to the output, the copy shares the memory */
+    buf = gst_buffer_make_writable(buf);
+    gst_buffer_add_video_region_of_interest_meta(buf, XPP_ROI_TYPE, cropX, cropY, cropWidth, cropHeight);
+    return buf;
+}
+
+bool ZoneFilter::Inside(const Detection &d) const
+{
+    Analytics::Point c = { d.x + d.width / 2.0, d.y + d.height / 2.0 };
+    for (const auto &z : zones)
+    {
+        if (c.x >= z.x0 && c.x <= z.x1 && c.y >= z.y0 && c.y <= z.y1 && Analytics::InPolygon(z.poly, c))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+GstBuffer *ZoneFilter::Filter(GstBuffer *buf)
+{
+    std::vector<Detection> dets;
+    if (!ExtractDetections(buf, dets))
+    {
+        return buf;
+    }
+
+    bool mapBack = cropping;
+    std::vector<Detection> in;
+    in.reserve(dets.size());
+    for (auto &d : dets)
+    {
+        if (mapBack)
+        {
+            /* The affixer scaled the model output to the whole frame */
+            d.x = cropX + d.x * cropWidth / width;
+            d.y = cropY + d.y * cropHeight / height;
+            d.width = d.width * cropWidth / width;
+            d.height = d.height * cropHeight / height;
+        }
+        if (Inside(d))
+        {
+            in.push_back(d);
+        }
+    }
+    frames++;
+    kept += in.size();
+    dropped += dets.size() - in.size();
+
+    if (!mapBack && in.size() == dets.size())
+    {
+        return buf;
+    }
+    buf = gst_buffer_make_writable(buf);
+    GstMeta *meta = gst_buffer_get_meta(buf, gst_inference_meta_api_get_type());
+    if (meta)
+    {
+        gst_buffer_remove_meta(buf, meta);
+    }
+    AttachDetections(buf, width, height, in);
+    return buf;
+}
+
+std::string ZoneFilter::Report()
+{
+    guint64 n = frames.exchange(0);
+    guint64 k = kept.exchange(0);
+    guint64 d = dropped.exchange(0);
+    char line[160];
+    snprintf(line, sizeof(line), "%.1f objects/frame in, %.1f outside, inference on %dx%d%s",
+            n ? (double) k / n : 0, n ? (double) d / n : 0,
+            cropping ? cropWidth : width, cropping ? cropHeight : height, cropping ? " crop" : " frame");
+    return std::string(line);
+}
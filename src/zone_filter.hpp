@@ -0,0 +1,94 @@
+/*
+ * Copyright 2021 Xilinx Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SMARTCAM_ZONE_FILTER_H__
+#define __SMARTCAM_ZONE_FILTER_H__
+
+#include <gst/gst.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "analytics.hpp"
+#include "detections.hpp"
+
+/*
+ * Static zones which restrict the inference to a part of the scene.
+ *
+ * The zones are rectangles and polygons in pixels of the input frames. The
+ * inference input is cropped to the box around all zones: a probe on the
+ * queue into the preprocessing adds the xpp crop meta of xpp_roi.h, so
+ * libivas_xpp scales only that region to the model input, and the model sees
+ * the zones at a higher resolution. The metadata affixer scales the boxes as
+ * if the model saw the whole frame, so they are mapped back into the crop.
+ *
+ * Objects whose box center is outside all zones are dropped from the
+ * inference meta right behind the inference results, before the cascade, the
+ * drawing and the ROI encoding. A box is checked against the bounds of each
+ * zone first, and against its polygon only when it is within them.
+ */
+class ZoneFilter
+{
+public:
+    struct Zone
+    {
+        std::string name;
+        std::vector<Analytics::Point> poly;
+        /* Bounds of the polygon */
+        double x0;
+        double y0;
+        double x1;
+        double y1;
+    };
+
+    /* Read the "zones" of the JSON file @path, at the top or in the config of
+     * libivas_xpp in a kernel config. False with the error printed if the
+     * file or a zone is invalid, no zones is not an error. */
+    static bool Load(const std::string &path, std::vector<Zone> &zones);
+
+    /* @width x @height is the size of the input frames */
+    ZoneFilter(const std::vector<Zone> &zones, gint width, gint height);
+    ~ZoneFilter();
+
+    /* Crop at the sink pad of @cropName if it exists, filter the results at
+     * @resultPad of @resultName */
+    bool Attach(GstElement *bin, const char *cropName, const char *resultName, const char *resultPad);
+
+    GstBuffer *Crop(GstBuffer *buf);
+    GstBuffer *Filter(GstBuffer *buf);
+
+private:
+    bool Inside(const Detection &d) const;
+    std::string Report();
+
+    std::vector<Zone> zones;
+    gint width;
+    gint height;
+    /* Region of the frame the model sees, aligned like the kernel does */
+    gint cropX;
+    gint cropY;
+    gint cropWidth;
+    gint cropHeight;
+    /* Set when the crop probe is in this pipeline */
+    std::atomic<bool> cropping;
+
+    guint metricsId;
+    std::atomic<guint64> frames;
+    std::atomic<guint64> kept;
+    std::atomic<guint64> dropped;
+};
+
+#endif /* __SMARTCAM_ZONE_FILTER_H__ */